@@ -0,0 +1,715 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#include "agent.h"
+#include "client.h"
+#include "event-loop.h"
+#include "key-cache.h"
+#include "locked-memory.h"
+#include "log.h"
+
+/**
+ * The size of the length prefix of a frame.
+ */
+#define FRAME_HEADER_SIZE 4
+
+/**
+ * The steps of serving a consumer.
+ */
+enum conn_state {
+	/**
+	 * The next request is received.
+	 */
+	CONN_READING,
+	/**
+	 * The key is negotiated with the server.
+	 */
+	CONN_WAITING,
+	/**
+	 * The reply is sent.
+	 */
+	CONN_WRITING,
+};
+
+struct agent;
+
+/**
+ * A connection of a consumer to the agent.
+ */
+struct agent_conn {
+	struct event_source source;
+	struct agent *agent;
+	/**
+	 * The handle of the requested key.
+	 */
+	char handle[AGENT_MAX_HANDLE + 1];
+	uint32_t handle_len;
+	/**
+	 * The length prefix of the request.
+	 */
+	unsigned char header[FRAME_HEADER_SIZE];
+	struct agent_conn *next;
+	/**
+	 * The number of bytes of the request received so far.
+	 */
+	size_t received;
+	/**
+	 * The length prefix and the status byte of the reply.
+	 */
+	unsigned char reply_header[FRAME_HEADER_SIZE + 1];
+	/**
+	 * The key or the error message sent with the reply.
+	 *
+	 * The payload is sent straight from the cache or the response. Only
+	 * if the consumer cannot take it at once, it is copied to `copy`.
+	 */
+	const char *payload;
+	size_t payload_len;
+	/**
+	 * The copy of the payload in locked memory or NULL.
+	 */
+	char *copy;
+	/**
+	 * The number of bytes of the reply sent so far.
+	 */
+	size_t sent;
+	enum conn_state state;
+};
+
+/**
+ * A negotiation of a key shared by all consumers waiting for it.
+ */
+struct pending_fetch {
+	struct agent *agent;
+	char *handle;
+	struct pending_fetch *next;
+};
+
+/**
+ * The state of the agent.
+ */
+struct agent {
+	struct key_cache cache;
+	struct key_client *client;
+	struct agent_conn *conns;
+	/**
+	 * The timer for wiping expired keys.
+	 */
+	struct timer expiry;
+	struct pending_fetch *fetches;
+	struct event_source listener;
+	const char *path;
+	/**
+	 * Whether the agent keeps serving consumers.
+	 */
+	int running;
+	/**
+	 * The signals terminating the agent.
+	 */
+	struct event_source signals;
+	sigset_t signal_mask;
+};
+
+static void accept_conns(struct event_source *source, uint32_t events);
+static void close_conn(struct agent_conn *conn);
+static enum unlocked_err create_listener(struct agent *agent);
+static enum unlocked_err create_signal_source(struct agent *agent);
+static void handle_conn(struct event_source *source, uint32_t events);
+static void handle_expiry(void *data);
+static void handle_fetched(void *data, enum unlocked_err err, char *key);
+static void handle_signal(struct event_source *source, uint32_t events);
+static void process_request(struct agent_conn *conn);
+static int read_request(struct agent_conn *conn);
+static void release_conn(struct event_source *source);
+static void schedule_expiry(struct agent *agent);
+static void send_reply(struct agent_conn *conn, enum unlocked_err err,
+		       const char *payload, size_t payload_len);
+static void write_reply(struct agent_conn *conn);
+
+enum unlocked_err run_agent(struct arguments *arguments,
+			    struct resolver *resolver)
+{
+	struct agent agent = { 0 };
+	enum unlocked_err err = UL_OK;
+	struct pending_fetch *fetch = NULL;
+	struct event_loop *loop = NULL;
+
+	agent.expiry.source.fd = -1;
+	agent.listener.fd = -1;
+	agent.path = arguments->agent_socket ? arguments->agent_socket :
+		UNLOCKED_AGENT_SOCKET;
+	agent.signals.fd = -1;
+	init_key_cache(&(agent.cache), arguments->key_ttl * 1000);
+	err = create_key_client(arguments, resolver, &(agent.client));
+	if (UL_OK != err) {
+		return err;
+	}
+	loop = get_key_client_loop(agent.client);
+	err = init_timer(loop, &(agent.expiry), handle_expiry, &agent);
+	if (UL_OK == err) {
+		err = create_signal_source(&agent);
+	}
+	if (UL_OK == err) {
+		err = create_listener(&agent);
+	}
+	if (UL_OK == err) {
+		logger(LOG_INFO, "Serving keys on %s\n", agent.path);
+		agent.running = 1;
+	}
+	while (UL_OK == err && agent.running) {
+		err = dispatch_key_client(agent.client, -1);
+	}
+	while (agent.conns) {
+		close_conn(agent.conns);
+	}
+	while ((fetch = agent.fetches)) {
+		agent.fetches = fetch->next;
+		free(fetch->handle);
+		free(fetch);
+	}
+	if (agent.listener.fd >= 0) {
+		unwatch_fd(loop, &(agent.listener));
+		close(agent.listener.fd);
+		unlink(agent.path);
+	}
+	if (agent.signals.fd >= 0) {
+		unwatch_fd(loop, &(agent.signals));
+		close(agent.signals.fd);
+		sigprocmask(SIG_UNBLOCK, &(agent.signal_mask), NULL);
+	}
+	free_timer(loop, &(agent.expiry));
+	free_key_client(agent.client);
+	free_key_cache(&(agent.cache));
+
+	return err;
+}
+
+/**
+ * Accept all pending connections of consumers.
+ *
+ * @param source is the listening socket.
+ * @param events are the epoll events that occured.
+ */
+static void accept_conns(struct event_source *source, uint32_t events)
+{
+	struct agent *agent = source->data;
+	struct agent_conn *conn = NULL;
+	int fd = -1;
+
+	while ((fd = accept4(source->fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		conn = calloc(1, sizeof(struct agent_conn));
+		if (NULL == conn) {
+			close(fd);
+			continue;
+		}
+		conn->agent = agent;
+		conn->source.data = conn;
+		conn->source.fd = fd;
+		conn->source.handle = handle_conn;
+		conn->source.release = release_conn;
+		conn->state = CONN_READING;
+		if (UL_OK != watch_fd(get_key_client_loop(agent->client),
+				      &(conn->source), EPOLLIN | EPOLLRDHUP)) {
+			close(fd);
+			free(conn);
+			continue;
+		}
+		conn->next = agent->conns;
+		agent->conns = conn;
+	}
+}
+
+/**
+ * Close the connection of a consumer.
+ *
+ * @param conn is the connection to close.
+ */
+static void close_conn(struct agent_conn *conn)
+{
+	struct agent_conn **link = &(conn->agent->conns);
+
+	while (*link != conn) {
+		link = &((*link)->next);
+	}
+	*link = conn->next;
+	unwatch_fd(get_key_client_loop(conn->agent->client), &(conn->source));
+}
+
+/**
+ * Create the socket the agent listens on.
+ *
+ * The socket is only accessible by its owner. A stale socket of an agent,
+ * that is not running anymore, is replaced.
+ *
+ * @param agent is the agent.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err create_listener(struct agent *agent)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX };
+	enum unlocked_err err = UL_OK;
+	int fd = -1;
+	mode_t mask = 0;
+
+	if (strlen(agent->path) >= sizeof(addr.sun_path)) {
+		logger(LOG_ERROR, "The path of the agent socket is too long\n");
+
+		return UL_ERR;
+	}
+	strcpy(addr.sun_path, agent->path);
+	if (0 == strncmp(agent->path, UNLOCKED_RUNTIME_DIR "/",
+			 sizeof(UNLOCKED_RUNTIME_DIR))) {
+		err = create_runtime_dir();
+		if (UL_OK != err) {
+			return err;
+		}
+	}
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return UL_ERRNO;
+	}
+	if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))
+	    || EAGAIN == errno) {
+		logger(LOG_ERROR, "Another agent is listening on %s\n",
+		       agent->path);
+		close(fd);
+
+		return UL_ERR;
+	}
+	unlink(agent->path);
+	mask = umask(0077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+	    || listen(fd, SOMAXCONN)) {
+		umask(mask);
+		close(fd);
+
+		return UL_ERRNO;
+	}
+	umask(mask);
+	agent->listener.data = agent;
+	agent->listener.fd = fd;
+	agent->listener.handle = accept_conns;
+	agent->listener.release = NULL;
+	err = watch_fd(get_key_client_loop(agent->client), &(agent->listener),
+		       EPOLLIN);
+	if (UL_OK != err) {
+		close(fd);
+		unlink(agent->path);
+		agent->listener.fd = -1;
+	}
+
+	return err;
+}
+
+/**
+ * Receive the signals terminating the agent from the event loop.
+ *
+ * @param agent is the agent.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err create_signal_source(struct agent *agent)
+{
+	enum unlocked_err err = UL_OK;
+
+	sigemptyset(&(agent->signal_mask));
+	sigaddset(&(agent->signal_mask), SIGINT);
+	sigaddset(&(agent->signal_mask), SIGTERM);
+	if (sigprocmask(SIG_BLOCK, &(agent->signal_mask), NULL)) {
+		return UL_ERRNO;
+	}
+	agent->signals.fd = signalfd(-1, &(agent->signal_mask),
+				     SFD_NONBLOCK | SFD_CLOEXEC);
+	if (agent->signals.fd < 0) {
+		sigprocmask(SIG_UNBLOCK, &(agent->signal_mask), NULL);
+
+		return UL_ERRNO;
+	}
+	agent->signals.data = agent;
+	agent->signals.handle = handle_signal;
+	agent->signals.release = NULL;
+	err = watch_fd(get_key_client_loop(agent->client), &(agent->signals),
+		       EPOLLIN);
+	if (UL_OK != err) {
+		close(agent->signals.fd);
+		agent->signals.fd = -1;
+		sigprocmask(SIG_UNBLOCK, &(agent->signal_mask), NULL);
+	}
+
+	return err;
+}
+
+/**
+ * Handle the events of the connection of a consumer.
+ *
+ * @param source is the connection.
+ * @param events are the epoll events that occured.
+ */
+static void handle_conn(struct event_source *source, uint32_t events)
+{
+	struct agent_conn *conn = source->data;
+	int status = 0;
+
+	if (CONN_WRITING == conn->state) {
+		write_reply(conn);
+
+		return;
+	}
+	if (CONN_WAITING == conn->state) {
+		// Consumers, that shut down their side after the request,
+		// still wait for the key.
+		if (events & (EPOLLHUP | EPOLLERR)) {
+			close_conn(conn);
+		}
+
+		return;
+	}
+	status = read_request(conn);
+	if (status < 0) {
+		close_conn(conn);
+	} else if (status > 0) {
+		process_request(conn);
+	}
+}
+
+/**
+ * Wipe the expired keys after the expiry timer fired.
+ *
+ * @param data is the agent.
+ */
+static void handle_expiry(void *data)
+{
+	schedule_expiry(data);
+}
+
+/**
+ * Completion callback of the negotiation of a key, which replies to all
+ * consumers waiting for the key.
+ *
+ * @param data is the pending negotiation.
+ * @param err is any error that occured.
+ * @param key is the received key or NULL.
+ */
+static void handle_fetched(void *data, enum unlocked_err err, char *key)
+{
+	struct pending_fetch *fetch = data;
+	struct agent *agent = fetch->agent;
+	struct agent_conn *conn = NULL;
+	struct pending_fetch **link = &(agent->fetches);
+	size_t key_len = key ? strlen(key) : 0;
+	struct agent_conn *next = NULL;
+
+	while (*link != fetch) {
+		link = &((*link)->next);
+	}
+	*link = fetch->next;
+	if (UL_OK == err) {
+		if (UL_OK == cache_key(&(agent->cache), fetch->handle, key,
+				       key_len)) {
+			schedule_expiry(agent);
+		}
+		logger(LOG_DEBUG, "Received the key \"%s\"\n", fetch->handle);
+	} else {
+		logger(LOG_ERROR, "Could not receive the key \"%s\": %s\n",
+		       fetch->handle, ul_error(err));
+	}
+	for (conn = agent->conns; conn; conn = next) {
+		next = conn->next;
+		if (CONN_WAITING != conn->state
+		    || strcmp(conn->handle, fetch->handle)) {
+			continue;
+		}
+		if (UL_OK == err) {
+			send_reply(conn, err, key, key_len);
+		} else {
+			send_reply(conn, err, ul_error(err),
+				   strlen(ul_error(err)));
+		}
+	}
+	// The key is freed with the arena of the job.
+	if (key) {
+		explicit_bzero(key, key_len);
+	}
+	free(fetch->handle);
+	free(fetch);
+}
+
+/**
+ * Stop the agent after a terminating signal was received.
+ *
+ * @param source is the signal file descriptor.
+ * @param events are the epoll events that occured.
+ */
+static void handle_signal(struct event_source *source, uint32_t events)
+{
+	struct agent *agent = source->data;
+	struct signalfd_siginfo info = { 0 };
+
+	while (sizeof(info) == read(source->fd, &info, sizeof(info))) {
+		logger(LOG_INFO, "Received signal %u, stopping\n",
+		       info.ssi_signo);
+		agent->running = 0;
+	}
+}
+
+/**
+ * Answer a complete request from the cache or start the negotiation of the
+ * key.
+ *
+ * @param conn is the connection with the request.
+ */
+static void process_request(struct agent_conn *conn)
+{
+	struct agent *agent = conn->agent;
+	const struct cached_key *cached = NULL;
+	enum unlocked_err err = UL_OK;
+	struct pending_fetch *fetch = NULL;
+
+	cached = find_cached_key(&(agent->cache), conn->handle);
+	if (cached) {
+		logger(LOG_DEBUG, "Serving the key \"%s\" from the cache\n",
+		       conn->handle);
+		send_reply(conn, UL_OK, cached->key, cached->key_len);
+
+		return;
+	}
+	conn->state = CONN_WAITING;
+	// Only a hang up of the consumer is of interest while waiting, which
+	// epoll reports without asking for it.
+	watch_fd(get_key_client_loop(agent->client), &(conn->source), 0);
+	for (fetch = agent->fetches; fetch; fetch = fetch->next) {
+		if (0 == strcmp(fetch->handle, conn->handle)) {
+			return;
+		}
+	}
+	fetch = calloc(1, sizeof(struct pending_fetch));
+	if (NULL == fetch) {
+		send_reply(conn, UL_MALLOC, ul_error(UL_MALLOC),
+			   strlen(ul_error(UL_MALLOC)));
+
+		return;
+	}
+	fetch->agent = agent;
+	fetch->handle = strdup(conn->handle);
+	err = fetch->handle ? fetch_key(agent->client, fetch->handle,
+					handle_fetched, fetch) : UL_MALLOC;
+	if (UL_OK != err) {
+		free(fetch->handle);
+		free(fetch);
+		send_reply(conn, err, ul_error(err), strlen(ul_error(err)));
+
+		return;
+	}
+	fetch->next = agent->fetches;
+	agent->fetches = fetch;
+}
+
+/**
+ * Receive the next part of a request.
+ *
+ * @param conn is the connection of the consumer.
+ *
+ * @return zero if the request is incomplete, a positive value if it is
+ *         complete or a negative value if the connection should be closed.
+ */
+static int read_request(struct agent_conn *conn)
+{
+	void *buffer = NULL;
+	size_t missing = 0;
+	ssize_t received = 0;
+
+	while (1) {
+		if (conn->received < FRAME_HEADER_SIZE) {
+			buffer = conn->header + conn->received;
+			missing = FRAME_HEADER_SIZE - conn->received;
+		} else {
+			buffer = conn->handle + conn->received
+				- FRAME_HEADER_SIZE;
+			missing = conn->handle_len + FRAME_HEADER_SIZE
+				- conn->received;
+		}
+		received = recv(conn->source.fd, buffer, missing, 0);
+		if (0 == received) {
+			return -1;
+		}
+		if (received < 0) {
+			return EAGAIN == errno || EWOULDBLOCK == errno ? 0 : -1;
+		}
+		conn->received += received;
+		if (FRAME_HEADER_SIZE == conn->received) {
+			memcpy(&(conn->handle_len), conn->header,
+			       FRAME_HEADER_SIZE);
+			conn->handle_len = ntohl(conn->handle_len);
+			if (0 == conn->handle_len
+			    || conn->handle_len > AGENT_MAX_HANDLE) {
+				logger(LOG_WARNING, "Rejecting a request with "
+				       "a handle of %u bytes\n",
+				       conn->handle_len);
+
+				return -1;
+			}
+		} else if (conn->received > FRAME_HEADER_SIZE
+			   && conn->received == conn->handle_len
+			   + FRAME_HEADER_SIZE) {
+			conn->handle[conn->handle_len] = '\0';
+			if (strlen(conn->handle) != conn->handle_len) {
+				return -1;
+			}
+
+			return 1;
+		}
+	}
+}
+
+/**
+ * Free the connection of a consumer after it is not watched anymore.
+ *
+ * @param source is the connection.
+ */
+static void release_conn(struct event_source *source)
+{
+	struct agent_conn *conn = source->data;
+
+	close(source->fd);
+	free_locked(conn->copy, conn->payload_len);
+	free(conn);
+}
+
+/**
+ * Wipe the expired keys and arm the expiry timer for the next key.
+ *
+ * @param agent is the agent.
+ */
+static void schedule_expiry(struct agent *agent)
+{
+	struct timespec next = { 0 };
+
+	if (expire_cached_keys(&(agent->cache), &next)) {
+		arm_timer_at(&(agent->expiry), &next);
+	}
+}
+
+/**
+ * Start to send the reply to a request.
+ *
+ * @param conn is the connection of the consumer.
+ * @param err is the status of the reply.
+ * @param payload is the key on success or the error message.
+ * @param payload_len is the length of the payload.
+ */
+static void send_reply(struct agent_conn *conn, enum unlocked_err err,
+		       const char *payload, size_t payload_len)
+{
+	uint32_t frame_len = htonl(payload_len + 1);
+
+	memcpy(conn->reply_header, &frame_len, FRAME_HEADER_SIZE);
+	conn->reply_header[FRAME_HEADER_SIZE] = err;
+	conn->payload = payload;
+	conn->payload_len = payload_len;
+	conn->sent = 0;
+	conn->state = CONN_WRITING;
+	write_reply(conn);
+}
+
+/**
+ * Send as much of the reply as possible without blocking.
+ *
+ * The payload is copied to locked memory before waiting for the consumer,
+ * because the cached key may be wiped in the meantime. After the reply has
+ * been sent, the connection waits for the next request.
+ *
+ * @param conn is the connection of the consumer.
+ */
+static void write_reply(struct agent_conn *conn)
+{
+	struct event_loop *loop = get_key_client_loop(conn->agent->client);
+	struct iovec iov[2] = { 0 };
+	struct msghdr msg = {.msg_iov = iov };
+	size_t offset = 0;
+	size_t reply_len = sizeof(conn->reply_header) + conn->payload_len;
+	ssize_t sent = 0;
+
+	while (conn->sent < reply_len) {
+		msg.msg_iovlen = 0;
+		if (conn->sent < sizeof(conn->reply_header)) {
+			iov[0].iov_base = conn->reply_header + conn->sent;
+			iov[0].iov_len = sizeof(conn->reply_header)
+				- conn->sent;
+			msg.msg_iovlen++;
+		}
+		offset = conn->sent > sizeof(conn->reply_header) ?
+			conn->sent - sizeof(conn->reply_header) : 0;
+		iov[msg.msg_iovlen].iov_base = (char *)conn->payload + offset;
+		iov[msg.msg_iovlen].iov_len = conn->payload_len - offset;
+		msg.msg_iovlen++;
+		sent = sendmsg(conn->source.fd, &msg, MSG_NOSIGNAL);
+		if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			if (NULL == conn->copy && conn->payload_len) {
+				conn->copy = alloc_locked(conn->payload_len);
+				if (NULL == conn->copy) {
+					close_conn(conn);
+
+					return;
+				}
+				memcpy(conn->copy, conn->payload,
+				       conn->payload_len);
+				conn->payload = conn->copy;
+			}
+			if (UL_OK != watch_fd(loop, &(conn->source),
+					      EPOLLOUT)) {
+				close_conn(conn);
+			}
+
+			return;
+		}
+		if (sent < 0) {
+			close_conn(conn);
+
+			return;
+		}
+		conn->sent += sent;
+	}
+	free_locked(conn->copy, conn->payload_len);
+	conn->copy = NULL;
+	conn->payload = NULL;
+	conn->payload_len = 0;
+	conn->received = 0;
+	conn->state = CONN_READING;
+	if (UL_OK != watch_fd(loop, &(conn->source), EPOLLIN | EPOLLRDHUP)) {
+		close_conn(conn);
+	}
+}
@@ -0,0 +1,60 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_AGENT_H
+#define UNLOCKED_AGENT_H
+
+#include "cli.h"
+#include "error.h"
+#include "resolver.h"
+#include "runtime.h"
+
+/**
+ * The default path of the socket the agent listens on.
+ */
+#define UNLOCKED_AGENT_SOCKET UNLOCKED_RUNTIME_DIR "/agent.sock"
+
+/**
+ * The maximum length of a key handle requested from the agent.
+ */
+#define AGENT_MAX_HANDLE 1024
+
+/**
+ * Serve keys to local consumers until the process is terminated.
+ *
+ * The agent listens on a unix socket. Every request and every reply is a
+ * frame made of its length as 32 bit unsigned integer in network byte order
+ * followed by the payload. The payload of a request is the handle of a key.
+ * The payload of a reply starts with a status byte, that is zero on success
+ * or the error code otherwise, followed by the key or the error message.
+ * Multiple requests can be sent over one connection, one after another.
+ *
+ * Keys are kept in locked memory for the configured time. Requests for a key,
+ * that is not cached, share a single negotiation with the server.
+ *
+ * @param arguments is the configuration of the client.
+ * @param resolver is the resolver looking up the servers ahead of time or
+ *                 NULL.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err run_agent(struct arguments *arguments,
+			    struct resolver *resolver);
+
+#endif
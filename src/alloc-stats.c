@@ -0,0 +1,154 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "alloc-stats.h"
+
+/*
+ * The calls of the allocator in the objects of libunlocked are renamed to the
+ * `__wrap_` functions below with `objcopy --redefine-sym` after the library
+ * is built. The `__real_` functions are renamed back to the allocator. Other
+ * code linked into the same executable, like main.c, iniparser, libcurl and
+ * OpenSSL, keeps calling the allocator directly and is not counted.
+ */
+extern void *__real_calloc(size_t count, size_t size);
+extern void __real_free(void *ptr);
+extern void *__real_malloc(size_t size);
+extern void *__real_realloc(void *ptr, size_t size);
+extern char *__real_strdup(const char *string);
+
+void *__wrap_calloc(size_t count, size_t size);
+void __wrap_free(void *ptr);
+void *__wrap_malloc(size_t size);
+void *__wrap_realloc(void *ptr, size_t size);
+char *__wrap_strdup(const char *string);
+
+static void count_allocation(size_t size);
+
+static const char *const phase_names[] = {
+	[ALLOC_OTHER] = "other",
+	[ALLOC_CREATE] = "create",
+	[ALLOC_POLL] = "poll",
+	[ALLOC_FULFIL] = "fulfil",
+};
+
+/**
+ * The heap traffic per phase. The resolver allocates from its own thread, so
+ * the counters are updated atomically.
+ */
+static struct alloc_counters alloc_stats[ALLOC_PHASE_COUNT];
+static enum alloc_phase current_phase = ALLOC_OTHER;
+
+void get_alloc_stats(enum alloc_phase phase, struct alloc_counters *counters)
+{
+	const struct alloc_counters *stats = alloc_stats + phase;
+
+	counters->allocations = __atomic_load_n(&(stats->allocations),
+						__ATOMIC_RELAXED);
+	counters->bytes = __atomic_load_n(&(stats->bytes), __ATOMIC_RELAXED);
+	counters->frees = __atomic_load_n(&(stats->frees), __ATOMIC_RELAXED);
+}
+
+void print_alloc_stats(FILE *file)
+{
+	struct alloc_counters counters = { 0 };
+
+	fprintf(file, "%-8s %12s %12s %12s\n", "phase", "allocations",
+		"bytes", "frees");
+	for (int i = 0; i < ALLOC_PHASE_COUNT; i++) {
+		get_alloc_stats(i, &counters);
+		fprintf(file, "%-8s %12lu %12lu %12lu\n", phase_names[i],
+			counters.allocations, counters.bytes, counters.frees);
+	}
+}
+
+void reset_alloc_stats(void)
+{
+	for (int i = 0; i < ALLOC_PHASE_COUNT; i++) {
+		__atomic_store_n(&(alloc_stats[i].allocations), 0,
+				 __ATOMIC_RELAXED);
+		__atomic_store_n(&(alloc_stats[i].bytes), 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&(alloc_stats[i].frees), 0, __ATOMIC_RELAXED);
+	}
+}
+
+void set_alloc_phase(enum alloc_phase phase)
+{
+	__atomic_store_n(&current_phase, phase, __ATOMIC_RELAXED);
+}
+
+void *__wrap_calloc(size_t count, size_t size)
+{
+	count_allocation(count * size);
+
+	return __real_calloc(count, size);
+}
+
+void __wrap_free(void *ptr)
+{
+	enum alloc_phase phase = ALLOC_OTHER;
+
+	if (ptr) {
+		phase = __atomic_load_n(&current_phase, __ATOMIC_RELAXED);
+		__atomic_add_fetch(&(alloc_stats[phase].frees), 1,
+				   __ATOMIC_RELAXED);
+	}
+	__real_free(ptr);
+}
+
+void *__wrap_malloc(size_t size)
+{
+	count_allocation(size);
+
+	return __real_malloc(size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+	count_allocation(size);
+
+	return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *string)
+{
+	count_allocation(strlen(string) + 1);
+
+	return __real_strdup(string);
+}
+
+/**
+ * Count a call of the allocator in the current phase.
+ *
+ * @param size is the number of requested bytes.
+ */
+static void count_allocation(size_t size)
+{
+	struct alloc_counters *stats = NULL;
+
+	if (0 == size) {
+		return;
+	}
+	stats = alloc_stats + __atomic_load_n(&current_phase,
+					      __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(stats->allocations), 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&(stats->bytes), size, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,103 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_ALLOC_STATS_H
+#define UNLOCKED_ALLOC_STATS_H
+
+#include <stdio.h>
+
+/**
+ * The phases the heap allocations of libunlocked are attributed to.
+ */
+enum alloc_phase {
+	/**
+	 * Everything outside of the negotiation of a key, like parsing the
+	 * configuration and initializing the modules.
+	 */
+	ALLOC_OTHER,
+	/**
+	 * Access to a key is requested from the servers.
+	 */
+	ALLOC_CREATE,
+	/**
+	 * The state of a request is polled or streamed.
+	 */
+	ALLOC_POLL,
+	/**
+	 * A request is marked as fulfilled and the key is received.
+	 */
+	ALLOC_FULFIL,
+	ALLOC_PHASE_COUNT,
+};
+
+/**
+ * The heap traffic of a phase.
+ */
+struct alloc_counters {
+	/**
+	 * The number of calls of malloc, calloc, realloc and strdup.
+	 */
+	unsigned long allocations;
+	/**
+	 * The number of bytes requested by these calls.
+	 */
+	unsigned long bytes;
+	/**
+	 * The number of calls of free with a pointer other than NULL.
+	 */
+	unsigned long frees;
+};
+
+#ifdef UNLOCKED_ALLOC_STATS
+
+/**
+ * Get the heap traffic of a phase since the start of the program or the last
+ * reset.
+ *
+ * @param phase is the phase.
+ * @param counters is populated with the heap traffic.
+ */
+void get_alloc_stats(enum alloc_phase phase, struct alloc_counters *counters);
+
+/**
+ * Print the heap traffic of all phases as table.
+ *
+ * @param file is the file to print to.
+ */
+void print_alloc_stats(FILE *file);
+
+/**
+ * Reset the heap traffic of all phases.
+ */
+void reset_alloc_stats(void);
+
+/**
+ * Attribute all further allocations to a phase.
+ *
+ * @param phase is the phase.
+ */
+void set_alloc_phase(enum alloc_phase phase);
+
+#else
+
+#define set_alloc_phase(phase) ((void) (phase))
+
+#endif
+
+#endif
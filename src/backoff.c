@@ -0,0 +1,100 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/random.h>
+
+#include "backoff.h"
+
+static double random_fraction(void);
+
+long get_next_delay(struct backoff *backoff)
+{
+	double delay = backoff->current;
+
+	if (backoff->jitter) {
+		delay *= random_fraction();
+	}
+	backoff->current *= backoff->multiplier;
+	if (backoff->current > backoff->max) {
+		backoff->current = backoff->max;
+	}
+
+	return delay;
+}
+
+void get_next_poll(struct backoff *backoff, struct timespec *deadline)
+{
+	long delay = get_next_delay(backoff);
+
+	*deadline = backoff->last_poll;
+	deadline->tv_sec += delay / 1000;
+	deadline->tv_nsec += (delay % 1000) * 1000000;
+	if (deadline->tv_nsec >= 1000000000) {
+		deadline->tv_sec++;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+void init_backoff(struct backoff *backoff, long initial, double multiplier,
+		  long max, unsigned int jitter)
+{
+	backoff->initial = initial < 0 ? 0 : initial;
+	backoff->multiplier = multiplier < 1 ? 1 : multiplier;
+	backoff->max = max < backoff->initial ? backoff->initial : max;
+	backoff->jitter = jitter;
+	backoff->current = backoff->initial;
+	backoff->polls = 0;
+	clock_gettime(CLOCK_MONOTONIC, &(backoff->last_poll));
+}
+
+void start_poll(struct backoff *backoff)
+{
+	clock_gettime(CLOCK_MONOTONIC, &(backoff->last_poll));
+	backoff->polls++;
+}
+
+void wait_for_next_poll(struct backoff *backoff)
+{
+	struct timespec deadline = { 0 };
+
+	get_next_poll(backoff, &deadline);
+	while (EINTR == clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME,
+					&deadline, NULL)) {
+		// Interrupted by a signal, continue sleeping.
+	}
+}
+
+/**
+ * Get a random number in the interval [0, 1].
+ *
+ * @return the random number or 1 if no random data is available.
+ */
+static double random_fraction(void)
+{
+	uint32_t value = 0;
+
+	if (sizeof(value) != getrandom(&value, sizeof(value), GRND_NONBLOCK)) {
+		return 1;
+	}
+
+	return (double) value / UINT32_MAX;
+}
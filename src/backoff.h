@@ -0,0 +1,115 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_BACKOFF_H
+#define UNLOCKED_BACKOFF_H
+
+#include <time.h>
+
+/**
+ * Schedules the requests of a polling loop with an exponential backoff.
+ *
+ * The delay between two polls starts at `initial` milliseconds and is
+ * multiplied by `multiplier` after every poll until it reaches `max`
+ * milliseconds. With jitter enabled, the actual delay is drawn uniformly from
+ * zero up to the current delay ("full jitter"), so that many clients started
+ * at the same time spread their requests.
+ *
+ * Delays are measured from the start of the previous poll on the monotonic
+ * clock, so the duration of a request counts towards the delay.
+ */
+struct backoff {
+	/**
+	 * The delay after the first poll in milliseconds.
+	 */
+	long initial;
+	/**
+	 * The factor the delay is multiplied with after every poll.
+	 */
+	double multiplier;
+	/**
+	 * The upper bound for the delay in milliseconds.
+	 */
+	long max;
+	/**
+	 * Whether to randomize the delays.
+	 */
+	unsigned int jitter;
+	/**
+	 * The current upper bound for the next delay in milliseconds.
+	 */
+	double current;
+	/**
+	 * The number of polls started.
+	 */
+	unsigned long polls;
+	/**
+	 * The time the last poll was started at.
+	 */
+	struct timespec last_poll;
+};
+
+/**
+ * Calculate the delay until the next poll and advance the backoff.
+ *
+ * @param backoff is the backoff to get the delay from.
+ *
+ * @return the delay in milliseconds.
+ */
+long get_next_delay(struct backoff *backoff);
+
+/**
+ * Calculate the time the next poll is due at and advance the backoff.
+ *
+ * This allows to wait for the next poll without blocking, e.g. with a timer.
+ *
+ * @param backoff is the backoff of the polling loop.
+ * @param deadline is set to the time on the monotonic clock the next poll is
+ *                 due at.
+ */
+void get_next_poll(struct backoff *backoff, struct timespec *deadline);
+
+/**
+ * Initialize the backoff for a new polling loop.
+ *
+ * @param backoff is the backoff to initialize.
+ * @param initial is the delay after the first poll in milliseconds.
+ * @param multiplier is the factor the delay grows with after every poll.
+ *                   Values smaller than one are treated as one.
+ * @param max is the upper bound for the delay in milliseconds.
+ * @param jitter specifies whether the delays should be randomized.
+ */
+void init_backoff(struct backoff *backoff, long initial, double multiplier,
+		  long max, unsigned int jitter);
+
+/**
+ * Record the start of a poll.
+ *
+ * @param backoff is the backoff of the polling loop.
+ */
+void start_poll(struct backoff *backoff);
+
+/**
+ * Sleep until the next poll is due.
+ *
+ * @param backoff is the backoff of the polling loop.
+ */
+void wait_for_next_poll(struct backoff *backoff);
+
+#endif
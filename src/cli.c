@@ -22,7 +22,9 @@
 #include <iniparser.h>
 
 #include "cli.h"
+#include "locked-memory.h"
 #include "log.h"
+#include "trace.h"
 
 #define OPT_CONFIG 'c'
 #define	OPT_HOST 'h'
@@ -32,15 +34,63 @@
 #define OPT_USER 'u'
 #define OPT_SKIP_VALIDATION 256
 #define OPT_VERBOSE 257
+#define OPT_POLL_INTERVAL 258
+#define OPT_POLL_MAX_INTERVAL 259
+#define OPT_POLL_MULTIPLIER 260
+#define OPT_NO_POLL_JITTER 261
+#define OPT_LONG_POLL 262
+#define OPT_LONG_POLL_TIMEOUT 263
+#define OPT_HEDGE_DELAY 264
+#define OPT_RESOLVE 265
+#define OPT_AGENT 266
+#define OPT_AGENT_SOCKET 267
+#define OPT_KEY_TTL 268
+#define OPT_MAX_RESPONSE_SIZE 269
+#define OPT_TIMINGS 270
+#define OPT_METRICS_FILE 271
+#define OPT_TRACE 272
+
+/**
+ * The size of the locked memory for the secrets of all arguments.
+ */
+#define SECRET_ARENA_SIZE (16 * 1024)
+
+static struct key_config *copy_keys(const struct key_config *keys,
+				    size_t count);
+static void free_keys(struct key_config *keys, size_t count);
+static enum unlocked_err parse_key_sections(const dictionary * ini,
+					    struct arguments *args);
+static char *replace_secret(char *old, const char *secret);
+static char *strdup_secret(const char *secret);
 
 static char doc[] = "unlocked-client -- a tool to fetch keys from a server";
 static size_t sub_parser_count = 0;
 static struct argp_child *sub_parsers = NULL;
 static void **sub_parser_inputs = NULL;
 static unsigned int is_debug = 0;
+/**
+ * The secrets of all arguments are kept in locked memory.
+ */
+static struct secure_arena secret_arena = { 0 };
 
 // *INDENT-OFF*
 static struct argp_option options[] = {
+	{
+		.name = "agent",
+		.key = OPT_AGENT,
+		.arg = 0,
+		.flags = 0,
+		.doc = "Keep running and serve keys to local consumers over a "
+			"unix socket",
+	},
+	{
+		.name = "agent-socket",
+		.key = OPT_AGENT_SOCKET,
+		.arg = "<path>",
+		.flags = 0,
+		.doc = "Path of the socket of the agent (default "
+			"/run/unlocked/agent.sock)",
+	},
         {
 		.name = "config",
 		.key = OPT_CONFIG,
@@ -48,12 +98,21 @@ static struct argp_option options[] = {
 		.flags = 0,
 		.doc = "Path to the configuration file",
 	},
+	{
+		.name = "hedge-delay",
+		.key = OPT_HEDGE_DELAY,
+		.arg = "<milliseconds>",
+		.flags = 0,
+		.doc = "Delay before the next server is asked as well if the "
+			"previous one did not answer (default 1000)",
+	},
 	{
 		.name = "host",
 		.key = OPT_HOST,
-		.arg = "<hostname>",
+		.arg = "<host>[:<port>],...",
 		.flags = 0,
-		.doc = "Hostname of the server",
+		.doc = "Comma separated list of servers, the first one is "
+			"preferred",
 	},
 	{
 		.name = "key",
@@ -62,6 +121,77 @@ static struct argp_option options[] = {
 		.flags = 0,
 		.doc = "Handle of the key to request",
 	},
+	{
+		.name = "key-ttl",
+		.key = OPT_KEY_TTL,
+		.arg = "<seconds>",
+		.flags = 0,
+		.doc = "Time the agent keeps received keys in memory "
+			"(default 300)",
+	},
+	{
+		.name = "long-poll",
+		.key = OPT_LONG_POLL,
+		.arg = 0,
+		.flags = 0,
+		.doc = "Stream the request state instead of polling, if the "
+			"server supports it",
+	},
+	{
+		.name = "long-poll-timeout",
+		.key = OPT_LONG_POLL_TIMEOUT,
+		.arg = "<seconds>",
+		.flags = 0,
+		.doc = "Time the server may hold a streaming request open "
+			"(default 60)",
+	},
+	{
+		.name = "max-response-size",
+		.key = OPT_MAX_RESPONSE_SIZE,
+		.arg = "<bytes>",
+		.flags = 0,
+		.doc = "Maximum size of the body of a response from the server "
+			"(default 1048576)",
+	},
+	{
+		.name = "metrics-file",
+		.key = OPT_METRICS_FILE,
+		.arg = "<path>",
+		.flags = 0,
+		.doc = "Write the metrics of the run to this file for the "
+			"textfile collector of the Prometheus node_exporter",
+	},
+	{
+		.name = "poll-interval",
+		.key = OPT_POLL_INTERVAL,
+		.arg = "<milliseconds>",
+		.flags = 0,
+		.doc = "Initial delay between polls of the request state "
+			"(default 1000)",
+	},
+	{
+		.name = "poll-max-interval",
+		.key = OPT_POLL_MAX_INTERVAL,
+		.arg = "<milliseconds>",
+		.flags = 0,
+		.doc = "Maximum delay between polls of the request state "
+			"(default 10000 or the poll interval)",
+	},
+	{
+		.name = "poll-multiplier",
+		.key = OPT_POLL_MULTIPLIER,
+		.arg = "<factor>",
+		.flags = 0,
+		.doc = "Factor the delay between polls grows with "
+			"(default 1.5)",
+	},
+	{
+		.name = "no-poll-jitter",
+		.key = OPT_NO_POLL_JITTER,
+		.arg = 0,
+		.flags = 0,
+		.doc = "Do not randomize the delay between polls",
+	},
 	{
 		.name = "port",
 		.key = OPT_PORT,
@@ -69,6 +199,14 @@ static struct argp_option options[] = {
 		.flags = 0,
 		.doc = "Port on the server (default 443)",
 	},
+	{
+		.name = "resolve",
+		.key = OPT_RESOLVE,
+		.arg = "<host>:<port>:<address>[,<address>]... ...",
+		.flags = 0,
+		.doc = "Whitespace separated list of fixed addresses for the "
+			"servers, that are used instead of resolving them",
+	},
 	{
 		.name = "secret",
 		.key = OPT_SECRET,
@@ -76,6 +214,22 @@ static struct argp_option options[] = {
 		.flags = 0,
 		.doc = "Secret used to authenticate against the server",
 	},
+	{
+		.name = "timings",
+		.key = OPT_TIMINGS,
+		.arg = "json",
+		.flags = OPTION_ARG_OPTIONAL,
+		.doc = "Report the network timings of the requests per phase "
+			"on the standard error stream, optionally as json",
+	},
+	{
+		.name = "trace",
+		.key = OPT_TRACE,
+		.arg = "<path>",
+		.flags = 0,
+		.doc = "Record the steps of the run to a file in the trace "
+			"event format for Perfetto",
+	},
 	{
 		.name = "user",
 		.key = OPT_USER,
@@ -115,20 +269,76 @@ static error_t parse_opt(int key, char *arg, struct argp_state *state)
 	struct arguments *arguments = state->input;
 
 	switch (key) {
+	case OPT_AGENT:
+		arguments->agent = yes;
+		break;
+	case OPT_AGENT_SOCKET:
+		arguments->agent_socket = strdup(arg);
+		break;
 	case OPT_CONFIG:
 		arguments->config_file = strdup(arg);
 		break;
+	case OPT_HEDGE_DELAY:
+		arguments->hedge_delay = atol(arg);
+		break;
 	case OPT_HOST:
 		arguments->host = strdup(arg);
 		break;
 	case OPT_KEY:
 		arguments->key_handle = strdup(arg);
 		break;
+	case OPT_KEY_TTL:
+		arguments->key_ttl = atol(arg);
+		break;
+	case OPT_LONG_POLL:
+		arguments->long_poll = yes;
+		break;
+	case OPT_LONG_POLL_TIMEOUT:
+		arguments->long_poll_timeout = atol(arg);
+		break;
+	case OPT_MAX_RESPONSE_SIZE:
+		arguments->max_response_size = atol(arg);
+		break;
+	case OPT_METRICS_FILE:
+		arguments->metrics_file = strdup(arg);
+		break;
+	case OPT_POLL_INTERVAL:
+		// Zero would be taken as unset when merging the configuration.
+		arguments->poll_interval = atol(arg);
+		if (arguments->poll_interval <= 0) {
+			argp_error(state, "Invalid poll interval: %s", arg);
+		}
+		break;
+	case OPT_POLL_MAX_INTERVAL:
+		arguments->poll_max_interval = atol(arg);
+		break;
+	case OPT_POLL_MULTIPLIER:
+		arguments->poll_multiplier = atof(arg);
+		break;
+	case OPT_NO_POLL_JITTER:
+		arguments->poll_jitter = no;
+		break;
 	case OPT_PORT:
 		arguments->port = atol(arg);
 		break;
+	case OPT_RESOLVE:
+		arguments->resolve = strdup(arg);
+		break;
 	case OPT_SECRET:
-		arguments->secret = strdup(arg);
+		arguments->secret = strdup_secret(arg);
+		break;
+	case OPT_TIMINGS:
+		if (NULL == arg) {
+			arguments->timings = TIMINGS_TEXT;
+		} else if (0 == strcmp(arg, "json")) {
+			arguments->timings = TIMINGS_JSON;
+		} else {
+			argp_error(state, "Unknown format of the timings: %s",
+				   arg);
+		}
+		break;
+	case OPT_TRACE:
+		arguments->trace_file = strdup(arg);
 		break;
 	case OPT_USER:
 		arguments->username = strdup(arg);
@@ -167,6 +377,7 @@ enum unlocked_err handle_args(int argc, char **argv, struct arguments *args)
 	struct arguments *cli_args = create_args();
 	struct arguments *config_args = create_args();
 	enum unlocked_err err = UL_OK;
+	long long begin = 0;
 
 	if (NULL == cli_args) {
 		return UL_MALLOC;
@@ -189,16 +400,23 @@ enum unlocked_err handle_args(int argc, char **argv, struct arguments *args)
 	argp_parse(&argp_client, argc, argv, 0, 0, cli_args);
 
 	if (cli_args->config_file) {
+		begin = trace_now();
 		err = parse_config_file(cli_args->config_file, config_args);
+		trace_span(TRACE_MAIN, "parse_config_file", begin);
 		if (UL_OK != err) {
 			return err;
 		}
 	}
 
-	merge_config(args, config_args);
+	err = merge_config(args, config_args);
 	free_args(config_args);
-	merge_config(args, cli_args);
+	if (UL_OK == err) {
+		err = merge_config(args, cli_args);
+	}
 	free_args(cli_args);
+	if (UL_OK != err) {
+		return err;
+	}
 
 	// Set global debug mode.
 	is_debug = args->verbose == yes;
@@ -206,8 +424,20 @@ enum unlocked_err handle_args(int argc, char **argv, struct arguments *args)
 	return UL_OK;
 }
 
-void merge_config(struct arguments *base, struct arguments *new)
+enum unlocked_err merge_config(struct arguments *base, struct arguments *new)
 {
+	enum unlocked_err err = UL_OK;
+	char *secret = NULL;
+
+	if (new->agent) {
+		base->agent = new->agent;
+	}
+	if (new->agent_socket) {
+		if (base->agent_socket) {
+			free(base->agent_socket);
+		}
+		base->agent_socket = strdup(new->agent_socket);
+	}
 	if (new->config_file) {
 		if (base->config_file) {
 			free(base->config_file);
@@ -220,20 +450,75 @@ void merge_config(struct arguments *base, struct arguments *new)
 		}
 		base->key_handle = strdup(new->key_handle);
 	}
+	if (new->key_count) {
+		free_keys(base->keys, base->key_count);
+		base->keys = copy_keys(new->keys, new->key_count);
+		base->key_count = base->keys ? new->key_count : 0;
+	}
+	if (new->key_ttl) {
+		base->key_ttl = new->key_ttl;
+	}
+	if (new->hedge_delay) {
+		base->hedge_delay = new->hedge_delay;
+	}
 	if (new->host) {
 		if (base->host) {
 			free(base->host);
 		}
 		base->host = strdup(new->host);
 	}
+	if (new->long_poll) {
+		base->long_poll = new->long_poll;
+	}
+	if (new->long_poll_timeout) {
+		base->long_poll_timeout = new->long_poll_timeout;
+	}
+	if (new->max_response_size) {
+		base->max_response_size = new->max_response_size;
+	}
+	if (new->metrics_file) {
+		if (base->metrics_file) {
+			free(base->metrics_file);
+		}
+		base->metrics_file = strdup(new->metrics_file);
+	}
+	if (new->poll_interval) {
+		base->poll_interval = new->poll_interval;
+	}
+	if (new->poll_jitter) {
+		base->poll_jitter = new->poll_jitter;
+	}
+	if (new->poll_max_interval) {
+		base->poll_max_interval = new->poll_max_interval;
+	}
+	if (new->poll_multiplier) {
+		base->poll_multiplier = new->poll_multiplier;
+	}
 	if (new->port) {
 		base->port = new->port;
 	}
+	if (new->resolve) {
+		if (base->resolve) {
+			free(base->resolve);
+		}
+		base->resolve = strdup(new->resolve);
+	}
 	if (new->secret) {
-		if (base->secret) {
-			free(base->secret);
+		secret = replace_secret(base->secret, new->secret);
+		if (secret) {
+			base->secret = secret;
+		} else {
+			err = UL_MALLOC;
+		}
+	}
+	if (new->timings) {
+		base->timings = new->timings;
+	}
+	if (new->trace_file) {
+		if (base->trace_file) {
+			free(base->trace_file);
 		}
-		base->secret = strdup(new->secret);
+		base->trace_file = strdup(new->trace_file);
 	}
 	if (new->username) {
 		if (base->username) {
@@ -247,16 +532,24 @@ void merge_config(struct arguments *base, struct arguments *new)
 	if (new->verbose) {
 		base->verbose = new->verbose;
 	}
+
+	return err;
 }
 
 enum unlocked_err parse_config_file(const char *const path,
 				    struct arguments *args)
 {
 	dictionary *ini = NULL;
+	const char *agent_socket = NULL;
 	const char *host = NULL;
 	const char *key_handle = NULL;
+	const char *metrics_file = NULL;
+	const char *resolve = NULL;
 	const char *secret = NULL;
 	const char *username = NULL;
+	int agent = 0;
+	int jitter = 0;
+	int long_poll = 0;
 	int validate = 0;
 	enum unlocked_err err = UL_OK;
 
@@ -267,6 +560,28 @@ enum unlocked_err parse_config_file(const char *const path,
 
 		return UL_ERR;
 	}
+	agent = iniparser_getboolean(ini, "unlocked:agent", -1);
+	switch (agent) {
+	case 1:
+		args->agent = yes;
+		break;
+	case 0:
+		args->agent = no;
+		break;
+	default:
+		args->agent = unset;
+	}
+	agent_socket = iniparser_getstring(ini, "unlocked:agent_socket", NULL);
+	if (NULL != agent_socket) {
+		args->agent_socket = strdup(agent_socket);
+		if (NULL == args->agent_socket) {
+			iniparser_freedict(ini);
+
+			return UL_MALLOC;
+		}
+	}
+	args->hedge_delay =
+		iniparser_getlongint(ini, "unlocked:hedge_delay", 0);
 	host = iniparser_getstring(ini, "unlocked:host", NULL);
 	if (NULL != host) {
 		args->host = strdup(host);
@@ -285,10 +600,66 @@ enum unlocked_err parse_config_file(const char *const path,
 			return UL_MALLOC;
 		}
 	}
+	args->key_ttl = iniparser_getlongint(ini, "unlocked:key_ttl", 0);
+	long_poll = iniparser_getboolean(ini, "unlocked:long_poll", -1);
+	switch (long_poll) {
+	case 1:
+		args->long_poll = yes;
+		break;
+	case 0:
+		args->long_poll = no;
+		break;
+	default:
+		args->long_poll = unset;
+	}
+	args->long_poll_timeout =
+		iniparser_getlongint(ini, "unlocked:long_poll_timeout", 0);
+	args->max_response_size =
+		iniparser_getlongint(ini, "unlocked:max_response_size", 0);
+	metrics_file = iniparser_getstring(ini, "unlocked:metrics_file", NULL);
+	if (NULL != metrics_file) {
+		args->metrics_file = strdup(metrics_file);
+		if (NULL == args->metrics_file) {
+			iniparser_freedict(ini);
+
+			return UL_MALLOC;
+		}
+	}
+	args->poll_interval =
+		iniparser_getlongint(ini, "unlocked:poll_interval", 0);
+	// Zero means unset when merging, so it is marked as invalid instead.
+	if (0 == args->poll_interval
+	    && iniparser_find_entry(ini, "unlocked:poll_interval")) {
+		args->poll_interval = -1;
+	}
+	jitter = iniparser_getboolean(ini, "unlocked:poll_jitter", -1);
+	switch (jitter) {
+	case 1:
+		args->poll_jitter = yes;
+		break;
+	case 0:
+		args->poll_jitter = no;
+		break;
+	default:
+		args->poll_jitter = unset;
+	}
+	args->poll_max_interval =
+		iniparser_getlongint(ini, "unlocked:poll_max_interval", 0);
+	args->poll_multiplier =
+		iniparser_getdouble(ini, "unlocked:poll_multiplier", 0);
 	args->port = iniparser_getlongint(ini, "unlocked:port", 0);
+	resolve = iniparser_getstring(ini, "unlocked:resolve", NULL);
+	if (NULL != resolve) {
+		args->resolve = strdup(resolve);
+		if (NULL == args->resolve) {
+			iniparser_freedict(ini);
+
+			return UL_MALLOC;
+		}
+	}
 	secret = iniparser_getstring(ini, "unlocked:secret", NULL);
 	if (NULL != secret) {
-		args->secret = strdup(secret);
+		args->secret = strdup_secret(secret);
 		if (NULL == args->secret) {
 			iniparser_freedict(ini);
 
@@ -316,6 +687,13 @@ enum unlocked_err parse_config_file(const char *const path,
 		args->validate = unset;
 	}
 
+	err = parse_key_sections(ini, args);
+	if (UL_OK != err) {
+		iniparser_freedict(ini);
+
+		return err;
+	}
+
 	err = parse_config(ini);
 	if (UL_OK != err) {
 		return err;
@@ -365,6 +743,9 @@ void free_args(struct arguments *args)
 		return;
 	}
 
+	if (args->agent_socket) {
+		free(args->agent_socket);
+	}
 	if (args->config_file) {
 		free(args->config_file);
 	}
@@ -374,8 +755,16 @@ void free_args(struct arguments *args)
 	if (args->host) {
 		free(args->host);
 	}
-	if (args->secret) {
-		free(args->secret);
+	free_keys(args->keys, args->key_count);
+	if (args->metrics_file) {
+		free(args->metrics_file);
+	}
+	if (args->resolve) {
+		free(args->resolve);
+	}
+	// The secret is freed with `free_secrets`.
+	if (args->trace_file) {
+		free(args->trace_file);
 	}
 	if (args->username) {
 		free(args->username);
@@ -391,7 +780,156 @@ void free_child_parsers(void)
 	sub_parser_count = 0;
 }
 
+void free_secrets(void)
+{
+	free_arena(&secret_arena);
+}
+
 unsigned int ul_debug(void)
 {
 	return is_debug;
 }
+
+/**
+ * Create a deep copy of a list of keys.
+ *
+ * @param keys is the list to copy.
+ * @param count is the number of keys in the list.
+ *
+ * @return the copy, that must be freed with `free_keys` or NULL on failure.
+ */
+static struct key_config *copy_keys(const struct key_config *keys,
+				    size_t count)
+{
+	struct key_config *copy = calloc(count, sizeof(struct key_config));
+	if (NULL == copy) {
+		return NULL;
+	}
+	for (size_t i = 0; i < count; i++) {
+		copy[i].name = strdup(keys[i].name);
+		copy[i].key_handle = strdup(keys[i].key_handle);
+		if (NULL == copy[i].name || NULL == copy[i].key_handle) {
+			free_keys(copy, i + 1);
+
+			return NULL;
+		}
+	}
+
+	return copy;
+}
+
+/**
+ * Free a list of keys.
+ *
+ * @param keys is the list to free. Passing NULL is allowed.
+ * @param count is the number of keys in the list.
+ */
+static void free_keys(struct key_config *keys, size_t count)
+{
+	if (NULL == keys) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		free(keys[i].name);
+		free(keys[i].key_handle);
+	}
+	free(keys);
+}
+
+/**
+ * Collect the keys from all sections starting with `KEY_SECTION_PREFIX`.
+ *
+ * The handle of a key defaults to the name of its section.
+ *
+ * @param ini is the dictionary of the loaded config file.
+ * @param args is the structure the keys are added to.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err parse_key_sections(const dictionary * ini,
+					    struct arguments *args)
+{
+	static const size_t prefix_len = sizeof(KEY_SECTION_PREFIX) - 1;
+	char *entry = NULL;
+	const char *handle = NULL;
+	struct key_config *keys = NULL;
+	const char *section = NULL;
+	int section_count = iniparser_getnsec(ini);
+
+	for (int i = 0; i < section_count; i++) {
+		section = iniparser_getsecname(ini, i);
+		if (NULL == section
+		    || strncmp(section, KEY_SECTION_PREFIX, prefix_len)
+		    || '\0' == section[prefix_len]) {
+			continue;
+		}
+		entry = get_section_entry(section, "key_handle");
+		if (NULL == entry) {
+			return UL_MALLOC;
+		}
+		handle = iniparser_getstring(ini, entry, section + prefix_len);
+		free(entry);
+		keys = realloc(args->keys, sizeof(struct key_config)
+			       * (args->key_count + 1));
+		if (NULL == keys) {
+			return UL_MALLOC;
+		}
+		args->keys = keys;
+		keys[args->key_count].name = strdup(section + prefix_len);
+		keys[args->key_count].key_handle = strdup(handle);
+		args->key_count++;
+		if (NULL == keys[args->key_count - 1].name
+		    || NULL == keys[args->key_count - 1].key_handle) {
+			return UL_MALLOC;
+		}
+	}
+
+	return UL_OK;
+}
+
+/**
+ * Replace a secret in locked memory.
+ *
+ * The memory of the old secret is reused if it is the most recent buffer in
+ * the locked memory. Otherwise the old secret is wiped.
+ *
+ * @param old is the secret to replace or NULL.
+ * @param secret is the new secret.
+ *
+ * @return the copy, that is freed with `free_secrets`, or NULL on failure.
+ *         The old secret is left untouched in this case.
+ */
+static char *replace_secret(char *old, const char *secret)
+{
+	char *copy = NULL;
+	size_t size = strlen(secret) + 1;
+
+	// Secrets set by the caller instead of the parsers are not replaced.
+	if (NULL == old || NULL == secret_arena.base || old < secret_arena.base
+	    || old >= secret_arena.base + secret_arena.used) {
+		return strdup_secret(secret);
+	}
+	copy = arena_realloc(&secret_arena, old, strlen(old) + 1, size);
+	if (copy) {
+		memcpy(copy, secret, size);
+	}
+
+	return copy;
+}
+
+/**
+ * Copy a secret into locked memory.
+ *
+ * @param secret is the secret to copy.
+ *
+ * @return the copy, that is freed with `free_secrets`, or NULL on failure.
+ */
+static char *strdup_secret(const char *secret)
+{
+	if (NULL == secret_arena.base
+	    && UL_OK != init_arena(&secret_arena, SECRET_ARENA_SIZE)) {
+		return NULL;
+	}
+
+	return arena_strdup(&secret_arena, secret);
+}
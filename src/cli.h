@@ -23,15 +23,49 @@
 #include "mod/module.h"
 #include "error.h"
 
+/**
+ * Prefix of the sections in the config file, that configure a single key.
+ */
+#define KEY_SECTION_PREFIX "key."
+
 /**
  * Enumeration used to store boolean values in the arguments structure.
  */
 enum tristate { no = -1, unset = 0, yes = 1 };
 
+/**
+ * The formats of the report of the network timings.
+ */
+enum timings_format { TIMINGS_OFF = 0, TIMINGS_TEXT, TIMINGS_JSON };
+
+/**
+ * A key configured in its own section of the config file.
+ */
+struct key_config {
+	/**
+	 * The name of the key, which is the name of its section without the
+	 * prefix.
+	 */
+	char *name;
+	/**
+	 * The handle of the key that should be requested from the server.
+	 */
+	char *key_handle;
+};
+
 /**
  * Contains arguments for the program.
  */
 struct arguments {
+	/**
+	 * Whether to keep running and serve keys to local consumers.
+	 */
+	enum tristate agent;
+	/**
+	 * The path of the socket the agent listens on or NULL for the
+	 * default.
+	 */
+	char *agent_socket;
 	/**
 	 * If not NULL, the config file at this path will be parsed to further
 	 * populate this structure.
@@ -42,17 +76,84 @@ struct arguments {
 	 */
 	char *key_handle;
 	/**
-	 * The host name or ip address of the server.
+	 * The keys configured in their own sections. If any, they are
+	 * requested concurrently instead of the single key handle.
+	 */
+	struct key_config *keys;
+	size_t key_count;
+	/**
+	 * The time in seconds the agent keeps received keys in memory.
+	 */
+	long key_ttl;
+	/**
+	 * The delay in milliseconds before the request for a key is also sent
+	 * to the next server, if the previous ones did not answer yet.
+	 */
+	long hedge_delay;
+	/**
+	 * The comma separated list of the host names or ip addresses of the
+	 * servers, each optionally followed by a port.
 	 */
 	char *host;
+	/**
+	 * Whether to wait for changes of the request state with a single
+	 * streaming request instead of polling.
+	 */
+	enum tristate long_poll;
+	/**
+	 * The time in seconds the server may hold a streaming request open.
+	 */
+	long long_poll_timeout;
+	/**
+	 * The maximum size of the body of a response in bytes.
+	 */
+	long max_response_size;
+	/**
+	 * The path of the file the metrics of the run are written to for the
+	 * textfile collector of the Prometheus node_exporter or NULL.
+	 */
+	char *metrics_file;
+	/**
+	 * The delay between the first polls of the request state in
+	 * milliseconds.
+	 */
+	long poll_interval;
+	/**
+	 * Whether to randomize the delays between polls of the request state.
+	 */
+	enum tristate poll_jitter;
+	/**
+	 * The upper bound for the delay between polls of the request state in
+	 * milliseconds.
+	 */
+	long poll_max_interval;
+	/**
+	 * The factor the delay between polls grows with after every poll.
+	 */
+	double poll_multiplier;
 	/**
 	 * The port of the server.
 	 */
 	long port;
+	/**
+	 * The whitespace separated list of fixed addresses of the servers in
+	 * the form "host:port:address[,address]...".
+	 */
+	char *resolve;
 	/**
 	 * The secret used to authenticate the client against the server.
 	 */
 	char *secret;
+	/**
+	 * The format to report the network timings of the requests in on
+	 * the standard error stream after the keys were received.
+	 */
+	enum timings_format timings;
+	/**
+	 * The path of the file the spans of the run are written to in the
+	 * trace event format or NULL.
+	 */
+	char *trace_file;
 	/**
 	 * The username used to identify the client.
 	 */
@@ -103,8 +204,11 @@ enum unlocked_err handle_args(int argc, char **argv, struct arguments *args);
  * @param base is the structure of arguments which may be overriden.
  * @param new is the structure of arguments which are used to override the
  *            base values.
+ *
+ * @return any error that occured. The secret of the base arguments is kept
+ *         if it could not be replaced.
  */
-void merge_config(struct arguments *base, struct arguments *new);
+enum unlocked_err merge_config(struct arguments *base, struct arguments *new);
 
 /**
  * Parse values from a configuration file.
@@ -136,6 +240,14 @@ void free_args(struct arguments *args);
  */
 void free_child_parsers(void);
 
+/**
+ * Wipe and free the secrets of all arguments.
+ *
+ * The secrets are kept in locked memory, that is shared by all arguments.
+ * Therefore they are not freed by `free_args`.
+ */
+void free_secrets(void);
+
 /**
  * This function is used to decide whether additional data should be outputted
  * for debugging purposes.
@@ -19,142 +19,721 @@
 
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
-#include "cJSON.h"
+#include <time.h>
+#include "alloc-stats.h"
+#include "backoff.h"
 #include "client.h"
 #include "error.h"
+#include "event-loop.h"
+#include "hosts.h"
 #include "https-client.h"
+#include "json-scan.h"
+#include "locked-memory.h"
 #include "log.h"
+#include "metrics.h"
 #include "mod/module.h"
+#include "request-state.h"
+#include "timings.h"
+#include "trace.h"
 
+/**
+ * Additional time in seconds granted to the server to finish a long poll.
+ */
+#define LONG_POLL_GRACE 15
+
+/**
+ * The time in seconds a stream may end before its timeout and still be
+ * reopened right away.
+ */
+#define LONG_POLL_EARLY 1
+
+/**
+ * The size of the locked memory for the key received by a job.
+ */
+#define KEY_ARENA_SIZE (64 * 1024)
+
+/**
+ * The steps of the negotiation of a key with the server.
+ */
+enum job_state {
+	/**
+	 * Access to the key is requested.
+	 */
+	JOB_CREATING,
+	/**
+	 * The state of the request is streamed by the server.
+	 */
+	JOB_STREAMING,
+	/**
+	 * The timer for the next poll of the request state is armed.
+	 */
+	JOB_WAITING,
+	/**
+	 * The state of the request is polled.
+	 */
+	JOB_POLLING,
+	/**
+	 * The request is marked as fulfilled and the key is received.
+	 */
+	JOB_FULFILLING,
+	/**
+	 * The negotiation has finished successfully or with an error.
+	 */
+	JOB_DONE,
+};
+
+/**
+ * A request for access to a key sent to a single server.
+ */
+struct host_attempt {
+	struct Exchange exchange;
+	struct server_host *host;
+	struct key_job *job;
+	struct Request request;
+	/**
+	 * The time the request was started at.
+	 */
+	struct timespec started;
+	char *url;
+};
+
+/**
+ * The negotiation of a single key with the server.
+ *
+ * Every job is a state machine driven by the completion callbacks of its
+ * requests and the expiry of its timers.
+ *
+ * Access to the key is requested from the preferred server first. If it does
+ * not answer within the hedge delay or fails, the request is also sent to the
+ * next server. The first server that creates the request wins, the requests to
+ * all other servers are cancelled and the rest of the negotiation is performed
+ * with the winner.
+ */
+struct key_job {
+	/**
+	 * Locked memory for the received key, which is wiped when the job is
+	 * freed.
+	 */
+	struct secure_arena arena;
+	/**
+	 * The requests for access to the key sent to the servers so far.
+	 */
+	struct host_attempt *attempts;
+	size_t attempt_count;
+	struct backoff backoff;
+	struct key_client *client;
+	/**
+	 * Data for the completion callback.
+	 */
+	void *data;
+	/**
+	 * Called after the job finished.
+	 *
+	 * @param data is the data of the job.
+	 * @param err is any error that occured.
+	 * @param key is the received key or NULL on failure. It is kept in
+	 *            the arena of the job.
+	 */
+	void (*done) (void *data, enum unlocked_err err, char *key);
+	/**
+	 * Any error that occured.
+	 */
+	enum unlocked_err err;
+	/**
+	 * The current or last request of the job.
+	 */
+	struct Exchange exchange;
+	char *handle;
+	/**
+	 * The time the current phase of the negotiation started at.
+	 */
+	struct timespec phase_started;
+	/**
+	 * The delay in milliseconds before the next server is asked or a
+	 * negative value to ask it only after a failure.
+	 */
+	long hedge_delay;
+	/**
+	 * The timer for sending the request to the next server.
+	 */
+	struct timer hedge_timer;
+	/**
+	 * The server the negotiation is performed with.
+	 */
+	const char *host;
+	/**
+	 * The servers ordered by preference.
+	 */
+	struct server_host *hosts;
+	size_t host_count;
+	/**
+	 * The key received from the server.
+	 */
+	char *key;
+	/**
+	 * The time in seconds the server may hold a streaming request open or
+	 * zero to poll the request state.
+	 */
+	long long_poll_timeout;
+	/**
+	 * The next job of the client.
+	 */
+	struct key_job *next;
+	/**
+	 * The response of the last poll of the request state, which is reused
+	 * for the next poll, or NULL.
+	 */
+	struct Response *poll_response;
+	struct Request request;
+	int request_id;
+	/**
+	 * The most recent state of the request for the key.
+	 */
+	char request_state[REQUEST_STATE_SIZE];
+	struct Session *session;
+	/**
+	 * The time the negotiation started at.
+	 */
+	struct timespec started;
+	/**
+	 * The time the job started to wait for the next poll at from
+	 * `trace_now`.
+	 */
+	long long sleep_started;
+	enum job_state state;
+	struct event_stream stream;
+	/**
+	 * The url used to stream the request state or NULL.
+	 */
+	char *stream_url;
+	/**
+	 * The timer for the next poll of the request state.
+	 */
+	struct timer timer;
+	/**
+	 * The track of the spans of the job in the trace.
+	 */
+	int track;
+	/**
+	 * The url of the request for the key.
+	 */
+	char *url;
+};
+
+/**
+ * Negotiates keys with the servers over a single session.
+ */
+struct key_client {
+	const struct arguments *arguments;
+	/**
+	 * The number of keys requested so far.
+	 */
+	size_t fetches;
+	struct server_host *hosts;
+	size_t host_count;
+	/**
+	 * The jobs, that have not been reaped yet.
+	 */
+	struct key_job *jobs;
+	/**
+	 * The outcomes of all negotiations and the retries of failed
+	 * requests.
+	 */
+	struct unlock_metrics metrics;
+	/**
+	 * The number of polls of all reaped jobs.
+	 */
+	unsigned long polls;
+	/**
+	 * The resolver looking up the servers ahead of time or NULL.
+	 */
+	struct resolver *resolver;
+	struct Session *session;
+	/**
+	 * The network timings of all requests of the client.
+	 */
+	struct timing_report timings;
+};
+
+/**
+ * The outcome of the request for a configured key.
+ */
+struct key_result {
+	enum unlocked_err err;
+	/**
+	 * The copy of the key in locked memory or NULL.
+	 */
+	char *key;
+	size_t key_len;
+	/**
+	 * The name of the key or NULL for the key of the `[unlocked]` section.
+	 */
+	const char *name;
+};
+
+static void close_phase(struct key_job *job);
+static size_t count_running_attempts(struct key_job *job);
+static enum unlocked_err deliver_keys(struct key_result *results,
+				      size_t count);
+static void finish_job(struct key_job *job, enum unlocked_err err);
+static void free_attempts(struct key_job *job);
+static void free_job(struct key_job *job);
+static enum alloc_phase get_job_alloc_phase(enum job_state state);
+static enum request_phase get_job_phase(enum job_state state);
+static const char *get_job_state_name(enum job_state state);
 static char *get_key_request_body(const char *const handle);
 static char *get_key_request_url(const char *const host);
 static int get_request_id(struct Response *response);
-static char *get_request_state(struct Response *response);
+static int get_request_state(struct Response *response,
+			     char state[REQUEST_STATE_SIZE]);
 static char *get_show_request_url(const char *const host, int id);
+static char *get_stream_url(const char *const url, long timeout);
+static void handle_attempt(struct Exchange *exchange);
+static void handle_attempt_failure(struct host_attempt *attempt,
+				   struct Response *response,
+				   enum unlocked_err err);
+static void handle_created(struct key_job *job, struct Response *response,
+			   enum unlocked_err err);
+static void handle_fulfilled(struct key_job *job, struct Response *response,
+			     enum unlocked_err err);
+static void handle_hedge_timer(void *data);
+static void handle_poll_timer(void *data);
+static void handle_polled(struct key_job *job, struct Response *response,
+			  enum unlocked_err err);
+static void handle_request_state(struct key_job *job);
+static void handle_response(struct Exchange *exchange);
+static void handle_streamed(struct key_job *job, struct Response *response,
+			    enum unlocked_err err);
+static void poll_request_state(struct key_job *job);
+static size_t reap_jobs(struct key_client *client);
+static void send_request(struct key_job *job, enum http_method method);
+static void start_attempt(struct key_job *job);
+static void start_job(struct key_job *job);
+static void start_stream(struct key_job *job);
+static void store_key(void *data, enum unlocked_err err, char *key);
 static void validate_content_type(struct Response *response);
+static void wait_for_poll(struct key_job *job);
+static void write_key_client_metrics(struct key_client *client);
 
-enum unlocked_err request_key(struct arguments *arguments)
+size_t count_key_fetches(struct key_client *client)
 {
-	struct Request request = { 0 };
-	struct Response *response = create_response();
-	int request_id = 0;
-	char *key = NULL;
-	char *request_state = NULL;
-	enum unlocked_err err = UL_OK;
+	size_t count = 0;
 
-	logger(LOG_DEBUG, "Requesting the key \"%s\" from the host \"%s\"\n",
-	       arguments->key_handle, arguments->host);
+	for (struct key_job * job = client->jobs; job; job = job->next) {
+		count++;
+	}
 
-	request.body = get_key_request_body(arguments->key_handle);
-	if (NULL == request.body) {
-		return UL_MALLOC;
+	return count;
+}
+
+unsigned long count_key_polls(struct key_client *client)
+{
+	unsigned long polls = client->polls;
+
+	for (struct key_job * job = client->jobs; job; job = job->next) {
+		polls += job->backoff.polls;
 	}
-	request.port = arguments->port;
-	request.secret = arguments->secret;
-	request.skip_validation = no == arguments->validate;
-	request.url = get_key_request_url(arguments->host);
-	if (NULL == request.url) {
-		free(request.body);
 
+	return polls;
+}
+
+enum unlocked_err create_key_client(const struct arguments *arguments,
+				    struct resolver *resolver,
+				    struct key_client **client)
+{
+	enum unlocked_err err = UL_OK;
+
+	*client = calloc(1, sizeof(struct key_client));
+	if (NULL == *client) {
 		return UL_MALLOC;
 	}
-	request.username = arguments->username;
+	(*client)->arguments = arguments;
+	err = parse_hosts(arguments->host, arguments->port,
+			  &((*client)->hosts), &((*client)->host_count));
+	if (UL_OK != err) {
+		free(*client);
+		*client = NULL;
 
+		return err;
+	}
+	err = load_host_latencies((*client)->hosts, (*client)->host_count);
+	if (UL_OK != err) {
+		logger(LOG_DEBUG, "Could not load the latencies of the "
+		       "servers: %s\n", ul_error(err));
+	}
+	sort_hosts((*client)->hosts, (*client)->host_count);
 	init_https_client();
-	https_hmac_POST(&request, response);
-	free(request.body);
-	request.body = NULL;
-	free(request.url);
-	request.url = NULL;
-	switch (response->status) {
-	case 201:
-		// Expected response status, continue
-		break;
-	case 401:
-		// Authentication failed
-		logger(LOG_ERROR,
-		       "Authentication against the server failed. "
-		       "Maybe the user or secret are incorrect?\n");
-		free_response(response);
+	(*client)->session = create_session();
+	if (NULL == (*client)->session) {
+		free_hosts((*client)->hosts, (*client)->host_count);
+		free(*client);
+		*client = NULL;
+		cleanup_https_client();
 
-		return UL_ERR;
-	default:
-		logger(LOG_ERROR,
-		       "Communication with the server failed with code %ld.\n",
-		       response->status);
-		free_response(response);
+		return UL_CURL;
+	}
+	(*client)->session->max_body_size = arguments->max_response_size;
+	(*client)->session->resolve = take_pinned_addresses(resolver);
+	// Lookups still running are collected when a request is sent to the
+	// server, or left to libcurl.
+	(*client)->resolver = resolver;
+	add_preresolved((*client)->session, collect_lookups(resolver));
+
+	return UL_OK;
+}
+
+enum unlocked_err dispatch_key_client(struct key_client *client, int timeout)
+{
+	enum unlocked_err err = UL_OK;
 
-		return UL_ERR;
+	// Jobs finished outside of the event loop are reaped without waiting
+	// for further events.
+	if (reap_jobs(client)) {
+		return UL_OK;
 	}
-	validate_content_type(response);
-	request_id = get_request_id(response);
-	free_response(response);
+	err = dispatch_events(client->session->loop, timeout);
+	reap_jobs(client);
 
-	request.url = get_show_request_url(arguments->host, request_id);
-	if (NULL == request.url) {
-		free(request.url);
+	return err;
+}
 
+enum unlocked_err fetch_key(struct key_client *client, const char *handle,
+			    void (*done)(void *data, enum unlocked_err err,
+					 char *key), void *data)
+{
+	const struct arguments *arguments = client->arguments;
+	enum unlocked_err err = UL_OK;
+	struct key_job *job = calloc(1, sizeof(struct key_job));
+
+	if (NULL == job) {
 		return UL_MALLOC;
 	}
-	do {
-		if (request_state) {
-			free(request_state);
-			request_state = NULL;
-			// Add a sane delay until the next request.
-			sleep(1);
-		}
-		response = create_response();
-		https_hmac_GET(&request, response);
-		request_state = get_request_state(response);
-		free_response(response);
-		response = NULL;
-	} while (request_state && 0 == strcmp(request_state, "PENDING"));
-	free(request.url);
-	request.url = NULL;
-	if (NULL == request_state) {
-		logger(LOG_ERROR, "Could not determine state of request %d\n",
-		       request_id);
-		cleanup_https_client();
+	job->handle = strdup(handle);
+	if (NULL == job->handle) {
+		free(job);
 
-		return UL_ERR;
+		return UL_MALLOC;
+	}
+	init_backoff(&(job->backoff), arguments->poll_interval,
+		     arguments->poll_multiplier, arguments->poll_max_interval,
+		     no != arguments->poll_jitter);
+	job->client = client;
+	job->data = data;
+	job->done = done;
+	job->hedge_delay = arguments->hedge_delay;
+	job->hosts = client->hosts;
+	job->host_count = client->host_count;
+	if (yes == arguments->long_poll) {
+		job->long_poll_timeout = arguments->long_poll_timeout;
 	}
-	if (0 == strcmp(request_state, "DENIED")) {
-		free(request_state);
+	job->request.secret = arguments->secret;
+	job->request.skip_validation = no == arguments->validate;
+	job->request.username = arguments->username;
+	job->session = client->session;
+	job->hedge_timer.source.fd = -1;
+	err = init_timer(client->session->loop, &(job->timer),
+			 handle_poll_timer, job);
+	if (UL_OK == err) {
+		err = init_timer(client->session->loop, &(job->hedge_timer),
+				 handle_hedge_timer, job);
+	}
+	if (UL_OK != err) {
+		free_job(job);
 
-		return UL_DENIED;
+		return err;
 	}
-	if (strcmp(request_state, "ACCEPTED")) {
-		logger(LOG_ERROR, "Unexpected state for request %d: \"%s\"\n",
-		       request_id, request_state);
-		free(request_state);
+	job->next = client->jobs;
+	client->jobs = job;
+	client->fetches++;
+	job->track = client->fetches;
+	trace_name_track(job->track, "key ", handle);
+	start_job(job);
+
+	return UL_OK;
+}
 
-		return UL_ERR;
+void free_key_client(struct key_client *client)
+{
+	struct key_job *job = NULL;
+	struct Session *session = client->session;
+
+	while ((job = client->jobs)) {
+		client->jobs = job->next;
+		if (JOB_DONE != job->state) {
+			https_hmac_cancel(session, &(job->exchange));
+			free_response(job->exchange.response);
+			job->exchange.response = NULL;
+			finish_job(job, UL_ERR);
+		}
+		client->polls += job->backoff.polls;
+		free_job(job);
 	}
-	free(request_state);
-	response = create_response();
-	request.body = "{\"state\": \"FULFILLED\"}";
-	request.url = get_show_request_url(arguments->host, request_id);
-	if (NULL == request.url) {
-		return UL_MALLOC;
+	if (UL_OK != store_host_latencies(client->hosts, client->host_count)) {
+		logger(LOG_DEBUG, "Could not store the latencies of the "
+		       "servers\n");
+	}
+	logger(LOG_DEBUG, "Polled the state of %zu request(s) %lu time(s)\n",
+	       client->fetches, client->polls);
+	logger(LOG_DEBUG, "Opened %ld connection(s) for %ld request(s), "
+	       "resumed %ld of %ld TLS session(s)\n", session->connections,
+	       session->requests, session->resumptions, session->handshakes);
+	if (client->arguments->metrics_file) {
+		write_key_client_metrics(client);
+	}
+#ifdef UNLOCKED_ALLOC_STATS
+	if (ul_debug()) {
+		print_alloc_stats(stdout);
+	}
+#endif
+	if (TIMINGS_TEXT == client->arguments->timings) {
+		print_timings(stderr, &(client->timings));
+	} else if (TIMINGS_JSON == client->arguments->timings) {
+		print_timings_json(stderr, &(client->timings));
 	}
-	https_hmac_PATCH(&request, response);
-	free(request.url);
+	free_session(session);
 	cleanup_https_client();
-	key = strdup(response->body);
-	free_response(response);
-	if (NULL == key) {
+	free_hosts(client->hosts, client->host_count);
+	free(client);
+}
+
+struct event_loop *get_key_client_loop(struct key_client *client)
+{
+	return client->session->loop;
+}
+
+enum unlocked_err request_key(struct arguments *arguments,
+			      struct resolver *resolver)
+{
+	struct key_client *client = NULL;
+	size_t count = arguments->key_count ? arguments->key_count : 1;
+	enum unlocked_err err = UL_OK;
+	const char *handle = NULL;
+	long long begin = 0;
+	struct key_result *results = NULL;
+
+	results = calloc(count, sizeof(struct key_result));
+	if (NULL == results) {
 		return UL_MALLOC;
 	}
-	// Override the newline character at the end of the key with a null
-	// terminator.
-	key[strlen(key) - 1] = '\0';
-	err = handle_success(key);
-	free(key);
+	err = create_key_client(arguments, resolver, &client);
+	if (UL_OK != err) {
+		free(results);
+
+		return err;
+	}
+	for (size_t i = 0; i < count; i++) {
+		handle = arguments->key_handle;
+		if (arguments->key_count) {
+			handle = arguments->keys[i].key_handle;
+			results[i].name = arguments->keys[i].name;
+		}
+		results[i].err = fetch_key(client, handle, store_key,
+					   &(results[i]));
+	}
+	while (UL_OK == err && count_key_fetches(client)) {
+		err = dispatch_key_client(client, -1);
+	}
+	if (UL_OK == err) {
+		begin = trace_now();
+		err = deliver_keys(results, count);
+		trace_span(TRACE_MAIN, "deliver_keys", begin);
+	}
+	free_key_client(client);
+	for (size_t i = 0; i < count; i++) {
+		free_locked(results[i].key, results[i].key_len + 1);
+	}
+	free(results);
+
+	return err;
+}
+
+/**
+ * Add the time spent in the current phase of a job to the timings of the
+ * client and start the next phase.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void close_phase(struct key_job *job)
+{
+	add_phase_elapsed(&(job->client->timings), get_job_phase(job->state),
+			  &(job->phase_started));
+	clock_gettime(CLOCK_MONOTONIC, &(job->phase_started));
+}
+
+/**
+ * Count the requests for access to a key, that are still running.
+ *
+ * @param job is the negotiation of the key.
+ *
+ * @return the number of running requests.
+ */
+static size_t count_running_attempts(struct key_job *job)
+{
+	size_t running = 0;
+
+	for (size_t i = 0; i < job->attempt_count; i++) {
+		if (job->attempts[i].exchange.curl) {
+			running++;
+		}
+	}
+
+	return running;
+}
+
+/**
+ * Provision the received keys to the modules.
+ *
+ * @param results are the outcomes of the requests for the keys.
+ * @param count is the number of keys.
+ *
+ * @return the first error of any request or from the modules.
+ */
+static enum unlocked_err deliver_keys(struct key_result *results,
+				      size_t count)
+{
+	enum unlocked_err err = UL_OK;
+	enum unlocked_err job_err = UL_OK;
+
+	for (size_t i = 0; i < count; i++) {
+		job_err = results[i].err;
+		if (UL_OK == job_err) {
+			job_err = handle_key_success(results[i].name,
+						     results[i].key);
+		}
+		if (UL_OK != job_err && results[i].name) {
+			logger(LOG_ERROR, "Could not provide the key \"%s\": "
+			       "%s\n", results[i].name, ul_error(job_err));
+		}
+		if (UL_OK == err) {
+			err = job_err;
+		}
+	}
 
 	return err;
 }
 
+/**
+ * Finish the negotiation of a key.
+ *
+ * @param job is the negotiation of the key.
+ * @param err is any error that occured.
+ */
+static void finish_job(struct key_job *job, enum unlocked_err err)
+{
+	close_phase(job);
+	record_unlock(&(job->client->metrics), err, &(job->started));
+	if (JOB_CREATING == job->state) {
+		free_attempts(job);
+		free(job->request.body);
+		job->request.body = NULL;
+	}
+	job->err = err;
+	job->state = JOB_DONE;
+}
+
+/**
+ * Cancel the running requests for access to a key and free all of them.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void free_attempts(struct key_job *job)
+{
+	if (NULL == job->attempts) {
+		return;
+	}
+	for (size_t i = 0; i < job->attempt_count; i++) {
+		https_hmac_cancel(job->session, &(job->attempts[i].exchange));
+		free_response(job->attempts[i].exchange.response);
+		free(job->attempts[i].url);
+	}
+	free(job->attempts);
+	job->attempts = NULL;
+	job->attempt_count = 0;
+	arm_timer(&(job->hedge_timer), -1);
+}
+
+/**
+ * Free all resources of a job.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void free_job(struct key_job *job)
+{
+	struct event_loop *loop = job->client->session->loop;
+
+	free_timer(loop, &(job->hedge_timer));
+	free_timer(loop, &(job->timer));
+	free_arena(&(job->arena));
+	free(job->handle);
+	free_response(job->poll_response);
+	free(job->stream_url);
+	free(job->url);
+	free(job);
+}
+
+/**
+ * Get the phase the allocations of a job are attributed to.
+ *
+ * @param state is the state of the job.
+ *
+ * @return the phase.
+ */
+static enum alloc_phase get_job_alloc_phase(enum job_state state)
+{
+	switch (state) {
+	case JOB_CREATING:
+		return ALLOC_CREATE;
+	case JOB_FULFILLING:
+		return ALLOC_FULFIL;
+	case JOB_DONE:
+		return ALLOC_OTHER;
+	default:
+		return ALLOC_POLL;
+	}
+}
+
+/**
+ * Get the phase of the negotiation of a key a job is in.
+ *
+ * @param state is the state of the job.
+ *
+ * @return the phase.
+ */
+static enum request_phase get_job_phase(enum job_state state)
+{
+	switch (state) {
+	case JOB_CREATING:
+		return PHASE_CREATE;
+	case JOB_FULFILLING:
+		return PHASE_FULFIL;
+	default:
+		return PHASE_POLL;
+	}
+}
+
+/**
+ * Get the name of the requests performed in a state of a job.
+ *
+ * @param state is the state of the job.
+ *
+ * @return the name.
+ */
+static const char *get_job_state_name(enum job_state state)
+{
+	switch (state) {
+	case JOB_CREATING:
+		return "create";
+	case JOB_STREAMING:
+		return "stream";
+	case JOB_POLLING:
+		return "poll";
+	case JOB_FULFILLING:
+		return "fulfil";
+	default:
+		return "request";
+	}
+}
+
 /**
  * Get the body of the json request used to request access to a key.
  *
@@ -221,102 +800,51 @@ static char *get_key_request_url(const char *const host)
  */
 static int get_request_id(struct Response *response)
 {
-	cJSON *body_json = NULL, *id_elem = NULL;
-	int id = 0;
+	struct json_field id = {
+		.name = "id",
+		.type = JSON_FIELD_NUMBER,
+	};
 
-	if (NULL == response) {
-		return id;
+	if (NULL == response || NULL == response->body) {
+		return 0;
 	}
-
-	body_json = cJSON_Parse(response->body);
-	if (NULL == body_json) {
-		const char *error_ptr = cJSON_GetErrorPtr();
-		if (error_ptr != NULL) {
-			logger(LOG_ERROR, "Error before: %s\n", error_ptr);
-
-			return id;
-		}
+	if (UL_OK != scan_json_object(response->body, response->body_len,
+				      &id, 1)) {
 		logger(LOG_ERROR, "Error parsing response json\n");
 
-		return id;
+		return 0;
 	}
-	id_elem = cJSON_GetObjectItemCaseSensitive(body_json, "id");
-	if (NULL == id_elem) {
+	if (JSON_FIELD_MISSING == id.status) {
 		logger(LOG_ERROR, "Key \"id\" not found\n");
-		cJSON_Delete(body_json);
 
-		return id;
+		return 0;
 	}
-
-	if (0 == cJSON_IsNumber(id_elem)) {
+	if (JSON_FIELD_INVALID == id.status) {
 		logger(LOG_ERROR, "Value of key \"id\" is not numeric\n");
-		cJSON_Delete(body_json);
 
-		return id;
+		return 0;
 	}
-	id = id_elem->valuedouble;
-	cJSON_Delete(body_json);
 
-	return id;
+	return id.number;
 }
 
 /**
- * Extract the id of the new request for a key from a
- * response from the server.
+ * Extract the state of the request for a key from a response from the
+ * server.
  *
  * @param response the response with the serialized request.
+ * @param state is the storage for the state of the request.
  *
- * @return a pointer to a string withthe request state, that must be freed after
- *         use or NULL on failure.
+ * @return zero on success or a non zero value on failure.
  */
-static char *get_request_state(struct Response *response)
+static int get_request_state(struct Response *response,
+			     char state[REQUEST_STATE_SIZE])
 {
-	cJSON *body_json = NULL, *state_elem = NULL;
-	char *state = NULL;
-	size_t state_len = 0;
-
-	if (NULL == response) {
-		return state;
+	if (NULL == response || NULL == response->body) {
+		return -1;
 	}
 
-	body_json = cJSON_Parse(response->body);
-	if (NULL == body_json) {
-		const char *error_ptr = cJSON_GetErrorPtr();
-		if (error_ptr != NULL) {
-			logger(LOG_ERROR, "Error before: %s\n", error_ptr);
-
-			return state;
-		}
-		logger(LOG_ERROR, "Error parsing response json\n");
-
-		return state;
-	}
-	state_elem = cJSON_GetObjectItemCaseSensitive(body_json, "state");
-	if (NULL == state_elem) {
-		logger(LOG_ERROR, "Key \"state\" not found\n");
-		cJSON_Delete(body_json);
-
-		return state;
-	}
-
-	if (0 == cJSON_IsString(state_elem) || NULL == state_elem->valuestring) {
-		logger(LOG_ERROR, "Value of key \"state\" is not a string\n");
-		cJSON_Delete(body_json);
-
-		return state;
-	}
-	state_len = strlen(state_elem->valuestring);
-	state = malloc(state_len + 1);
-	if (NULL == state) {
-		cJSON_Delete(body_json);
-
-		return state;
-	}
-	memcpy(state, state_elem->valuestring, state_len);
-	state[state_len] = '\0';
-	cJSON_Delete(body_json);
-
-	return state;
+	return parse_request_state(response->body, response->body_len, state);
 }
 
 /**
@@ -348,6 +876,605 @@ static char *get_show_request_url(const char *const host, int id)
 	return url;
 }
 
+/**
+ * Get the url for the endpoint used to stream the state of a request.
+ *
+ * @param url is the url of the request.
+ * @param timeout is the time in seconds the server may hold the request.
+ *
+ * @return the url or NULL on failure. This value must be freed after use.
+ */
+static char *get_stream_url(const char *const url, long timeout)
+{
+	static const char *const fmt = "%s?wait=%ld";
+	char *stream_url = NULL;
+	long url_len = 0;
+
+	url_len = snprintf(NULL, 0, fmt, url, timeout);
+	stream_url = malloc(url_len + 1);
+	if (NULL == stream_url) {
+		return NULL;
+	}
+	if (0 > snprintf(stream_url, url_len + 1, fmt, url, timeout)) {
+		free(stream_url);
+
+		return NULL;
+	}
+
+	return stream_url;
+}
+
+/**
+ * Completion callback for the requests for access to a key, which decides the
+ * race between the servers.
+ *
+ * @param exchange is the finished request.
+ */
+static void handle_attempt(struct Exchange *exchange)
+{
+	struct host_attempt *attempt = exchange->data;
+	struct timespec now = { 0 };
+	struct key_job *job = attempt->job;
+	long latency = 0;
+	struct Response *response = exchange->response;
+
+	set_alloc_phase(ALLOC_CREATE);
+	exchange->response = NULL;
+	add_request_timings(&(job->client->timings), PHASE_CREATE,
+			    &(response->timings));
+	trace_request(job->track, attempt->host->name, &(response->timings));
+	if (UL_OK != exchange->err || 201 != response->status) {
+		handle_attempt_failure(attempt, response, exchange->err);
+
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	latency = (now.tv_sec - attempt->started.tv_sec) * 1000
+		+ (now.tv_nsec - attempt->started.tv_nsec) / 1000000;
+	record_host_latency(attempt->host, latency);
+	logger(LOG_DEBUG, "The host \"%s\" created the request after %ld "
+	       "ms\n", attempt->host->name, latency);
+	job->host = attempt->host->name;
+	job->request.port = attempt->host->port;
+	free_attempts(job);
+	handle_created(job, response, UL_OK);
+}
+
+/**
+ * Handle a failed request for access to a key.
+ *
+ * The request is sent to the next server right away. Once all servers failed,
+ * the job finishes with the failure of the last one.
+ *
+ * @param attempt is the failed request.
+ * @param response is the response of the server or NULL if the request could
+ *                 not be started.
+ * @param err is any error that occured while performing the request.
+ */
+static void handle_attempt_failure(struct host_attempt *attempt,
+				   struct Response *response,
+				   enum unlocked_err err)
+{
+	struct key_job *job = attempt->job;
+
+	record_host_failure(attempt->host);
+	if (job->attempt_count < job->host_count) {
+		logger(LOG_DEBUG, "Requesting the key from the host \"%s\" "
+		       "failed, trying the next one\n", attempt->host->name);
+		job->client->metrics.retries++;
+		free_response(response);
+		start_attempt(job);
+
+		return;
+	}
+	if (count_running_attempts(job)) {
+		free_response(response);
+
+		return;
+	}
+	if (NULL == response) {
+		finish_job(job, err);
+
+		return;
+	}
+	handle_created(job, response, err);
+}
+
+/**
+ * Handle the response to the request for access to a key.
+ *
+ * @param job is the negotiation of the key.
+ * @param response is the response of the server.
+ * @param err is any error that occured while performing the request.
+ */
+static void handle_created(struct key_job *job, struct Response *response,
+			   enum unlocked_err err)
+{
+	free(job->request.body);
+	job->request.body = NULL;
+	switch (response->status) {
+	case 201:
+		// Expected response status, continue
+		break;
+	case 401:
+		// Authentication failed
+		logger(LOG_ERROR,
+		       "Authentication against the server failed. "
+		       "Maybe the user or secret are incorrect?\n");
+		free_response(response);
+		finish_job(job, UL_ERR);
+
+		return;
+	default:
+		logger(LOG_ERROR,
+		       "Communication with the server failed with code %ld.\n",
+		       response->status);
+		free_response(response);
+		finish_job(job, UL_ERR);
+
+		return;
+	}
+	validate_content_type(response);
+	job->request_id = get_request_id(response);
+	free_response(response);
+	free(job->url);
+	job->url = get_show_request_url(job->host, job->request_id);
+	job->request.url = job->url;
+	if (NULL == job->url) {
+		finish_job(job, UL_MALLOC);
+
+		return;
+	}
+	close_phase(job);
+	if (job->long_poll_timeout) {
+		job->stream_url = get_stream_url(job->url,
+						 job->long_poll_timeout);
+	}
+	if (job->stream_url) {
+		start_stream(job);
+	} else {
+		poll_request_state(job);
+	}
+}
+
+/**
+ * Handle the response to marking a request as fulfilled, which contains the
+ * key.
+ *
+ * @param job is the negotiation of the key.
+ * @param response is the response of the server.
+ * @param err is any error that occured while performing the request.
+ */
+static void handle_fulfilled(struct key_job *job, struct Response *response,
+			     enum unlocked_err err)
+{
+	size_t key_len = 0;
+
+	job->request.body = NULL;
+	if (UL_OK != err || NULL == response->body) {
+		free_response(response);
+		finish_job(job, UL_OK == err ? UL_ERR : err);
+
+		return;
+	}
+	// The job takes the body of the response instead of copying the key.
+	job->key = response->body;
+	key_len = response->body_len;
+	response->body = NULL;
+	free_response(response);
+	// Override the newline character appended to the body with a null
+	// terminator.
+	job->key[key_len] = '\0';
+	finish_job(job, UL_OK);
+}
+
+/**
+ * Send the request for access to the key to the next server after the hedge
+ * delay expired without an answer.
+ *
+ * @param data is the negotiation of the key.
+ */
+static void handle_hedge_timer(void *data)
+{
+	struct key_job *job = data;
+
+	if (JOB_CREATING != job->state
+	    || job->attempt_count >= job->host_count) {
+		return;
+	}
+	logger(LOG_DEBUG, "No answer after %ld ms, also asking the next "
+	       "host\n", job->hedge_delay);
+	start_attempt(job);
+}
+
+/**
+ * Poll the request state after the timer of the job expired.
+ *
+ * @param data is the negotiation of the key.
+ */
+static void handle_poll_timer(void *data)
+{
+	struct key_job *job = data;
+
+	if (JOB_WAITING != job->state) {
+		return;
+	}
+	trace_span(job->track, "sleep", job->sleep_started);
+	if (job->stream_url) {
+		start_stream(job);
+	} else {
+		poll_request_state(job);
+	}
+}
+
+/**
+ * Handle the response to a poll of the request state.
+ *
+ * @param job is the negotiation of the key.
+ * @param response is the response of the server.
+ * @param err is any error that occured while performing the request.
+ */
+static void handle_polled(struct key_job *job, struct Response *response,
+			  enum unlocked_err err)
+{
+	int result = get_request_state(response, job->request_state);
+
+	// The response is reused for the next poll.
+	reset_response(response);
+	job->poll_response = response;
+	if (0 != result) {
+		logger(LOG_ERROR, "Could not determine state of request %d\n",
+		       job->request_id);
+		finish_job(job, UL_ERR);
+
+		return;
+	}
+	if (strcmp(job->request_state, "PENDING")) {
+		handle_request_state(job);
+
+		return;
+	}
+	wait_for_poll(job);
+}
+
+/**
+ * Act on a request state other than "PENDING".
+ *
+ * @param job is the negotiation of the key.
+ */
+static void handle_request_state(struct key_job *job)
+{
+	enum unlocked_err err = UL_OK;
+
+	if (0 == strcmp(job->request_state, "DENIED")) {
+		finish_job(job, UL_DENIED);
+
+		return;
+	}
+	if (strcmp(job->request_state, "ACCEPTED")) {
+		logger(LOG_ERROR, "Unexpected state for request %d: \"%s\"\n",
+		       job->request_id, job->request_state);
+		finish_job(job, UL_ERR);
+
+		return;
+	}
+	close_phase(job);
+	set_alloc_phase(ALLOC_FULFIL);
+	// Every job has its own arena, so that overlapping fetches of the
+	// agent do not exhaust the memory of each other.
+	err = init_arena(&(job->arena), KEY_ARENA_SIZE);
+	if (UL_OK != err) {
+		finish_job(job, err);
+
+		return;
+	}
+	job->state = JOB_FULFILLING;
+	job->request.body = "{\"state\": \"FULFILLED\"}";
+	job->exchange.response = create_response();
+	if (job->exchange.response) {
+		job->exchange.response->arena = &(job->arena);
+	}
+	send_request(job, HTTP_PATCH);
+}
+
+/**
+ * Completion callback for all requests of a job, which advances the job to
+ * its next step.
+ *
+ * @param exchange is the finished request.
+ */
+static void handle_response(struct Exchange *exchange)
+{
+	struct key_job *job = exchange->data;
+	struct Response *response = exchange->response;
+
+	set_alloc_phase(get_job_alloc_phase(job->state));
+	exchange->response = NULL;
+	add_request_timings(&(job->client->timings),
+			    get_job_phase(job->state), &(response->timings));
+	trace_request(job->track, get_job_state_name(job->state),
+		      &(response->timings));
+	switch (job->state) {
+	case JOB_STREAMING:
+		handle_streamed(job, response, exchange->err);
+		break;
+	case JOB_POLLING:
+		handle_polled(job, response, exchange->err);
+		break;
+	case JOB_FULFILLING:
+		handle_fulfilled(job, response, exchange->err);
+		break;
+	default:
+		free_response(response);
+	}
+}
+
+/**
+ * Handle the end of a stream of request states.
+ *
+ * A stream held open by the server until its timeout is reopened right away,
+ * one that ended early only after the backoff, so a server closing streams
+ * early is not asked in a tight loop. If the server does not stream the
+ * state or any error occured, the job falls back to polling.
+ *
+ * @param job is the negotiation of the key.
+ * @param response is the response of the server.
+ * @param err is any error that occured while performing the request.
+ */
+static void handle_streamed(struct key_job *job, struct Response *response,
+			    enum unlocked_err err)
+{
+	const char *content_type = NULL;
+	struct timespec now = { 0 };
+
+	job->request.accept = NULL;
+	job->request.timeout = 0;
+	job->request.url = job->url;
+	if (UL_OK == err && 200 == response->status) {
+		content_type = get_content_type(response);
+	}
+	if (NULL == content_type
+	    || content_type != strstr(content_type, "text/event-stream")) {
+		logger(LOG_DEBUG, "The server does not stream the state of "
+		       "request %d, falling back to polling\n",
+		       job->request_id);
+		free(job->stream_url);
+		job->stream_url = NULL;
+		// A plain reply already carries the state of the request.
+		if (content_type
+		    && content_type == strstr(content_type,
+					      "application/json")) {
+			handle_polled(job, response, err);
+
+			return;
+		}
+		free_response(response);
+		poll_request_state(job);
+
+		return;
+	}
+	free_response(response);
+	if (job->stream.state[0] && strcmp(job->stream.state, "PENDING")) {
+		memcpy(job->request_state, job->stream.state,
+		       REQUEST_STATE_SIZE);
+		handle_request_state(job);
+
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (now.tv_sec - job->stream.opened.tv_sec
+	    >= job->long_poll_timeout - LONG_POLL_EARLY) {
+		start_stream(job);
+
+		return;
+	}
+	logger(LOG_DEBUG, "The stream of request %d ended early\n",
+	       job->request_id);
+	wait_for_poll(job);
+}
+
+/**
+ * Poll the state of the request for the key.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void poll_request_state(struct key_job *job)
+{
+	set_alloc_phase(ALLOC_POLL);
+	job->state = JOB_POLLING;
+	start_poll(&(job->backoff));
+	job->exchange.response = job->poll_response ? job->poll_response :
+	    create_response();
+	job->poll_response = NULL;
+	send_request(job, HTTP_GET);
+}
+
+/**
+ * Start the next request of a job.
+ *
+ * The response of the exchange must be created before. The job finishes with
+ * an error if the request cannot be started.
+ *
+ * @param job is the negotiation of the key.
+ * @param method is the HTTP method of the request.
+ */
+static void send_request(struct key_job *job, enum http_method method)
+{
+	if (NULL == job->exchange.response) {
+		finish_job(job, UL_MALLOC);
+
+		return;
+	}
+	job->exchange.data = job;
+	job->exchange.done = handle_response;
+	job->exchange.method = method;
+	job->exchange.request = &(job->request);
+	if (UL_OK != https_hmac_start(job->session, &(job->exchange))) {
+		free_response(job->exchange.response);
+		job->exchange.response = NULL;
+		finish_job(job, job->exchange.err);
+	}
+}
+
+/**
+ * Invoke the completion callbacks of the finished jobs and free them.
+ *
+ * @param client is the client with the jobs.
+ *
+ * @return the number of reaped jobs.
+ */
+static size_t reap_jobs(struct key_client *client)
+{
+	struct key_job *done = NULL;
+	struct key_job *job = NULL;
+	struct key_job **link = &(client->jobs);
+	size_t reaped = 0;
+
+	// The finished jobs are unlinked first, because the callbacks may
+	// fetch further keys.
+	while ((job = *link)) {
+		if (JOB_DONE == job->state) {
+			*link = job->next;
+			job->next = done;
+			done = job;
+		} else {
+			link = &(job->next);
+		}
+	}
+	if (done) {
+		set_alloc_phase(ALLOC_OTHER);
+	}
+	while ((job = done)) {
+		done = job->next;
+		client->polls += job->backoff.polls;
+		job->done(job->data, job->err, job->key);
+		free_job(job);
+		reaped++;
+	}
+
+	return reaped;
+}
+
+/**
+ * Send the request for access to the key to the next server.
+ *
+ * Unless it is the last server, the hedge timer is armed to ask the following
+ * one if this request takes too long.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void start_attempt(struct key_job *job)
+{
+	struct host_attempt *attempt = &(job->attempts[job->attempt_count]);
+	enum unlocked_err err = UL_MALLOC;
+
+	set_alloc_phase(ALLOC_CREATE);
+	add_preresolved(job->session, collect_lookups(job->client->resolver));
+	job->attempt_count++;
+	attempt->job = job;
+	attempt->host = &(job->hosts[job->attempt_count - 1]);
+	logger(LOG_DEBUG, "Requesting the key \"%s\" from the host \"%s\" "
+	       "on port %ld\n", job->handle, attempt->host->name,
+	       attempt->host->port);
+	attempt->request = job->request;
+	attempt->request.port = attempt->host->port;
+	attempt->url = get_key_request_url(attempt->host->name);
+	attempt->request.url = attempt->url;
+	attempt->exchange.data = attempt;
+	attempt->exchange.done = handle_attempt;
+	attempt->exchange.method = HTTP_POST;
+	attempt->exchange.request = &(attempt->request);
+	attempt->exchange.response = create_response();
+	clock_gettime(CLOCK_MONOTONIC, &(attempt->started));
+	if (attempt->url && attempt->exchange.response) {
+		err = https_hmac_start(job->session, &(attempt->exchange));
+	}
+	if (UL_OK != err) {
+		free_response(attempt->exchange.response);
+		attempt->exchange.response = NULL;
+		handle_attempt_failure(attempt, NULL, err);
+
+		return;
+	}
+	if (job->attempt_count < job->host_count) {
+		arm_timer(&(job->hedge_timer), job->hedge_delay);
+	}
+}
+
+/**
+ * Start the negotiation of a key by requesting access to it.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void start_job(struct key_job *job)
+{
+	job->state = JOB_CREATING;
+	clock_gettime(CLOCK_MONOTONIC, &(job->started));
+	job->phase_started = job->started;
+	job->request.body = get_key_request_body(job->handle);
+	job->attempts = calloc(job->host_count, sizeof(struct host_attempt));
+	if (NULL == job->request.body || NULL == job->attempts) {
+		finish_job(job, UL_MALLOC);
+
+		return;
+	}
+	start_attempt(job);
+}
+
+/**
+ * Open a stream of the request state.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void start_stream(struct key_job *job)
+{
+	struct Response *response = NULL;
+
+	set_alloc_phase(ALLOC_POLL);
+	response = create_response();
+	job->stream.state[0] = '\0';
+	job->stream.offset = 0;
+	job->stream.events = 0;
+	clock_gettime(CLOCK_MONOTONIC, &(job->stream.opened));
+	if (response) {
+		response->stream_callback = parse_event_stream;
+		response->stream_data = &(job->stream);
+	}
+	job->request.accept = "text/event-stream";
+	job->request.timeout = job->long_poll_timeout + LONG_POLL_GRACE;
+	job->request.url = job->stream_url;
+	job->state = JOB_STREAMING;
+	start_poll(&(job->backoff));
+	job->exchange.response = response;
+	send_request(job, HTTP_GET);
+}
+
+/**
+ * Completion callback storing the outcome of the request for a configured
+ * key.
+ *
+ * @param data is the outcome to populate.
+ * @param err is any error that occured.
+ * @param key is the received key or NULL.
+ */
+static void store_key(void *data, enum unlocked_err err, char *key)
+{
+	struct key_result *result = data;
+
+	result->err = err;
+	if (UL_OK != err) {
+		return;
+	}
+	result->key_len = strlen(key);
+	result->key = alloc_locked(result->key_len + 1);
+	if (NULL == result->key) {
+		result->err = UL_MALLOC;
+
+		return;
+	}
+	memcpy(result->key, key, result->key_len);
+}
+
 /**
  * Log an error when the content type of the response is not
  * "application/json".
@@ -356,7 +1483,7 @@ static char *get_show_request_url(const char *const host, int id)
  */
 static void validate_content_type(struct Response *response)
 {
-	char *content_type = NULL;
+	const char *content_type = NULL;
 
 	if (NULL == response) {
 		return;
@@ -374,6 +1501,48 @@ static void validate_content_type(struct Response *response)
 			       ", got \"%s\"\n", content_type);
 		}
 	}
+}
 
-	free(content_type);
+/**
+ * Write the metrics of all negotiations of a client to the configured file.
+ *
+ * @param client is the client.
+ */
+static void write_key_client_metrics(struct key_client *client)
+{
+	struct unlock_metrics *metrics = &(client->metrics);
+	struct Session *session = client->session;
+	enum unlocked_err err = UL_OK;
+
+	metrics->polls = client->polls;
+	metrics->connections = session->connections;
+	metrics->resumptions = session->resumptions;
+	metrics->bytes_in = session->bytes_in;
+	metrics->bytes_out = session->bytes_out;
+	err = write_metrics(client->arguments->metrics_file, metrics);
+	if (UL_OK != err) {
+		logger(LOG_ERROR, "Could not write the metrics to %s: %s\n",
+		       client->arguments->metrics_file, ul_error(err));
+	}
+}
+
+/**
+ * Wait for the next poll of a pending request according to the backoff.
+ *
+ * Once the timer expires, the state is polled or streamed again.
+ *
+ * @param job is the negotiation of the key.
+ */
+static void wait_for_poll(struct key_job *job)
+{
+	struct timespec deadline = { 0 };
+	enum unlocked_err err = UL_OK;
+
+	job->state = JOB_WAITING;
+	job->sleep_started = trace_now();
+	get_next_poll(&(job->backoff), &deadline);
+	err = arm_timer_at(&(job->timer), &deadline);
+	if (UL_OK != err) {
+		finish_job(job, err);
+	}
 }
@@ -20,8 +20,11 @@
 #ifndef UNLOCKED_CLIENT_H
 #define UNLOCKED_CLIENT_H
 
+#include <stddef.h>
 #include "cli.h"
 #include "error.h"
+#include "event-loop.h"
+#include "resolver.h"
 
 /**
  *
@@ -29,9 +32,106 @@
 enum unlocked_err init_client();
 
 /**
+ * Negotiates keys with the servers over a single session.
+ */
+struct key_client;
+
+/**
+ * Count the requests for keys, that have not been completed yet.
+ *
+ * @param client is the client.
+ *
+ * @return the number of pending requests.
+ */
+size_t count_key_fetches(struct key_client *client);
+
+/**
+ * Count the polls and streaming requests of the request states of all keys
+ * requested so far.
+ *
+ * @param client is the client.
+ *
+ * @return the number of polls.
+ */
+unsigned long count_key_polls(struct key_client *client);
+
+/**
+ * Create a client for requesting keys from the configured servers.
+ *
+ * @param arguments is the configuration of the client. It must stay valid
+ *                  until the client is freed.
+ * @param resolver is the resolver looking up the servers ahead of time or
+ *                 NULL. It must stay valid until the client is freed.
+ * @param client is set to the new client, that must be freed with
+ *               `free_key_client` after use.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err create_key_client(const struct arguments *arguments,
+				    struct resolver *resolver,
+				    struct key_client **client);
+
+/**
+ * Wait for events of the client and dispatch them.
+ *
+ * The completion callbacks of finished requests are invoked from here.
+ *
+ * @param client is the client.
+ * @param timeout is the maximum time to wait in milliseconds or -1 to wait
+ *                until any event occurs.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err dispatch_key_client(struct key_client *client, int timeout);
+
+/**
+ * Start to request a key from the servers.
+ *
+ * @param client is the client.
+ * @param handle is the handle of the key.
+ * @param done is called from `dispatch_key_client` after the request
+ *             finished with the key, which is NULL on failure. The key is
+ *             kept in locked memory, that is wiped after `done` returned.
+ * @param data is passed to `done`.
+ *
+ * @return any error that prevented the request from being started. In this
+ *         case the completion callback is not invoked.
+ */
+enum unlocked_err fetch_key(struct key_client *client, const char *handle,
+			    void (*done)(void *data, enum unlocked_err err,
+					 char *key), void *data);
+
+/**
+ * Cancel all pending requests and free the client.
+ *
+ * The completion callbacks of cancelled requests are not invoked.
+ *
+ * @param client is the client to free.
+ */
+void free_key_client(struct key_client *client);
+
+/**
+ * Get the event loop of a client, which allows to dispatch further event
+ * sources with `dispatch_key_client`.
+ *
+ * @param client is the client.
+ *
+ * @return the event loop of the client.
+ */
+struct event_loop *get_key_client_loop(struct key_client *client);
+
+/**
+ * Request the configured keys from the servers and provide them to the
+ * modules.
+ *
+ * @param arguments is the configuration of the client.
+ * @param resolver is the resolver looking up the servers ahead of time or
+ *                 NULL. It is finished before the first request.
  *
+ * @return any error that occured.
  */
-enum unlocked_err request_key(struct arguments *arguments);
+enum unlocked_err request_key(struct arguments *arguments,
+			      struct resolver *resolver);
 
 enum unlocked_err cleanup_client();
 
@@ -31,8 +31,6 @@ static const char *ERR_SD_SOCKET_DISABLED = "SD_SOCKET is not active, but at "
 	"least one file descriptor was passed to the program\n";
 static const char *ERR_SD_SOCKET_NO_FD = "SD_SOCKET is active, but no file "
 	"descriptor was passed to the program\n";
-static const char *ERR_SD_SOCKET_MANY_FD = "SD_SOCKET is active and more than "
-	"one file descriptor was passed to the program\n";
 static const char *ERR_UNKNOWN = "Unknomn error\n";
 
 const char *ul_error(enum unlocked_err err)
@@ -54,8 +52,6 @@ const char *ul_error(enum unlocked_err err)
 		return ERR_SD_SOCKET_DISABLED;
 	case UL_SD_SOCKET_NO_FD:
 		return ERR_SD_SOCKET_NO_FD;
-	case UL_SD_SOCKET_MANY_FD:
-		return ERR_SD_SOCKET_MANY_FD;
 	default:
 		return ERR_UNKNOWN;
 	}
@@ -29,7 +29,6 @@ enum unlocked_err {
 	UL_MALLOC,
 	UL_SD_SOCKET_DISABLED,
 	UL_SD_SOCKET_NO_FD,
-	UL_SD_SOCKET_MANY_FD,
 };
 
 /**
@@ -0,0 +1,257 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "event-loop.h"
+
+/**
+ * The maximum number of events dispatched after a single wait.
+ */
+#define MAX_EVENTS 16
+
+static int is_retired(struct event_loop *loop, struct event_source *source);
+static void release_retired(struct event_loop *loop);
+static void timer_handler(struct event_source *source, uint32_t events);
+
+enum unlocked_err arm_timer(struct timer *timer, long delay)
+{
+	struct itimerspec spec = { 0 };
+
+	if (delay > 0) {
+		spec.it_value.tv_sec = delay / 1000;
+		spec.it_value.tv_nsec = (delay % 1000) * 1000000;
+	} else if (0 == delay) {
+		// A zero value would disarm the timer.
+		spec.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(timer->source.fd, 0, &spec, NULL)) {
+		return UL_ERRNO;
+	}
+
+	return UL_OK;
+}
+
+enum unlocked_err arm_timer_at(struct timer *timer,
+			       const struct timespec *deadline)
+{
+	struct itimerspec spec = { 0 };
+
+	spec.it_value = *deadline;
+	if (0 == spec.it_value.tv_sec && 0 == spec.it_value.tv_nsec) {
+		spec.it_value.tv_nsec = 1;
+	}
+	if (timerfd_settime(timer->source.fd, TFD_TIMER_ABSTIME, &spec, NULL)) {
+		return UL_ERRNO;
+	}
+
+	return UL_OK;
+}
+
+struct event_loop *create_event_loop(void)
+{
+	struct event_loop *loop = malloc(sizeof(struct event_loop));
+	if (NULL == loop) {
+		return NULL;
+	}
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (loop->epoll_fd < 0) {
+		free(loop);
+
+		return NULL;
+	}
+	loop->dispatching = 0;
+	loop->retired = NULL;
+	loop->retired_count = 0;
+	loop->retired_size = 0;
+
+	return loop;
+}
+
+enum unlocked_err dispatch_events(struct event_loop *loop, int timeout)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int count = epoll_wait(loop->epoll_fd, events, MAX_EVENTS, timeout);
+	struct event_source *source = NULL;
+
+	if (count < 0) {
+		return EINTR == errno ? UL_OK : UL_ERRNO;
+	}
+	loop->dispatching = 1;
+	for (int i = 0; i < count; i++) {
+		source = events[i].data.ptr;
+		if (is_retired(loop, source)) {
+			continue;
+		}
+		source->handle(source, events[i].events);
+	}
+	loop->dispatching = 0;
+	release_retired(loop);
+
+	return UL_OK;
+}
+
+void free_event_loop(struct event_loop *loop)
+{
+	if (NULL == loop) {
+		return;
+	}
+	close(loop->epoll_fd);
+	free(loop->retired);
+	free(loop);
+}
+
+void free_timer(struct event_loop *loop, struct timer *timer)
+{
+	if (timer->source.fd < 0) {
+		return;
+	}
+	unwatch_fd(loop, &(timer->source));
+	close(timer->source.fd);
+	timer->source.fd = -1;
+}
+
+enum unlocked_err init_timer(struct event_loop *loop, struct timer *timer,
+			     void (*fire)(void *data), void *data)
+{
+	enum unlocked_err err = UL_OK;
+
+	timer->data = data;
+	timer->fire = fire;
+	timer->source.data = timer;
+	timer->source.handle = timer_handler;
+	timer->source.release = NULL;
+	timer->source.fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer->source.fd < 0) {
+		return UL_ERRNO;
+	}
+	err = watch_fd(loop, &(timer->source), EPOLLIN);
+	if (UL_OK != err) {
+		close(timer->source.fd);
+		timer->source.fd = -1;
+	}
+
+	return err;
+}
+
+void unwatch_fd(struct event_loop *loop, struct event_source *source)
+{
+	struct retired_source *retired = NULL;
+
+	epoll_ctl(loop->epoll_fd, EPOLL_CTL_DEL, source->fd, NULL);
+	if (!loop->dispatching) {
+		if (source->release) {
+			source->release(source);
+		}
+
+		return;
+	}
+	if (loop->retired_count == loop->retired_size) {
+		retired = realloc(loop->retired, sizeof(struct retired_source)
+				  * (loop->retired_size + MAX_EVENTS));
+		if (NULL == retired) {
+			// Without memory the source is leaked instead of
+			// risking a pending event for a freed source.
+			return;
+		}
+		loop->retired = retired;
+		loop->retired_size += MAX_EVENTS;
+	}
+	loop->retired[loop->retired_count].source = source;
+	loop->retired[loop->retired_count].release = source->release;
+	loop->retired_count++;
+}
+
+enum unlocked_err watch_fd(struct event_loop *loop,
+			   struct event_source *source, uint32_t events)
+{
+	struct epoll_event event = {
+		.events = events,
+		.data.ptr = source,
+	};
+
+	if (0 == epoll_ctl(loop->epoll_fd, EPOLL_CTL_MOD, source->fd, &event)) {
+		return UL_OK;
+	}
+	if (ENOENT == errno
+	    && 0 == epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, source->fd,
+			      &event)) {
+		return UL_OK;
+	}
+
+	return UL_ERRNO;
+}
+
+/**
+ * Check whether an event source was removed while events are dispatched.
+ *
+ * @param loop is the event loop.
+ * @param source is the event source.
+ *
+ * @return whether the source was removed.
+ */
+static int is_retired(struct event_loop *loop, struct event_source *source)
+{
+	for (size_t i = 0; i < loop->retired_count; i++) {
+		if (loop->retired[i].source == source) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Release all event sources removed while events were dispatched.
+ *
+ * @param loop is the event loop.
+ */
+static void release_retired(struct event_loop *loop)
+{
+	for (size_t i = 0; i < loop->retired_count; i++) {
+		if (loop->retired[i].release) {
+			loop->retired[i].release(loop->retired[i].source);
+		}
+	}
+	loop->retired_count = 0;
+}
+
+/**
+ * Handle the expiry of a timer.
+ *
+ * @param source is the event source of the timer.
+ * @param events are the epoll events that occured.
+ */
+static void timer_handler(struct event_source *source, uint32_t events)
+{
+	struct timer *timer = source->data;
+	uint64_t expirations = 0;
+
+	if (sizeof(expirations) != read(source->fd, &expirations,
+					sizeof(expirations))) {
+		// The timer was rearmed after it expired.
+		return;
+	}
+	timer->fire(timer->data);
+}
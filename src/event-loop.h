@@ -0,0 +1,191 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_EVENT_LOOP_H
+#define UNLOCKED_EVENT_LOOP_H
+
+#include <stdint.h>
+#include <time.h>
+#include "error.h"
+
+/**
+ * A file descriptor watched by an event loop.
+ */
+struct event_source {
+	int fd;
+	/**
+	 * Called by the event loop when the file descriptor is ready.
+	 *
+	 * @param source is the event source.
+	 * @param events are the epoll events that occured.
+	 */
+	void (*handle) (struct event_source * source, uint32_t events);
+	/**
+	 * If not NULL, this function is called to free the event source after
+	 * it is not watched anymore.
+	 *
+	 * @param source is the event source.
+	 */
+	void (*release) (struct event_source * source);
+	void *data;
+};
+
+/**
+ * A timer on the monotonic clock backed by a timerfd.
+ */
+struct timer {
+	struct event_source source;
+	/**
+	 * Called by the event loop when the timer expired.
+	 *
+	 * @param data is the data of the timer.
+	 */
+	void (*fire) (void *data);
+	void *data;
+};
+
+/**
+ * An event source removed while events were dispatched.
+ */
+struct retired_source {
+	struct event_source *source;
+	/**
+	 * The release function of the source. It is copied, because sources
+	 * without release function may be freed by their owner at any time.
+	 */
+	void (*release) (struct event_source * source);
+};
+
+/**
+ * Dispatches the events of multiple file descriptors with epoll.
+ */
+struct event_loop {
+	int epoll_fd;
+	/**
+	 * Whether events are currently dispatched.
+	 */
+	unsigned int dispatching;
+	/**
+	 * Event sources, that were removed while events were dispatched.
+	 * Pending events for these sources are dropped and they are released
+	 * after all events have been dispatched.
+	 */
+	struct retired_source *retired;
+	size_t retired_count;
+	size_t retired_size;
+};
+
+/**
+ * Arm a timer to expire after a delay.
+ *
+ * @param timer is the timer to arm.
+ * @param delay is the delay in milliseconds. A delay of zero lets the timer
+ *              expire immediately, a negative delay disarms the timer.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err arm_timer(struct timer *timer, long delay);
+
+/**
+ * Arm a timer to expire at a point in time.
+ *
+ * @param timer is the timer to arm.
+ * @param deadline is the time on the monotonic clock the timer expires at.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err arm_timer_at(struct timer *timer,
+			       const struct timespec *deadline);
+
+/**
+ * Create a new event loop.
+ *
+ * @return the event loop that must be freed with `free_event_loop` or NULL on
+ *         failure.
+ */
+struct event_loop *create_event_loop(void);
+
+/**
+ * Wait for events and dispatch them to the handlers of their sources.
+ *
+ * @param loop is the event loop.
+ * @param timeout is the maximum time to wait in milliseconds or -1 to wait
+ *                until any event occurs.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err dispatch_events(struct event_loop *loop, int timeout);
+
+/**
+ * Free an event loop.
+ *
+ * All event sources must be removed before.
+ *
+ * @param loop is the event loop to free. Passing NULL is allowed.
+ */
+void free_event_loop(struct event_loop *loop);
+
+/**
+ * Remove a timer from the event loop and close its file descriptor.
+ *
+ * @param loop is the event loop the timer was added to.
+ * @param timer is the timer.
+ */
+void free_timer(struct event_loop *loop, struct timer *timer);
+
+/**
+ * Create the file descriptor of a timer and add it to an event loop.
+ *
+ * The timer is disarmed until `arm_timer` or `arm_timer_at` is called.
+ *
+ * @param loop is the event loop the timer is added to.
+ * @param timer is the timer to initialize.
+ * @param fire is called every time the timer expires.
+ * @param data is passed to `fire`.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err init_timer(struct event_loop *loop, struct timer *timer,
+			     void (*fire)(void *data), void *data);
+
+/**
+ * Stop watching an event source.
+ *
+ * The source is released with its release function, but not before the
+ * currently dispatched events have been processed.
+ *
+ * @param loop is the event loop.
+ * @param source is the source to remove.
+ */
+void unwatch_fd(struct event_loop *loop, struct event_source *source);
+
+/**
+ * Watch a file descriptor for events or change the events of an already
+ * watched file descriptor.
+ *
+ * @param loop is the event loop.
+ * @param source is the source with the file descriptor.
+ * @param events are the epoll events to wait for.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err watch_fd(struct event_loop *loop,
+			   struct event_source *source, uint32_t events);
+
+#endif
@@ -0,0 +1,114 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/core_names.h>
+#include <openssl/params.h>
+
+#include "hmac-signer.h"
+
+/**
+ * The size of a SHA512 digest in bytes.
+ */
+#define DIGEST_SIZE 64
+
+struct hmac_signer *create_signer(const char *secret)
+{
+	struct hmac_signer *signer = NULL;
+	OSSL_PARAM params[] = {
+		OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST,
+						 "SHA512", 0),
+		OSSL_PARAM_construct_end(),
+	};
+
+	signer = malloc(sizeof(struct hmac_signer));
+	if (NULL == signer) {
+		return NULL;
+	}
+	signer->ctx = NULL;
+	signer->secret = secret;
+	signer->mac = EVP_MAC_fetch(NULL, OSSL_MAC_NAME_HMAC, NULL);
+	if (NULL == signer->mac) {
+		free_signer(signer);
+
+		return NULL;
+	}
+	signer->ctx = EVP_MAC_CTX_new(signer->mac);
+	if (NULL == signer->ctx
+	    || !EVP_MAC_init(signer->ctx, (const unsigned char *) secret,
+			     strlen(secret), params)) {
+		free_signer(signer);
+
+		return NULL;
+	}
+
+	return signer;
+}
+
+enum unlocked_err finish_signature(struct hmac_signer *signer,
+				   char signature[SIGNATURE_SIZE])
+{
+	static const char hex_digits[] = "0123456789ABCDEF";
+	unsigned char digest[DIGEST_SIZE];
+	size_t digest_len = 0;
+
+	if (!EVP_MAC_final(signer->ctx, digest, &digest_len, sizeof(digest))
+	    || DIGEST_SIZE != digest_len) {
+		return UL_ERR;
+	}
+	for (size_t i = 0; i < DIGEST_SIZE; i++) {
+		signature[i * 2] = hex_digits[digest[i] >> 4];
+		signature[i * 2 + 1] = hex_digits[digest[i] & 0xf];
+	}
+	signature[DIGEST_SIZE * 2] = '\0';
+
+	return UL_OK;
+}
+
+void free_signer(struct hmac_signer *signer)
+{
+	if (NULL == signer) {
+		return;
+	}
+	// Freeing the context wipes the key.
+	EVP_MAC_CTX_free(signer->ctx);
+	EVP_MAC_free(signer->mac);
+	free(signer);
+}
+
+enum unlocked_err start_signature(struct hmac_signer *signer)
+{
+	// Without a key the keyed state of the context is restored.
+	if (!EVP_MAC_init(signer->ctx, NULL, 0, NULL)) {
+		return UL_ERR;
+	}
+
+	return UL_OK;
+}
+
+enum unlocked_err update_signature(struct hmac_signer *signer,
+				   const void *data, size_t length)
+{
+	if (!EVP_MAC_update(signer->ctx, data, length)) {
+		return UL_ERR;
+	}
+
+	return UL_OK;
+}
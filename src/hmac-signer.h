@@ -0,0 +1,98 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_HMAC_SIGNER_H
+#define UNLOCKED_HMAC_SIGNER_H
+
+#include <stddef.h>
+#include <openssl/evp.h>
+
+#include "error.h"
+
+/**
+ * The size of a signature in bytes, which is the hexadecimal SHA512 HMAC
+ * followed by a null terminator.
+ */
+#define SIGNATURE_SIZE 129
+
+/**
+ * Signs messages with a SHA512 HMAC of a secret.
+ *
+ * The key schedule is derived from the secret only once when the signer is
+ * created. Every signature afterwards starts from the keyed state.
+ */
+struct hmac_signer {
+	EVP_MAC *mac;
+	EVP_MAC_CTX *ctx;
+	/**
+	 * The secret the signer was created for. It is not copied and only
+	 * used to tell whether a request uses the same secret.
+	 */
+	const char *secret;
+};
+
+/**
+ * Create a signer for a secret.
+ *
+ * @param secret is the secret. It must outlive the signer.
+ *
+ * @return the signer or NULL on failure.
+ */
+struct hmac_signer *create_signer(const char *secret);
+
+/**
+ * Finish a signature.
+ *
+ * @param signer is the signer.
+ * @param signature is the storage for the upper case hexadecimal signature.
+ *
+ * @return UL_OK on success or UL_ERR if the signature could not be computed.
+ */
+enum unlocked_err finish_signature(struct hmac_signer *signer,
+				   char signature[SIGNATURE_SIZE]);
+
+/**
+ * Free a signer and wipe its key.
+ *
+ * @param signer is the signer to free.
+ */
+void free_signer(struct hmac_signer *signer);
+
+/**
+ * Start a new signature and drop any data passed to the signer before.
+ *
+ * @param signer is the signer.
+ *
+ * @return UL_OK on success or UL_ERR on failure.
+ */
+enum unlocked_err start_signature(struct hmac_signer *signer);
+
+/**
+ * Add data to the current signature.
+ *
+ * @param signer is the signer.
+ * @param data is the data to sign.
+ * @param length is the length of the data in bytes.
+ *
+ * @return UL_OK on success or UL_ERR on failure.
+ */
+enum unlocked_err update_signature(struct hmac_signer *signer,
+				   const void *data, size_t length);
+
+#endif
@@ -0,0 +1,366 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hosts.h"
+#include "log.h"
+
+/**
+ * The weight of a new sample in the smoothed latency of a server.
+ */
+#define LATENCY_WEIGHT 0.25
+
+/**
+ * The maximum length of a host name in the file with the latencies.
+ */
+#define MAX_HOST_NAME 255
+
+static int compare_hosts(const struct server_host *a,
+			 const struct server_host *b);
+static char *copy_host_name(const char *start, const char *end, int brackets);
+static enum unlocked_err parse_host(const char *start, const char *end,
+				    long default_port,
+				    struct server_host *host);
+static enum unlocked_err parse_port(const char *start, const char *end,
+				    long *port);
+
+void free_hosts(struct server_host *hosts, size_t count)
+{
+	if (NULL == hosts) {
+		return;
+	}
+	for (size_t i = 0; i < count; i++) {
+		free(hosts[i].name);
+	}
+	free(hosts);
+}
+
+enum unlocked_err load_host_latencies(struct server_host *hosts,
+				      size_t count)
+{
+	unsigned int failures = 0;
+	FILE *file = NULL;
+	long latency = 0;
+	char line[MAX_HOST_NAME + 64] = { 0 };
+	char name[MAX_HOST_NAME + 1] = { 0 };
+	long port = 0;
+
+	file = fopen(UNLOCKED_HOST_LATENCIES, "r");
+	if (NULL == file) {
+		return ENOENT == errno ? UL_OK : UL_ERRNO;
+	}
+	while (fgets(line, sizeof(line), file)) {
+		if (4 != sscanf(line, "%255s %ld %ld %u", name, &port,
+				&latency, &failures)) {
+			continue;
+		}
+		for (size_t i = 0; i < count; i++) {
+			if (port == hosts[i].port
+			    && 0 == strcmp(name, hosts[i].name)) {
+				hosts[i].latency = latency;
+				hosts[i].failures = failures;
+			}
+		}
+	}
+	fclose(file);
+
+	return UL_OK;
+}
+
+enum unlocked_err parse_hosts(const char *list, long default_port,
+			      struct server_host **hosts, size_t *count)
+{
+	const char *end = NULL;
+	enum unlocked_err err = UL_OK;
+	size_t size = 1;
+
+	*hosts = NULL;
+	*count = 0;
+	for (const char *c = list; *c; c++) {
+		if (',' == *c) {
+			size++;
+		}
+	}
+	*hosts = calloc(size, sizeof(struct server_host));
+	if (NULL == *hosts) {
+		return UL_MALLOC;
+	}
+	while (*list) {
+		end = strchr(list, ',');
+		if (NULL == end) {
+			end = list + strlen(list);
+		}
+		err = parse_host(list, end, default_port, &((*hosts)[*count]));
+		if (UL_OK != err) {
+			free_hosts(*hosts, *count);
+			*hosts = NULL;
+			*count = 0;
+
+			return err;
+		}
+		if ((*hosts)[*count].name) {
+			(*count)++;
+		}
+		list = *end ? end + 1 : end;
+	}
+	if (0 == *count) {
+		logger(LOG_ERROR, "No hostname given\n");
+		free(*hosts);
+		*hosts = NULL;
+
+		return UL_ERR;
+	}
+
+	return UL_OK;
+}
+
+void record_host_failure(struct server_host *host)
+{
+	host->failures++;
+}
+
+void record_host_latency(struct server_host *host, long latency)
+{
+	if (host->latency < 0) {
+		host->latency = latency;
+	} else {
+		host->latency += (latency - host->latency) * LATENCY_WEIGHT;
+	}
+	host->failures = 0;
+}
+
+void sort_hosts(struct server_host *hosts, size_t count)
+{
+	struct server_host host = { 0 };
+	size_t j = 0;
+
+	// An insertion sort keeps the configured order of equal servers and
+	// the lists are short anyway.
+	for (size_t i = 1; i < count; i++) {
+		host = hosts[i];
+		for (j = i; j > 0 && compare_hosts(&host, &hosts[j - 1]) < 0;
+		     j--) {
+			hosts[j] = hosts[j - 1];
+		}
+		hosts[j] = host;
+	}
+}
+
+enum unlocked_err store_host_latencies(const struct server_host *hosts,
+				       size_t count)
+{
+	struct atomic_file latencies = { 0 };
+	enum unlocked_err err = create_runtime_dir();
+
+	if (UL_OK != err) {
+		return err;
+	}
+	err = open_atomic_file(&latencies, UNLOCKED_HOST_LATENCIES);
+	if (UL_OK != err) {
+		return err;
+	}
+	for (size_t i = 0; i < count; i++) {
+		if (strlen(hosts[i].name) > MAX_HOST_NAME) {
+			continue;
+		}
+		if (0 > fprintf(latencies.file, "%s %ld %ld %u\n",
+				hosts[i].name, hosts[i].port,
+				hosts[i].latency, hosts[i].failures)) {
+			discard_atomic_file(&latencies);
+
+			return UL_ERRNO;
+		}
+	}
+
+	return commit_atomic_file(&latencies);
+}
+
+/**
+ * Compare two servers by their expected latency.
+ *
+ * @param a is the first server.
+ * @param b is the second server.
+ *
+ * @return a negative value if the first server should be tried before the
+ *         second one, a positive value if it should be tried after it or zero
+ *         if both are equal.
+ */
+static int compare_hosts(const struct server_host *a,
+			 const struct server_host *b)
+{
+	if (a->failures != b->failures) {
+		return a->failures < b->failures ? -1 : 1;
+	}
+	if (a->latency < 0 || b->latency < 0) {
+		return (a->latency < 0) - (b->latency < 0);
+	}
+
+	return (a->latency > b->latency) - (a->latency < b->latency);
+}
+
+/**
+ * Copy a host name.
+ *
+ * @param start is the start of the name.
+ * @param end is the end of the name.
+ * @param brackets is non zero to enclose the name in brackets.
+ *
+ * @return the name, that must be freed after use, or NULL on failure.
+ */
+static char *copy_host_name(const char *start, const char *end, int brackets)
+{
+	size_t len = end - start;
+	char *name = malloc(len + (brackets ? 3 : 1));
+
+	if (NULL == name) {
+		return NULL;
+	}
+	if (brackets) {
+		name[0] = '[';
+		memcpy(name + 1, start, len);
+		name[len + 1] = ']';
+		name[len + 2] = '\0';
+	} else {
+		memcpy(name, start, len);
+		name[len] = '\0';
+	}
+
+	return name;
+}
+
+/**
+ * Parse a single entry of a list of servers.
+ *
+ * @param start is the start of the entry.
+ * @param end is the end of the entry.
+ * @param default_port is the port used if the entry has no port.
+ * @param host is the server to populate. Its name stays NULL if the entry is
+ *             empty.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err parse_host(const char *start, const char *end,
+				    long default_port,
+				    struct server_host *host)
+{
+	const char *colon = NULL;
+	const char *name_end = NULL;
+	enum unlocked_err err = UL_OK;
+
+	while (start < end && isspace((unsigned char)*start)) {
+		start++;
+	}
+	while (end > start && isspace((unsigned char)end[-1])) {
+		end--;
+	}
+	if (start == end) {
+		return UL_OK;
+	}
+	host->latency = -1;
+	host->port = default_port;
+	if ('[' == *start) {
+		name_end = memchr(start, ']', end - start);
+		if (NULL == name_end || name_end == start + 1) {
+			logger(LOG_ERROR, "Invalid host \"%.*s\"\n",
+			       (int)(end - start), start);
+
+			return UL_ERR;
+		}
+		name_end++;
+		if (name_end < end) {
+			if (':' != *name_end) {
+				logger(LOG_ERROR, "Invalid host \"%.*s\"\n",
+				       (int)(end - start), start);
+
+				return UL_ERR;
+			}
+			err = parse_port(name_end + 1, end, &(host->port));
+		}
+		host->name = copy_host_name(start, name_end, 0);
+	} else {
+		colon = memchr(start, ':', end - start);
+		if (colon && memchr(colon + 1, ':', end - colon - 1)) {
+			// A bare IPv6 address without a port.
+			host->name = copy_host_name(start, end, 1);
+		} else if (colon) {
+			if (colon == start) {
+				logger(LOG_ERROR, "Invalid host \"%.*s\"\n",
+				       (int)(end - start), start);
+
+				return UL_ERR;
+			}
+			err = parse_port(colon + 1, end, &(host->port));
+			host->name = copy_host_name(start, colon, 0);
+		} else {
+			host->name = copy_host_name(start, end, 0);
+		}
+	}
+	if (UL_OK != err) {
+		free(host->name);
+		host->name = NULL;
+
+		return err;
+	}
+
+	return host->name ? UL_OK : UL_MALLOC;
+}
+
+/**
+ * Parse the port of an entry of a list of servers.
+ *
+ * @param start is the start of the port.
+ * @param end is the end of the port.
+ * @param port is set to the parsed port.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err parse_port(const char *start, const char *end,
+				    long *port)
+{
+	long value = 0;
+
+	if (start == end) {
+		logger(LOG_ERROR, "Missing port after \":\"\n");
+
+		return UL_ERR;
+	}
+	for (const char *c = start; c < end; c++) {
+		if (!isdigit((unsigned char)*c) || value > 65535) {
+			logger(LOG_ERROR, "Invalid port \"%.*s\"\n",
+			       (int)(end - start), start);
+
+			return UL_ERR;
+		}
+		value = value * 10 + (*c - '0');
+	}
+	if (0 == value || value > 65535) {
+		logger(LOG_ERROR, "Invalid port \"%.*s\"\n",
+		       (int)(end - start), start);
+
+		return UL_ERR;
+	}
+	*port = value;
+
+	return UL_OK;
+}
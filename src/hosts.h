@@ -0,0 +1,133 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_HOSTS_H
+#define UNLOCKED_HOSTS_H
+
+#include <stddef.h>
+#include "error.h"
+#include "runtime.h"
+
+/**
+ * The file where the latencies of the servers are persisted between
+ * invocations.
+ */
+#define UNLOCKED_HOST_LATENCIES UNLOCKED_RUNTIME_DIR "/host-latency"
+
+/**
+ * A server the client can request keys from.
+ */
+struct server_host {
+	/**
+	 * The host name or ip address of the server as used in urls. IPv6
+	 * addresses are enclosed in brackets.
+	 */
+	char *name;
+	long port;
+	/**
+	 * The smoothed time in milliseconds the server took to answer the
+	 * request for a key or -1 if unknown.
+	 */
+	long latency;
+	/**
+	 * The number of consecutive failed requests for a key.
+	 */
+	unsigned int failures;
+};
+
+/**
+ * Free a list of servers.
+ *
+ * @param hosts is the list to free. Passing NULL is allowed.
+ * @param count is the number of servers in the list.
+ */
+void free_hosts(struct server_host *hosts, size_t count);
+
+/**
+ * Restore the latencies of the servers from previous invocations.
+ *
+ * Servers without any record keep their unknown latency.
+ *
+ * @param hosts is the list of servers.
+ * @param count is the number of servers in the list.
+ *
+ * @return any error that occured. A missing file is not an error.
+ */
+enum unlocked_err load_host_latencies(struct server_host *hosts,
+				      size_t count);
+
+/**
+ * Parse a comma separated list of servers.
+ *
+ * Every entry is a host name or ip address optionally followed by a colon and
+ * the port, e.g. "a.example.com:8443, 192.0.2.1, [2001:db8::1]:443".
+ *
+ * @param list is the list to parse.
+ * @param default_port is the port of entries without an explicit port.
+ * @param hosts is set to the parsed list, that must be freed with
+ *              `free_hosts` after use.
+ * @param count is set to the number of servers in the list.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err parse_hosts(const char *list, long default_port,
+			      struct server_host **hosts, size_t *count);
+
+/**
+ * Record a failed request for a key.
+ *
+ * @param host is the server that failed.
+ */
+void record_host_failure(struct server_host *host);
+
+/**
+ * Record the time a server took to answer a request for a key.
+ *
+ * The latency is smoothed with an exponentially weighted moving average, so
+ * that a single slow request does not demote a server.
+ *
+ * @param host is the server that answered.
+ * @param latency is the time in milliseconds until the answer was received.
+ */
+void record_host_latency(struct server_host *host, long latency);
+
+/**
+ * Order the servers by their expected latency.
+ *
+ * Servers with fewer consecutive failures come first. Among them servers with
+ * a known latency precede servers with an unknown latency and are ordered by
+ * it. Otherwise the configured order is kept.
+ *
+ * @param hosts is the list of servers to sort.
+ * @param count is the number of servers in the list.
+ */
+void sort_hosts(struct server_host *hosts, size_t count);
+
+/**
+ * Persist the latencies of the servers for later invocations.
+ *
+ * @param hosts is the list of servers.
+ * @param count is the number of servers in the list.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err store_host_latencies(const struct server_host *hosts,
+				       size_t count);
+
+#endif
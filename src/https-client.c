@@ -23,86 +23,304 @@
 #include <stdio.h>
 #include <string.h>
 #include <time.h>
+#include <sys/epoll.h>
 #include "error.h"
+#include "event-loop.h"
 #include "https-client.h"
 #include "log.h"
+#include "tls-cache.h"
 #include <curl/curl.h>
-#include <openssl/hmac.h>
-#include <openssl/evp.h>
+#include <openssl/ssl.h>
 
+/**
+ * The initial size of the buffer for a body of unknown length.
+ */
+#define MIN_BODY_SIZE 512
+
+/**
+ * The maximum number of headers sent with a request.
+ */
+#define REQUEST_HEADER_COUNT 4
+
+struct request_headers {
+	/**
+	 * The list of headers passed to libcurl. Its nodes point into the
+	 * data.
+	 */
+	struct curl_slist nodes[REQUEST_HEADER_COUNT];
+	/**
+	 * The null terminated header lines one after another.
+	 */
+	char *data;
+	size_t size;
+	/**
+	 * Whether the headers belong to a running request.
+	 */
+	int in_use;
+	/**
+	 * The next headers of the session.
+	 */
+	struct request_headers *next;
+};
+
+static CURL *acquire_handle(struct Session *session);
+static struct request_headers *acquire_headers(struct Session *session);
+static char *append_header(struct request_headers *headers, size_t *used,
+			   const char *name, const char *value);
 static char *authHeader(struct curl_slist *headers, const char *username,
-			const char *key, const char *body);
+			struct hmac_signer *signer, const char *body);
+static struct request_headers *build_headers(struct Session *session,
+					     enum http_method method,
+					     struct Request *request);
+static void clear_headers(struct header_store *store);
+static void count_done(struct Exchange *exchange);
+static void finish_request(struct Session *session, CURL *curl,
+			   CURLcode result);
+static int format_date_header(char *header, size_t size, time_t epoch);
 static size_t header_callback(char *buffer, size_t size, size_t nitems,
 			      void *userdata);
-static const char *hmac_sha512(const char *const key,
-			       const char *const message);
-static char *joinHeaderNames(struct curl_slist *header_list);
+static void limit_arena_body(struct Response *response);
+static int multi_timer_callback(CURLM * multi, long timeout, void *userp);
+static enum unlocked_err perform_one(struct Session *session,
+				     enum http_method method,
+				     struct Request *request,
+				     struct Response *response);
+static enum unlocked_err prepare_auth_prefix(struct Session *session,
+					     const char *username);
+static int prereq_callback(void *clientp, char *conn_primary_ip,
+			   char *conn_local_ip, int conn_primary_port,
+			   int conn_local_port);
+static void process_messages(struct Session *session);
+static void read_timings(CURL *curl, struct request_timings *timings);
+static void release_handle(struct Session *session, CURL *curl);
+static void release_headers(struct request_headers *headers);
+static int reserve_body(struct Response *response, size_t size);
+static void release_socket(struct event_source *source);
+static void setup_handle(struct Session *session, CURL *curl);
+static void setup_request(struct Session *session, CURL *curl,
+			  struct Exchange *exchange);
+static int socket_callback(CURL * curl, curl_socket_t fd, int what,
+			   void *userp, void *socketp);
+static void socket_handler(struct event_source *source, uint32_t events);
 static void strToLower(char *str);
+static void timer_callback(void *data);
+static void update_session_stats(struct Session *session, CURL *curl,
+				 struct Response *response);
 static size_t write_callback(char *ptr, size_t size, size_t nmemb,
 			     void *userdata);
 
+static const char *const method_names[] = {
+	[HTTP_GET] = "GET",
+	[HTTP_PATCH] = "PATCH",
+	[HTTP_POST] = "POST",
+};
+
+enum unlocked_err add_preresolved(struct Session *session,
+				  struct curl_slist *entries)
+{
+	enum unlocked_err err = UL_OK;
+	struct curl_slist *list = session->preresolved;
+	struct curl_slist *tmp = NULL;
+
+	if (session->succeeded || NULL == entries) {
+		curl_slist_free_all(entries);
+
+		return UL_OK;
+	}
+	// The list replaces the pinned addresses, so it starts with them.
+	for (struct curl_slist * pinned = list ? NULL : session->resolve;
+	     pinned; pinned = pinned->next) {
+		tmp = curl_slist_append(list, pinned->data);
+		if (NULL == tmp) {
+			curl_slist_free_all(list);
+			curl_slist_free_all(entries);
+
+			return UL_MALLOC;
+		}
+		list = tmp;
+	}
+	for (struct curl_slist * entry = entries; entry; entry = entry->next) {
+		tmp = curl_slist_append(list, entry->data);
+		if (NULL == tmp) {
+			err = UL_MALLOC;
+			break;
+		}
+		list = tmp;
+	}
+	session->preresolved = list;
+	curl_slist_free_all(entries);
+
+	return err;
+}
+
 struct Response *create_response(void)
 {
 	struct Response *resp = malloc(sizeof(struct Response));
 	if (NULL == resp) {
 		return NULL;
 	}
+	resp->allocations = 0;
+	resp->arena = NULL;
 	resp->body = NULL;
 	resp->body_len = 0;
-	resp->headers = NULL;
+	resp->body_size = 0;
+	clear_headers(&resp->headers);
+	resp->max_body_size = 0;
 	resp->status = 0;
+	resp->stream_callback = NULL;
+	resp->stream_data = NULL;
+	resp->stream_stopped = 0;
+	resp->tls_resumed = 0;
 
 	return resp;
 }
 
+struct Session *create_session(void)
+{
+	struct Session *session = malloc(sizeof(struct Session));
+	if (NULL == session) {
+		return NULL;
+	}
+	session->bytes_in = 0;
+	session->bytes_out = 0;
+	session->connections = 0;
+	session->handles = NULL;
+	session->handle_count = 0;
+	session->handshakes = 0;
+	session->idle = NULL;
+	session->idle_count = 0;
+	session->requests = 0;
+	session->dropped_resolve = NULL;
+	session->preresolved = NULL;
+	session->resolve = NULL;
+	session->resumptions = 0;
+	session->running = 0;
+	session->signer = NULL;
+	session->succeeded = 0;
+	session->auth_prefix = NULL;
+	session->auth_prefix_len = 0;
+	session->auth_username = NULL;
+	session->date[0] = '\0';
+	session->date_time = 0;
+	session->request_headers = NULL;
+	session->loop = create_event_loop();
+	if (NULL == session->loop) {
+		free(session);
+
+		return NULL;
+	}
+	if (UL_OK != init_timer(session->loop, &(session->timer),
+				timer_callback, session)) {
+		free_event_loop(session->loop);
+		free(session);
+
+		return NULL;
+	}
+	session->share = curl_share_init();
+	if (NULL == session->share) {
+		free_timer(session->loop, &(session->timer));
+		free_event_loop(session->loop);
+		free(session);
+
+		return NULL;
+	}
+	curl_share_setopt(session->share, CURLSHOPT_SHARE,
+			  CURL_LOCK_DATA_SSL_SESSION);
+	curl_share_setopt(session->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	session->multi = curl_multi_init();
+	if (NULL == session->multi) {
+		curl_share_cleanup(session->share);
+		free_timer(session->loop, &(session->timer));
+		free_event_loop(session->loop);
+		free(session);
+
+		return NULL;
+	}
+	curl_multi_setopt(session->multi, CURLMOPT_SOCKETFUNCTION,
+			  socket_callback);
+	curl_multi_setopt(session->multi, CURLMOPT_SOCKETDATA, session);
+	curl_multi_setopt(session->multi, CURLMOPT_TIMERFUNCTION,
+			  multi_timer_callback);
+	curl_multi_setopt(session->multi, CURLMOPT_TIMERDATA, session);
+	if (NULL == acquire_handle(session)) {
+		free_session(session);
+
+		return NULL;
+	}
+	release_handle(session, session->handles[0]);
+	if (UL_OK != load_tls_sessions(session->handles[0])) {
+		logger(LOG_WARNING, "Could not load the TLS session cache %s\n",
+		       UNLOCKED_TLS_CACHE);
+	}
+
+	return session;
+}
+
+void free_session(struct Session *session)
+{
+	struct request_headers *headers = NULL;
+
+	if (NULL == session) {
+		return;
+	}
+	if (session->handshakes && session->handle_count) {
+		setup_handle(session, session->handles[0]);
+		if (UL_OK != store_tls_sessions(session->handles[0])) {
+			logger(LOG_DEBUG,
+			       "Could not store the TLS session cache %s\n",
+			       UNLOCKED_TLS_CACHE);
+		}
+	}
+	for (size_t i = 0; i < session->handle_count; i++) {
+		curl_multi_remove_handle(session->multi, session->handles[i]);
+	}
+	// Closing the connections removes their sockets from the event loop.
+	curl_multi_cleanup(session->multi);
+	for (size_t i = 0; i < session->handle_count; i++) {
+		curl_easy_cleanup(session->handles[i]);
+	}
+	free(session->handles);
+	free(session->idle);
+	curl_share_cleanup(session->share);
+	curl_slist_free_all(session->dropped_resolve);
+	curl_slist_free_all(session->preresolved);
+	curl_slist_free_all(session->resolve);
+	free_signer(session->signer);
+	free(session->auth_prefix);
+	while (session->request_headers) {
+		headers = session->request_headers;
+		session->request_headers = headers->next;
+		free(headers->data);
+		free(headers);
+	}
+	free_timer(session->loop, &(session->timer));
+	free_event_loop(session->loop);
+	free(session);
+}
+
 void free_response(struct Response *response)
 {
 	if (NULL == response) {
 		return;
 	}
-	if (response->body) {
+	if (response->body && response->arena) {
+		// The memory is returned to the arena when it is reset.
+		explicit_bzero(response->body, response->body_size);
+	} else if (response->body) {
 		free(response->body);
 	}
-	curl_slist_free_all(response->headers);
 	free(response);
 }
 
 char *date_header(const time_t * epoch)
 {
-	char *header = NULL;
-	static const char *const header_fmt =
-		"Date: %s, %02d %s %d %02d:%02d:%02d GMT";
-	int header_length = 0;
-	static const char *const days[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
-		"Fri", "Sat"
-	};
-	static const char *const months[] = { "Jan", "Feb", "Mar", "Apr", "May",
-		"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
-	};
-	time_t now = 0;
-	struct tm *tm = NULL;
-	if (NULL == epoch) {
-		now = time(NULL);
-		epoch = &now;
-	}
-	tm = gmtime(epoch);
-
-	header_length = snprintf(NULL, 0, header_fmt, days[tm->tm_wday],
-				 tm->tm_mday, months[tm->tm_mon],
-				 tm->tm_year + 1900, tm->tm_hour, tm->tm_min,
-				 tm->tm_sec);
-	if (0 > header_length) {
-		return NULL;
-	}
-	header = malloc(header_length + 1);
+	char *header = malloc(DATE_HEADER_SIZE);
+
 	if (NULL == header) {
 		return NULL;
 	}
-
-	if (0 > snprintf(header, header_length + 1, header_fmt,
-			 days[tm->tm_wday], tm->tm_mday, months[tm->tm_mon],
-			 tm->tm_year + 1900, tm->tm_hour, tm->tm_min,
-			 tm->tm_sec)) {
+	if (0 != format_date_header(header, DATE_HEADER_SIZE,
+				    epoch ? *epoch : time(NULL))) {
 		free(header);
 
 		return NULL;
@@ -111,38 +329,21 @@ char *date_header(const time_t * epoch)
 	return header;
 }
 
-char *get_content_type(struct Response *response)
+const char *get_content_type(const struct Response *response)
 {
-	static const char *const needle = "content-type";
-	struct curl_slist *iter = response->headers;
-	char *content_type = NULL;
-	size_t content_type_len = 0;
-	char *source = NULL;
+	return get_header(response, HEADER_CONTENT_TYPE);
+}
 
-	while (iter) {
-		if (NULL != iter->data
-		    && iter->data == strcasestr(iter->data, needle)) {
-			source = iter->data + strlen(needle);
-			while (':' == *source || ' ' == *source) {
-				source++;
-			}
-			// Ignore \r\n at the end of the header
-			content_type_len = strlen(source) - 2;
-			// Add one character for the null terminator.
-			content_type = malloc(content_type_len + 1);
-			if (NULL == content_type) {
-				return content_type;
-			}
-			memcpy(content_type, source, content_type_len);
-			content_type[content_type_len] = '\0';
-			strToLower(content_type);
+const char *get_header(const struct Response *response,
+		       enum response_header header)
+{
+	unsigned short value = response->headers.values[header];
 
-			return content_type;
-		}
-		iter = iter->next;
+	if (0 == value) {
+		return NULL;
 	}
 
-	return content_type;
+	return response->headers.data + value - 1;
 }
 
 void cleanup_https_client(void)
@@ -151,10 +352,11 @@ void cleanup_https_client(void)
 }
 
 struct curl_slist *add_auth_header(struct curl_slist *headers,
-				   struct Request *request)
+				   struct Request *request,
+				   struct hmac_signer *signer)
 {
-	char *header_auth = authHeader(headers, request->username,
-				       request->secret, request->body);
+	char *header_auth = authHeader(headers, request->username, signer,
+				       request->body);
 	if (NULL == header_auth) {
 		return NULL;
 	}
@@ -190,189 +392,328 @@ enum unlocked_err init_https_client(void)
 	return UL_OK;
 }
 
-enum unlocked_err https_hmac_GET(struct Request *request,
-				 struct Response *response)
+char *joinHeaderNames(struct curl_slist *header_list)
 {
-	CURL *curl;
-	CURLcode status;
-	struct curl_slist *headers = NULL;
+	const char *separator = NULL;
+	struct curl_slist *header_iterator = header_list;
+	char *headers = NULL;
+	size_t headers_size = 1;
+	int offset = 0;
+	if (NULL == header_list) {
+		headers = malloc(1);
+		if (NULL == headers) {
+			return NULL;
+		}
+		headers[0] = '\0';
 
-	logger(LOG_DEBUG, "Starting GET %s on port %d\n", request->url,
-	       request->port);
+		return headers;
+	}
 
-	headers = add_date_header(headers);
-	if (NULL == headers) {
-		return UL_MALLOC;
+	while (header_iterator) {
+		separator = strstr(header_iterator->data, ":");
+		if (NULL == separator) {
+			return NULL;
+		}
+		headers_size += separator - header_iterator->data;
+		header_iterator = header_iterator->next;
+		if (header_iterator) {
+			headers_size += 1;
+		}
 	}
-	headers = add_auth_header(headers, request);
+	header_iterator = header_list;
+	headers = malloc(headers_size);
 	if (NULL == headers) {
-		return UL_MALLOC;
+		return NULL;
 	}
-	headers = curl_slist_append(headers, "Accept: application/json");
-	if (NULL == headers) {
-		return UL_MALLOC;
+	while (header_iterator) {
+		separator = strstr(header_iterator->data, ":");
+		memcpy(headers + offset, header_iterator->data,
+		       separator - header_iterator->data);
+		offset += separator - header_iterator->data;
+		header_iterator = header_iterator->next;
+		if (header_iterator) {
+			headers[offset] = ' ';
+		} else {
+			headers[offset] = '\0';
+		}
+		offset += 1;
 	}
+	strToLower(headers);
 
-	curl = curl_easy_init();
-	if (!curl) {
-		curl_slist_free_all(headers);
+	return headers;
+}
 
-		return UL_CURL;
-	}
+enum unlocked_err https_hmac_GET(struct Session *session,
+				 struct Request *request,
+				 struct Response *response)
+{
+	return perform_one(session, HTTP_GET, request, response);
+}
 
-	curl_easy_setopt(curl, CURLOPT_URL, request->url);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	curl_easy_setopt(curl, CURLOPT_PORT, request->port);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+enum unlocked_err https_hmac_PATCH(struct Session *session,
+				   struct Request *request,
+				   struct Response *response)
+{
+	return perform_one(session, HTTP_PATCH, request, response);
+}
 
-	status = curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(response->status));
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(headers);
-	if (CURLE_OK != status) {
-		fprintf(stderr, "libcurl error: %s \n",
-			curl_easy_strerror(status));
+enum unlocked_err https_hmac_POST(struct Session *session,
+				  struct Request *request,
+				  struct Response *response)
+{
+	return perform_one(session, HTTP_POST, request, response);
+}
 
-		return UL_CURL;
+enum unlocked_err https_hmac_perform_all(struct Session *session,
+					 struct Exchange *exchanges,
+					 size_t count)
+{
+	size_t remaining = 0;
+	enum unlocked_err err = UL_OK;
+
+	for (size_t i = 0; i < count; i++) {
+		exchanges[i].data = &remaining;
+		exchanges[i].done = count_done;
+		if (UL_OK == https_hmac_start(session, &(exchanges[i]))) {
+			remaining++;
+		}
+	}
+	while (remaining) {
+		err = dispatch_events(session->loop, -1);
+		if (UL_OK != err) {
+			for (size_t i = 0; i < count; i++) {
+				https_hmac_cancel(session, &(exchanges[i]));
+			}
+
+			return err;
+		}
 	}
-	logger(LOG_DEBUG, "Finished GET request with status %ld : %s",
-	       response->status, response->body);
 
 	return UL_OK;
 }
 
-enum unlocked_err https_hmac_PATCH(struct Request *request,
-				   struct Response *response)
+void https_hmac_cancel(struct Session *session, struct Exchange *exchange)
 {
-	CURL *curl;
-	CURLcode status;
-	struct curl_slist *headers = NULL;
+	if (NULL == exchange->curl) {
+		return;
+	}
+	logger(LOG_DEBUG, "Cancelled %s request\n",
+	       method_names[exchange->method]);
+	curl_multi_remove_handle(session->multi, exchange->curl);
+	release_handle(session, exchange->curl);
+	release_headers(exchange->headers);
+	exchange->curl = NULL;
+	exchange->headers = NULL;
+	exchange->err = UL_CURL;
+	session->running--;
+}
 
-	logger(LOG_DEBUG, "Starting PATCH %s on port %d with the body %s\n",
-	       request->url, request->port, request->body);
+enum unlocked_err https_hmac_start(struct Session *session,
+				   struct Exchange *exchange)
+{
+	CURLMcode status = CURLM_OK;
 
-	headers = add_date_header(headers);
-	if (NULL == headers) {
-		return UL_MALLOC;
-	}
-	headers = add_auth_header(headers, request);
-	if (NULL == headers) {
-		return UL_MALLOC;
-	}
-	headers = curl_slist_append(headers, "Accept: text/plain");
-	if (NULL == headers) {
-		return UL_MALLOC;
+	exchange->curl = NULL;
+	exchange->err = UL_OK;
+	exchange->response->max_body_size = session->max_body_size;
+	if (exchange->response->arena) {
+		limit_arena_body(exchange->response);
 	}
-	headers =
-		curl_slist_append(headers,
-				  "Content-Type: application/json; charsets: utf-8");
-	if (NULL == headers) {
+	exchange->headers = build_headers(session, exchange->method,
+					  exchange->request);
+	if (NULL == exchange->headers) {
+		exchange->err = UL_MALLOC;
+
 		return UL_MALLOC;
 	}
-
-	curl = curl_easy_init();
-	if (!curl) {
-		curl_slist_free_all(headers);
+	exchange->curl = acquire_handle(session);
+	if (NULL == exchange->curl) {
+		release_headers(exchange->headers);
+		exchange->headers = NULL;
+		exchange->err = UL_CURL;
 
 		return UL_CURL;
 	}
-
-	curl_easy_setopt(curl, CURLOPT_URL, request->url);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	curl_easy_setopt(curl, CURLOPT_PORT, request->port);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
-	curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
-
-	status = curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(response->status));
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(headers);
-	if (CURLE_OK != status) {
+	setup_request(session, exchange->curl, exchange);
+	status = curl_multi_add_handle(session->multi, exchange->curl);
+	if (CURLM_OK != status) {
 		fprintf(stderr, "libcurl error: %s \n",
-			curl_easy_strerror(status));
+			curl_multi_strerror(status));
+		release_handle(session, exchange->curl);
+		release_headers(exchange->headers);
+		exchange->curl = NULL;
+		exchange->headers = NULL;
+		exchange->err = UL_CURL;
 
 		return UL_CURL;
 	}
-	logger(LOG_DEBUG, "Finished PATCH request with status %ld : %s",
-	       response->status, response->body);
+	session->running++;
 
 	return UL_OK;
 }
 
-enum unlocked_err https_hmac_POST(struct Request *request,
-				  struct Response *response)
+void reset_response(struct Response *response)
 {
-	CURL *curl;
-	CURLcode status;
-	struct curl_slist *headers = NULL;
-
-	logger(LOG_DEBUG, "Starting POST %s on port %d with the body %s\n",
-	       request->url, request->port, request->body);
+	if (response->body && response->arena) {
+		explicit_bzero(response->body, response->body_size);
+	} else if (response->body) {
+		response->body[0] = '\0';
+	}
+	response->allocations = 0;
+	response->body_len = 0;
+	clear_headers(&response->headers);
+	response->status = 0;
+	response->stream_callback = NULL;
+	response->stream_data = NULL;
+	response->stream_stopped = 0;
+	response->tls_resumed = 0;
+}
 
-	headers = add_date_header(headers);
-	if (NULL == headers) {
-		return UL_MALLOC;
+void store_header(struct Response *response, const char *line, size_t length)
+{
+	struct header_store *store = &response->headers;
+	static const char *const names[] = {
+		[HEADER_CONTENT_TYPE] = "content-type",
+		[HEADER_DATE] = "date",
+		[HEADER_ETAG] = "etag",
+		[HEADER_RETRY_AFTER] = "retry-after",
+	};
+	const char *colon = memchr(line, ':', length);
+	const char *end = line + length;
+	size_t name_len = 0;
+	char *value = NULL;
+	enum response_header header = HEADER_COUNT;
+
+	if (NULL == colon) {
+		if (length > 5 && 0 == strncmp(line, "HTTP/", 5)) {
+			clear_headers(store);
+		}
+		return;
 	}
-	headers = add_auth_header(headers, request);
-	if (NULL == headers) {
-		return UL_MALLOC;
+	name_len = colon - line;
+	for (int i = 0; i < HEADER_COUNT; i++) {
+		if (name_len == strlen(names[i])
+		    && 0 == strncasecmp(line, names[i], name_len)) {
+			header = i;
+			break;
+		}
 	}
-	headers = curl_slist_append(headers, "Accept: application/json");
-	if (NULL == headers) {
-		return UL_MALLOC;
+	if (HEADER_COUNT == header) {
+		return;
 	}
-	headers =
-		curl_slist_append(headers,
-				  "Content-Type: application/json; charsets: utf-8");
-	if (NULL == headers) {
-		curl_slist_free_all(headers);
-
-		return UL_MALLOC;
+	colon++;
+	while (colon < end && (' ' == *colon || '\t' == *colon)) {
+		colon++;
+	}
+	while (end > colon && isspace((unsigned char)end[-1])) {
+		end--;
+	}
+	if ((size_t) (end - colon) + 1 > HEADER_STORE_SIZE - store->used) {
+		logger(LOG_DEBUG, "Dropping the %s header, which does not fit "
+		       "into the header store\n", names[header]);
+		return;
 	}
+	value = store->data + store->used;
+	memcpy(value, colon, end - colon);
+	value[end - colon] = '\0';
+	if (HEADER_CONTENT_TYPE == header) {
+		// Media types are case insensitive
+		strToLower(value);
+	}
+	store->values[header] = store->used + 1;
+	store->used += end - colon + 1;
+}
 
-	curl = curl_easy_init();
-	if (!curl) {
-		curl_slist_free_all(headers);
+/**
+ * Take an idle easy handle from the pool of the session or create a new one.
+ *
+ * @param session is the session to take the handle from.
+ *
+ * @return the handle or NULL on failure.
+ */
+static CURL *acquire_handle(struct Session *session)
+{
+	CURL *curl = NULL;
+	CURL **handles = NULL;
 
-		return UL_CURL;
+	if (session->idle_count) {
+		return session->idle[--session->idle_count];
+	}
+	handles = realloc(session->handles,
+			  sizeof(CURL *) * (session->handle_count + 1));
+	if (NULL == handles) {
+		return NULL;
+	}
+	session->handles = handles;
+	// Reserve the space to return the handle to the pool.
+	handles = realloc(session->idle,
+			  sizeof(CURL *) * (session->handle_count + 1));
+	if (NULL == handles) {
+		return NULL;
+	}
+	session->idle = handles;
+	curl = curl_easy_init();
+	if (NULL == curl) {
+		return NULL;
 	}
+	setup_handle(session, curl);
+	session->handles[session->handle_count++] = curl;
 
-	curl_easy_setopt(curl, CURLOPT_URL, request->url);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-	curl_easy_setopt(curl, CURLOPT_PORT, request->port);
-	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-	curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
-	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
-	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body);
-	curl_easy_setopt(curl, CURLOPT_WRITEDATA, response);
-	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+	return curl;
+}
 
-	status = curl_easy_perform(curl);
-	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(response->status));
-	curl_easy_cleanup(curl);
-	curl_slist_free_all(headers);
-	if (CURLE_OK != status) {
-		fprintf(stderr, "libcurl error: %s \n",
-			curl_easy_strerror(status));
+/**
+ * Take the headers of a finished request from the session or create new ones.
+ *
+ * @param session is the session to take the headers from.
+ *
+ * @return the headers or NULL on failure.
+ */
+static struct request_headers *acquire_headers(struct Session *session)
+{
+	struct request_headers *headers = session->request_headers;
 
-		return UL_CURL;
+	while (headers && headers->in_use) {
+		headers = headers->next;
+	}
+	if (NULL == headers) {
+		headers = malloc(sizeof(struct request_headers));
+		if (NULL == headers) {
+			return NULL;
+		}
+		headers->data = NULL;
+		headers->size = 0;
+		headers->next = session->request_headers;
+		session->request_headers = headers;
 	}
-	logger(LOG_DEBUG, "Finished POST request with status %ld : %s",
-	       response->status, response->body);
+	headers->in_use = 1;
 
-	return UL_OK;
+	return headers;
+}
+
+/**
+ * Append a header line to the data of the headers.
+ *
+ * @param headers are the headers with enough space for the line.
+ * @param used is the number of bytes of the data used so far. It is increased
+ *             by the length of the line.
+ * @param name is the start of the line.
+ * @param value is the end of the line.
+ *
+ * @return the null terminated line.
+ */
+static char *append_header(struct request_headers *headers, size_t *used,
+			   const char *name, const char *value)
+{
+	char *line = headers->data + *used;
+	size_t name_len = strlen(name);
+	size_t value_len = strlen(value);
+
+	memcpy(line, name, name_len);
+	memcpy(line + name_len, value, value_len + 1);
+	*used += name_len + value_len + 1;
+
+	return line;
 }
 
 /**
@@ -384,57 +725,51 @@ enum unlocked_err https_hmac_POST(struct Request *request,
  *                hashed message.
  * @param username is a handle that helps the server to identify the key that
  *                 was used to generate the hash.
- * @param key is the secret key used to generate the hash.
+ * @param signer is the signer for the secret key used to generate the hash.
  * @param body is the data that should be included in the hashed message.
  *
  * @return a string with the header that must be freed after use.
  */
 static char *authHeader(struct curl_slist *headers, const char *username,
-			const char *key, const char *body)
+			struct hmac_signer *signer, const char *body)
 {
 	const char *const auth_fmt = "Authorization: hmac username=\"%s\", "
 		"algorithm=\"sha512\", headers=\"%s\", signature=\"%s\"";
 	int auth_header_size = 0;
 	char *auth_header = NULL;
-	char *data_to_sign = NULL;
-	size_t data_to_sign_size = 1;
-	const char *hex_digest = NULL;
+	enum unlocked_err err = UL_OK;
+	char signature[SIGNATURE_SIZE];
 	struct curl_slist *header_iterator = headers;
 	char *header_names = joinHeaderNames(headers);
 	if (NULL == header_names) {
 		return NULL;
 	}
 
-	if (NULL != body) {
-		data_to_sign_size += strlen(body);
-	}
-
-	while (header_iterator) {
-		data_to_sign_size += strlen(header_iterator->data) + 1;
+	// The signed message is the headers, each followed by a newline, and
+	// the body.
+	err = start_signature(signer);
+	while (UL_OK == err && header_iterator) {
+		err = update_signature(signer, header_iterator->data,
+				       strlen(header_iterator->data));
+		if (UL_OK == err) {
+			err = update_signature(signer, "\n", 1);
+		}
 		header_iterator = header_iterator->next;
 	}
-
-	data_to_sign = malloc(data_to_sign_size);
-	if (NULL == data_to_sign) {
-		free(header_names);
-
-		return NULL;
+	if (UL_OK == err && NULL != body) {
+		err = update_signature(signer, body, strlen(body));
 	}
-	data_to_sign[0] = '\0';
-	header_iterator = headers;
-	while (header_iterator) {
-		strcat(data_to_sign, header_iterator->data);
-		strcat(data_to_sign, "\n");
-		header_iterator = header_iterator->next;
+	if (UL_OK == err) {
+		err = finish_signature(signer, signature);
 	}
-	if (NULL != body) {
-		strcat(data_to_sign, body);
+	if (UL_OK != err) {
+		free(header_names);
+
+		return NULL;
 	}
-	hex_digest = hmac_sha512(key, data_to_sign);
-	free(data_to_sign);
 
 	auth_header_size = snprintf(NULL, 0, auth_fmt, username, header_names,
-				    hex_digest);
+				    signature);
 	if (0 > auth_header_size) {
 		free(header_names);
 
@@ -448,7 +783,7 @@ static char *authHeader(struct curl_slist *headers, const char *username,
 		return NULL;
 	}
 	if (0 > snprintf(auth_header, auth_header_size, auth_fmt, username,
-			 header_names, hex_digest)) {
+			 header_names, signature)) {
 		free(auth_header);
 		free(header_names);
 
@@ -460,112 +795,649 @@ static char *authHeader(struct curl_slist *headers, const char *username,
 }
 
 /**
+ * Create the headers for a request.
+ *
+ * The Authorization header is built from a template of the session and the
+ * Date header is formatted only once per second. The headers are reused once
+ * the request finished, so that polling does not allocate any memory.
+ *
+ * @param session is the session that sends the request.
+ * @param method is the method of the request.
+ * @param request is the request to create the headers for.
+ *
+ * @return the headers or NULL if any error occured.
+ */
+static struct request_headers *build_headers(struct Session *session,
+					     enum http_method method,
+					     struct Request *request)
+{
+	static const char *const content_type =
+		"application/json; charsets: utf-8";
+	const char *accept = request->accept;
+	struct request_headers *headers = NULL;
+	char *lines[REQUEST_HEADER_COUNT] = { NULL };
+	size_t count = 0;
+	size_t size = 0;
+	size_t used = 0;
+	time_t now = time(NULL);
+	// The signature is followed by the closing quote of the header.
+	char signature[SIGNATURE_SIZE + 1];
+	char *data = NULL;
+	enum unlocked_err err = UL_OK;
+
+	if (session->signer && session->signer->secret != request->secret) {
+		free_signer(session->signer);
+		session->signer = NULL;
+	}
+	if (NULL == session->signer) {
+		session->signer = create_signer(request->secret);
+		if (NULL == session->signer) {
+			return NULL;
+		}
+	}
+	if (UL_OK != prepare_auth_prefix(session, request->username)) {
+		return NULL;
+	}
+	if (now != session->date_time) {
+		if (0 != format_date_header(session->date,
+					    sizeof(session->date), now)) {
+			return NULL;
+		}
+		session->date_time = now;
+	}
+	if (NULL == accept) {
+		accept = HTTP_PATCH == method ? "text/plain" :
+		    "application/json";
+	}
+	// The signed message is the Date header followed by a newline and the
+	// body.
+	err = start_signature(session->signer);
+	if (UL_OK == err) {
+		err = update_signature(session->signer, session->date,
+				       strlen(session->date));
+	}
+	if (UL_OK == err) {
+		err = update_signature(session->signer, "\n", 1);
+	}
+	if (UL_OK == err && request->body) {
+		err = update_signature(session->signer, request->body,
+				       strlen(request->body));
+	}
+	if (UL_OK == err) {
+		err = finish_signature(session->signer, signature);
+	}
+	if (UL_OK != err) {
+		return NULL;
+	}
+	signature[SIGNATURE_SIZE - 1] = '"';
+	signature[SIGNATURE_SIZE] = '\0';
+
+	headers = acquire_headers(session);
+	if (NULL == headers) {
+		return NULL;
+	}
+	size = strlen(session->date) + 1 + session->auth_prefix_len
+	    + SIGNATURE_SIZE + 1 + strlen("Accept: ") + strlen(accept) + 1
+	    + strlen("Content-Type: ") + strlen(content_type) + 1;
+	if (size > headers->size) {
+		data = realloc(headers->data, size);
+		if (NULL == data) {
+			release_headers(headers);
+
+			return NULL;
+		}
+		headers->data = data;
+		headers->size = size;
+	}
+	lines[count++] = append_header(headers, &used, session->date, "");
+	lines[count++] = append_header(headers, &used, session->auth_prefix,
+				       signature);
+	lines[count++] = append_header(headers, &used, "Accept: ", accept);
+	if (HTTP_GET != method) {
+		lines[count++] = append_header(headers, &used, "Content-Type: ",
+					       content_type);
+	}
+	for (size_t i = 0; i < count; i++) {
+		headers->nodes[i].data = lines[i];
+		headers->nodes[i].next = i + 1 < count ?
+		    &(headers->nodes[i + 1]) : NULL;
+	}
+
+	return headers;
+}
+
+/**
+ * Drop all headers of a header store.
+ *
+ * @param store is the store to clear.
+ */
+static void clear_headers(struct header_store *store)
+{
+	store->used = 0;
+	memset(store->values, 0, sizeof(store->values));
+}
+
+/**
+ * Completion callback, that counts down the remaining requests of a batch.
+ *
+ * @param exchange is the finished request.
+ */
+static void count_done(struct Exchange *exchange)
+{
+	size_t *remaining = exchange->data;
+
+	(*remaining)--;
+}
+
+/**
+ * Collect the result of a finished request and invoke its completion
+ * callback.
+ *
+ * @param session is the session that performed the request.
+ * @param curl is the easy handle used for the request.
+ * @param result is the outcome of the transfer.
+ */
+static void finish_request(struct Session *session, CURL *curl,
+			   CURLcode result)
+{
+	char *exchange_ptr = NULL;
+	struct Exchange *exchange = NULL;
+	struct Response *response = NULL;
+
+	curl_easy_getinfo(curl, CURLINFO_PRIVATE, &exchange_ptr);
+	exchange = (struct Exchange *) exchange_ptr;
+	response = exchange->response;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &(response->status));
+	update_session_stats(session, curl, response);
+	read_timings(curl, &(response->timings));
+	logger(LOG_DEBUG, "Received %zu byte(s) with %u allocation(s) for the "
+	       "%s request\n", response->body_len, response->allocations,
+	       method_names[exchange->method]);
+	curl_multi_remove_handle(session->multi, curl);
+	release_handle(session, curl);
+	release_headers(exchange->headers);
+	exchange->curl = NULL;
+	exchange->headers = NULL;
+	session->running--;
+	if (CURLE_WRITE_ERROR == result && response->stream_stopped) {
+		logger(LOG_DEBUG, "%s request stopped after the body was "
+		       "processed\n", method_names[exchange->method]);
+		exchange->err = UL_OK;
+	} else if (CURLE_OK != result) {
+		fprintf(stderr, "libcurl error: %s \n",
+			curl_easy_strerror(result));
+		exchange->err = UL_CURL;
+	} else if (response->arena) {
+		// The body contains secrets.
+		logger(LOG_DEBUG, "Finished %s request with status %ld\n",
+		       method_names[exchange->method], response->status);
+		exchange->err = UL_OK;
+	} else {
+		logger(LOG_DEBUG, "Finished %s request with status %ld : %s",
+		       method_names[exchange->method], response->status,
+		       response->body);
+		exchange->err = UL_OK;
+	}
+	// The servers were reached, later requests look them up again.
+	if (UL_OK == exchange->err && !session->succeeded) {
+		session->succeeded = 1;
+		session->dropped_resolve = session->preresolved;
+		session->preresolved = NULL;
+	}
+	if (exchange->done) {
+		exchange->done(exchange);
+	}
+}
+
+/**
+ * Format the Date header for a point in time according to RFC7231.
+ *
+ * @param header is the storage for the header.
+ * @param size is the size of the storage in bytes.
+ * @param epoch is the point in time.
  *
+ * @return zero on success or a non zero value if the header does not fit.
+ */
+static int format_date_header(char *header, size_t size, time_t epoch)
+{
+	static const char *const header_fmt =
+		"Date: %s, %02d %s %d %02d:%02d:%02d GMT";
+	static const char *const days[] = { "Sun", "Mon", "Tue", "Wed", "Thu",
+		"Fri", "Sat"
+	};
+	static const char *const months[] = { "Jan", "Feb", "Mar", "Apr", "May",
+		"Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+	};
+	struct tm tm = { 0 };
+	int header_length = 0;
+
+	if (NULL == gmtime_r(&epoch, &tm)) {
+		return -1;
+	}
+	header_length = snprintf(header, size, header_fmt, days[tm.tm_wday],
+				 tm.tm_mday, months[tm.tm_mon],
+				 tm.tm_year + 1900, tm.tm_hour, tm.tm_min,
+				 tm.tm_sec);
+	if (0 > header_length || (size_t) header_length >= size) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Receive a header line of a response from libcurl.
+ *
+ * @param buffer is the header line, which is not null terminated.
+ * @param size is always one.
+ * @param nitems is the length of the header line.
+ * @param userdata is the response.
+ *
+ * @return the number of bytes handled.
  */
 static size_t header_callback(char *buffer, size_t size, size_t nitems,
 			      void *userdata)
 {
 	size_t length = size * nitems;
-	char *header = NULL;
-	struct Response *resp = userdata;
 
-	if (NULL == memchr(buffer, ':', length)) {
-		// No header
-		return length;
+	store_header(userdata, buffer, length);
+
+	return length;
+}
+
+/**
+ * Limit the size of a body allocated from an arena to the free memory of the
+ * arena, including the newline and null terminator appended to the body.
+ *
+ * @param response is the response with the arena.
+ */
+static void limit_arena_body(struct Response *response)
+{
+	struct secure_arena *arena = response->arena;
+	size_t available = arena->size - arena->used;
+
+	// A limit of zero would lift the limit instead.
+	available = available > 3 ? available - 2 : 1;
+	if (0 == response->max_body_size
+	    || response->max_body_size > available) {
+		response->max_body_size = available;
 	}
-	header = malloc(length + 1);
-	if (NULL == header) {
-		return 0;
+}
+
+/**
+ * Arm the timer of the session as requested by libcurl.
+ *
+ * See `man 3 CURLMOPT_TIMERFUNCTION` for the parameters.
+ */
+static int multi_timer_callback(CURLM * multi, long timeout, void *userp)
+{
+	struct Session *session = userp;
+
+	if (UL_OK != arm_timer(&(session->timer), timeout)) {
+		return -1;
 	}
-	memcpy(header, buffer, length);
-	header[length] = '\0';
-	resp->headers = curl_slist_append(resp->headers, header);
-	free(header);
 
-	return length;
+	return 0;
 }
 
 /**
- * Generates a HMAC using SHA512.
+ * Perform a single request.
  *
- * @param key is the secret key.
- * @param message is the message to be authenticated.
+ * @param session is the session to perform the request with.
+ * @param method is the HTTP method of the request.
+ * @param request is the request to perform.
+ * @param response will be populated with the response.
  *
- * @return a static string with the hexadecimal hash digest.
- *         This string is 128 characters long (and an additional zero byte).
- *         It must not be freed.
+ * @return any error that occured.
  */
-static const char *hmac_sha512(const char *const key, const char *const message)
+static enum unlocked_err perform_one(struct Session *session,
+				     enum http_method method,
+				     struct Request *request,
+				     struct Response *response)
 {
-	const unsigned char *digest = NULL;
-	static char hex_digest[129] = { 0 };
+	struct Exchange exchange = {
+		.err = UL_OK,
+		.method = method,
+		.request = request,
+		.response = response,
+	};
+	enum unlocked_err err = https_hmac_perform_all(session, &exchange, 1);
 
-	digest = HMAC(EVP_sha512(), key, strlen(key),
-		      (unsigned char *) message, strlen(message), NULL, NULL);
-	for (int i = 0; i < 64; i++) {
-		sprintf(hex_digest + i * 2, "%02X", digest[i]);
+	if (UL_OK != err) {
+		return err;
 	}
 
-	return hex_digest;
+	return exchange.err;
 }
 
 /**
- * Joins the names of headers separated by single spaces.
+ * Build the template for the Authorization header of a user unless the
+ * session already has it.
  *
- * @param header_list list of headers in the format
- *                    `<header-name>: <header>`.
+ * @param session is the session to build the template for.
+ * @param username is the user to authenticate as.
  *
- * @return the header names joined by single spaces.
+ * @return UL_OK on success or UL_MALLOC on failure.
  */
-static char *joinHeaderNames(struct curl_slist *header_list)
+static enum unlocked_err prepare_auth_prefix(struct Session *session,
+					     const char *username)
 {
-	const char *separator = NULL;
-	struct curl_slist *header_iterator = header_list;
-	char *headers = NULL;
-	size_t headers_size = 1;
-	int offset = 0;
-	if (NULL == header_list) {
-		headers = malloc(1);
-		if (NULL == headers) {
-			return NULL;
+	static const char *const prefix_fmt = "Authorization: hmac "
+		"username=\"%s\", algorithm=\"sha512\", headers=\"date\", "
+		"signature=\"";
+	int prefix_len = 0;
+
+	if (session->auth_prefix && session->auth_username == username) {
+		return UL_OK;
+	}
+	free(session->auth_prefix);
+	session->auth_prefix = NULL;
+	prefix_len = snprintf(NULL, 0, prefix_fmt, username);
+	if (0 > prefix_len) {
+		return UL_MALLOC;
+	}
+	session->auth_prefix = malloc(prefix_len + 1);
+	if (NULL == session->auth_prefix) {
+		return UL_MALLOC;
+	}
+	snprintf(session->auth_prefix, prefix_len + 1, prefix_fmt, username);
+	session->auth_prefix_len = prefix_len;
+	session->auth_username = username;
+
+	return UL_OK;
+}
+
+/**
+ * Records whether the TLS handshake of the connection used for a request
+ * resumed an earlier session.
+ *
+ * This is invoked by libcurl after the connection has been established and
+ * before the request is sent. See `man 3 CURLOPT_PREREQFUNCTION` for the
+ * parameters.
+ */
+static int prereq_callback(void *clientp, char *conn_primary_ip,
+			   char *conn_local_ip, int conn_primary_port,
+			   int conn_local_port)
+{
+	CURL *curl = clientp;
+	char *exchange_ptr = NULL;
+	struct Exchange *exchange = NULL;
+	struct curl_tlssessioninfo *info = NULL;
+
+	if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_PRIVATE,
+					  &exchange_ptr)
+	    || NULL == exchange_ptr) {
+		return CURL_PREREQFUNC_OK;
+	}
+	exchange = (struct Exchange *) exchange_ptr;
+	exchange->response->tls_resumed = 0;
+	if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_TLS_SSL_PTR, &info)
+	    || NULL == info || NULL == info->internals) {
+		return CURL_PREREQFUNC_OK;
+	}
+	if (CURLSSLBACKEND_OPENSSL == info->backend) {
+		exchange->response->tls_resumed =
+			SSL_session_reused(info->internals);
+	}
+
+	return CURL_PREREQFUNC_OK;
+}
+
+/**
+ * Collect the results of all finished requests.
+ *
+ * @param session is the session that performs the requests.
+ */
+static void process_messages(struct Session *session)
+{
+	CURLMsg *message = NULL;
+	int queued = 0;
+
+	while ((message = curl_multi_info_read(session->multi, &queued))) {
+		if (CURLMSG_DONE == message->msg) {
+			finish_request(session, message->easy_handle,
+				       message->data.result);
 		}
-		headers[0] = '\0';
+	}
+}
 
-		return headers;
+/**
+ * Read the progress of a finished request.
+ *
+ * @param curl is the easy handle used for the request.
+ * @param timings are set to the progress of the request. Values libcurl does
+ *                not report are zero.
+ */
+static void read_timings(CURL *curl, struct request_timings *timings)
+{
+	memset(timings, 0, sizeof(struct request_timings));
+	curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T,
+			  &(timings->namelookup));
+	curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &(timings->connect));
+	curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T,
+			  &(timings->appconnect));
+	curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T,
+			  &(timings->starttransfer));
+	curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &(timings->total));
+}
+
+/**
+ * Return an easy handle to the pool of the session.
+ *
+ * @param session is the session the handle belongs to.
+ * @param curl is the handle.
+ */
+static void release_handle(struct Session *session, CURL *curl)
+{
+	session->idle[session->idle_count++] = curl;
+}
+
+/**
+ * Return the headers of a finished request to the session.
+ *
+ * @param headers are the headers to return.
+ */
+static void release_headers(struct request_headers *headers)
+{
+	headers->in_use = 0;
+}
+
+/**
+ * Free the event source of a socket after it has been removed from the
+ * event loop.
+ *
+ * @param source is the event source of the socket.
+ */
+static void release_socket(struct event_source *source)
+{
+	free(source);
+}
+
+/**
+ * Grow the buffer for the body of a response.
+ *
+ * The buffer at least doubles its size, so that appending all chunks of a
+ * body copies every byte only a constant number of times on average.
+ *
+ * @param response is the response.
+ * @param size is the number of bytes needed.
+ *
+ * @return zero on success or -1 if the memory is exhausted.
+ */
+static int reserve_body(struct Response *response, size_t size)
+{
+	char *body = NULL;
+	size_t new_size = response->body_size ? response->body_size * 2 :
+	    MIN_BODY_SIZE;
+	// The geometric growth does not exceed the size limit.
+	size_t limit = response->max_body_size + 2;
+
+	if (new_size < size) {
+		new_size = size;
+	}
+	if (response->max_body_size && new_size > limit) {
+		new_size = limit > size ? limit : size;
+	}
+	if (response->arena) {
+		body = arena_realloc(response->arena, response->body,
+				     response->body_size, new_size);
+	} else {
+		body = realloc(response->body, new_size);
 	}
+	if (NULL == body) {
+		logger(LOG_ERROR, "Could not allocate %zu bytes for the "
+		       "response\n", new_size);
 
-	while (header_iterator) {
-		separator = strstr(header_iterator->data, ":");
-		if (NULL == separator) {
-			return NULL;
+		return -1;
+	}
+	response->body = body;
+	response->body_size = new_size;
+	response->allocations++;
+
+	return 0;
+}
+
+/**
+ * Apply the options shared by all requests of a session to an easy handle.
+ *
+ * This must be called again after the handle has been reset.
+ *
+ * @param session is the session the handle belongs to.
+ * @param curl is the handle to configure.
+ */
+static void setup_handle(struct Session *session, CURL *curl)
+{
+	curl_easy_setopt(curl, CURLOPT_SHARE, session->share);
+	curl_easy_setopt(curl, CURLOPT_PREREQFUNCTION, prereq_callback);
+	curl_easy_setopt(curl, CURLOPT_PREREQDATA, curl);
+	if (session->preresolved) {
+		curl_easy_setopt(curl, CURLOPT_RESOLVE, session->preresolved);
+	} else if (session->resolve) {
+		curl_easy_setopt(curl, CURLOPT_RESOLVE, session->resolve);
+	}
+}
+
+/**
+ * Configure an easy handle for a request.
+ *
+ * @param session is the session the handle belongs to.
+ * @param curl is the handle to configure.
+ * @param exchange is the request to perform with its response and its
+ *                 headers.
+ */
+static void setup_request(struct Session *session, CURL *curl,
+			  struct Exchange *exchange)
+{
+	struct Request *request = exchange->request;
+	struct Response *response = exchange->response;
+
+	if (request->body) {
+		logger(LOG_DEBUG, "Starting %s %s on port %ld with the body "
+		       "%s\n", method_names[exchange->method], request->url,
+		       request->port, request->body);
+	} else {
+		logger(LOG_DEBUG, "Starting %s %s on port %ld\n",
+		       method_names[exchange->method], request->url,
+		       request->port);
+	}
+
+	// Resetting the options keeps open connections and cached sessions.
+	curl_easy_reset(curl);
+	setup_handle(session, curl);
+	curl_easy_setopt(curl, CURLOPT_URL, request->url);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	curl_easy_setopt(curl, CURLOPT_PORT, request->port);
+	curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+	// Prefer multiplexing over an existing connection to a new one.
+	curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+	curl_easy_setopt(curl, CURLOPT_HTTPHEADER, exchange->headers->nodes);
+	curl_easy_setopt(curl, CURLOPT_HEADERDATA, response);
+	curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_callback);
+	curl_easy_setopt(curl, CURLOPT_WRITEDATA, exchange);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_callback);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, request->timeout);
+	curl_easy_setopt(curl, CURLOPT_PRIVATE, exchange);
+	switch (exchange->method) {
+	case HTTP_PATCH:
+		curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, "PATCH");
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body);
+		break;
+	case HTTP_POST:
+		curl_easy_setopt(curl, CURLOPT_POSTFIELDS, request->body);
+		break;
+	case HTTP_GET:
+		break;
+	}
+}
+
+/**
+ * Watch the sockets of libcurl in the event loop of the session.
+ *
+ * See `man 3 CURLMOPT_SOCKETFUNCTION` for the parameters.
+ */
+static int socket_callback(CURL * curl, curl_socket_t fd, int what,
+			   void *userp, void *socketp)
+{
+	struct Session *session = userp;
+	struct event_source *source = socketp;
+	uint32_t events = 0;
+
+	if (CURL_POLL_REMOVE == what) {
+		if (source) {
+			curl_multi_assign(session->multi, fd, NULL);
+			unwatch_fd(session->loop, source);
 		}
-		headers_size += separator - header_iterator->data;
-		header_iterator = header_iterator->next;
-		if (header_iterator) {
-			headers_size += 1;
+
+		return 0;
+	}
+	if (NULL == source) {
+		source = malloc(sizeof(struct event_source));
+		if (NULL == source) {
+			return -1;
 		}
+		source->data = session;
+		source->fd = fd;
+		source->handle = socket_handler;
+		source->release = release_socket;
+		curl_multi_assign(session->multi, fd, source);
 	}
-	header_iterator = header_list;
-	headers = malloc(headers_size);
-	if (NULL == headers) {
-		return NULL;
+	if (CURL_POLL_IN & what) {
+		events |= EPOLLIN;
 	}
-	while (header_iterator) {
-		separator = strstr(header_iterator->data, ":");
-		memcpy(headers + offset, header_iterator->data,
-		       separator - header_iterator->data);
-		offset += separator - header_iterator->data;
-		header_iterator = header_iterator->next;
-		if (header_iterator) {
-			headers[offset] = ' ';
-		} else {
-			headers[offset] = '\0';
-		}
-		offset += 1;
+	if (CURL_POLL_OUT & what) {
+		events |= EPOLLOUT;
+	}
+	if (UL_OK != watch_fd(session->loop, source, events)) {
+		return -1;
 	}
-	strToLower(headers);
 
-	return headers;
+	return 0;
+}
+
+/**
+ * Let libcurl process a ready socket.
+ *
+ * @param source is the event source of the socket.
+ * @param events are the epoll events that occured.
+ */
+static void socket_handler(struct event_source *source, uint32_t events)
+{
+	int actions = 0;
+	int running = 0;
+	struct Session *session = source->data;
+
+	if (EPOLLIN & events) {
+		actions |= CURL_CSELECT_IN;
+	}
+	if (EPOLLOUT & events) {
+		actions |= CURL_CSELECT_OUT;
+	}
+	if ((EPOLLERR | EPOLLHUP) & events) {
+		actions |= CURL_CSELECT_ERR;
+	}
+	curl_multi_socket_action(session->multi, source->fd, actions, &running);
+	process_messages(session);
 }
 
 /**
@@ -581,30 +1453,121 @@ static void strToLower(char *str)
 }
 
 /**
+ * Let libcurl handle its timeouts.
+ *
+ * @param data is the session.
+ */
+static void timer_callback(void *data)
+{
+	int running = 0;
+	struct Session *session = data;
+
+	curl_multi_socket_action(session->multi, CURL_SOCKET_TIMEOUT, 0,
+				 &running);
+	process_messages(session);
+}
+
+/**
+ * Update the statistics of a session after a request has been performed.
  *
+ * @param session is the session that performed the request.
+ * @param curl is the easy handle used for the request.
+ * @param response is the response to the request.
+ */
+static void update_session_stats(struct Session *session, CURL *curl,
+				 struct Response *response)
+{
+	long connections = 0;
+	curl_off_t body_size = 0;
+	long header_size = 0;
+
+	session->requests++;
+	if (CURLE_OK == curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T,
+					  &body_size)
+	    && CURLE_OK == curl_easy_getinfo(curl, CURLINFO_HEADER_SIZE,
+					     &header_size)) {
+		session->bytes_in += body_size + header_size;
+	}
+	if (CURLE_OK == curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T,
+					  &body_size)
+	    && CURLE_OK == curl_easy_getinfo(curl, CURLINFO_REQUEST_SIZE,
+					     &header_size)) {
+		session->bytes_out += body_size + header_size;
+	}
+	if (CURLE_OK != curl_easy_getinfo(curl, CURLINFO_NUM_CONNECTS,
+					  &connections) || 0 == connections) {
+		// The connection was reused, no handshake took place.
+		response->tls_resumed = 0;
+
+		return;
+	}
+	session->connections += connections;
+	session->handshakes += connections;
+	if (response->tls_resumed) {
+		session->resumptions++;
+	}
+}
+
+/**
+ * Append a chunk of the body to the response.
+ *
+ * @param ptr is the chunk.
+ * @param size is always 1.
+ * @param nmemb is the size of the chunk.
+ * @param userdata is the exchange the chunk belongs to.
+ *
+ * @return the number of bytes processed. Anything else than the size of the
+ *         chunk aborts the transfer.
  */
 static size_t write_callback(char *ptr, size_t size, size_t nmemb,
 			     void *userdata)
 {
+	curl_off_t content_length = -1;
+	struct Exchange *exchange = userdata;
 	size_t length = size * nmemb;
-	struct Response *resp = userdata;
+	struct Response *resp = exchange->response;
+	// The body is followed by a newline and a null terminator.
+	size_t needed = resp->body_len + length + 2;
+
+	// The whole body is allocated at once if the server announced its
+	// length.
+	if (0 == resp->body_len
+	    && CURLE_OK == curl_easy_getinfo(exchange->curl,
+					     CURLINFO_CONTENT_LENGTH_DOWNLOAD_T,
+					     &content_length)
+	    && content_length > 0) {
+		if (resp->max_body_size
+		    && (curl_off_t) resp->max_body_size < content_length) {
+			logger(LOG_ERROR, "The response of %"
+			       CURL_FORMAT_CURL_OFF_T " bytes exceeds the "
+			       "maximum size of %zu bytes\n", content_length,
+			       resp->max_body_size);
 
-	if (NULL == resp->body) {
-		resp->body = malloc(length + 2);
-		if (NULL == resp->body) {
 			return 0;
 		}
-	} else {
-		resp->body = realloc(resp->body, resp->body_len + length + 2);
-		if (NULL == resp->body) {
-			return 0;
+		if ((size_t) content_length + 2 > needed) {
+			needed = content_length + 2;
 		}
 	}
+	if (resp->max_body_size
+	    && resp->body_len + length > resp->max_body_size) {
+		logger(LOG_ERROR, "The response exceeds the maximum size of "
+		       "%zu bytes\n", resp->max_body_size);
+
+		return 0;
+	}
+	if (needed > resp->body_size && reserve_body(resp, needed)) {
+		return 0;
+	}
 	memcpy(resp->body + resp->body_len, ptr, length);
 	resp->body_len += length;
 	resp->body[resp->body_len] = '\n';
 	resp->body[resp->body_len + 1] = '\0';
+	if (resp->stream_callback && resp->stream_callback(resp)) {
+		resp->stream_stopped = 1;
 
-	return length;
+		return 0;
+	}
 
+	return length;
 }
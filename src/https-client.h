@@ -20,30 +20,326 @@
 #ifndef UNLOCKED_HTTPS_CLIENT_H
 #define UNLOCKED_HTTPS_CLIENT_H
 
+#include <time.h>
 #include <curl/curl.h>
 #include "error.h"
+#include "event-loop.h"
+#include "hmac-signer.h"
+#include "locked-memory.h"
+
+enum http_method {
+	HTTP_GET,
+	HTTP_PATCH,
+	HTTP_POST,
+};
+
+/**
+ * The response headers kept by the client. All other headers are dropped
+ * when they are received.
+ */
+enum response_header {
+	HEADER_CONTENT_TYPE,
+	HEADER_DATE,
+	HEADER_ETAG,
+	HEADER_RETRY_AFTER,
+	HEADER_COUNT,
+};
+
+/**
+ * The size of the buffer for the values of the headers of a response.
+ */
+#define HEADER_STORE_SIZE 512
+
+/**
+ * The headers of a response in a single buffer without any allocations.
+ */
+struct header_store {
+	/**
+	 * The null terminated values of the headers one after another.
+	 */
+	char data[HEADER_STORE_SIZE];
+	size_t used;
+	/**
+	 * The offset of the value of each header in the data plus one or zero
+	 * if the header was not received.
+	 */
+	unsigned short values[HEADER_COUNT];
+};
+
+/**
+ * The progress of a request in microseconds since it started, as reported
+ * by libcurl. Each value includes the previous ones. Steps that did not take
+ * place, like the handshake on a reused connection, are zero.
+ */
+struct request_timings {
+	curl_off_t namelookup;
+	curl_off_t connect;
+	curl_off_t appconnect;
+	curl_off_t starttransfer;
+	curl_off_t total;
+};
+
+/**
+ * The size of a Date header formatted according to RFC7231 including the
+ * null terminator.
+ */
+#define DATE_HEADER_SIZE 36
+
+/**
+ * The headers of a request. They are owned by the session and reused by later
+ * requests.
+ */
+struct request_headers;
 
 struct Request {
+	/**
+	 * The media type for the Accept header or NULL for the default of the
+	 * method.
+	 */
+	const char *accept;
 	char *body;
 	long port;
 	char *secret;
 	int skip_validation;
+	/**
+	 * The maximum duration of the request in seconds or zero for no limit.
+	 */
+	long timeout;
 	char *url;
 	char *username;
 };
 
 struct Response {
+	/**
+	 * If not NULL, the body is allocated from this arena, because it
+	 * contains secrets.
+	 */
+	struct secure_arena *arena;
+	/**
+	 * The body received so far followed by a newline and a null
+	 * terminator.
+	 */
 	char *body;
 	size_t body_len;
-	struct curl_slist *headers;
+	/**
+	 * The number of bytes allocated for the body. The buffer grows
+	 * geometrically and is presized from the Content-Length header.
+	 */
+	size_t body_size;
+	/**
+	 * The number of times the buffer for the body was allocated for the
+	 * current request.
+	 */
+	unsigned int allocations;
+	/**
+	 * The maximum size of the body in bytes or zero for no limit. The
+	 * transfer fails if the body gets larger.
+	 */
+	size_t max_body_size;
+	struct header_store headers;
 	long status;
+	/**
+	 * If not NULL, this function is called every time a new chunk of the
+	 * body has been received. This allows to process streamed responses
+	 * before the transfer is complete.
+	 *
+	 * @param response is the response with the body received so far.
+	 *
+	 * @return zero to continue the transfer or a non zero value to stop it.
+	 */
+	int (*stream_callback) (struct Response * response);
+	/**
+	 * Data for the stream callback.
+	 */
+	void *stream_data;
+	/**
+	 * Whether the transfer was stopped by the stream callback.
+	 */
+	int stream_stopped;
+	/**
+	 * Whether a new connection was opened for this response, which resumed
+	 * an earlier TLS session.
+	 */
+	int tls_resumed;
+	struct request_timings timings;
 };
 
 /**
+ * State shared by all requests of a negotiation with the server.
  *
+ * The easy handles are kept alive between requests, so that libcurl can reuse
+ * the connections to the server instead of connecting again for every
+ * request. All requests run concurrently on the multi handle, which is driven
+ * by the event loop of the session. TLS sessions are kept in a share handle
+ * and persisted between invocations, so that new connections can resume them
+ * instead of a full handshake.
+ */
+struct Session {
+	CURLM *multi;
+	CURLSH *share;
+	/**
+	 * The event loop dispatching the sockets and timeouts of libcurl.
+	 * Further event sources may be added to this loop by the user of the
+	 * session.
+	 */
+	struct event_loop *loop;
+	/**
+	 * The timer requested by libcurl.
+	 */
+	struct timer timer;
+	/**
+	 * All easy handles of the session.
+	 */
+	CURL **handles;
+	size_t handle_count;
+	/**
+	 * The easy handles currently not used by any request.
+	 */
+	CURL **idle;
+	size_t idle_count;
+	/**
+	 * The pinned addresses of the servers for `CURLOPT_RESOLVE`, that are
+	 * used instead of looking them up, or NULL. The list is freed with the
+	 * session.
+	 */
+	struct curl_slist *resolve;
+	/**
+	 * The pinned addresses followed by the addresses resolved ahead of
+	 * time, which are used instead of `resolve` until a request
+	 * succeeded, or NULL.
+	 */
+	struct curl_slist *preresolved;
+	/**
+	 * The addresses resolved ahead of time after they were dropped. They
+	 * are kept until the session is freed, because requests started
+	 * before may still refer to them.
+	 */
+	struct curl_slist *dropped_resolve;
+	/**
+	 * Whether any request of the session succeeded.
+	 */
+	int succeeded;
+	/**
+	 * The maximum size of the body of a response in bytes or zero for no
+	 * limit.
+	 */
+	size_t max_body_size;
+	/**
+	 * The number of requests currently running.
+	 */
+	size_t running;
+	/**
+	 * The size of the HTTP messages received and sent in this session
+	 * including their headers in bytes.
+	 */
+	curl_off_t bytes_in;
+	curl_off_t bytes_out;
+	/**
+	 * The number of connections opened for the requests of this session.
+	 */
+	long connections;
+	/**
+	 * The number of TLS handshakes performed for the new connections.
+	 */
+	long handshakes;
+	/**
+	 * The number of requests performed in this session.
+	 */
+	long requests;
+	/**
+	 * The number of handshakes, that resumed an earlier TLS session.
+	 */
+	long resumptions;
+	/**
+	 * The signer for the secret of the most recent request or NULL.
+	 */
+	struct hmac_signer *signer;
+	/**
+	 * The Authorization header up to the signature for the user of the
+	 * most recent request or NULL.
+	 */
+	char *auth_prefix;
+	size_t auth_prefix_len;
+	const char *auth_username;
+	/**
+	 * The Date header for the second `date_time`. It is formatted at most
+	 * once per second.
+	 */
+	char date[DATE_HEADER_SIZE];
+	time_t date_time;
+	/**
+	 * The headers of all requests of the session, that are reused once a
+	 * request finished.
+	 */
+	struct request_headers *request_headers;
+};
+
+/**
+ * A request together with its response for asynchronous execution.
+ */
+struct Exchange {
+	enum http_method method;
+	struct Request *request;
+	struct Response *response;
+	/**
+	 * Any error that occured while performing this request.
+	 */
+	enum unlocked_err err;
+	/**
+	 * If not NULL, this function is called from the event loop of the
+	 * session after the request finished.
+	 *
+	 * @param exchange is the finished request with its response and error.
+	 */
+	void (*done) (struct Exchange * exchange);
+	/**
+	 * Data for the completion callback.
+	 */
+	void *data;
+	/**
+	 * The easy handle while the request is running or NULL.
+	 */
+	CURL *curl;
+	/**
+	 * The headers of the request while it is running.
+	 */
+	struct request_headers *headers;
+};
+
+/**
+ * Add addresses of the servers resolved ahead of time to a session.
+ *
+ * Unlike the pinned addresses, they are only used until the first request of
+ * the session succeeded, so that a long running session follows changes of
+ * the DNS. Addresses added after that are ignored.
+ *
+ * @param session is the session to add the addresses to.
+ * @param entries are the addresses for `CURLOPT_RESOLVE` or NULL. The list is
+ *                freed.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err add_preresolved(struct Session *session,
+				  struct curl_slist *entries);
+
+/**
+ * Create an empty response, that is passed to a request.
+ *
+ * @return the response that must be freed with `free_response` or NULL on
+ *         failure.
  */
 struct Response *create_response(void);
 
+/**
+ * Create a new session for requests against the server.
+ *
+ * The http client must be initialized before a session is created.
+ *
+ * @return the session that must be freed with `free_session` or NULL on
+ *         failure.
+ */
+struct Session *create_session(void);
+
 /**
  * Generates the date header with the current date formatted according to
  * RFC7231.
@@ -60,16 +356,36 @@ char *date_header(const time_t * epoch);
  */
 void free_response(struct Response *response);
 
+/**
+ * Free a session and close all of its connections.
+ *
+ * @param session is the session to free. Passing NULL is allowed.
+ */
+void free_session(struct Session *session);
+
 /**
  * Get the content type of a response.
  *
  * @param response is the response to get the content type for.
  *
  * @return the content type of the response or NULL if the content type is not
- *         set. If the return value is not NULL, it must be freed after use.
- *         The returned string will be all lower case and zero terminated.
+ *         set. The returned string is owned by the response, all lower case
+ *         and zero terminated.
  */
-char *get_content_type(struct Response *response);
+const char *get_content_type(const struct Response *response);
+
+/**
+ * Get the value of a header of a response.
+ *
+ * @param response is the response to get the header from.
+ * @param header is the header to get.
+ *
+ * @return the value of the header without surrounding whitespace or NULL if
+ *         the header was not received. The returned string is owned by the
+ *         response.
+ */
+const char *get_header(const struct Response *response,
+		       enum response_header header);
 
 /**
  * Cleanup after the http client.
@@ -83,12 +399,14 @@ void cleanup_https_client(void);
  *                header, passing NULL to create a new list is nevertheless
  *                allowed.
  * @param request is the request to create the auth header for.
+ * @param signer is the signer for the secret of the request.
  *
  * @return the list of headers with the appended auth header or NULL if any
  *         error occured.
  */
 struct curl_slist *add_auth_header(struct curl_slist *headers,
-				   struct Request *request);
+				   struct Request *request,
+				   struct hmac_signer *signer);
 
 /**
  * @param headers is the list of headers the date header will be appended to.
@@ -107,21 +425,103 @@ struct curl_slist *add_date_header(struct curl_slist *headers);
 enum unlocked_err init_https_client(void);
 
 /**
+ * Joins the names of headers separated by single spaces.
+ *
+ * @param header_list list of headers in the format
+ *                    `<header-name>: <header>`.
  *
+ * @return the lower case header names joined by single spaces, that must be
+ *         freed after use, or NULL on failure.
  */
-enum unlocked_err https_hmac_GET(struct Request *request,
+char *joinHeaderNames(struct curl_slist *header_list);
+
+/**
+ *
+ */
+enum unlocked_err https_hmac_GET(struct Session *session,
+				 struct Request *request,
 				 struct Response *response);
 
 /**
  *
  */
-enum unlocked_err https_hmac_PATCH(struct Request *request,
+enum unlocked_err https_hmac_PATCH(struct Session *session,
+				   struct Request *request,
 				   struct Response *response);
 
 /**
  *
  */
-enum unlocked_err https_hmac_POST(struct Request *request,
+enum unlocked_err https_hmac_POST(struct Session *session,
+				  struct Request *request,
 				  struct Response *response);
 
+/**
+ * Cancel a running request.
+ *
+ * The completion callback of the request is not invoked. Cancelling a request
+ * that is not running is allowed and has no effect.
+ *
+ * @param session is the session running the request.
+ * @param exchange is the request to cancel.
+ */
+void https_hmac_cancel(struct Session *session, struct Exchange *exchange);
+
+/**
+ * Start a request without waiting for it to finish.
+ *
+ * The request is performed while the event loop of the session dispatches
+ * events. Afterwards the completion callback of the exchange is invoked.
+ * The exchange must stay valid until then.
+ *
+ * @param session is the session to perform the request with.
+ * @param exchange is the request with the response to populate.
+ *
+ * @return any error that prevented the request from being started. In this
+ *         case the completion callback is not invoked.
+ */
+enum unlocked_err https_hmac_start(struct Session *session,
+				   struct Exchange *exchange);
+
+/**
+ * Perform multiple requests concurrently and wait for all of them to finish.
+ *
+ * This dispatches the events of the session until all requests finished. The
+ * completion callbacks and their data are overwritten.
+ *
+ * @param session is the session to perform the requests with.
+ * @param exchanges is an array of requests, each with a response that will be
+ *                  populated. The outcome of every single request is stored
+ *                  in its `err` member.
+ * @param count is the number of requests.
+ *
+ * @return any error that prevented the requests from being performed.
+ */
+enum unlocked_err https_hmac_perform_all(struct Session *session,
+					 struct Exchange *exchanges,
+					 size_t count);
+
+/**
+ * Prepare a response to be passed to another request.
+ *
+ * The headers and the status are dropped and the body is emptied, but the
+ * memory allocated for the body is kept.
+ *
+ * @param response is the response to reset.
+ */
+void reset_response(struct Response *response);
+
+/**
+ * Store a header line of a response, if it is one of the headers kept by the
+ * client.
+ *
+ * A status line starts a new response, e.g. after a redirect, and drops all
+ * headers stored so far.
+ *
+ * @param response is the response to store the header in.
+ * @param line is the header line, which does not need to be null terminated.
+ * @param length is the length of the line in bytes.
+ */
+void store_header(struct Response *response, const char *line, size_t length);
+
 #endif
@@ -0,0 +1,557 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "json-scan.h"
+
+/**
+ * The maximum nesting depth of arrays and objects.
+ */
+#define MAX_DEPTH 64
+
+/**
+ * The size of the buffer for the names of members, that are compared with
+ * the names of the fields. Longer names never match a field.
+ */
+#define NAME_SIZE 64
+
+/**
+ * The size of the buffer for the text of a number, that is converted for a
+ * field.
+ */
+#define NUMBER_SIZE 64
+
+struct json_scanner {
+	const char *pos;
+	const char *end;
+	unsigned int depth;
+};
+
+static int append_utf8(char *out, size_t size, size_t *length,
+		       unsigned int code);
+static int extract_field(struct json_scanner *scanner,
+			 struct json_field *field);
+static int scan_array(struct json_scanner *scanner);
+static int scan_digits(struct json_scanner *scanner);
+static int scan_hex(struct json_scanner *scanner, unsigned int *code);
+static int scan_literal(struct json_scanner *scanner, const char *literal);
+static int scan_number(struct json_scanner *scanner);
+static int scan_object(struct json_scanner *scanner, struct json_field *fields,
+		       size_t field_count);
+static int scan_string(struct json_scanner *scanner, char *out, size_t size,
+		       size_t *length);
+static int scan_value(struct json_scanner *scanner);
+static void skip_whitespace(struct json_scanner *scanner);
+
+enum unlocked_err scan_json_object(const char *json, size_t length,
+				   struct json_field *fields,
+				   size_t field_count)
+{
+	struct json_scanner scanner = {
+		.pos = json,
+		.end = json + length,
+		.depth = 0,
+	};
+
+	for (size_t i = 0; i < field_count; i++) {
+		fields[i].status = JSON_FIELD_MISSING;
+	}
+	skip_whitespace(&scanner);
+	if (scanner.pos >= scanner.end || '{' != *scanner.pos) {
+		return UL_ERR;
+	}
+	if (0 != scan_object(&scanner, fields, field_count)) {
+		return UL_ERR;
+	}
+	skip_whitespace(&scanner);
+	if (scanner.pos != scanner.end) {
+		return UL_ERR;
+	}
+
+	return UL_OK;
+}
+
+/**
+ * Append a code point encoded as UTF-8 to a decoded string.
+ *
+ * @param out is the storage for the string or NULL.
+ * @param size is the size of the storage in bytes.
+ * @param length is the length of the string so far. It is increased by the
+ *               length of the encoded code point, even if the storage is too
+ *               small.
+ * @param code is the code point.
+ *
+ * @return zero on success or a non zero value if the code point is invalid.
+ */
+static int append_utf8(char *out, size_t size, size_t *length,
+		       unsigned int code)
+{
+	unsigned char bytes[4];
+	size_t count = 0;
+
+	if (code < 0x80) {
+		bytes[count++] = code;
+	} else if (code < 0x800) {
+		bytes[count++] = 0xc0 | (code >> 6);
+		bytes[count++] = 0x80 | (code & 0x3f);
+	} else if (code < 0x10000) {
+		bytes[count++] = 0xe0 | (code >> 12);
+		bytes[count++] = 0x80 | ((code >> 6) & 0x3f);
+		bytes[count++] = 0x80 | (code & 0x3f);
+	} else if (code < 0x110000) {
+		bytes[count++] = 0xf0 | (code >> 18);
+		bytes[count++] = 0x80 | ((code >> 12) & 0x3f);
+		bytes[count++] = 0x80 | ((code >> 6) & 0x3f);
+		bytes[count++] = 0x80 | (code & 0x3f);
+	} else {
+		return -1;
+	}
+	for (size_t i = 0; i < count; i++) {
+		// Keep space for the null terminator.
+		if (out && *length + 1 < size) {
+			out[*length] = bytes[i];
+		}
+		(*length)++;
+	}
+
+	return 0;
+}
+
+/**
+ * Scan the value of a member, that was requested as field.
+ *
+ * @param scanner is positioned at the start of the value.
+ * @param field is the field to store the value in.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int extract_field(struct json_scanner *scanner,
+			 struct json_field *field)
+{
+	const char *start = scanner->pos;
+	char number[NUMBER_SIZE];
+	size_t length = 0;
+
+	if (JSON_FIELD_STRING == field->type && '"' == *start) {
+		if (0 != scan_string(scanner, field->string,
+				     field->string_size, &length)) {
+			return -1;
+		}
+		field->status = length < field->string_size ?
+		    JSON_FIELD_FOUND : JSON_FIELD_INVALID;
+
+		return 0;
+	}
+	if (JSON_FIELD_NUMBER == field->type
+	    && ('-' == *start || (*start >= '0' && *start <= '9'))) {
+		if (0 != scan_number(scanner)) {
+			return -1;
+		}
+		length = scanner->pos - start;
+		if (length >= NUMBER_SIZE) {
+			field->status = JSON_FIELD_INVALID;
+
+			return 0;
+		}
+		memcpy(number, start, length);
+		number[length] = '\0';
+		field->number = strtod(number, NULL);
+		field->status = JSON_FIELD_FOUND;
+
+		return 0;
+	}
+	field->status = JSON_FIELD_INVALID;
+
+	return scan_value(scanner);
+}
+
+/**
+ * Scan an array and all its elements.
+ *
+ * @param scanner is positioned at the opening bracket.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_array(struct json_scanner *scanner)
+{
+	scanner->pos++;
+	skip_whitespace(scanner);
+	if (scanner->pos < scanner->end && ']' == *scanner->pos) {
+		scanner->pos++;
+
+		return 0;
+	}
+	while (scanner->pos < scanner->end) {
+		if (0 != scan_value(scanner)) {
+			return -1;
+		}
+		skip_whitespace(scanner);
+		if (scanner->pos >= scanner->end) {
+			return -1;
+		}
+		if (']' == *scanner->pos) {
+			scanner->pos++;
+
+			return 0;
+		}
+		if (',' != *scanner->pos) {
+			return -1;
+		}
+		scanner->pos++;
+		skip_whitespace(scanner);
+	}
+
+	return -1;
+}
+
+/**
+ * Scan one or more decimal digits.
+ *
+ * @param scanner is positioned at the first digit.
+ *
+ * @return zero on success or a non zero value if there is no digit.
+ */
+static int scan_digits(struct json_scanner *scanner)
+{
+	const char *start = scanner->pos;
+
+	while (scanner->pos < scanner->end && *scanner->pos >= '0'
+	       && *scanner->pos <= '9') {
+		scanner->pos++;
+	}
+
+	return start == scanner->pos ? -1 : 0;
+}
+
+/**
+ * Scan the four hexadecimal digits of an unicode escape sequence.
+ *
+ * @param scanner is positioned at the first digit.
+ * @param code is set to the value of the digits.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_hex(struct json_scanner *scanner, unsigned int *code)
+{
+	char digit = 0;
+
+	if (scanner->end - scanner->pos < 4) {
+		return -1;
+	}
+	*code = 0;
+	for (int i = 0; i < 4; i++) {
+		digit = *scanner->pos++;
+		*code <<= 4;
+		if (digit >= '0' && digit <= '9') {
+			*code |= digit - '0';
+		} else if (digit >= 'a' && digit <= 'f') {
+			*code |= digit - 'a' + 10;
+		} else if (digit >= 'A' && digit <= 'F') {
+			*code |= digit - 'A' + 10;
+		} else {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Scan one of the literals true, false and null.
+ *
+ * @param scanner is positioned at the start of the literal.
+ * @param literal is the expected literal.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_literal(struct json_scanner *scanner, const char *literal)
+{
+	size_t length = strlen(literal);
+
+	if ((size_t) (scanner->end - scanner->pos) < length
+	    || 0 != memcmp(scanner->pos, literal, length)) {
+		return -1;
+	}
+	scanner->pos += length;
+
+	return 0;
+}
+
+/**
+ * Scan a number.
+ *
+ * @param scanner is positioned at the start of the number.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_number(struct json_scanner *scanner)
+{
+	if (scanner->pos < scanner->end && '-' == *scanner->pos) {
+		scanner->pos++;
+	}
+	if (scanner->pos < scanner->end && '0' == *scanner->pos) {
+		scanner->pos++;
+	} else if (0 != scan_digits(scanner)) {
+		return -1;
+	}
+	if (scanner->pos < scanner->end && '.' == *scanner->pos) {
+		scanner->pos++;
+		if (0 != scan_digits(scanner)) {
+			return -1;
+		}
+	}
+	if (scanner->pos < scanner->end
+	    && ('e' == *scanner->pos || 'E' == *scanner->pos)) {
+		scanner->pos++;
+		if (scanner->pos < scanner->end
+		    && ('+' == *scanner->pos || '-' == *scanner->pos)) {
+			scanner->pos++;
+		}
+		if (0 != scan_digits(scanner)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Scan an object and all its members.
+ *
+ * @param scanner is positioned at the opening brace.
+ * @param fields are the members to extract or NULL for nested objects.
+ * @param field_count is the number of fields.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_object(struct json_scanner *scanner, struct json_field *fields,
+		       size_t field_count)
+{
+	char name[NAME_SIZE];
+	size_t name_len = 0;
+	struct json_field *field = NULL;
+
+	scanner->pos++;
+	skip_whitespace(scanner);
+	if (scanner->pos < scanner->end && '}' == *scanner->pos) {
+		scanner->pos++;
+
+		return 0;
+	}
+	while (scanner->pos < scanner->end) {
+		if (0 != scan_string(scanner, fields ? name : NULL,
+				     sizeof(name), &name_len)) {
+			return -1;
+		}
+		skip_whitespace(scanner);
+		if (scanner->pos >= scanner->end || ':' != *scanner->pos) {
+			return -1;
+		}
+		scanner->pos++;
+		skip_whitespace(scanner);
+		if (scanner->pos >= scanner->end) {
+			return -1;
+		}
+		field = NULL;
+		for (size_t i = 0; fields && i < field_count; i++) {
+			if (name_len < sizeof(name)
+			    && 0 == strcmp(name, fields[i].name)
+			    && JSON_FIELD_MISSING == fields[i].status) {
+				field = fields + i;
+				break;
+			}
+		}
+		if (field ? 0 != extract_field(scanner, field) :
+		    0 != scan_value(scanner)) {
+			return -1;
+		}
+		skip_whitespace(scanner);
+		if (scanner->pos >= scanner->end) {
+			return -1;
+		}
+		if ('}' == *scanner->pos) {
+			scanner->pos++;
+
+			return 0;
+		}
+		if (',' != *scanner->pos) {
+			return -1;
+		}
+		scanner->pos++;
+		skip_whitespace(scanner);
+	}
+
+	return -1;
+}
+
+/**
+ * Scan and decode a string.
+ *
+ * @param scanner is positioned at the opening quote.
+ * @param out is the storage for the decoded and null terminated string or
+ *            NULL to only validate the string.
+ * @param size is the size of the storage in bytes.
+ * @param length is set to the length of the decoded string. If it is not
+ *               smaller than the size, the string was truncated.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_string(struct json_scanner *scanner, char *out, size_t size,
+		       size_t *length)
+{
+	unsigned char c = 0;
+	unsigned int code = 0;
+	unsigned int low = 0;
+
+	*length = 0;
+	if (scanner->pos >= scanner->end || '"' != *scanner->pos) {
+		return -1;
+	}
+	scanner->pos++;
+	while (scanner->pos < scanner->end) {
+		c = *scanner->pos++;
+		if ('"' == c) {
+			if (out && size) {
+				out[*length < size ? *length : size - 1] = '\0';
+			}
+
+			return 0;
+		}
+		if (c < 0x20) {
+			return -1;
+		}
+		if ('\\' != c) {
+			if (out && *length + 1 < size) {
+				out[*length] = c;
+			}
+			(*length)++;
+			continue;
+		}
+		if (scanner->pos >= scanner->end) {
+			return -1;
+		}
+		c = *scanner->pos++;
+		switch (c) {
+		case '"':
+		case '\\':
+		case '/':
+			code = c;
+			break;
+		case 'b':
+			code = '\b';
+			break;
+		case 'f':
+			code = '\f';
+			break;
+		case 'n':
+			code = '\n';
+			break;
+		case 'r':
+			code = '\r';
+			break;
+		case 't':
+			code = '\t';
+			break;
+		case 'u':
+			if (0 != scan_hex(scanner, &code)) {
+				return -1;
+			}
+			if (code >= 0xdc00 && code <= 0xdfff) {
+				return -1;
+			}
+			if (code < 0xd800 || code > 0xdbff) {
+				break;
+			}
+			// A high surrogate is followed by a low surrogate.
+			if (0 != scan_literal(scanner, "\\u")
+			    || 0 != scan_hex(scanner, &low)
+			    || low < 0xdc00 || low > 0xdfff) {
+				return -1;
+			}
+			code = 0x10000 + ((code - 0xd800) << 10)
+			    + (low - 0xdc00);
+			break;
+		default:
+			return -1;
+		}
+		if (0 != append_utf8(out, size, length, code)) {
+			return -1;
+		}
+	}
+
+	return -1;
+}
+
+/**
+ * Scan any value.
+ *
+ * @param scanner is positioned at the start of the value.
+ *
+ * @return zero on success or a non zero value on a syntax error.
+ */
+static int scan_value(struct json_scanner *scanner)
+{
+	size_t length = 0;
+	int result = 0;
+
+	if (scanner->pos >= scanner->end) {
+		return -1;
+	}
+	switch (*scanner->pos) {
+	case '{':
+	case '[':
+		if (++scanner->depth > MAX_DEPTH) {
+			return -1;
+		}
+		if ('{' == *scanner->pos) {
+			result = scan_object(scanner, NULL, 0);
+		} else {
+			result = scan_array(scanner);
+		}
+		scanner->depth--;
+
+		return result;
+	case '"':
+		return scan_string(scanner, NULL, 0, &length);
+	case 't':
+		return scan_literal(scanner, "true");
+	case 'f':
+		return scan_literal(scanner, "false");
+	case 'n':
+		return scan_literal(scanner, "null");
+	default:
+		return scan_number(scanner);
+	}
+}
+
+/**
+ * Skip the whitespace between tokens.
+ *
+ * @param scanner is the scanner.
+ */
+static void skip_whitespace(struct json_scanner *scanner)
+{
+	while (scanner->pos < scanner->end
+	       && (' ' == *scanner->pos || '\t' == *scanner->pos
+		   || '\n' == *scanner->pos || '\r' == *scanner->pos)) {
+		scanner->pos++;
+	}
+}
@@ -0,0 +1,84 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_JSON_SCAN_H
+#define UNLOCKED_JSON_SCAN_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+enum json_field_type {
+	JSON_FIELD_NUMBER,
+	JSON_FIELD_STRING,
+};
+
+enum json_field_status {
+	/**
+	 * The object has no member with the name of the field.
+	 */
+	JSON_FIELD_MISSING,
+	JSON_FIELD_FOUND,
+	/**
+	 * The value has another type than the field or a string is too long
+	 * for the storage of the field.
+	 */
+	JSON_FIELD_INVALID,
+};
+
+/**
+ * A member of a json object, that is extracted without building a tree.
+ */
+struct json_field {
+	const char *name;
+	enum json_field_type type;
+	enum json_field_status status;
+	/**
+	 * The value of a number field.
+	 */
+	double number;
+	/**
+	 * The storage for the decoded and null terminated value of a string
+	 * field.
+	 */
+	char *string;
+	size_t string_size;
+};
+
+/**
+ * Extract members from a json object.
+ *
+ * The document is scanned once and validated completely, but only the values
+ * of the requested members of the top-level object are kept. Of duplicate
+ * members, the first one is used.
+ *
+ * @param json is the json document, which does not need to be null
+ *             terminated.
+ * @param length is the length of the document in bytes.
+ * @param fields are the members to extract. Their status and value are
+ *               updated.
+ * @param field_count is the number of fields.
+ *
+ * @return UL_OK if the document is a valid json object or UL_ERR otherwise.
+ */
+enum unlocked_err scan_json_object(const char *json, size_t length,
+				   struct json_field *fields,
+				   size_t field_count);
+
+#endif
@@ -0,0 +1,177 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "key-cache.h"
+#include "locked-memory.h"
+
+static int is_expired(const struct cached_key *entry,
+		      const struct timespec *now);
+static void remove_cached_key(struct key_cache *cache, size_t index);
+
+enum unlocked_err cache_key(struct key_cache *cache, const char *handle,
+			    const char *key, size_t key_len)
+{
+	struct cached_key *entries = NULL;
+	struct cached_key *entry = NULL;
+	char *copy = NULL;
+
+	copy = alloc_locked(key_len + 1);
+	if (NULL == copy) {
+		return UL_MALLOC;
+	}
+	memcpy(copy, key, key_len);
+	for (size_t i = 0; i < cache->count && NULL == entry; i++) {
+		if (0 == strcmp(handle, cache->entries[i].handle)) {
+			entry = &(cache->entries[i]);
+			free_locked(entry->key, entry->key_len + 1);
+		}
+	}
+	if (NULL == entry) {
+		if (cache->count == cache->size) {
+			entries = realloc(cache->entries,
+					  sizeof(struct cached_key)
+					  * (cache->size + 4));
+			if (NULL == entries) {
+				free_locked(copy, key_len + 1);
+
+				return UL_MALLOC;
+			}
+			cache->entries = entries;
+			cache->size += 4;
+		}
+		entry = &(cache->entries[cache->count]);
+		entry->handle = strdup(handle);
+		if (NULL == entry->handle) {
+			free_locked(copy, key_len + 1);
+
+			return UL_MALLOC;
+		}
+		cache->count++;
+	}
+	entry->key = copy;
+	entry->key_len = key_len;
+	clock_gettime(CLOCK_MONOTONIC, &(entry->expires));
+	entry->expires.tv_sec += cache->ttl / 1000;
+	entry->expires.tv_nsec += (cache->ttl % 1000) * 1000000;
+	if (entry->expires.tv_nsec >= 1000000000) {
+		entry->expires.tv_sec++;
+		entry->expires.tv_nsec -= 1000000000;
+	}
+
+	return UL_OK;
+}
+
+size_t expire_cached_keys(struct key_cache *cache, struct timespec *next)
+{
+	struct timespec now = { 0 };
+	size_t i = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	while (i < cache->count) {
+		if (is_expired(&(cache->entries[i]), &now)) {
+			remove_cached_key(cache, i);
+			continue;
+		}
+		if (0 == i || is_expired(&(cache->entries[i]), next)) {
+			*next = cache->entries[i].expires;
+		}
+		i++;
+	}
+
+	return cache->count;
+}
+
+const struct cached_key *find_cached_key(struct key_cache *cache,
+					 const char *handle)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (size_t i = 0; i < cache->count; i++) {
+		if (strcmp(handle, cache->entries[i].handle)) {
+			continue;
+		}
+		if (is_expired(&(cache->entries[i]), &now)) {
+			remove_cached_key(cache, i);
+
+			return NULL;
+		}
+
+		return &(cache->entries[i]);
+	}
+
+	return NULL;
+}
+
+void free_key_cache(struct key_cache *cache)
+{
+	while (cache->count) {
+		remove_cached_key(cache, cache->count - 1);
+	}
+	free(cache->entries);
+	cache->entries = NULL;
+	cache->size = 0;
+}
+
+void init_key_cache(struct key_cache *cache, long ttl)
+{
+	cache->count = 0;
+	cache->entries = NULL;
+	cache->size = 0;
+	cache->ttl = ttl;
+}
+
+/**
+ * Check whether a key has expired.
+ *
+ * @param entry is the cached key.
+ * @param now is the current time on the monotonic clock.
+ *
+ * @return non zero if the key has expired.
+ */
+static int is_expired(const struct cached_key *entry,
+		      const struct timespec *now)
+{
+	if (entry->expires.tv_sec != now->tv_sec) {
+		return entry->expires.tv_sec < now->tv_sec;
+	}
+
+	return entry->expires.tv_nsec <= now->tv_nsec;
+}
+
+/**
+ * Wipe a key and remove it from the cache.
+ *
+ * @param cache is the cache.
+ * @param index is the index of the key.
+ */
+static void remove_cached_key(struct key_cache *cache, size_t index)
+{
+	struct cached_key *entry = &(cache->entries[index]);
+
+	free_locked(entry->key, entry->key_len + 1);
+	free(entry->handle);
+	cache->count--;
+	if (index < cache->count) {
+		*entry = cache->entries[cache->count];
+	}
+}
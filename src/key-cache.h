@@ -0,0 +1,105 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_KEY_CACHE_H
+#define UNLOCKED_KEY_CACHE_H
+
+#include <stddef.h>
+#include <time.h>
+#include "error.h"
+
+/**
+ * A key kept in memory for later requests.
+ */
+struct cached_key {
+	char *handle;
+	/**
+	 * The key in locked memory, terminated by a null byte.
+	 */
+	char *key;
+	size_t key_len;
+	/**
+	 * The time on the monotonic clock the key is wiped at.
+	 */
+	struct timespec expires;
+};
+
+/**
+ * Keeps received keys in locked memory for a limited time.
+ */
+struct key_cache {
+	struct cached_key *entries;
+	size_t count;
+	size_t size;
+	/**
+	 * The time in milliseconds keys are kept.
+	 */
+	long ttl;
+};
+
+/**
+ * Store a key in the cache or replace the cached key with the same handle.
+ *
+ * @param cache is the cache.
+ * @param handle is the handle of the key.
+ * @param key is the key to copy into the cache.
+ * @param key_len is the length of the key.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err cache_key(struct key_cache *cache, const char *handle,
+			    const char *key, size_t key_len);
+
+/**
+ * Wipe all keys, that have expired.
+ *
+ * @param cache is the cache.
+ * @param next is set to the time the next key expires at, if any.
+ *
+ * @return the number of keys left in the cache.
+ */
+size_t expire_cached_keys(struct key_cache *cache, struct timespec *next);
+
+/**
+ * Find a key, that has not expired yet.
+ *
+ * @param cache is the cache.
+ * @param handle is the handle of the key.
+ *
+ * @return the cached key or NULL if the key is not cached.
+ */
+const struct cached_key *find_cached_key(struct key_cache *cache,
+					 const char *handle);
+
+/**
+ * Wipe all keys and free the cache.
+ *
+ * @param cache is the cache.
+ */
+void free_key_cache(struct key_cache *cache);
+
+/**
+ * Initialize an empty cache.
+ *
+ * @param cache is the cache to initialize.
+ * @param ttl is the time in milliseconds keys are kept.
+ */
+void init_key_cache(struct key_cache *cache, long ttl);
+
+#endif
@@ -0,0 +1,174 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdalign.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "locked-memory.h"
+#include "log.h"
+
+/**
+ * The alignment of the buffers allocated from an arena.
+ */
+#define ARENA_ALIGNMENT alignof(max_align_t)
+
+static size_t get_mapping_size(size_t size);
+
+void *arena_alloc(struct secure_arena *arena, size_t size)
+{
+	size_t offset = (arena->used + ARENA_ALIGNMENT - 1)
+	    & ~(ARENA_ALIGNMENT - 1);
+
+	if (NULL == arena->base || offset > arena->size
+	    || size > arena->size - offset) {
+		return NULL;
+	}
+	arena->last = offset;
+	arena->used = offset + size;
+
+	return arena->base + offset;
+}
+
+void *arena_realloc(struct secure_arena *arena, void *ptr, size_t old_size,
+		    size_t size)
+{
+	char *buffer = ptr;
+
+	if (NULL == buffer) {
+		return arena_alloc(arena, size);
+	}
+	if (buffer == arena->base + arena->last
+	    && size <= arena->size - arena->last) {
+		if (size < old_size) {
+			explicit_bzero(buffer + size, old_size - size);
+		}
+		arena->used = arena->last + size;
+
+		return buffer;
+	}
+	buffer = arena_alloc(arena, size);
+	if (NULL == buffer) {
+		return NULL;
+	}
+	memcpy(buffer, ptr, old_size < size ? old_size : size);
+	// The old buffer stays in the arena until it is reset, but it does
+	// not keep a copy of the secret.
+	explicit_bzero(ptr, old_size);
+
+	return buffer;
+}
+
+char *arena_strdup(struct secure_arena *arena, const char *str)
+{
+	size_t size = strlen(str) + 1;
+	char *copy = arena_alloc(arena, size);
+
+	if (NULL == copy) {
+		return NULL;
+	}
+	memcpy(copy, str, size);
+
+	return copy;
+}
+
+void free_arena(struct secure_arena *arena)
+{
+	free_locked(arena->base, arena->size);
+	arena->base = NULL;
+	arena->size = 0;
+	arena->used = 0;
+	arena->last = 0;
+}
+
+enum unlocked_err init_arena(struct secure_arena *arena, size_t size)
+{
+	arena->base = alloc_locked(size);
+	if (NULL == arena->base) {
+		return UL_MALLOC;
+	}
+	arena->size = size;
+	arena->used = 0;
+	arena->last = 0;
+
+	return UL_OK;
+}
+
+void reset_arena(struct secure_arena *arena)
+{
+	if (arena->used) {
+		explicit_bzero(arena->base, arena->used);
+	}
+	arena->used = 0;
+	arena->last = 0;
+}
+
+void *alloc_locked(size_t size)
+{
+	static int warned = 0;
+	size_t mapping_size = get_mapping_size(size);
+	void *ptr = NULL;
+
+	ptr = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == ptr) {
+		return NULL;
+	}
+	madvise(ptr, mapping_size, MADV_DONTDUMP);
+	if (mlock(ptr, mapping_size) && !warned) {
+		// Usually the limit for locked memory is exceeded. The memory
+		// is still usable, but may be swapped out.
+		logger(LOG_WARNING, "Could not lock memory for secrets\n");
+		warned = 1;
+	}
+
+	return ptr;
+}
+
+void free_locked(void *ptr, size_t size)
+{
+	size_t mapping_size = get_mapping_size(size);
+
+	if (NULL == ptr) {
+		return;
+	}
+	explicit_bzero(ptr, mapping_size);
+	munlock(ptr, mapping_size);
+	munmap(ptr, mapping_size);
+}
+
+/**
+ * Round a size up to whole pages.
+ *
+ * @param size is the size in bytes.
+ *
+ * @return the size of the mapping for the memory.
+ */
+static size_t get_mapping_size(size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+
+	if (0 == size) {
+		size = 1;
+	}
+
+	return (size + page_size - 1) / page_size * page_size;
+}
@@ -0,0 +1,126 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_LOCKED_MEMORY_H
+#define UNLOCKED_LOCKED_MEMORY_H
+
+#include <stddef.h>
+
+#include "error.h"
+
+/**
+ * Memory for secrets, from which buffers are allocated one after another.
+ *
+ * The arena is backed by a single mapping allocated with `alloc_locked`.
+ * Buffers are never freed individually. Instead all of them are wiped at once
+ * when the arena is reset.
+ */
+struct secure_arena {
+	char *base;
+	size_t size;
+	size_t used;
+	/**
+	 * The offset of the most recent buffer, which can be resized in place.
+	 */
+	size_t last;
+};
+
+/**
+ * Allocate a buffer from an arena.
+ *
+ * @param arena is the arena.
+ * @param size is the size of the buffer in bytes.
+ *
+ * @return the zero initialized buffer or NULL if the arena is exhausted.
+ */
+void *arena_alloc(struct secure_arena *arena, size_t size);
+
+/**
+ * Resize a buffer allocated from an arena.
+ *
+ * The most recent buffer is resized in place, any other buffer is copied.
+ *
+ * @param arena is the arena.
+ * @param ptr is the buffer to resize or NULL to allocate a new buffer.
+ * @param old_size is the current size of the buffer.
+ * @param size is the new size of the buffer.
+ *
+ * @return the resized buffer or NULL if the arena is exhausted. The original
+ *         buffer is left untouched in this case.
+ */
+void *arena_realloc(struct secure_arena *arena, void *ptr, size_t old_size,
+		    size_t size);
+
+/**
+ * Copy a string into an arena.
+ *
+ * @param arena is the arena.
+ * @param str is the string to copy.
+ *
+ * @return the copy or NULL if the arena is exhausted.
+ */
+char *arena_strdup(struct secure_arena *arena, const char *str);
+
+/**
+ * Wipe and free the memory of an arena.
+ *
+ * @param arena is the arena. Freeing an arena, that has not been initialized
+ *              or that has been freed already, is allowed.
+ */
+void free_arena(struct secure_arena *arena);
+
+/**
+ * Map the memory of an arena.
+ *
+ * @param arena is the arena to initialize.
+ * @param size is the number of bytes available in the arena.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err init_arena(struct secure_arena *arena, size_t size);
+
+/**
+ * Wipe all buffers of an arena and make its memory available again.
+ *
+ * @param arena is the arena.
+ */
+void reset_arena(struct secure_arena *arena);
+
+/**
+ * Allocate memory for secrets, that is never swapped out nor included in core
+ * dumps.
+ *
+ * The memory is mapped separately from the heap and zero initialized.
+ *
+ * @param size is the number of bytes to allocate.
+ *
+ * @return the memory, that must be freed with `free_locked`, or NULL on
+ *         failure.
+ */
+void *alloc_locked(size_t size);
+
+/**
+ * Wipe and free memory allocated with `alloc_locked`.
+ *
+ * @param ptr is the memory to free. Passing NULL is allowed.
+ * @param size is the size passed to `alloc_locked`.
+ */
+void free_locked(void *ptr, size_t size);
+
+#endif
@@ -19,6 +19,7 @@
 
 #include <stdlib.h>
 
+#include "agent.h"
 #include "cli.h"
 #include "client.h"
 #include "error.h"
@@ -26,8 +27,15 @@
 #include "mod/module.h"
 #include "mod/mod_sd_socket.h"
 #include "mod/mod_stdout.h"
+#include "resolver.h"
+#include "trace.h"
 #include "version.h"
 
+/**
+ * The maximum delay between polls in milliseconds, unless configured.
+ */
+#define DEFAULT_POLL_MAX_INTERVAL 10000
+
 const char *argp_program_version = "unlocked-client " UNLOCKED_VERSION;
 const char *argp_program_bug_address = "<mail@kalehmann.de>";
 
@@ -38,12 +46,44 @@ static int validate_args(struct arguments *arguments)
 
 		return EXIT_FAILURE;
 	}
+	if (arguments->long_poll_timeout <= 0) {
+		fprintf(stderr, "Invalid long poll timeout given\n");
+
+		return EXIT_FAILURE;
+	}
+	if (arguments->max_response_size <= 0) {
+		fprintf(stderr, "Invalid maximum response size given\n");
+
+		return EXIT_FAILURE;
+	}
+	if (arguments->poll_interval <= 0) {
+		fprintf(stderr, "Invalid poll interval given\n");
+
+		return EXIT_FAILURE;
+	}
+	if (arguments->poll_max_interval < arguments->poll_interval) {
+		fprintf(stderr, "The maximum poll interval must not be smaller "
+			"than the poll interval\n");
+
+		return EXIT_FAILURE;
+	}
+	if (arguments->poll_multiplier < 1) {
+		fprintf(stderr, "The poll multiplier must be at least 1\n");
+
+		return EXIT_FAILURE;
+	}
 	if (0 == arguments->port) {
 		fprintf(stderr, "Invalid port given\n");
 
 		return EXIT_FAILURE;
 	}
-	if (NULL == arguments->key_handle) {
+	if (arguments->key_ttl <= 0) {
+		fprintf(stderr, "Invalid key ttl given\n");
+
+		return EXIT_FAILURE;
+	}
+	if (yes != arguments->agent && NULL == arguments->key_handle
+	    && 0 == arguments->key_count) {
 		fprintf(stderr, "No key handle given\n");
 
 		return EXIT_FAILURE;
@@ -65,37 +105,91 @@ static int validate_args(struct arguments *arguments)
 int main(int argc, char **argv)
 {
 	enum unlocked_err err = UL_OK;
+	long long begin = 0;
+	struct resolver resolver = { 0 };
 	struct arguments *arguments = create_args();
 	if (NULL == arguments) {
 		return EXIT_FAILURE;
 	}
+	arguments->hedge_delay = 1000;
+	arguments->key_ttl = 300;
+	arguments->long_poll_timeout = 60;
+	arguments->max_response_size = 1024 * 1024;
+	arguments->poll_interval = 1000;
+	arguments->poll_jitter = yes;
+	arguments->poll_multiplier = 1.5;
 	arguments->port = 443;
 	arguments->validate = yes;
 
 	register_module(get_mod_sd_socket());
 	register_module(get_mod_stdout());
+	begin = trace_now();
 	handle_args(argc, argv, arguments);
+	// The spans of the arguments are kept until the trace file is known.
+	if (arguments->trace_file
+	    && UL_OK != open_trace(arguments->trace_file)) {
+		logger(LOG_ERROR, "Could not open the trace file %s\n",
+		       arguments->trace_file);
+	}
+	trace_span(TRACE_MAIN, "handle_args", begin);
+	// Without a configured maximum, a longer poll interval raises it.
+	if (0 == arguments->poll_max_interval) {
+		arguments->poll_max_interval = DEFAULT_POLL_MAX_INTERVAL;
+		if (arguments->poll_interval > DEFAULT_POLL_MAX_INTERVAL) {
+			arguments->poll_max_interval = arguments->poll_interval;
+		}
+	}
 	if (EXIT_SUCCESS != validate_args(arguments)) {
 		free_args(arguments);
 		free_child_parsers();
+		free_secrets();
+		cleanup_modules();
+		close_trace();
+
+		return EXIT_FAILURE;
+	}
+	// The servers are resolved while the modules are initialized.
+	err = start_resolver(&resolver, arguments->host, arguments->port,
+			     arguments->resolve);
+	if (UL_OK != err) {
+		free_args(arguments);
+		free_child_parsers();
+		free_secrets();
 		cleanup_modules();
+		close_trace();
+		logger(LOG_ERROR, ul_error(err));
 
 		return EXIT_FAILURE;
 	}
-	err = initialize_modules();
+	// The agent hands out keys itself instead of the modules.
+	if (yes != arguments->agent) {
+		begin = trace_now();
+		err = initialize_modules();
+		trace_span(TRACE_MAIN, "initialize_modules", begin);
+	}
 	if (UL_OK != err) {
+		free_resolver(&resolver);
 		free_args(arguments);
 		free_child_parsers();
+		free_secrets();
 		cleanup_modules();
+		close_trace();
 		logger(LOG_ERROR, ul_error(err));
 
 		return EXIT_FAILURE;
 	}
 
-	err = request_key(arguments);
+	if (yes == arguments->agent) {
+		err = run_agent(arguments, &resolver);
+	} else {
+		err = request_key(arguments, &resolver);
+	}
+	free_resolver(&resolver);
 	free_args(arguments);
 	free_child_parsers();
+	free_secrets();
 	cleanup_modules();
+	close_trace();
 	if (UL_OK != err) {
 		logger(LOG_ERROR, ul_error(err));
 
@@ -0,0 +1,161 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <sys/stat.h>
+
+#include "metrics.h"
+#include "runtime.h"
+
+static void print_counter(FILE *file, const char *name, const char *help,
+			  long long value);
+
+/**
+ * The upper bounds of the buckets of the unlock durations in microseconds.
+ * Most of the time is spent waiting for the approval by a human.
+ */
+static const long long bucket_bounds[UNLOCK_BUCKET_COUNT] = {
+	500000, 1000000, 2500000, 5000000, 10000000, 30000000, 60000000,
+	120000000, 300000000, 600000000,
+};
+
+/**
+ * The labels of the outcomes of the negotiations.
+ */
+static const char *const result_labels[UNLOCK_RESULT_COUNT] = {
+	[UL_OK] = "result=\"accepted\"",
+	[UL_CURL] = "result=\"error\",error=\"curl\"",
+	[UL_DENIED] = "result=\"denied\"",
+	[UL_ERR] = "result=\"error\",error=\"err\"",
+	[UL_ERRNO] = "result=\"error\",error=\"errno\"",
+	[UL_MALLOC] = "result=\"error\",error=\"malloc\"",
+	[UL_SD_SOCKET_DISABLED] =
+	    "result=\"error\",error=\"sd_socket_disabled\"",
+	[UL_SD_SOCKET_NO_FD] = "result=\"error\",error=\"sd_socket_no_fd\"",
+};
+
+void print_metrics(FILE *file, const struct unlock_metrics *metrics)
+{
+	unsigned long cumulative = 0;
+
+	fprintf(file, "# HELP unlocked_unlock_duration_seconds Time from "
+		"requesting a key until it was received or the negotiation "
+		"failed.\n"
+		"# TYPE unlocked_unlock_duration_seconds histogram\n");
+	for (int i = 0; i < UNLOCK_BUCKET_COUNT; i++) {
+		cumulative += metrics->buckets[i];
+		fprintf(file, "unlocked_unlock_duration_seconds_bucket"
+			"{le=\"%g\"} %lu\n", bucket_bounds[i] / 1000000.0,
+			cumulative);
+	}
+	fprintf(file, "unlocked_unlock_duration_seconds_bucket{le=\"+Inf\"} "
+		"%lu\n"
+		"unlocked_unlock_duration_seconds_sum %.6f\n"
+		"unlocked_unlock_duration_seconds_count %lu\n",
+		metrics->unlocks, metrics->duration / 1000000.0,
+		metrics->unlocks);
+	fprintf(file, "# HELP unlocked_unlocks_total Finished negotiations of "
+		"keys by their outcome.\n"
+		"# TYPE unlocked_unlocks_total counter\n");
+	for (int i = 0; i < UNLOCK_RESULT_COUNT; i++) {
+		fprintf(file, "unlocked_unlocks_total{%s} %lu\n",
+			result_labels[i], metrics->results[i]);
+	}
+	print_counter(file, "unlocked_polls_total", "Polls and streaming "
+		      "requests of the request states.", metrics->polls);
+	print_counter(file, "unlocked_connections_total", "Connections opened "
+		      "to the servers.", metrics->connections);
+	print_counter(file, "unlocked_tls_resumptions_total", "TLS handshakes, "
+		      "that resumed an earlier session.",
+		      metrics->resumptions);
+	print_counter(file, "unlocked_retries_total", "Requests for access to "
+		      "a key sent to the next server after a failure.",
+		      metrics->retries);
+	print_counter(file, "unlocked_received_bytes_total", "Size of the "
+		      "received HTTP messages including their headers.",
+		      metrics->bytes_in);
+	print_counter(file, "unlocked_sent_bytes_total", "Size of the sent "
+		      "HTTP messages including their headers.",
+		      metrics->bytes_out);
+}
+
+void record_unlock(struct unlock_metrics *metrics, enum unlocked_err err,
+		   const struct timespec *since)
+{
+	struct timespec now = { 0 };
+	long long duration = 0;
+	int bucket = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	duration = (now.tv_sec - since->tv_sec) * 1000000LL
+	    + (now.tv_nsec - since->tv_nsec) / 1000;
+	while (bucket < UNLOCK_BUCKET_COUNT
+	       && duration > bucket_bounds[bucket]) {
+		bucket++;
+	}
+	// Negotiations longer than the last bound are only counted in the
+	// implicit "+Inf" bucket.
+	if (bucket < UNLOCK_BUCKET_COUNT) {
+		metrics->buckets[bucket]++;
+	}
+	metrics->unlocks++;
+	metrics->duration += duration;
+	if ((unsigned int) err < UNLOCK_RESULT_COUNT) {
+		metrics->results[err]++;
+	}
+}
+
+enum unlocked_err write_metrics(const char *path,
+				const struct unlock_metrics *metrics)
+{
+	struct atomic_file file = { 0 };
+	enum unlocked_err err = open_atomic_file(&file, path);
+
+	if (UL_OK != err) {
+		return err;
+	}
+	// The node_exporter usually runs as another user than the client.
+	if (fchmod(fileno(file.file), 0644)) {
+		discard_atomic_file(&file);
+
+		return UL_ERRNO;
+	}
+	print_metrics(file.file, metrics);
+	if (ferror(file.file)) {
+		discard_atomic_file(&file);
+
+		return UL_ERRNO;
+	}
+
+	return commit_atomic_file(&file);
+}
+
+/**
+ * Print a single counter with its help text.
+ *
+ * @param file is the file to print to.
+ * @param name is the name of the counter.
+ * @param help describes the counter.
+ * @param value is the value of the counter.
+ */
+static void print_counter(FILE *file, const char *name, const char *help,
+			  long long value)
+{
+	fprintf(file, "# HELP %s %s\n# TYPE %s counter\n%s %lld\n", name, help,
+		name, name, value);
+}
@@ -0,0 +1,115 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_METRICS_H
+#define UNLOCKED_METRICS_H
+
+#include <stdio.h>
+#include <time.h>
+#include <curl/curl.h>
+
+#include "error.h"
+
+/**
+ * The number of finite buckets of the histogram of the unlock durations.
+ */
+#define UNLOCK_BUCKET_COUNT 10
+
+/**
+ * The number of values of `enum unlocked_err`.
+ */
+#define UNLOCK_RESULT_COUNT (UL_SD_SOCKET_NO_FD + 1)
+
+/**
+ * Counters describing the negotiations of keys during a run of the client,
+ * that are exported for the textfile collector of the Prometheus
+ * node_exporter.
+ */
+struct unlock_metrics {
+	/**
+	 * The number of negotiations per bucket of the duration histogram.
+	 * Every negotiation is only counted in the smallest bucket it fits
+	 * in, the buckets are accumulated when the metrics are printed.
+	 */
+	unsigned long buckets[UNLOCK_BUCKET_COUNT];
+	/**
+	 * The number of finished negotiations.
+	 */
+	unsigned long unlocks;
+	/**
+	 * The sum of the durations of all negotiations in microseconds.
+	 */
+	unsigned long long duration;
+	/**
+	 * The number of finished negotiations per outcome.
+	 */
+	unsigned long results[UNLOCK_RESULT_COUNT];
+	/**
+	 * The number of polls and streaming requests of the request states.
+	 */
+	unsigned long polls;
+	/**
+	 * The number of requests for access to a key sent to the next server
+	 * after a server failed.
+	 */
+	unsigned long retries;
+	long connections;
+	/**
+	 * The number of TLS handshakes, that resumed an earlier session.
+	 */
+	long resumptions;
+	/**
+	 * The size of the received and sent HTTP messages including their
+	 * headers in bytes.
+	 */
+	curl_off_t bytes_in;
+	curl_off_t bytes_out;
+};
+
+/**
+ * Print the metrics in the Prometheus text exposition format.
+ *
+ * @param file is the file to print to.
+ * @param metrics are the metrics.
+ */
+void print_metrics(FILE *file, const struct unlock_metrics *metrics);
+
+/**
+ * Count a finished negotiation of a key.
+ *
+ * @param metrics are the metrics.
+ * @param err is the outcome of the negotiation.
+ * @param since is the start of the negotiation on the monotonic clock.
+ */
+void record_unlock(struct unlock_metrics *metrics, enum unlocked_err err,
+		   const struct timespec *since);
+
+/**
+ * Atomically replace a file with the metrics, so that the textfile collector
+ * never reads a partially written file.
+ *
+ * @param path is the path of the file, that should end with ".prom".
+ * @param metrics are the metrics.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err write_metrics(const char *path,
+				const struct unlock_metrics *metrics);
+
+#endif
@@ -16,10 +16,20 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
 #include <argp.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include <systemd/sd-daemon.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
 
+#include "../event-loop.h"
 #include "../log.h"
 #include "module.h"
 #include "mod_sd_socket.h"
@@ -27,11 +37,98 @@
 #define OPT_SD_SOCKET 350
 
 struct sd_socket_state {
-	int socket_fd;
+	/**
+	 * The number of consumers the key is delivered to before the sockets
+	 * are closed or zero to deliver the key until the timeout is reached.
+	 */
+	unsigned int consumers;
+	/**
+	 * The number of consumers the key has been delivered to.
+	 */
+	unsigned int deliveries;
+	/**
+	 * The name of the file descriptors passed by systemd for an instance
+	 * of a single key or NULL if all unnamed file descriptors are used.
+	 */
+	char *fd_name;
+	/**
+	 * Whether the consumers receive a file descriptor of a memfd with the
+	 * key instead of the key itself.
+	 */
+	unsigned int pass_fd;
+	/**
+	 * The next instance for a single key.
+	 */
+	struct sd_socket_state *next;
+	int *socket_fds;
+	size_t socket_count;
+	/**
+	 * The time in seconds the key is delivered for or zero to wait for
+	 * the consumers without time limit.
+	 */
+	long timeout;
+};
+
+struct key_server;
+
+/**
+ * The delivery of the key to a single consumer.
+ */
+struct key_delivery {
+	struct event_source source;
+	struct key_server *server;
+	struct key_delivery *next;
+	/**
+	 * Whether the consumer received the complete key.
+	 */
+	unsigned int delivered;
+	/**
+	 * The number of bytes of the key already sent.
+	 */
+	size_t sent;
+};
+
+/**
+ * Serves the key to all consumers connecting to the sockets.
+ */
+struct key_server {
+	unsigned int accepting;
+	unsigned int consumers;
+	unsigned int deliveries;
+	struct key_delivery *deliveries_pending;
+	const char *key;
+	/**
+	 * The memfd with the key passed to the consumers or -1 to send the
+	 * key itself.
+	 */
+	int key_fd;
+	size_t key_len;
+	struct event_source *listeners;
+	size_t listener_count;
+	struct event_loop *loop;
+	struct timer timeout;
 };
 
+static void accept_consumers(struct event_source *source, uint32_t events);
+static void close_delivery(struct key_delivery *delivery);
+static int collect_fds(struct sd_socket_state *state, int fd_count,
+		       char **socket_names);
+static void complete_delivery(struct key_delivery *delivery);
+static void handle_delivery(struct event_source *source, uint32_t events);
+static void handle_timeout(void *data);
+static struct sd_socket_state *init_state(void);
+static void release_delivery(struct event_source *source);
+static void send_key(struct key_delivery *delivery);
+static void send_key_fd(struct key_delivery *delivery);
+static void stop_accepting(struct key_server *server);
+
 static const char *const module_name = "mod_sd_socket";
 
+/**
+ * The instances for single keys, which take their file descriptors by name.
+ */
+static struct sd_socket_state *named_states = NULL;
+
 // *INDENT-OFF*
 static struct argp_option options[] = {
         {
@@ -62,13 +159,33 @@ static error_t sd_socket_parser(int key, char *arg, struct argp_state *state)
 
 static enum unlocked_err cleanup(struct unlocked_module *module)
 {
+	struct sd_socket_state *state = NULL;
+	struct sd_socket_state **link = &named_states;
+
 	if (NULL == module) {
 		return UL_OK;
 	}
 	if (NULL != module->argp) {
 		free(module->argp);
 	}
+	if (NULL != module->key_name) {
+		free(module->key_name);
+	}
 	if (NULL != module->state) {
+		state = module->state;
+		if (state->fd_name) {
+			free(state->fd_name);
+			while (*link && *link != state) {
+				link = &((*link)->next);
+			}
+			if (*link) {
+				*link = state->next;
+			}
+		}
+		for (size_t i = 0; i < state->socket_count; i++) {
+			close(state->socket_fds[i]);
+		}
+		free(state->socket_fds);
 		free(module->state);
 	}
 	free(module);
@@ -76,49 +193,169 @@ static enum unlocked_err cleanup(struct unlocked_module *module)
 	return UL_OK;
 }
 
+/**
+ * Take the file descriptors with the name configured for the instance.
+ */
+static enum unlocked_err init_named(struct unlocked_module *module,
+				    int fd_count, char **socket_names)
+{
+	struct sd_socket_state *state = module->state;
+
+	if (collect_fds(state, fd_count, socket_names)) {
+		return UL_MALLOC;
+	}
+	if (0 == state->socket_count) {
+		logger(LOG_ERROR, "No socket \"%s\" passed by systemd for the "
+		       "key \"%s\".\n", state->fd_name, module->key_name);
+
+		return UL_SD_SOCKET_NO_FD;
+	}
+	logger(LOG_DEBUG, "%zu socket(s) \"%s\" passed by systemd for the key "
+	       "\"%s\".\n", state->socket_count, state->fd_name,
+	       module->key_name);
+
+	return UL_OK;
+}
+
 static enum unlocked_err init(struct unlocked_module *module)
 {
+	enum unlocked_err err = UL_OK;
 	char **socket_names = 0;
 	int fd_count = sd_listen_fds_with_names(0, &socket_names);
 	struct sd_socket_state *state = module->state;
-	if (!module->enabled) {
-		if (fd_count > 0) {
-			return UL_SD_SOCKET_DISABLED;
-		}
-		return UL_OK;
-	}
 
-	if (fd_count == 0) {
-		return UL_SD_SOCKET_NO_FD;
+	if (state->fd_name) {
+		err = init_named(module, fd_count, socket_names);
+	} else if (!module->enabled) {
+		if (fd_count > 0 && NULL == named_states) {
+			err = UL_SD_SOCKET_DISABLED;
+		}
+	} else if (collect_fds(state, fd_count, socket_names)) {
+		err = UL_MALLOC;
+	} else if (0 == state->socket_count) {
+		err = UL_SD_SOCKET_NO_FD;
+	} else {
+		logger(LOG_DEBUG, "%zu socket(s) passed by systemd.\n",
+		       state->socket_count);
 	}
-	if (fd_count > 1) {
-		return UL_SD_SOCKET_MANY_FD;
+	for (int i = 0; socket_names && i < fd_count; i++) {
+		free(socket_names[i]);
 	}
+	free(socket_names);
 
-	logger(LOG_DEBUG, "Socket \"%s\" passed by systemd.\n",
-	       socket_names[0]);
-	state->socket_fd = SD_LISTEN_FDS_START + 0;
+	return err;
+}
 
-	return UL_OK;
+/**
+ * Serve the key to the consumers and log the number of deliveries.
+ *
+ * @param module is the instance of the module.
+ * @param key is the key or NULL if the memfd is passed.
+ * @param key_fd is the memfd with the key or -1 if the key is sent.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err serve(struct unlocked_module *module,
+			       const char *const key, int key_fd)
+{
+	enum unlocked_err err = UL_OK;
+	struct sd_socket_state *state = module->state;
+
+	err = serve_sd_sockets(state->socket_fds, state->socket_count, key,
+			       key_fd, state->consumers, state->timeout,
+			       &(state->deliveries));
+	if (module->key_name) {
+		logger(LOG_DEBUG, "Delivered the key \"%s\" to %u "
+		       "consumer(s)\n", module->key_name, state->deliveries);
+	} else {
+		logger(LOG_DEBUG, "Delivered the key to %u consumer(s)\n",
+		       state->deliveries);
+	}
+
+	return err;
 }
 
 static enum unlocked_err success(struct unlocked_module *module,
 				 const char *const key)
 {
-	int client_fd = 0, ret = 0;
-	size_t key_len = strlen(key);
-	struct sd_socket_state *state = module->state;
 	if (!module->enabled) {
 		return UL_OK;
 	}
-	client_fd = accept(state->socket_fd, NULL, NULL);
-	if (client_fd < 0) {
-		return UL_ERRNO;
+
+	return serve(module, key, -1);
+}
+
+static enum unlocked_err success_fd(struct unlocked_module *module,
+				    int key_fd)
+{
+	if (!module->enabled) {
+		return UL_OK;
+	}
+
+	return serve(module, NULL, key_fd);
+}
+
+/**
+ * Read how the key is served from the config file.
+ *
+ * The current values of the state are kept for missing entries.
+ *
+ * @param module is the instance of the module.
+ * @param ini is the dictionary of the parsed config file.
+ * @param section is the section of the entries.
+ * @param prefix is prepended to the names of the entries.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err parse_delivery(struct unlocked_module *module,
+					const dictionary * ini,
+					const char *section, const char *prefix)
+{
+	char name[32];
+	int consumers = 0;
+	char *consumers_entry = NULL;
+	enum unlocked_err err = UL_OK;
+	char *pass_fd_entry = NULL;
+	struct sd_socket_state *state = module->state;
+	long timeout = 0;
+	char *timeout_entry = NULL;
+
+	snprintf(name, sizeof(name), "%sconsumers", prefix);
+	consumers_entry = get_section_entry(section, name);
+	snprintf(name, sizeof(name), "%spass_fd", prefix);
+	pass_fd_entry = get_section_entry(section, name);
+	snprintf(name, sizeof(name), "%stimeout", prefix);
+	timeout_entry = get_section_entry(section, name);
+	if (NULL == consumers_entry || NULL == pass_fd_entry
+	    || NULL == timeout_entry) {
+		err = UL_MALLOC;
+	} else {
+		consumers = iniparser_getint(ini, consumers_entry,
+					     state->consumers);
+		timeout = iniparser_getlongint(ini, timeout_entry,
+					       state->timeout);
+		state->pass_fd = iniparser_getboolean(ini, pass_fd_entry,
+						      state->pass_fd);
+	}
+	if (UL_OK == err && consumers < 0) {
+		logger(LOG_ERROR, "Invalid number of consumers given in "
+		       "\"%s\"\n", consumers_entry);
+		err = UL_ERR;
+	}
+	if (UL_OK == err && timeout < 0) {
+		logger(LOG_ERROR, "Invalid timeout given in \"%s\"\n",
+		       timeout_entry);
+		err = UL_ERR;
 	}
-	ret = send(client_fd, key, key_len, 0);
-	if (ret < 0) {
-		return UL_ERRNO;
+	free(consumers_entry);
+	free(pass_fd_entry);
+	free(timeout_entry);
+	if (UL_OK != err) {
+		return err;
 	}
+	state->consumers = consumers;
+	state->timeout = timeout;
+	module->success_fd = state->pass_fd ? &success_fd : NULL;
 
 	return UL_OK;
 }
@@ -137,6 +374,86 @@ static enum unlocked_err parse_sd_socket_config(struct unlocked_module *module,
 		break;
 	}
 
+	return parse_delivery(module, ini, "sd_socket", "");
+}
+
+static struct unlocked_module *create_module(void)
+{
+	struct unlocked_module *module = malloc(sizeof(struct unlocked_module));
+	if (NULL == module) {
+		return NULL;
+	}
+	module->state = init_state();
+	if (NULL == module->state) {
+		free(module);
+
+		return NULL;
+	}
+	module->argp = NULL;
+	module->name = module_name;
+	module->key_name = NULL;
+	module->enabled = 0;
+	module->init = &init;
+	module->instantiate = NULL;
+	module->parse_config = NULL;
+	module->success = &success;
+	module->success_fd = NULL;
+	module->failure = NULL;
+	module->cleanup = &cleanup;
+
+	return module;
+}
+
+static enum unlocked_err instantiate(struct unlocked_module *module,
+				     const dictionary * ini,
+				     const char *section, const char *key_name,
+				     struct unlocked_module **instance)
+{
+	enum unlocked_err err = UL_OK;
+	const char *fd_name = NULL;
+	struct sd_socket_state *state = NULL;
+	int use = 0;
+	char *entry = get_section_entry(section, "use_socket");
+	if (NULL == entry) {
+		return UL_MALLOC;
+	}
+	use = iniparser_getboolean(ini, entry, 0);
+	free(entry);
+	if (!use) {
+		return UL_OK;
+	}
+	entry = get_section_entry(section, "socket");
+	if (NULL == entry) {
+		return UL_MALLOC;
+	}
+	fd_name = iniparser_getstring(ini, entry, key_name);
+	free(entry);
+	*instance = create_module();
+	if (NULL == *instance) {
+		return UL_MALLOC;
+	}
+	state = (*instance)->state;
+	// The settings of the [sd_socket] section are the defaults.
+	state->consumers = ((struct sd_socket_state *)module->state)->consumers;
+	state->pass_fd = ((struct sd_socket_state *)module->state)->pass_fd;
+	state->timeout = ((struct sd_socket_state *)module->state)->timeout;
+	err = parse_delivery(*instance, ini, section, "socket_");
+	if (UL_OK == err) {
+		state->fd_name = strdup(fd_name);
+		if (NULL == state->fd_name) {
+			err = UL_MALLOC;
+		}
+	}
+	if (UL_OK != err) {
+		cleanup(*instance);
+		*instance = NULL;
+
+		return err;
+	}
+	state->next = named_states;
+	named_states = state;
+	(*instance)->enabled = 1;
+
 	return UL_OK;
 }
 
@@ -163,34 +480,384 @@ static struct sd_socket_state *init_state(void)
 	if (NULL == state) {
 		return NULL;
 	}
-	state->socket_fd = 0;
+	state->consumers = 1;
+	state->deliveries = 0;
+	state->fd_name = NULL;
+	state->next = NULL;
+	state->pass_fd = 0;
+	state->socket_fds = NULL;
+	state->socket_count = 0;
+	state->timeout = 0;
 
 	return state;
 }
 
+unsigned int count_sd_socket_deliveries(const struct unlocked_module *module)
+{
+	const struct sd_socket_state *state = module->state;
+
+	return state->deliveries;
+}
+
 struct unlocked_module *get_mod_sd_socket(void)
 {
-	struct unlocked_module *module = malloc(sizeof(struct unlocked_module));
+	struct unlocked_module *module = create_module();
 	if (NULL == module) {
 		return NULL;
 	}
 	module->argp = init_argp();
 	if (NULL == module->argp) {
-		return NULL;
-	}
-	module->state = init_state();
-	if (NULL == module->state) {
-		free(module->argp);
+		cleanup(module);
 
 		return NULL;
 	}
-	module->name = module_name;
-	module->enabled = 0;
-	module->init = &init;
+	module->instantiate = &instantiate;
 	module->parse_config = &parse_sd_socket_config;
-	module->success = &success;
-	module->failure = NULL;
-	module->cleanup = &cleanup;
 
 	return module;
 }
+
+enum unlocked_err serve_sd_sockets(const int *fds, size_t fd_count,
+				   const char *key, int key_fd,
+				   unsigned int consumers, long timeout,
+				   unsigned int *deliveries)
+{
+	enum unlocked_err err = UL_OK;
+	struct key_server server = { 0 };
+
+	server.consumers = consumers;
+	server.key = key;
+	server.key_fd = key_fd;
+	server.key_len = key ? strlen(key) : 0;
+	server.timeout.source.fd = -1;
+	server.loop = create_event_loop();
+	if (NULL == server.loop) {
+		return UL_MALLOC;
+	}
+	server.listeners = calloc(fd_count, sizeof(struct event_source));
+	if (NULL == server.listeners) {
+		free_event_loop(server.loop);
+
+		return UL_MALLOC;
+	}
+	server.accepting = 1;
+	for (size_t i = 0; UL_OK == err && i < fd_count; i++) {
+		// The sockets from systemd may be blocking.
+		if (fcntl(fds[i], F_SETFL,
+			  fcntl(fds[i], F_GETFL) | O_NONBLOCK) < 0) {
+			err = UL_ERRNO;
+			break;
+		}
+		server.listeners[i].data = &server;
+		server.listeners[i].fd = fds[i];
+		server.listeners[i].handle = accept_consumers;
+		err = watch_fd(server.loop, &(server.listeners[i]), EPOLLIN);
+		if (UL_OK == err) {
+			server.listener_count++;
+		}
+	}
+	if (UL_OK == err && timeout > 0) {
+		err = init_timer(server.loop, &(server.timeout), handle_timeout,
+				 &server);
+		if (UL_OK == err) {
+			err = arm_timer(&(server.timeout), timeout * 1000);
+		}
+	}
+	while (UL_OK == err
+	       && (server.accepting || server.deliveries_pending)) {
+		err = dispatch_events(server.loop, -1);
+	}
+	stop_accepting(&server);
+	while (server.deliveries_pending) {
+		close_delivery(server.deliveries_pending);
+	}
+	if (server.timeout.source.fd >= 0) {
+		free_timer(server.loop, &(server.timeout));
+	}
+	free_event_loop(server.loop);
+	free(server.listeners);
+	*deliveries = server.deliveries;
+
+	return err;
+}
+
+/**
+ * Accept all pending connections of consumers and start to send them the key.
+ *
+ * @param source is the listening socket.
+ * @param events are the epoll events that occured.
+ */
+static void accept_consumers(struct event_source *source, uint32_t events)
+{
+	struct key_delivery *delivery = NULL;
+	int fd = -1;
+	struct key_server *server = source->data;
+
+	while (server->accepting && (fd = accept4(source->fd, NULL, NULL,
+						  SOCK_NONBLOCK |
+						  SOCK_CLOEXEC)) >= 0) {
+		delivery = calloc(1, sizeof(struct key_delivery));
+		if (NULL == delivery) {
+			close(fd);
+			continue;
+		}
+		delivery->server = server;
+		delivery->source.data = delivery;
+		delivery->source.fd = fd;
+		delivery->source.handle = handle_delivery;
+		delivery->source.release = release_delivery;
+		delivery->next = server->deliveries_pending;
+		server->deliveries_pending = delivery;
+		send_key(delivery);
+	}
+}
+
+/**
+ * Stop the delivery of the key to a consumer and close the connection.
+ *
+ * @param delivery is the delivery to stop.
+ */
+static void close_delivery(struct key_delivery *delivery)
+{
+	struct key_delivery **link = &(delivery->server->deliveries_pending);
+
+	while (*link != delivery) {
+		link = &((*link)->next);
+	}
+	*link = delivery->next;
+	if (!delivery->delivered) {
+		logger(LOG_WARNING, "Closing the connection to a consumer "
+		       "before the key was delivered\n");
+	}
+	unwatch_fd(delivery->server->loop, &(delivery->source));
+}
+
+/**
+ * Collect the file descriptors passed by systemd for an instance.
+ *
+ * An instance for a single key takes all file descriptors with its name.
+ * Otherwise all file descriptors, that are not taken by the instances for
+ * single keys, are used.
+ *
+ * @param state is the state of the instance.
+ * @param fd_count is the number of file descriptors passed by systemd.
+ * @param socket_names are the names of the file descriptors.
+ *
+ * @return zero on success or -1 if allocating memory failed.
+ */
+static int collect_fds(struct sd_socket_state *state, int fd_count,
+		       char **socket_names)
+{
+	struct sd_socket_state *named = NULL;
+	int taken = 0;
+
+	if (fd_count <= 0) {
+		return 0;
+	}
+	state->socket_fds = malloc(sizeof(int) * fd_count);
+	if (NULL == state->socket_fds) {
+		return -1;
+	}
+	for (int i = 0; i < fd_count; i++) {
+		if (state->fd_name) {
+			taken = !strcmp(state->fd_name, socket_names[i]);
+		} else {
+			taken = 1;
+			for (named = named_states; named; named = named->next) {
+				if (!strcmp(named->fd_name, socket_names[i])) {
+					taken = 0;
+					break;
+				}
+			}
+		}
+		if (taken) {
+			state->socket_fds[state->socket_count] =
+			    SD_LISTEN_FDS_START + i;
+			state->socket_count++;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Count a complete delivery and close the connection to the consumer.
+ *
+ * @param delivery is the delivery.
+ */
+static void complete_delivery(struct key_delivery *delivery)
+{
+	struct key_server *server = delivery->server;
+
+	delivery->delivered = 1;
+	server->deliveries++;
+	close_delivery(delivery);
+	if (server->consumers && server->deliveries >= server->consumers) {
+		stop_accepting(server);
+	}
+}
+
+/**
+ * Continue to send the key after the connection of a consumer got writable.
+ *
+ * @param source is the connection of the consumer.
+ * @param events are the epoll events that occured.
+ */
+static void handle_delivery(struct event_source *source, uint32_t events)
+{
+	struct key_delivery *delivery = source->data;
+
+	if (events & (EPOLLERR | EPOLLHUP)) {
+		close_delivery(delivery);
+
+		return;
+	}
+	send_key(delivery);
+}
+
+/**
+ * Stop serving the key after the timeout has been reached.
+ *
+ * Consumers, that did not receive the complete key yet, are disconnected.
+ *
+ * @param data is the server.
+ */
+static void handle_timeout(void *data)
+{
+	struct key_server *server = data;
+
+	logger(LOG_DEBUG, "Timeout for delivering the key reached\n");
+	stop_accepting(server);
+	while (server->deliveries_pending) {
+		close_delivery(server->deliveries_pending);
+	}
+}
+
+/**
+ * Close the connection to a consumer after it is not watched anymore.
+ *
+ * @param source is the connection.
+ */
+static void release_delivery(struct event_source *source)
+{
+	close(source->fd);
+	free(source->data);
+}
+
+/**
+ * Send as much of the key to a consumer as possible without blocking.
+ *
+ * The connection is closed after the whole key has been sent.
+ *
+ * @param delivery is the delivery of the key.
+ */
+static void send_key(struct key_delivery *delivery)
+{
+	struct key_server *server = delivery->server;
+	ssize_t sent = 0;
+
+	if (server->key_fd >= 0) {
+		send_key_fd(delivery);
+
+		return;
+	}
+	while (delivery->sent < server->key_len) {
+		sent = send(delivery->source.fd, server->key + delivery->sent,
+			    server->key_len - delivery->sent, MSG_NOSIGNAL);
+		if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+			if (UL_OK != watch_fd(server->loop, &(delivery->source),
+					      EPOLLOUT)) {
+				close_delivery(delivery);
+			}
+
+			return;
+		}
+		if (sent < 0) {
+			logger(LOG_WARNING, "Failed to send the key to a "
+			       "consumer: %s\n", strerror(errno));
+			close_delivery(delivery);
+
+			return;
+		}
+		delivery->sent += sent;
+	}
+	complete_delivery(delivery);
+}
+
+/**
+ * Pass the memfd with the key to a consumer.
+ *
+ * The file descriptor is sent as ancillary data of a single null byte and
+ * the connection is closed afterwards.
+ *
+ * @param delivery is the delivery of the key.
+ */
+static void send_key_fd(struct key_delivery *delivery)
+{
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct cmsghdr *cmsg = NULL;
+	char payload = '\0';
+	struct iovec iov = {.iov_base = &payload,.iov_len = 1 };
+	struct msghdr msg = { 0 };
+	char path[32];
+	ssize_t sent = 0;
+	struct key_server *server = delivery->server;
+	int fd = -1;
+
+	// Every consumer gets its own read only file description, because
+	// consumers would share the file offset otherwise.
+	snprintf(path, sizeof(path), "/proc/self/fd/%d", server->key_fd);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		logger(LOG_WARNING, "Failed to reopen the memfd with the key: "
+		       "%s\n", strerror(errno));
+		close_delivery(delivery);
+
+		return;
+	}
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+	sent = sendmsg(delivery->source.fd, &msg, MSG_NOSIGNAL);
+	close(fd);
+	if (sent < 0 && (EAGAIN == errno || EWOULDBLOCK == errno)) {
+		if (UL_OK != watch_fd(server->loop, &(delivery->source),
+				      EPOLLOUT)) {
+			close_delivery(delivery);
+		}
+
+		return;
+	}
+	if (sent < 0) {
+		logger(LOG_WARNING, "Failed to pass the key to a consumer: "
+		       "%s\n", strerror(errno));
+		close_delivery(delivery);
+
+		return;
+	}
+	complete_delivery(delivery);
+}
+
+/**
+ * Stop accepting new consumers.
+ *
+ * Consumers, that are already connected, still receive the key.
+ *
+ * @param server is the server.
+ */
+static void stop_accepting(struct key_server *server)
+{
+	if (!server->accepting) {
+		return;
+	}
+	server->accepting = 0;
+	for (size_t i = 0; i < server->listener_count; i++) {
+		unwatch_fd(server->loop, &(server->listeners[i]));
+	}
+}
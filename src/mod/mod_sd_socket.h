@@ -19,17 +19,58 @@
 #ifndef UNLOCKED_MOD_SD_SOCKET_H
 #define UNLOCKED_MOD_SD_SOCKET_H
 
+#include <stddef.h>
+
 #include "module.h"
 
+/**
+ * Get the number of consumers an instance of the module delivered its key to.
+ *
+ * @param module is the instance of the module.
+ *
+ * @return the number of complete deliveries.
+ */
+unsigned int count_sd_socket_deliveries(const struct unlocked_module *module);
+
 /**
  * Returns a module for systemd socket activation.
  *
- * Upon initialization, the module takes a single file descriptor for
- * a socket provided by systemd and provides the key through the socket on
- * success.
+ * Upon initialization, the module takes the file descriptors for sockets
+ * provided by systemd and on success serves the key to every consumer
+ * connecting to any of the sockets.
+ * Instances for keys configured in their own sections take the file
+ * descriptors with the name given in the section instead.
  *
  * @return a pointer to the module
  */
 struct unlocked_module *get_mod_sd_socket(void);
 
+/**
+ * Serve a key to the consumers connecting to listening sockets.
+ *
+ * Every consumer receives the complete key before its connection is closed.
+ * If a memfd with the key is given, every consumer receives a read only file
+ * descriptor of it as `SCM_RIGHTS` ancillary data of a single null byte
+ * instead.
+ *
+ * @param fds are the listening sockets.
+ * @param fd_count is the number of listening sockets.
+ * @param key is the key to serve or NULL if the memfd is passed.
+ * @param key_fd is the memfd with the key or -1 to send the key itself.
+ * @param consumers is the number of consumers to serve before returning or
+ *                  zero to serve consumers until the timeout is reached.
+ *                  Consumers, that connected before the number was reached,
+ *                  are still served.
+ * @param timeout is the time in seconds after which consumers, that did not
+ *                receive the key yet, are disconnected or zero to wait
+ *                without time limit.
+ * @param deliveries is set to the number of complete deliveries.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err serve_sd_sockets(const int *fds, size_t fd_count,
+				   const char *key, int key_fd,
+				   unsigned int consumers, long timeout,
+				   unsigned int *deliveries);
+
 #endif
@@ -65,6 +65,9 @@ static enum unlocked_err cleanup(struct unlocked_module *module)
 	if (NULL != module->argp) {
 		free(module->argp);
 	}
+	if (NULL != module->key_name) {
+		free(module->key_name);
+	}
 	if (NULL != module->state) {
 		free(module->state);
 	}
@@ -83,6 +86,10 @@ static enum unlocked_err success(struct unlocked_module *module,
 	if (key_len != fwrite(key, sizeof(char), key_len, stdout)) {
 		return UL_ERR;
 	}
+	// Keys of multiple sections are separated by newlines.
+	if (module->key_name && EOF == fputc('\n', stdout)) {
+		return UL_ERR;
+	}
 	if (fflush(stdout)) {
 		return UL_ERR;
 	}
@@ -90,6 +97,52 @@ static enum unlocked_err success(struct unlocked_module *module,
 	return UL_OK;
 }
 
+static struct unlocked_module *create_module(void)
+{
+	struct unlocked_module *module = malloc(sizeof(struct unlocked_module));
+	if (NULL == module) {
+		return NULL;
+	}
+	module->argp = NULL;
+	module->state = NULL;
+	module->name = module_name;
+	module->key_name = NULL;
+	module->enabled = 0;
+	module->init = NULL;
+	module->instantiate = NULL;
+	module->parse_config = NULL;
+	module->success = &success;
+	module->success_fd = NULL;
+	module->failure = NULL;
+	module->cleanup = &cleanup;
+
+	return module;
+}
+
+static enum unlocked_err instantiate(struct unlocked_module *module,
+				     const dictionary * ini,
+				     const char *section, const char *key_name,
+				     struct unlocked_module **instance)
+{
+	int use = 0;
+	char *entry = get_section_entry(section, "use_stdout");
+	if (NULL == entry) {
+		return UL_MALLOC;
+	}
+	use = iniparser_getboolean(ini, entry, 0);
+	free(entry);
+	if (!use) {
+		return UL_OK;
+	}
+	*instance = create_module();
+	if (NULL == *instance) {
+		return UL_MALLOC;
+	}
+	(*instance)->enabled = 1;
+
+	return UL_OK;
+}
+
 static enum unlocked_err parse_stdout_config(struct unlocked_module *module,
 					     const dictionary * ini)
 {
@@ -126,22 +179,18 @@ static struct argp *init_argp(void)
 
 struct unlocked_module *get_mod_stdout(void)
 {
-	struct unlocked_module *module = malloc(sizeof(struct unlocked_module));
+	struct unlocked_module *module = create_module();
 	if (NULL == module) {
 		return NULL;
 	}
 	module->argp = init_argp();
 	if (NULL == module->argp) {
+		free(module);
+
 		return NULL;
 	}
-	module->state = NULL;
-	module->name = module_name;
-	module->enabled = 0;
-	module->init = NULL;
+	module->instantiate = &instantiate;
 	module->parse_config = &parse_stdout_config;
-	module->success = &success;
-	module->failure = NULL;
-	module->cleanup = &cleanup;
 
 	return module;
 }
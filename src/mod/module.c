@@ -15,10 +15,21 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
 #include "module.h"
 #include "../cli.h"
 #include "../log.h"
+#include "../trace.h"
+
+static int create_key_fd(const char *const key);
+static enum unlocked_err instantiate_modules(const dictionary * ini);
 
 static struct unlocked_module **modules = NULL;
 
@@ -68,30 +79,88 @@ enum unlocked_err handle_failure(enum unlocked_err provided_err)
 }
 
 enum unlocked_err handle_success(const char *const key)
+{
+	return handle_key_success(NULL, key);
+}
+
+enum unlocked_err handle_key_success(const char *const key_name,
+				     const char *const key)
 {
 	enum unlocked_err err = UL_OK;
+	long long begin = 0;
+	// The memfd is only created if any module takes the key as file.
+	int key_fd = -1;
+	unsigned int receivers = 0;
 
 	for (unsigned int i = 0; i < module_count; i++) {
-		if (modules[i]->enabled && NULL != modules[i]->success) {
-			if (modules[i]->name) {
-				logger(LOG_DEBUG,
-				       "Invoking success callback "
-				       "on module \"%s\"\n", modules[i]->name);
-			} else {
-				logger(LOG_DEBUG,
-				       "Invoking success callback on "
-				       "unnamed module\n");
+		if (!modules[i]->enabled
+		    || (NULL == modules[i]->success
+			&& NULL == modules[i]->success_fd)) {
+			continue;
+		}
+		if (key_name != modules[i]->key_name
+		    && (NULL == key_name || NULL == modules[i]->key_name
+			|| strcmp(key_name, modules[i]->key_name))) {
+			continue;
+		}
+		if (modules[i]->name) {
+			logger(LOG_DEBUG,
+			       "Invoking success callback "
+			       "on module \"%s\"\n", modules[i]->name);
+		} else {
+			logger(LOG_DEBUG,
+			       "Invoking success callback on "
+			       "unnamed module\n");
+		}
+		if (modules[i]->success_fd && key_fd < 0) {
+			key_fd = create_key_fd(key);
+			if (key_fd < 0) {
+				return UL_ERRNO;
 			}
+		}
+		begin = trace_now();
+		if (modules[i]->success_fd) {
+			err = modules[i]->success_fd(modules[i], key_fd);
+		} else {
 			err = modules[i]->success(modules[i], key);
-			if (UL_OK != err) {
-				return err;
-			}
 		}
+		trace_span(TRACE_MAIN, modules[i]->name ? modules[i]->name :
+			   "unnamed module", begin);
+		if (UL_OK != err) {
+			break;
+		}
+		receivers++;
+	}
+	if (key_fd >= 0) {
+		close(key_fd);
+	}
+	if (UL_OK == err && key_name && 0 == receivers) {
+		logger(LOG_WARNING, "No module outputs the key \"%s\"\n",
+		       key_name);
 	}
 
 	return err;
 }
 
+char *get_section_entry(const char *const section, const char *const key)
+{
+	static const char *const fmt = "%s:%s";
+	char *entry = NULL;
+	int entry_len = snprintf(NULL, 0, fmt, section, key);
+
+	entry = malloc(entry_len + 1);
+	if (NULL == entry) {
+		return NULL;
+	}
+	if (0 > snprintf(entry, entry_len + 1, fmt, section, key)) {
+		free(entry);
+
+		return NULL;
+	}
+
+	return entry;
+}
+
 enum unlocked_err initialize_modules(void)
 {
 	enum unlocked_err err = UL_OK;
@@ -121,7 +190,7 @@ enum unlocked_err parse_config(const dictionary * ini)
 		}
 	}
 
-	return err;
+	return instantiate_modules(ini);
 }
 
 enum unlocked_err register_module(struct unlocked_module *module)
@@ -138,3 +207,97 @@ enum unlocked_err register_module(struct unlocked_module *module)
 
 	return UL_OK;
 }
+
+/**
+ * Store a key in a sealed memfd.
+ *
+ * The memfd lives in memory only and its content can neither be changed nor
+ * can it be resized after it has been sealed.
+ *
+ * @param key is the key to store.
+ *
+ * @return the file descriptor of the memfd or -1 with errno set on failure.
+ */
+static int create_key_fd(const char *const key)
+{
+	static const int seals = F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW
+	    | F_SEAL_WRITE;
+	size_t key_len = strlen(key);
+	ssize_t written = 0;
+	int fd = memfd_create("unlocked-key", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd < 0) {
+		return -1;
+	}
+	for (size_t offset = 0; offset < key_len; offset += written) {
+		written = write(fd, key + offset, key_len - offset);
+		if (written < 0) {
+			close(fd);
+
+			return -1;
+		}
+	}
+	if (fcntl(fd, F_ADD_SEALS, seals) < 0) {
+		close(fd);
+
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Instantiate the registered modules for every section of the config file,
+ * that configures a single key.
+ *
+ * @param ini is the dictionary of the loaded config file.
+ *
+ * @return any error from the modules.
+ */
+static enum unlocked_err instantiate_modules(const dictionary * ini)
+{
+	static const size_t prefix_len = sizeof(KEY_SECTION_PREFIX) - 1;
+	enum unlocked_err err = UL_OK;
+	struct unlocked_module *instance = NULL;
+	// Instances registered in this function are not instantiated again.
+	unsigned int count = module_count;
+	const char *section = NULL;
+	int section_count = iniparser_getnsec(ini);
+
+	for (int i = 0; i < section_count; i++) {
+		section = iniparser_getsecname(ini, i);
+		if (NULL == section
+		    || strncmp(section, KEY_SECTION_PREFIX, prefix_len)
+		    || '\0' == section[prefix_len]) {
+			continue;
+		}
+		for (unsigned int j = 0; j < count; j++) {
+			if (NULL == modules[j]->instantiate) {
+				continue;
+			}
+			instance = NULL;
+			err = modules[j]->instantiate(modules[j], ini, section,
+						      section + prefix_len,
+						      &instance);
+			if (UL_OK != err) {
+				return err;
+			}
+			if (NULL == instance) {
+				continue;
+			}
+			instance->key_name = strdup(section + prefix_len);
+			if (NULL == instance->key_name) {
+				if (instance->cleanup) {
+					instance->cleanup(instance);
+				}
+
+				return UL_MALLOC;
+			}
+			err = register_module(instance);
+			if (UL_OK != err) {
+				return err;
+			}
+		}
+	}
+
+	return UL_OK;
+}
@@ -42,6 +42,14 @@ struct unlocked_module {
 	 * The name of the module.
 	 */
 	const char *name;
+	/**
+	 * The name of the key this instance receives or NULL if the instance
+	 * receives the key from the `[unlocked]` section.
+	 *
+	 * This is set after the instance has been created by `instantiate` and
+	 * must be freed by the cleanup callback.
+	 */
+	char *key_name;
 	/**
 	 * The module can set this value after parsing the config to set if
 	 * it has been enabled or not.
@@ -62,6 +70,24 @@ struct unlocked_module {
 	 */
 	enum unlocked_err (*parse_config) (struct unlocked_module * module,
 					   const dictionary * dict);
+	/**
+	 * Create a new instance of the module for a key configured in its own
+	 * section of the config file.
+	 *
+	 * @param module is the instance of the module.
+	 * @param dict is the dictionary of the parsed config file.
+	 * @param section is the name of the section of the key.
+	 * @param key_name is the name of the key.
+	 * @param instance is set to the new instance or NULL if the section
+	 *                 does not use the module.
+	 *
+	 * @return any error that occured.
+	 */
+	enum unlocked_err (*instantiate) (struct unlocked_module * module,
+					  const dictionary * dict,
+					  const char *section,
+					  const char *key_name,
+					  struct unlocked_module ** instance);
 	/**
 	 * Used to initialize additional resources for the module.
 	 *
@@ -83,6 +109,21 @@ struct unlocked_module {
 	 */
 	enum unlocked_err (*success) (struct unlocked_module * module,
 				      const char *const key);
+	/**
+	 * If not NULL, this function is called after a key has been received
+	 * from the server instead of `success`.
+	 *
+	 * The key is passed as a sealed memfd, that can neither be written
+	 * nor resized. The file descriptor is closed after all modules
+	 * received the key, so it must be duplicated to keep it open.
+	 *
+	 * @param module is the instance of the module.
+	 * @param key_fd is the file descriptor of the memfd with the key.
+	 *
+	 * @return any error that occured.
+	 */
+	enum unlocked_err (*success_fd) (struct unlocked_module * module,
+					 int key_fd);
 	/**
 	 * Called on failure.
 	 *
@@ -124,7 +165,8 @@ enum unlocked_err cleanup_modules(void);
 enum unlocked_err handle_failure(enum unlocked_err err);
 
 /**
- * Provision the key from the server to all registered modules.
+ * Provision the key from the server to all registered modules, that are not
+ * instantiated for a named key.
  *
  * @param key is the key provided by the server
  *
@@ -132,6 +174,30 @@ enum unlocked_err handle_failure(enum unlocked_err err);
  */
 enum unlocked_err handle_success(const char *const key);
 
+/**
+ * Provision a key from the server to the modules instantiated for it.
+ *
+ * @param key_name is the name of the key or NULL for the key from the
+ *                 `[unlocked]` section.
+ * @param key is the key provided by the server
+ *
+ * @return any error from the modules
+ */
+enum unlocked_err handle_key_success(const char *const key_name,
+				     const char *const key);
+
+/**
+ * Get the name of an entry in a section of the config file as used by
+ * iniparser.
+ *
+ * @param section is the name of the section.
+ * @param key is the name of the entry in the section.
+ *
+ * @return the name of the entry, that must be freed after use or NULL on
+ *         failure.
+ */
+char *get_section_entry(const char *const section, const char *const key);
+
 /**
  * Give the modules a chance to initialize additional resources.
  *
@@ -142,6 +208,9 @@ enum unlocked_err initialize_modules(void);
 /**
  * Let all the registered modules parse the config file.
  *
+ * Afterwards every module is instantiated for each section configuring a
+ * single key, that uses the module.
+ *
  * @param ini is the dictionary of the loaded config file.
  *
  * @return any error from the modules.
@@ -0,0 +1,148 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "json-scan.h"
+#include "log.h"
+#include "request-state.h"
+
+char *find_event_end(char *start, char *end)
+{
+	char *line_end = NULL;
+
+	while (start < end) {
+		line_end = memchr(start, '\n', end - start);
+		if (NULL == line_end) {
+			return NULL;
+		}
+		start = line_end + 1;
+		if (start < end && '\r' == *start) {
+			start++;
+		}
+		if (start < end && '\n' == *start) {
+			return start;
+		}
+	}
+
+	return NULL;
+}
+
+int parse_event_state(const char *event, const char *end,
+		      char state[REQUEST_STATE_SIZE])
+{
+	char data[EVENT_DATA_SIZE];
+	size_t data_len = 0;
+	const char *line_end = NULL;
+	const char *value = NULL;
+	size_t value_len = 0;
+
+	while (event < end) {
+		line_end = memchr(event, '\n', end - event);
+		if (NULL == line_end) {
+			line_end = end;
+		}
+		if (line_end - event >= 5 && 0 == memcmp(event, "data:", 5)) {
+			value = event + 5;
+			if (value < line_end && ' ' == *value) {
+				value++;
+			}
+			value_len = line_end - value;
+			if (value_len && '\r' == value[value_len - 1]) {
+				value_len--;
+			}
+			if (data_len + 1 + value_len > sizeof(data)) {
+				logger(LOG_WARNING, "Ignoring an event with "
+				       "more than %d bytes of data\n",
+				       EVENT_DATA_SIZE);
+
+				return -1;
+			}
+			if (data_len) {
+				data[data_len++] = '\n';
+			}
+			memcpy(data + data_len, value, value_len);
+			data_len += value_len;
+		}
+		event = line_end + 1;
+	}
+	if (0 == data_len) {
+		return -1;
+	}
+
+	return parse_request_state(data, data_len, state);
+}
+
+int parse_event_stream(struct Response *response)
+{
+	char *body_end = response->body + response->body_len;
+	char *event = NULL;
+	char *event_end = NULL;
+	char state[REQUEST_STATE_SIZE];
+	int result = 0;
+	struct event_stream *stream = response->stream_data;
+
+	event = response->body + stream->offset;
+	while ((event_end = find_event_end(event, body_end))) {
+		result = parse_event_state(event, event_end, state);
+		stream->offset = event_end + 1 - response->body;
+		event = event_end + 1;
+		if (0 != result) {
+			continue;
+		}
+		logger(LOG_DEBUG, "Received request state \"%s\"\n", state);
+		memcpy(stream->state, state, REQUEST_STATE_SIZE);
+		stream->events++;
+		if (strcmp(state, "PENDING")) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int parse_request_state(const char *const json, size_t length,
+			char state[REQUEST_STATE_SIZE])
+{
+	struct json_field field = {
+		.name = "state",
+		.type = JSON_FIELD_STRING,
+		.string = state,
+		.string_size = REQUEST_STATE_SIZE,
+	};
+
+	if (UL_OK != scan_json_object(json, length, &field, 1)) {
+		logger(LOG_ERROR, "Error parsing response json\n");
+
+		return -1;
+	}
+	if (JSON_FIELD_MISSING == field.status) {
+		logger(LOG_ERROR, "Key \"state\" not found\n");
+
+		return -1;
+	}
+	if (JSON_FIELD_INVALID == field.status) {
+		logger(LOG_ERROR, "Value of key \"state\" is not a string of "
+		       "at most %d characters\n", REQUEST_STATE_SIZE - 1);
+
+		return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,114 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_REQUEST_STATE_H
+#define UNLOCKED_REQUEST_STATE_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "https-client.h"
+
+/**
+ * The size of the storage for the state of a request including the null
+ * terminator.
+ */
+#define REQUEST_STATE_SIZE 32
+
+/**
+ * The maximum size of the joined data lines of a server-sent event.
+ */
+#define EVENT_DATA_SIZE 4096
+
+/**
+ * State of a stream of server-sent events with request states.
+ */
+struct event_stream {
+	/**
+	 * The offset of the first unprocessed event in the response body.
+	 */
+	size_t offset;
+	/**
+	 * The number of events with a request state received.
+	 */
+	unsigned int events;
+	/**
+	 * The time the stream was opened at on the monotonic clock.
+	 */
+	struct timespec opened;
+	/**
+	 * The most recent state of the request or an empty string.
+	 */
+	char state[REQUEST_STATE_SIZE];
+};
+
+/**
+ * Find the end of a server-sent event, which is terminated by an empty line.
+ *
+ * @param start is the start of the event.
+ * @param end is the end of the received data.
+ *
+ * @return a pointer to the empty line terminating the event or NULL if the
+ *         event is not complete yet.
+ */
+char *find_event_end(char *start, char *end);
+
+/**
+ * Extract the request state from a single server-sent event.
+ *
+ * The data of the event is expected to be the json representation of the
+ * request. Multiple data lines are joined with newlines into a buffer of
+ * EVENT_DATA_SIZE bytes, comments and other fields are ignored.
+ *
+ * @param event is the start of the event.
+ * @param end is the end of the event.
+ * @param state is the storage for the state of the request.
+ *
+ * @return zero on success or a non zero value if the event does not contain a
+ *         state.
+ */
+int parse_event_state(const char *event, const char *end,
+		      char state[REQUEST_STATE_SIZE]);
+
+/**
+ * Process the complete events received in a stream of server-sent events.
+ *
+ * This is used as stream callback for the response. The stream data of the
+ * response must be a struct event_stream.
+ *
+ * @param response is the response with the stream.
+ *
+ * @return zero to continue the stream or one if the request is not pending
+ *         anymore.
+ */
+int parse_event_stream(struct Response *response);
+
+/**
+ * Extract the state from the json representation of a request.
+ *
+ * @param json is the serialized request.
+ * @param length is the length of the serialized request in bytes.
+ * @param state is the storage for the state of the request.
+ *
+ * @return zero on success or a non zero value on failure.
+ */
+int parse_request_state(const char *const json, size_t length,
+			char state[REQUEST_STATE_SIZE]);
+
+#endif
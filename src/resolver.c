@@ -0,0 +1,384 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <ctype.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include "hosts.h"
+#include "log.h"
+#include "resolver.h"
+
+static int is_address(const char *name);
+static int is_pinned(const struct curl_slist *pinned, const char *name,
+		     long port);
+static char *lookup_addresses(const char *name, long port);
+static enum unlocked_err parse_pinned(const char *list,
+				      struct curl_slist **pinned);
+static void release_lookup(struct host_lookup *lookup);
+static void *resolve_host(void *data);
+static int validate_pinned(const char *entry);
+
+struct curl_slist *collect_lookups(struct resolver *resolver)
+{
+	struct curl_slist *entries = NULL;
+	struct curl_slist *tmp = NULL;
+	struct host_lookup *lookup = NULL;
+
+	if (NULL == resolver) {
+		return NULL;
+	}
+	for (size_t i = 0; i < resolver->lookup_count; i++) {
+		lookup = resolver->lookups[i];
+		if (lookup->collected
+		    || !__atomic_load_n(&(lookup->done), __ATOMIC_ACQUIRE)) {
+			continue;
+		}
+		if (NULL == lookup->entry) {
+			lookup->collected = 1;
+			continue;
+		}
+		tmp = curl_slist_append(entries, lookup->entry);
+		if (NULL == tmp) {
+			break;
+		}
+		entries = tmp;
+		lookup->collected = 1;
+		logger(LOG_DEBUG, "Resolved %s\n", lookup->entry + 1);
+	}
+
+	return entries;
+}
+
+void free_resolver(struct resolver *resolver)
+{
+	for (size_t i = 0; i < resolver->lookup_count; i++) {
+		release_lookup(resolver->lookups[i]);
+	}
+	free(resolver->lookups);
+	curl_slist_free_all(resolver->pinned);
+	resolver->lookups = NULL;
+	resolver->lookup_count = 0;
+	resolver->pinned = NULL;
+}
+
+enum unlocked_err start_resolver(struct resolver *resolver,
+				 const char *hosts, long default_port,
+				 const char *pinned)
+{
+	enum unlocked_err err = UL_OK;
+	size_t host_count = 0;
+	struct server_host *host_list = NULL;
+	struct host_lookup *lookup = NULL;
+	pthread_t thread;
+
+	resolver->lookups = NULL;
+	resolver->lookup_count = 0;
+	resolver->pinned = NULL;
+	if (pinned) {
+		err = parse_pinned(pinned, &(resolver->pinned));
+		if (UL_OK != err) {
+			free_resolver(resolver);
+
+			return err;
+		}
+	}
+	err = parse_hosts(hosts, default_port, &host_list, &host_count);
+	if (UL_OK != err) {
+		free_resolver(resolver);
+
+		return err;
+	}
+	resolver->lookups = calloc(host_count, sizeof(struct host_lookup *));
+	if (NULL == resolver->lookups) {
+		free_hosts(host_list, host_count);
+		free_resolver(resolver);
+
+		return UL_MALLOC;
+	}
+	for (size_t i = 0; i < host_count; i++) {
+		if (is_address(host_list[i].name)
+		    || is_pinned(resolver->pinned, host_list[i].name,
+				 host_list[i].port)) {
+			continue;
+		}
+		lookup = calloc(1, sizeof(struct host_lookup));
+		if (NULL == lookup) {
+			continue;
+		}
+		lookup->name = host_list[i].name;
+		lookup->port = host_list[i].port;
+		host_list[i].name = NULL;
+		// One reference for the resolver and one for the thread.
+		lookup->refs = 2;
+		resolver->lookups[resolver->lookup_count++] = lookup;
+		if (pthread_create(&thread, NULL, resolve_host, lookup)) {
+			logger(LOG_DEBUG, "Could not resolve \"%s\" ahead of "
+			       "time\n", lookup->name);
+			lookup->refs = 1;
+			lookup->done = 1;
+			continue;
+		}
+		pthread_detach(thread);
+	}
+	free_hosts(host_list, host_count);
+
+	return UL_OK;
+}
+
+struct curl_slist *take_pinned_addresses(struct resolver *resolver)
+{
+	struct curl_slist *pinned = NULL;
+
+	if (NULL == resolver) {
+		return NULL;
+	}
+	pinned = resolver->pinned;
+	resolver->pinned = NULL;
+
+	return pinned;
+}
+
+/**
+ * Check whether a host is given by its ip address.
+ *
+ * @param name is the host name as used in urls.
+ *
+ * @return non zero if the host is an ip address.
+ */
+static int is_address(const char *name)
+{
+	struct in_addr addr = { 0 };
+
+	// IPv6 addresses are enclosed in brackets.
+	return '[' == *name || 1 == inet_pton(AF_INET, name, &addr);
+}
+
+/**
+ * Check whether the address of a server is pinned.
+ *
+ * @param pinned is the list of pinned addresses.
+ * @param name is the host name of the server.
+ * @param port is the port of the server.
+ *
+ * @return non zero if the address of the server is pinned.
+ */
+static int is_pinned(const struct curl_slist *pinned, const char *name,
+		     long port)
+{
+	const char *entry = NULL;
+	size_t name_len = strlen(name);
+
+	for (; pinned; pinned = pinned->next) {
+		entry = pinned->data;
+		if ('+' == *entry) {
+			entry++;
+		}
+		if (0 == strncmp(entry, name, name_len)
+		    && ':' == entry[name_len]
+		    && port == strtol(entry + name_len + 1, NULL, 10)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Look up the addresses of a server.
+ *
+ * @param name is the host name of the server.
+ * @param port is the port of the server.
+ *
+ * @return the entry for `CURLOPT_RESOLVE` in the form "+name:port:addresses"
+ *         that must be freed after use or NULL on failure.
+ */
+static char *lookup_addresses(const char *name, long port)
+{
+	char address[INET6_ADDRSTRLEN] = { 0 };
+	const void *addr = NULL;
+	struct addrinfo hints = { 0 };
+	char *entry = NULL;
+	size_t entry_len = 0;
+	size_t entry_size = 0;
+	struct addrinfo *result = NULL;
+	int status = 0;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = AI_ADDRCONFIG;
+	status = getaddrinfo(name, NULL, &hints, &result);
+	if (status) {
+		logger(LOG_DEBUG, "Could not resolve \"%s\" ahead of time: "
+		       "%s\n", name, gai_strerror(status));
+
+		return NULL;
+	}
+	// The prefix, the name, the port and room for the first address.
+	entry_size = strlen(name) + 25 + INET6_ADDRSTRLEN;
+	for (struct addrinfo * ai = result; ai; ai = ai->ai_next) {
+		entry_size += INET6_ADDRSTRLEN + 3;
+	}
+	entry = malloc(entry_size);
+	if (NULL == entry) {
+		freeaddrinfo(result);
+
+		return NULL;
+	}
+	entry_len = snprintf(entry, entry_size, "+%s:%ld:", name, port);
+	for (struct addrinfo * ai = result; ai; ai = ai->ai_next) {
+		if (AF_INET == ai->ai_family) {
+			addr = &((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+		} else if (AF_INET6 == ai->ai_family) {
+			addr = &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+		} else {
+			continue;
+		}
+		if (NULL == inet_ntop(ai->ai_family, addr, address,
+				      sizeof(address))) {
+			continue;
+		}
+		entry_len += snprintf(entry + entry_len,
+				      entry_size - entry_len,
+				      AF_INET6 == ai->ai_family ? "%s[%s]" :
+				      "%s%s", ':' == entry[entry_len - 1] ?
+				      "" : ",", address);
+	}
+	freeaddrinfo(result);
+	if (':' == entry[entry_len - 1]) {
+		free(entry);
+
+		return NULL;
+	}
+
+	return entry;
+}
+
+/**
+ * Split a whitespace separated list of pinned addresses.
+ *
+ * @param list is the list to split.
+ * @param pinned is set to the list of the pinned addresses.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err parse_pinned(const char *list,
+				      struct curl_slist **pinned)
+{
+	char *entry = NULL;
+	size_t len = 0;
+	struct curl_slist *tmp = NULL;
+
+	while (*list) {
+		while (isspace((unsigned char)*list)) {
+			list++;
+		}
+		for (len = 0; list[len] && !isspace((unsigned char)list[len]);
+		     len++) ;
+		if (0 == len) {
+			break;
+		}
+		entry = strndup(list, len);
+		if (NULL == entry) {
+			return UL_MALLOC;
+		}
+		if (!validate_pinned(entry)) {
+			logger(LOG_ERROR, "Invalid pinned address \"%s\", "
+			       "expected \"<host>:<port>:<address>\"\n",
+			       entry);
+			free(entry);
+
+			return UL_ERR;
+		}
+		tmp = curl_slist_append(*pinned, entry);
+		free(entry);
+		if (NULL == tmp) {
+			return UL_MALLOC;
+		}
+		*pinned = tmp;
+		list += len;
+	}
+
+	return UL_OK;
+}
+
+/**
+ * Give up a reference to a lookup and free it with the last one.
+ *
+ * @param lookup is the lookup to release.
+ */
+static void release_lookup(struct host_lookup *lookup)
+{
+	if (__atomic_sub_fetch(&(lookup->refs), 1, __ATOMIC_ACQ_REL)) {
+		return;
+	}
+	free(lookup->entry);
+	free(lookup->name);
+	free(lookup);
+}
+
+/**
+ * Thread function looking up the addresses of a server.
+ *
+ * @param data is the lookup to perform.
+ *
+ * @return NULL
+ */
+static void *resolve_host(void *data)
+{
+	struct host_lookup *lookup = data;
+
+	lookup->entry = lookup_addresses(lookup->name, lookup->port);
+	__atomic_store_n(&(lookup->done), 1, __ATOMIC_RELEASE);
+	release_lookup(lookup);
+
+	return NULL;
+}
+
+/**
+ * Check the format of a pinned address.
+ *
+ * @param entry is the pinned address in the form
+ *              "[+]name:port:address[,address]...".
+ *
+ * @return non zero if the entry is valid.
+ */
+static int validate_pinned(const char *entry)
+{
+	const char *port = NULL;
+
+	if ('+' == *entry) {
+		entry++;
+	}
+	port = strchr(entry, ':');
+	if (NULL == port || port == entry || !isdigit((unsigned char)port[1])) {
+		return 0;
+	}
+	port++;
+	while (isdigit((unsigned char)*port)) {
+		port++;
+	}
+
+	return ':' == *port && port[1];
+}
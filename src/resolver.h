@@ -0,0 +1,127 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_RESOLVER_H
+#define UNLOCKED_RESOLVER_H
+
+#include <stddef.h>
+#include <curl/curl.h>
+#include "error.h"
+
+/**
+ * The lookup of the addresses of a single server.
+ *
+ * The lookup is shared by the resolver and the detached thread performing
+ * it. Whoever releases it last frees it, so a resolver can be freed without
+ * waiting for a slow lookup.
+ */
+struct host_lookup {
+	/**
+	 * The entry for `CURLOPT_RESOLVE` in the form "+name:port:addresses"
+	 * or NULL if the lookup failed. It is only valid once `done` is set.
+	 */
+	char *entry;
+	char *name;
+	long port;
+	/**
+	 * Set by the thread once the lookup finished.
+	 */
+	int done;
+	/**
+	 * Whether the result was collected from the resolver.
+	 */
+	int collected;
+	/**
+	 * The number of owners of the lookup.
+	 */
+	int refs;
+};
+
+/**
+ * Resolves the host names of the servers ahead of the first request.
+ *
+ * Every server is looked up in its own thread, so that the lookups run
+ * concurrently with each other and with the rest of the startup. Servers with
+ * a pinned address or an ip address instead of a name are not looked up.
+ *
+ * The results are collected without waiting for the lookups. Servers that
+ * are not resolved in time are looked up by libcurl itself.
+ */
+struct resolver {
+	struct host_lookup **lookups;
+	size_t lookup_count;
+	/**
+	 * The pinned addresses given in the configuration.
+	 */
+	struct curl_slist *pinned;
+};
+
+/**
+ * Collect the results of the lookups, that finished since the last call,
+ * without waiting for the running ones.
+ *
+ * The entries are prefixed with "+", so that they expire from the DNS cache
+ * of libcurl like addresses it looked up itself.
+ *
+ * @param resolver is the resolver to collect the results from. Passing NULL
+ *                 is allowed.
+ *
+ * @return the resolved addresses for `CURLOPT_RESOLVE` or NULL if there are
+ *         none. The list must be freed with `curl_slist_free_all` after use.
+ */
+struct curl_slist *collect_lookups(struct resolver *resolver);
+
+/**
+ * Free all resources of a resolver and abandon running lookups.
+ *
+ * The threads of running lookups are not cancelled, they free their lookup
+ * once they finish.
+ *
+ * @param resolver is the resolver to free.
+ */
+void free_resolver(struct resolver *resolver);
+
+/**
+ * Start to resolve the servers.
+ *
+ * @param resolver is the resolver to start.
+ * @param hosts is the comma separated list of servers.
+ * @param default_port is the port of servers without an explicit port.
+ * @param pinned is a whitespace separated list of pinned addresses in the
+ *               form "name:port:address[,address]..." or NULL.
+ *
+ * @return any error that occured. In this case the resolver needs not to be
+ *         freed. Lookups that cannot be started are left to libcurl and are
+ *         not an error.
+ */
+enum unlocked_err start_resolver(struct resolver *resolver,
+				 const char *hosts, long default_port,
+				 const char *pinned);
+
+/**
+ * Take the pinned addresses from a resolver.
+ *
+ * @param resolver is the resolver. Passing NULL is allowed.
+ *
+ * @return the pinned addresses for `CURLOPT_RESOLVE` or NULL if there are
+ *         none. The list must be freed with `curl_slist_free_all` after use.
+ */
+struct curl_slist *take_pinned_addresses(struct resolver *resolver);
+
+#endif
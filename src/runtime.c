@@ -0,0 +1,96 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "runtime.h"
+
+enum unlocked_err commit_atomic_file(struct atomic_file *file)
+{
+	enum unlocked_err err = UL_OK;
+
+	if (fclose(file->file) || rename(file->tmp_path, file->path)) {
+		unlink(file->tmp_path);
+		err = UL_ERRNO;
+	}
+	free(file->tmp_path);
+	file->file = NULL;
+	file->tmp_path = NULL;
+
+	return err;
+}
+
+enum unlocked_err create_runtime_dir(void)
+{
+	if (mkdir(UNLOCKED_RUNTIME_DIR, 0700) && EEXIST != errno) {
+		return UL_ERRNO;
+	}
+
+	return UL_OK;
+}
+
+void discard_atomic_file(struct atomic_file *file)
+{
+	fclose(file->file);
+	unlink(file->tmp_path);
+	free(file->tmp_path);
+	file->file = NULL;
+	file->tmp_path = NULL;
+}
+
+enum unlocked_err open_atomic_file(struct atomic_file *file,
+				   const char *path)
+{
+	static const char tmp_suffix[] = ".XXXXXX";
+	size_t path_len = strlen(path);
+	int fd = -1;
+
+	file->file = NULL;
+	file->path = path;
+	file->tmp_path = malloc(path_len + sizeof(tmp_suffix));
+	if (NULL == file->tmp_path) {
+		return UL_MALLOC;
+	}
+	memcpy(file->tmp_path, path, path_len);
+	memcpy(file->tmp_path + path_len, tmp_suffix, sizeof(tmp_suffix));
+	// mkstemp creates the file with the mode 0600.
+	fd = mkstemp(file->tmp_path);
+	if (fd < 0) {
+		free(file->tmp_path);
+		file->tmp_path = NULL;
+
+		return UL_ERRNO;
+	}
+	file->file = fdopen(fd, "wb");
+	if (NULL == file->file) {
+		close(fd);
+		unlink(file->tmp_path);
+		free(file->tmp_path);
+		file->tmp_path = NULL;
+
+		return UL_ERRNO;
+	}
+
+	return UL_OK;
+}
@@ -0,0 +1,89 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_RUNTIME_H
+#define UNLOCKED_RUNTIME_H
+
+#include <stdio.h>
+#include "error.h"
+
+#ifndef UNLOCKED_RUNTIME_DIR
+#define UNLOCKED_RUNTIME_DIR "/run/unlocked"
+#endif
+
+/**
+ * A file that is written to a temporary file first and then atomically moved
+ * to its final path, so that readers never see a partially written file.
+ */
+struct atomic_file {
+	/**
+	 * The stream to write the content of the file to.
+	 */
+	FILE *file;
+	/**
+	 * The final path of the file.
+	 */
+	const char *path;
+	/**
+	 * The path of the temporary file.
+	 */
+	char *tmp_path;
+};
+
+/**
+ * Move the temporary file to its final path.
+ *
+ * On failure, the temporary file is removed.
+ *
+ * @param file is the file to commit.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err commit_atomic_file(struct atomic_file *file);
+
+/**
+ * Create the runtime directory, that is only accessible by its owner, if it
+ * does not exist yet.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err create_runtime_dir(void);
+
+/**
+ * Remove the temporary file without replacing the final path.
+ *
+ * @param file is the file to discard.
+ */
+void discard_atomic_file(struct atomic_file *file);
+
+/**
+ * Create a temporary file, that replaces a file after it has been written.
+ *
+ * The temporary file is created next to the final path with the mode 0600.
+ *
+ * @param file is the structure to initialize.
+ * @param path is the final path of the file. It must stay valid until the
+ *             file is committed or discarded.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err open_atomic_file(struct atomic_file *file,
+				   const char *path);
+
+#endif
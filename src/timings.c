@@ -0,0 +1,134 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "timings.h"
+
+static double as_ms(curl_off_t microseconds);
+static curl_off_t step(curl_off_t end, curl_off_t start);
+
+static const char *const phase_names[] = {
+	[PHASE_CREATE] = "create",
+	[PHASE_POLL] = "poll",
+	[PHASE_FULFIL] = "fulfil",
+};
+
+void add_phase_elapsed(struct timing_report *report, enum request_phase phase,
+		       const struct timespec *since)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	report->phases[phase].elapsed += (now.tv_sec - since->tv_sec) * 1000000
+	    + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
+void add_request_timings(struct timing_report *report,
+			 enum request_phase phase,
+			 const struct request_timings *timings)
+{
+	struct phase_timings *totals = report->phases + phase;
+	curl_off_t ready = get_ready_time(timings);
+
+	totals->requests++;
+	totals->dns += timings->namelookup;
+	totals->connect += step(timings->connect, timings->namelookup);
+	totals->tls += step(timings->appconnect, timings->connect);
+	totals->ttfb += step(timings->starttransfer, ready);
+	totals->total += timings->total;
+	if (timings->total > totals->max_total) {
+		totals->max_total = timings->total;
+	}
+}
+
+curl_off_t get_ready_time(const struct request_timings *timings)
+{
+	curl_off_t ready = timings->namelookup;
+
+	if (timings->connect > ready) {
+		ready = timings->connect;
+	}
+	if (timings->appconnect > ready) {
+		ready = timings->appconnect;
+	}
+
+	return ready;
+}
+
+void print_timings(FILE *file, const struct timing_report *report)
+{
+	const struct phase_timings *phase = NULL;
+
+	fprintf(file, "%-8s %8s %9s %10s %9s %9s %10s %9s %11s\n", "phase",
+		"requests", "dns ms", "connect ms", "tls ms", "ttfb ms",
+		"total ms", "max ms", "elapsed ms");
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		phase = report->phases + i;
+		fprintf(file, "%-8s %8lu %9.1f %10.1f %9.1f %9.1f %10.1f %9.1f "
+			"%11.1f\n", phase_names[i], phase->requests,
+			as_ms(phase->dns), as_ms(phase->connect),
+			as_ms(phase->tls), as_ms(phase->ttfb),
+			as_ms(phase->total), as_ms(phase->max_total),
+			as_ms(phase->elapsed));
+	}
+}
+
+void print_timings_json(FILE *file, const struct timing_report *report)
+{
+	const struct phase_timings *phase = NULL;
+
+	fprintf(file, "{");
+	for (int i = 0; i < PHASE_COUNT; i++) {
+		phase = report->phases + i;
+		fprintf(file, "%s\"%s\": {\"requests\": %lu, \"dns_ms\": %.3f, "
+			"\"connect_ms\": %.3f, \"tls_ms\": %.3f, "
+			"\"ttfb_ms\": %.3f, \"total_ms\": %.3f, "
+			"\"max_ms\": %.3f, \"elapsed_ms\": %.3f}",
+			i ? ", " : "", phase_names[i], phase->requests,
+			as_ms(phase->dns), as_ms(phase->connect),
+			as_ms(phase->tls), as_ms(phase->ttfb),
+			as_ms(phase->total), as_ms(phase->max_total),
+			as_ms(phase->elapsed));
+	}
+	fprintf(file, "}\n");
+}
+
+/**
+ * Convert microseconds to milliseconds.
+ *
+ * @param microseconds is the duration in microseconds.
+ *
+ * @return the duration in milliseconds.
+ */
+static double as_ms(curl_off_t microseconds)
+{
+	return microseconds / 1000.0;
+}
+
+/**
+ * Get the duration of a step from the cumulative times reported by libcurl.
+ *
+ * @param end is the time the step ended at.
+ * @param start is the time the step started at.
+ *
+ * @return the duration of the step or zero if it did not take place.
+ */
+static curl_off_t step(curl_off_t end, curl_off_t start)
+{
+	return end > start ? end - start : 0;
+}
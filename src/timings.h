@@ -0,0 +1,145 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_TIMINGS_H
+#define UNLOCKED_TIMINGS_H
+
+#include <stdio.h>
+#include <time.h>
+
+#include "https-client.h"
+
+/**
+ * The phases of the negotiation of a key.
+ */
+enum request_phase {
+	/**
+	 * Access to the key is requested from the servers.
+	 */
+	PHASE_CREATE,
+	/**
+	 * The state of the request is polled or streamed until the request
+	 * is accepted, which includes the approval by a human.
+	 */
+	PHASE_POLL,
+	/**
+	 * The request is marked as fulfilled and the key is received.
+	 */
+	PHASE_FULFIL,
+	PHASE_COUNT,
+};
+
+/**
+ * The time spent in the steps of all requests of a phase.
+ *
+ * All durations are sums over the requests in microseconds.
+ */
+struct phase_timings {
+	unsigned long requests;
+	/**
+	 * Resolving the name of the server.
+	 */
+	curl_off_t dns;
+	/**
+	 * Establishing the TCP connection.
+	 */
+	curl_off_t connect;
+	/**
+	 * The TLS handshake.
+	 */
+	curl_off_t tls;
+	/**
+	 * Sending the request and waiting for the first byte of the response
+	 * once the connection was ready.
+	 */
+	curl_off_t ttfb;
+	/**
+	 * The whole requests.
+	 */
+	curl_off_t total;
+	/**
+	 * The duration of the longest request.
+	 */
+	curl_off_t max_total;
+	/**
+	 * The wall-clock time spent in the phase by all keys, including the
+	 * delays between requests.
+	 */
+	curl_off_t elapsed;
+};
+
+/**
+ * The network timings of the negotiations of keys aggregated per phase.
+ */
+struct timing_report {
+	struct phase_timings phases[PHASE_COUNT];
+};
+
+/**
+ * Add the wall-clock time since a point in time to a phase.
+ *
+ * @param report is the report.
+ * @param phase is the phase.
+ * @param since is the start of the phase on the monotonic clock.
+ */
+void add_phase_elapsed(struct timing_report *report, enum request_phase phase,
+		       const struct timespec *since);
+
+/**
+ * Add the timings of a finished request to a phase.
+ *
+ * @param report is the report.
+ * @param phase is the phase the request belongs to.
+ * @param timings are the timings of the request reported by libcurl.
+ */
+void add_request_timings(struct timing_report *report,
+			 enum request_phase phase,
+			 const struct request_timings *timings);
+
+/**
+ * Get the time a request was sent at.
+ *
+ * The request is sent once the connection is ready, which is after the
+ * handshake for new connections. libcurl reports no connect time for some
+ * reused connections, but still the time of the name lookup.
+ *
+ * @param timings are the timings of the request.
+ *
+ * @return the time the connection was ready at in microseconds since the
+ *         start of the request.
+ */
+curl_off_t get_ready_time(const struct request_timings *timings);
+
+/**
+ * Print a report as table with one line per phase.
+ *
+ * @param file is the file to print to.
+ * @param report is the report.
+ */
+void print_timings(FILE *file, const struct timing_report *report);
+
+/**
+ * Print a report as a json object with one member per phase.
+ *
+ * @param file is the file to print to.
+ * @param report is the report.
+ */
+void print_timings_json(FILE *file, const struct timing_report *report);
+
+#endif
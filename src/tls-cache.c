@@ -0,0 +1,324 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "error.h"
+#include "log.h"
+#include "runtime.h"
+#include "tls-cache.h"
+
+/**
+ * Upper bound for each field of a cached session. Larger values indicate a
+ * corrupt cache file.
+ */
+#define MAX_FIELD_SIZE 65536
+
+static const char cache_magic[8] = "ULTLS01\n";
+
+static void free_record(struct tls_record *record);
+static int read_field(FILE *file, unsigned char **data, size_t *len);
+static int read_record(FILE *file, struct tls_record *record);
+static int write_field(FILE *file, const void *data, size_t len);
+
+enum unlocked_err read_tls_cache(FILE *file, time_t now,
+				 tls_record_callback callback, void *userdata,
+				 unsigned int *imported)
+{
+	char magic[sizeof(cache_magic)] = { 0 };
+	struct tls_record record = { 0 };
+
+	*imported = 0;
+	if (1 != fread(magic, sizeof(magic), 1, file)
+	    || memcmp(magic, cache_magic, sizeof(magic))) {
+		return UL_ERR;
+	}
+	while (read_record(file, &record)) {
+		if (record.valid_until > now && callback(&record, userdata)) {
+			(*imported)++;
+		}
+		free_record(&record);
+	}
+
+	return UL_OK;
+}
+
+int write_tls_cache_header(FILE *file)
+{
+	return 1 != fwrite(cache_magic, sizeof(cache_magic), 1, file);
+}
+
+int write_tls_record(FILE *file, const struct tls_record *record)
+{
+	if (write_field(file, record->session_key,
+			strlen(record->session_key))
+	    || write_field(file, record->shmac, record->shmac_len)
+	    || write_field(file, record->sdata, record->sdata_len)
+	    || 1 != fwrite(&record->valid_until, sizeof(record->valid_until),
+			   1, file)) {
+		return 1;
+	}
+
+	return 0;
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+
+static CURLcode export_callback(CURL *handle, void *userptr,
+				const char *session_key,
+				const unsigned char *shmac, size_t shmac_len,
+				const unsigned char *sdata, size_t sdata_len,
+				curl_off_t valid_until, int ietf_tls_id,
+				const char *alpn, size_t earlydata_max);
+static int import_callback(const struct tls_record *record, void *userdata);
+
+enum unlocked_err load_tls_sessions(CURL *curl)
+{
+	enum unlocked_err err = UL_OK;
+	FILE *file = NULL;
+	unsigned int imported = 0;
+
+	file = fopen(UNLOCKED_TLS_CACHE, "rb");
+	if (NULL == file) {
+		if (ENOENT == errno) {
+			return UL_OK;
+		}
+
+		return UL_ERRNO;
+	}
+	err = read_tls_cache(file, time(NULL), import_callback, curl,
+			     &imported);
+	fclose(file);
+	if (UL_OK != err) {
+		logger(LOG_WARNING, "Ignoring invalid TLS session cache %s\n",
+		       UNLOCKED_TLS_CACHE);
+
+		return UL_OK;
+	}
+	logger(LOG_DEBUG, "Imported %u TLS session(s) from %s\n", imported,
+	       UNLOCKED_TLS_CACHE);
+
+	return UL_OK;
+}
+
+enum unlocked_err store_tls_sessions(CURL *curl)
+{
+	struct atomic_file cache = { 0 };
+	CURLcode status = CURLE_OK;
+	enum unlocked_err err = create_runtime_dir();
+
+	if (UL_OK != err) {
+		return err;
+	}
+	err = open_atomic_file(&cache, UNLOCKED_TLS_CACHE);
+	if (UL_OK != err) {
+		return err;
+	}
+	if (write_tls_cache_header(cache.file)) {
+		discard_atomic_file(&cache);
+
+		return UL_ERRNO;
+	}
+	status = curl_easy_ssls_export(curl, export_callback, cache.file);
+	if (CURLE_OK != status) {
+		discard_atomic_file(&cache);
+		logger(LOG_DEBUG, "Could not export TLS sessions: %s\n",
+		       curl_easy_strerror(status));
+
+		return UL_CURL;
+	}
+
+	return commit_atomic_file(&cache);
+}
+
+/**
+ * Write a single session from the session cache of libcurl to the cache file.
+ *
+ * See `man 3 curl_easy_ssls_export` for the parameters.
+ */
+static CURLcode export_callback(CURL *handle, void *userptr,
+				const char *session_key,
+				const unsigned char *shmac, size_t shmac_len,
+				const unsigned char *sdata, size_t sdata_len,
+				curl_off_t valid_until, int ietf_tls_id,
+				const char *alpn, size_t earlydata_max)
+{
+	struct tls_record record = {
+		.session_key = (char *) session_key,
+		.shmac = (unsigned char *) shmac,
+		.shmac_len = shmac_len,
+		.sdata = (unsigned char *) sdata,
+		.sdata_len = sdata_len,
+		.valid_until = valid_until,
+	};
+
+	if (NULL == session_key) {
+		return CURLE_OK;
+	}
+	if (write_tls_record(userptr, &record)) {
+		return CURLE_WRITE_ERROR;
+	}
+
+	return CURLE_OK;
+}
+
+/**
+ * Import a session read from the cache file into the session cache of
+ * libcurl.
+ *
+ * @param record is the session to import.
+ * @param userdata is the curl handle to import the session into.
+ *
+ * @return 1 if the session was imported or 0 otherwise.
+ */
+static int import_callback(const struct tls_record *record, void *userdata)
+{
+	return CURLE_OK == curl_easy_ssls_import(userdata, record->session_key,
+						 record->shmac,
+						 record->shmac_len,
+						 record->sdata,
+						 record->sdata_len);
+}
+
+#else
+
+enum unlocked_err load_tls_sessions(CURL *curl)
+{
+	logger(LOG_DEBUG, "Persisting TLS sessions requires libcurl 8.12.0 "
+	       "or newer\n");
+
+	return UL_OK;
+}
+
+enum unlocked_err store_tls_sessions(CURL *curl)
+{
+	return UL_OK;
+}
+
+#endif
+
+/**
+ * Free the fields of a record read from the cache file.
+ *
+ * @param record is the record to free the fields of.
+ */
+static void free_record(struct tls_record *record)
+{
+	free(record->session_key);
+	free(record->shmac);
+	if (record->sdata) {
+		// The session data contains the secrets of the session.
+		explicit_bzero(record->sdata, record->sdata_len);
+		free(record->sdata);
+	}
+	memset(record, 0, sizeof(struct tls_record));
+}
+
+/**
+ * Read a length prefixed field from the cache file.
+ *
+ * @param file is the cache file.
+ * @param data will be set to the zero terminated data of the field, which
+ *             must be freed after use.
+ * @param len will be set to the length of the field.
+ *
+ * @return 1 if a field was read or 0 on failure.
+ */
+static int read_field(FILE *file, unsigned char **data, size_t *len)
+{
+	uint32_t field_len = 0;
+
+	if (1 != fread(&field_len, sizeof(field_len), 1, file)
+	    || field_len > MAX_FIELD_SIZE) {
+		return 0;
+	}
+	*data = malloc(field_len + 1);
+	if (NULL == *data) {
+		return 0;
+	}
+	if (field_len && 1 != fread(*data, field_len, 1, file)) {
+		free(*data);
+		*data = NULL;
+
+		return 0;
+	}
+	(*data)[field_len] = '\0';
+	*len = field_len;
+
+	return 1;
+}
+
+/**
+ * Read the next session from the cache file.
+ *
+ * @param file is the cache file.
+ * @param record will be populated with the session.
+ *
+ * @return 1 if a session was read or 0 at the end of the file or on failure.
+ */
+static int read_record(FILE *file, struct tls_record *record)
+{
+	size_t key_len = 0;
+
+	if (!read_field(file, (unsigned char **) &record->session_key,
+			&key_len)) {
+		return 0;
+	}
+	if (!read_field(file, &record->shmac, &record->shmac_len)
+	    || !read_field(file, &record->sdata, &record->sdata_len)
+	    || 1 != fread(&record->valid_until, sizeof(record->valid_until), 1,
+			  file)) {
+		free_record(record);
+
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Write a length prefixed field to the cache file.
+ *
+ * @param file is the cache file.
+ * @param data is the data of the field.
+ * @param len is the length of the data.
+ *
+ * @return zero on success or a non zero value on failure.
+ */
+static int write_field(FILE *file, const void *data, size_t len)
+{
+	uint32_t field_len = len;
+
+	if (len > MAX_FIELD_SIZE) {
+		return 1;
+	}
+	if (1 != fwrite(&field_len, sizeof(field_len), 1, file)) {
+		return 1;
+	}
+	if (len && 1 != fwrite(data, len, 1, file)) {
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,137 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_TLS_CACHE_H
+#define UNLOCKED_TLS_CACHE_H
+
+#include <curl/curl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "error.h"
+#include "runtime.h"
+
+/**
+ * The file where TLS sessions are persisted between invocations.
+ */
+#define UNLOCKED_TLS_CACHE UNLOCKED_RUNTIME_DIR "/tls-sessions"
+
+/**
+ * A TLS session as stored in the cache file.
+ */
+struct tls_record {
+	/**
+	 * The zero terminated key libcurl files the session under.
+	 */
+	char *session_key;
+	/**
+	 * The salted hash of the peer the session belongs to.
+	 */
+	unsigned char *shmac;
+	size_t shmac_len;
+	/**
+	 * The serialized session including its secrets.
+	 */
+	unsigned char *sdata;
+	size_t sdata_len;
+	/**
+	 * The time in seconds since the epoch until the session may be resumed.
+	 */
+	int64_t valid_until;
+};
+
+/**
+ * Callback for each session read from the cache file, that did not expire
+ * yet.
+ *
+ * @param record is the session. Its fields are freed after the callback
+ *               returns.
+ * @param userdata is the pointer passed to read_tls_cache.
+ *
+ * @return 1 if the session was imported or 0 otherwise.
+ */
+typedef int (*tls_record_callback)(const struct tls_record *record,
+				   void *userdata);
+
+/**
+ * Import the TLS sessions persisted by earlier invocations into the session
+ * cache of a curl handle.
+ *
+ * Expired sessions are skipped. A missing cache file is not an error.
+ *
+ * @param curl is the handle to import the sessions into. If a share handle is
+ *             attached to it, the sessions are imported into the share.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err load_tls_sessions(CURL *curl);
+
+/**
+ * Persist the TLS sessions from the session cache of a curl handle.
+ *
+ * The cache file is replaced atomically and only readable by its owner.
+ *
+ * @param curl is the handle to export the sessions from.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err store_tls_sessions(CURL *curl);
+
+/**
+ * Read the sessions from a cache file.
+ *
+ * Reading stops at the first truncated or oversized record, all sessions
+ * before it are still passed to the callback.
+ *
+ * @param file is the cache file opened for reading.
+ * @param now is the current time. Sessions valid until then or earlier are
+ *            skipped.
+ * @param callback is called for each session that did not expire.
+ * @param userdata is passed to the callback.
+ * @param imported will be set to the number of sessions the callback
+ *                 imported.
+ *
+ * @return UL_ERR if the file is no cache file or UL_OK otherwise.
+ */
+enum unlocked_err read_tls_cache(FILE *file, time_t now,
+				 tls_record_callback callback, void *userdata,
+				 unsigned int *imported);
+
+/**
+ * Write the header identifying a cache file.
+ *
+ * @param file is the cache file opened for writing.
+ *
+ * @return zero on success or a non zero value on failure.
+ */
+int write_tls_cache_header(FILE *file);
+
+/**
+ * Append a session to a cache file.
+ *
+ * @param file is the cache file opened for writing.
+ * @param record is the session to append.
+ *
+ * @return zero on success or a non zero value on failure, for example when a
+ *         field of the session is too large.
+ */
+int write_tls_record(FILE *file, const struct tls_record *record);
+
+#endif
@@ -0,0 +1,216 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "timings.h"
+#include "trace.h"
+
+/**
+ * The number of spans kept until the trace file is opened.
+ */
+#define PENDING_SPAN_COUNT 8
+#define PENDING_NAME_SIZE 32
+
+/**
+ * A span recorded before the trace file was opened.
+ */
+struct pending_span {
+	int track;
+	long long begin;
+	long long end;
+	char name[PENDING_NAME_SIZE];
+};
+
+static void record_span(int track, const char *name, long long begin,
+			long long end);
+static void write_span(int track, const char *name, long long begin,
+		       long long end);
+static void write_string(const char *prefix, const char *string);
+
+static FILE *trace_file = NULL;
+/**
+ * The number of events written to the trace file.
+ */
+static unsigned long trace_events = 0;
+static struct pending_span pending_spans[PENDING_SPAN_COUNT];
+static size_t pending_count = 0;
+static int trace_pid = 0;
+
+void close_trace(void)
+{
+	if (NULL == trace_file) {
+		return;
+	}
+	fprintf(trace_file, "\n]\n");
+	fclose(trace_file);
+	trace_file = NULL;
+}
+
+enum unlocked_err open_trace(const char *path)
+{
+	trace_file = fopen(path, "w");
+	if (NULL == trace_file) {
+		return UL_ERRNO;
+	}
+	trace_events = 0;
+	trace_pid = getpid();
+	fprintf(trace_file, "[");
+	trace_name_track(TRACE_MAIN, NULL, "unlocked-client");
+	for (size_t i = 0; i < pending_count; i++) {
+		write_span(pending_spans[i].track, pending_spans[i].name,
+			   pending_spans[i].begin, pending_spans[i].end);
+	}
+	pending_count = 0;
+
+	return UL_OK;
+}
+
+void trace_name_track(int track, const char *prefix, const char *name)
+{
+	if (NULL == trace_file) {
+		return;
+	}
+	fprintf(trace_file, "%s\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+		"\"pid\": %d, \"tid\": %d, \"args\": {\"name\": ",
+		trace_events++ ? "," : "", trace_pid, trace_pid + track);
+	write_string(prefix, name);
+	fprintf(trace_file, "}}");
+}
+
+long long trace_now(void)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_BOOTTIME, &now);
+
+	return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void trace_request(int track, const char *name,
+		   const struct request_timings *timings)
+{
+	long long end = trace_now();
+	long long begin = end - timings->total;
+	curl_off_t ready = get_ready_time(timings);
+
+	if (NULL == trace_file) {
+		return;
+	}
+	write_span(track, name, begin, end);
+	if (timings->namelookup) {
+		write_span(track, "dns", begin, begin + timings->namelookup);
+	}
+	if (timings->connect > timings->namelookup) {
+		write_span(track, "connect", begin + timings->namelookup,
+			   begin + timings->connect);
+	}
+	if (timings->appconnect > timings->connect) {
+		write_span(track, "tls", begin + timings->connect,
+			   begin + timings->appconnect);
+	}
+	if (timings->starttransfer > ready) {
+		write_span(track, "ttfb", begin + ready,
+			   begin + timings->starttransfer);
+	}
+	if (timings->total > timings->starttransfer) {
+		write_span(track, "receive", begin + timings->starttransfer,
+			   end);
+	}
+}
+
+void trace_span(int track, const char *name, long long begin)
+{
+	record_span(track, name, begin, trace_now());
+}
+
+/**
+ * Write a span to the trace file or keep it until the file is opened.
+ *
+ * @param track is the track of the span.
+ * @param name is the name of the span.
+ * @param begin is the start of the span in microseconds.
+ * @param end is the end of the span in microseconds.
+ */
+static void record_span(int track, const char *name, long long begin,
+			long long end)
+{
+	struct pending_span *span = NULL;
+
+	if (trace_file) {
+		write_span(track, name, begin, end);
+
+		return;
+	}
+	if (pending_count >= PENDING_SPAN_COUNT) {
+		return;
+	}
+	span = pending_spans + pending_count++;
+	span->track = track;
+	span->begin = begin;
+	span->end = end;
+	strncpy(span->name, name, PENDING_NAME_SIZE - 1);
+	span->name[PENDING_NAME_SIZE - 1] = '\0';
+}
+
+/**
+ * Write a complete event to the trace file.
+ *
+ * @param track is the track of the span.
+ * @param name is the name of the span.
+ * @param begin is the start of the span in microseconds.
+ * @param end is the end of the span in microseconds.
+ */
+static void write_span(int track, const char *name, long long begin,
+		       long long end)
+{
+	fprintf(trace_file, "%s\n{\"name\": ", trace_events++ ? "," : "");
+	write_string(NULL, name);
+	fprintf(trace_file, ", \"ph\": \"X\", \"ts\": %lld, \"dur\": %lld, "
+		"\"pid\": %d, \"tid\": %d}", begin, end - begin, trace_pid,
+		trace_pid + track);
+}
+
+/**
+ * Write a json string to the trace file.
+ *
+ * @param prefix is written before the string without escaping or NULL.
+ * @param string is the string to escape.
+ */
+static void write_string(const char *prefix, const char *string)
+{
+	putc('"', trace_file);
+	if (prefix) {
+		fputs(prefix, trace_file);
+	}
+	for (; *string; string++) {
+		if ('"' == *string || '\\' == *string) {
+			putc('\\', trace_file);
+			putc(*string, trace_file);
+		} else if ((unsigned char) *string < 0x20) {
+			fprintf(trace_file, "\\u%04x", *string);
+		} else {
+			putc(*string, trace_file);
+		}
+	}
+	putc('"', trace_file);
+}
@@ -0,0 +1,91 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_TRACE_H
+#define UNLOCKED_TRACE_H
+
+#include "error.h"
+#include "https-client.h"
+
+/**
+ * The track of the spans, that are not related to a single key.
+ */
+#define TRACE_MAIN 0
+
+/**
+ * Stop recording spans and complete the trace file.
+ */
+void close_trace(void);
+
+/**
+ * Start writing spans to a file in the trace event format, that can be
+ * opened with Perfetto or chrome://tracing.
+ *
+ * Spans, that were recorded before the file was opened, are written first.
+ *
+ * @param path is the path of the file.
+ *
+ * @return any error that occured.
+ */
+enum unlocked_err open_trace(const char *path);
+
+/**
+ * Name a track of the trace.
+ *
+ * @param track is the track.
+ * @param prefix is prepended to the name or NULL.
+ * @param name is the name of the track.
+ */
+void trace_name_track(int track, const char *prefix, const char *name);
+
+/**
+ * Get the current time for the start of a span.
+ *
+ * The time is taken from `CLOCK_BOOTTIME`, so that traces line up with the
+ * output of `systemd-analyze`.
+ *
+ * @return the time since the system booted in microseconds.
+ */
+long long trace_now(void);
+
+/**
+ * Record a finished request and its steps as reported by libcurl.
+ *
+ * The request is assumed to have just finished.
+ *
+ * @param track is the track of the request.
+ * @param name is the name of the request.
+ * @param timings are the timings of the request.
+ */
+void trace_request(int track, const char *name,
+		   const struct request_timings *timings);
+
+/**
+ * Record a span, that ends now.
+ *
+ * Before a trace file is opened, a few spans are kept in memory. Any further
+ * spans are dropped silently.
+ *
+ * @param track is the track of the span.
+ * @param name is the name of the span.
+ * @param begin is the start of the span from `trace_now`.
+ */
+void trace_span(int track, const char *name, long long begin);
+
+#endif
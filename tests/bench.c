@@ -0,0 +1,250 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <curl/curl.h>
+#include <openssl/crypto.h>
+
+#include "bench.h"
+
+/**
+ * The default minimal duration of a round in milliseconds.
+ */
+#define DEFAULT_MIN_TIME 100
+
+/**
+ * The default number of rounds of every benchmark.
+ */
+#define DEFAULT_ROUNDS 5
+
+/**
+ * The maximal number of rounds of every benchmark.
+ */
+#define MAX_ROUNDS 32
+
+/*
+ * The allocator of the C library, which is wrapped to count allocations.
+ */
+extern void *__libc_calloc(size_t count, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_malloc(size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static unsigned long allocations = 0;
+static unsigned long allocated_bytes = 0;
+static long min_round_time = DEFAULT_MIN_TIME * 1000000L;
+static unsigned int round_count = DEFAULT_ROUNDS;
+
+static int compare_doubles(const void *a, const void *b);
+static void count_allocation(size_t size);
+static long elapsed_ns(const struct timespec *start);
+static void print_json_string(FILE * stream, const char *str);
+
+void *calloc(size_t count, size_t size)
+{
+	count_allocation(count * size);
+
+	return __libc_calloc(count, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+void *malloc(size_t size)
+{
+	count_allocation(size);
+
+	return __libc_malloc(size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	count_allocation(size);
+
+	return __libc_realloc(ptr, size);
+}
+
+void configure_benchmarks(long min_time, unsigned int rounds)
+{
+	if (min_time > 0) {
+		min_round_time = min_time * 1000000L;
+	}
+	if (rounds > 0) {
+		round_count = rounds < MAX_ROUNDS ? rounds : MAX_ROUNDS;
+	}
+}
+
+unsigned long count_allocations(unsigned long *bytes)
+{
+	if (bytes) {
+		*bytes = __atomic_load_n(&allocated_bytes, __ATOMIC_RELAXED);
+	}
+
+	return __atomic_load_n(&allocations, __ATOMIC_RELAXED);
+}
+
+void print_bench_json(FILE * stream, const struct bench_result *results,
+		      size_t count)
+{
+	fprintf(stream, "{\n  \"libcurl\": ");
+	print_json_string(stream, curl_version_info(CURLVERSION_NOW)->version);
+	fprintf(stream, ",\n  \"openssl\": ");
+	print_json_string(stream, OpenSSL_version(OPENSSL_VERSION));
+	fprintf(stream, ",\n  \"benchmarks\": [");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(stream, "%s\n    {\"name\": ", i ? "," : "");
+		print_json_string(stream, results[i].name);
+		fprintf(stream, ", \"iterations\": %lu, \"ns_per_op\": %.1f, "
+			"\"allocs_per_op\": %.2f, \"bytes_per_op\": %.1f}",
+			results[i].iterations, results[i].ns_per_op,
+			results[i].allocs_per_op, results[i].bytes_per_op);
+	}
+	fprintf(stream, "\n  ]\n}\n");
+}
+
+void print_bench_table(FILE * stream, const struct bench_result *results,
+		       size_t count)
+{
+	fprintf(stream, "%-32s %12s %12s %12s\n", "benchmark", "ns/op",
+		"allocs/op", "bytes/op");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(stream, "%-32s %12.1f %12.2f %12.1f\n",
+			results[i].name, results[i].ns_per_op,
+			results[i].allocs_per_op, results[i].bytes_per_op);
+	}
+}
+
+void run_benchmark(const char *name, bench_op op, void *data,
+		   struct bench_result *result)
+{
+	double round_ns[MAX_ROUNDS];
+	unsigned long iterations = 1;
+	unsigned long total = 0;
+	unsigned long allocs = 0;
+	unsigned long bytes = 0;
+	unsigned long start_bytes = 0;
+	unsigned long start_allocs = 0;
+	struct timespec start = { 0 };
+	long elapsed = 0;
+
+	// Warm up caches and lazily initialized state.
+	op(data);
+	// Find the number of iterations for a round of the minimal time.
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < iterations; i++) {
+			op(data);
+		}
+		elapsed = elapsed_ns(&start);
+		if (elapsed >= min_round_time) {
+			break;
+		}
+		iterations *= 2;
+	}
+	start_allocs = count_allocations(&start_bytes);
+	for (unsigned int round = 0; round < round_count; round++) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (unsigned long i = 0; i < iterations; i++) {
+			op(data);
+		}
+		round_ns[round] = (double)elapsed_ns(&start) / iterations;
+		total += iterations;
+	}
+	allocs = count_allocations(&bytes) - start_allocs;
+	bytes -= start_bytes;
+	qsort(round_ns, round_count, sizeof(double), compare_doubles);
+	result->name = name;
+	result->iterations = iterations;
+	result->ns_per_op = round_ns[round_count / 2];
+	result->allocs_per_op = (double)allocs / total;
+	result->bytes_per_op = (double)bytes / total;
+}
+
+/**
+ * Compare two doubles for sorting.
+ *
+ * @param a is the first double.
+ * @param b is the second double.
+ *
+ * @return a negative value, zero or a positive value if the first double is
+ *         smaller, equal or greater than the second one.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+	double first = *(const double *)a;
+	double second = *(const double *)b;
+
+	return (first > second) - (first < second);
+}
+
+/**
+ * Count a call of the allocator.
+ *
+ * @param size is the number of bytes requested.
+ */
+static void count_allocation(size_t size)
+{
+	if (0 == size) {
+		return;
+	}
+	__atomic_add_fetch(&allocations, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&allocated_bytes, size, __ATOMIC_RELAXED);
+}
+
+/**
+ * Get the time since a point in time.
+ *
+ * @param start is the point in time.
+ *
+ * @return the time in nanoseconds.
+ */
+static long elapsed_ns(const struct timespec *start)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - start->tv_sec) * 1000000000L
+	    + now.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * Print a string as json string.
+ *
+ * @param stream is the stream to print the string to.
+ * @param str is the string.
+ */
+static void print_json_string(FILE * stream, const char *str)
+{
+	fputc('"', stream);
+	for (; *str; str++) {
+		if ('"' == *str || '\\' == *str) {
+			fprintf(stream, "\\%c", *str);
+		} else if ((unsigned char)*str < 0x20) {
+			fprintf(stream, "\\u%04x", *str);
+		} else {
+			fputc(*str, stream);
+		}
+	}
+	fputc('"', stream);
+}
@@ -0,0 +1,105 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_BENCH_H
+#define UNLOCKED_BENCH_H
+
+#include <stdio.h>
+
+/**
+ * The outcome of a single benchmark.
+ */
+struct bench_result {
+	const char *name;
+	/**
+	 * The number of operations of the fastest round.
+	 */
+	unsigned long iterations;
+	/**
+	 * The median time of an operation over all rounds in nanoseconds.
+	 */
+	double ns_per_op;
+	double allocs_per_op;
+	double bytes_per_op;
+};
+
+/**
+ * A function, that performs the measured operation once.
+ *
+ * @param data is the data of the benchmark.
+ */
+typedef void (*bench_op)(void *data);
+
+/**
+ * Configure how long every benchmark runs.
+ *
+ * @param min_time is the minimal duration of a round in milliseconds or zero
+ *                 to keep the current duration.
+ * @param rounds is the number of rounds the median is taken from or zero to
+ *               keep the current number.
+ */
+void configure_benchmarks(long min_time, unsigned int rounds);
+
+/**
+ * Get the number of heap allocations since the start of the program.
+ *
+ * Every call of malloc, calloc and realloc with a non zero size counts as an
+ * allocation.
+ *
+ * @param bytes is set to the number of bytes requested by these calls, if it
+ *              is not NULL.
+ *
+ * @return the number of allocations.
+ */
+unsigned long count_allocations(unsigned long *bytes);
+
+/**
+ * Print the results of benchmarks as json.
+ *
+ * @param stream is the stream to print the results to.
+ * @param results are the results.
+ * @param count is the number of results.
+ */
+void print_bench_json(FILE * stream, const struct bench_result *results,
+		      size_t count);
+
+/**
+ * Print the results of benchmarks as table.
+ *
+ * @param stream is the stream to print the results to.
+ * @param results are the results.
+ * @param count is the number of results.
+ */
+void print_bench_table(FILE * stream, const struct bench_result *results,
+		       size_t count);
+
+/**
+ * Measure an operation.
+ *
+ * The operation is repeated until a round takes at least the minimal time.
+ *
+ * @param name is the name of the benchmark.
+ * @param op is the operation.
+ * @param data is passed to the operation.
+ * @param result is populated with the measurements.
+ */
+void run_benchmark(const char *name, bench_op op, void *data,
+		   struct bench_result *result);
+
+#endif
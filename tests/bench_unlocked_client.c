@@ -0,0 +1,503 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "bench.h"
+#include "cJSON.h"
+#include "../src/cli.h"
+#include "../src/hmac-signer.h"
+#include "../src/https-client.h"
+#include "../src/json-scan.h"
+
+/**
+ * The size of the storage for the state of a request.
+ */
+#define STATE_SIZE 32
+
+/**
+ * The number of items in the large json response.
+ */
+#define LARGE_ITEMS 1000
+
+/**
+ * The maximum number of patterns of benchmarks to skip.
+ */
+#define MAX_EXCLUDES 8
+
+struct benchmark {
+	const char *name;
+	bench_op op;
+	void *data;
+};
+
+struct auth_data {
+	struct curl_slist *headers;
+	struct Request request;
+	struct hmac_signer *signer;
+};
+
+struct config_data {
+	const char *path;
+	struct arguments *parsed;
+	/**
+	 * The secret of the parsed arguments on the heap, because the locked
+	 * memory for secrets is wiped after every run of a benchmark.
+	 */
+	char *secret;
+};
+
+struct json_data {
+	const char *json;
+	size_t length;
+};
+
+static const char *const realistic_json =
+    "{\"id\": 42, \"key_handle\": \"root-disk\", \"state\": \"PENDING\", "
+    "\"created_at\": \"2022-07-10T09:41:29+00:00\", "
+    "\"updated_at\": \"2022-07-10T09:41:31+00:00\", "
+    "\"user\": \"node-17\"}";
+
+static const char *const response_headers[] = {
+	"HTTP/2 200\r\n",
+	"date: Sun, 10 Jul 2022 09:41:29 GMT\r\n",
+	"server: nginx\r\n",
+	"content-type: application/json\r\n",
+	"content-length: 131\r\n",
+	"strict-transport-security: max-age=31536000\r\n",
+};
+
+static void bench_add_auth_header(void *data);
+static void bench_auth_reference(void *data);
+static void bench_cjson(void *data);
+static void bench_date_header(void *data);
+static void bench_get_content_type(void *data);
+static void bench_join_header_names(void *data);
+static void bench_merge_config(void *data);
+static void bench_parse_config_file(void *data);
+static void bench_scan_json(void *data);
+static void bench_sign(void *data);
+static void bench_store_header(void *data);
+static char *create_large_json(void);
+static int is_excluded(const char *name, const char *const *excludes,
+		       size_t exclude_count);
+static void usage(const char *program);
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"exclude", required_argument, NULL, 'x'},
+		{"filter", required_argument, NULL, 'f'},
+		{"help", no_argument, NULL, 'h'},
+		{"json", required_argument, NULL, 'j'},
+		{"min-time", required_argument, NULL, 't'},
+		{"rounds", required_argument, NULL, 'r'},
+		{0, 0, 0, 0},
+	};
+	struct auth_data auth = {
+		.request = {
+			    .body = "{\"state\": \"FULFILLED\"}",
+			    .secret = "test-secret",
+			    .username = "test-server",
+			    },
+	};
+	struct config_data config = {
+		.path = UNLOCKED_BENCH_CONFIG,
+	};
+	struct json_data large = { 0 };
+	struct json_data realistic = {
+		.json = realistic_json,
+		.length = strlen(realistic_json),
+	};
+	struct Response *response = NULL;
+	const struct benchmark benchmarks[] = {
+		{"add_auth_header", bench_add_auth_header, &auth},
+		{"auth_reference", bench_auth_reference, &auth},
+		{"sign", bench_sign, &auth},
+		{"date_header", bench_date_header, NULL},
+		{"joinHeaderNames", bench_join_header_names, &auth},
+		{"store_header", bench_store_header, &response},
+		{"get_content_type", bench_get_content_type, &response},
+		{"scan_json/realistic", bench_scan_json, &realistic},
+		{"cjson/realistic", bench_cjson, &realistic},
+		{"scan_json/large", bench_scan_json, &large},
+		{"cjson/large", bench_cjson, &large},
+		{"parse_config_file", bench_parse_config_file, &config},
+		{"merge_config", bench_merge_config, &config},
+	};
+	const size_t benchmark_count =
+	    sizeof(benchmarks) / sizeof(benchmarks[0]);
+	struct bench_result results[sizeof(benchmarks) / sizeof(benchmarks[0])];
+	const char *excludes[MAX_EXCLUDES];
+	size_t exclude_count = 0;
+	const char *filter = NULL;
+	const char *json_path = NULL;
+	long min_time = 0;
+	unsigned int rounds = 0;
+	size_t result_count = 0;
+	FILE *json_file = NULL;
+	int opt = 0;
+
+	while (-1 != (opt = getopt_long(argc, argv, "f:hj:r:t:x:", options,
+					NULL))) {
+		switch (opt) {
+		case 'x':
+			if (MAX_EXCLUDES == exclude_count) {
+				fprintf(stderr, "Too many excluded "
+					"benchmarks\n");
+
+				return EXIT_FAILURE;
+			}
+			excludes[exclude_count++] = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json_path = optarg;
+			break;
+		case 'r':
+			rounds = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			min_time = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+	configure_benchmarks(min_time, rounds);
+	if (UL_OK != init_https_client()) {
+		return EXIT_FAILURE;
+	}
+	auth.signer = create_signer(auth.request.secret);
+	auth.headers = curl_slist_append(NULL, "Date: Sun, 10 Jul 2022 "
+					 "09:41:29 GMT");
+	response = create_response();
+	large.json = create_large_json();
+	config.parsed = create_args();
+	if (NULL == auth.signer || NULL == auth.headers || NULL == response
+	    || NULL == large.json || NULL == config.parsed
+	    || UL_OK != parse_config_file(config.path, config.parsed)) {
+		fprintf(stderr, "Could not prepare the benchmarks\n");
+
+		return EXIT_FAILURE;
+	}
+	large.length = strlen(large.json);
+	config.secret = strdup(config.parsed->secret);
+	config.parsed->secret = config.secret;
+	free_secrets();
+	if (NULL == config.secret) {
+		fprintf(stderr, "Could not prepare the benchmarks\n");
+
+		return EXIT_FAILURE;
+	}
+	for (size_t i = 0; i < sizeof(response_headers) / sizeof(char *); i++) {
+		store_header(response, response_headers[i],
+			     strlen(response_headers[i]));
+	}
+
+	for (size_t i = 0; i < benchmark_count; i++) {
+		if ((filter && NULL == strstr(benchmarks[i].name, filter))
+		    || is_excluded(benchmarks[i].name, excludes,
+				   exclude_count)) {
+			continue;
+		}
+		run_benchmark(benchmarks[i].name, benchmarks[i].op,
+			      benchmarks[i].data, results + result_count++);
+	}
+	print_bench_table(stdout, results, result_count);
+	if (json_path) {
+		json_file = strcmp(json_path, "-") ? fopen(json_path, "w") :
+		    stdout;
+		if (NULL == json_file) {
+			perror(json_path);
+
+			return EXIT_FAILURE;
+		}
+		print_bench_json(json_file, results, result_count);
+		if (stdout != json_file) {
+			fclose(json_file);
+		}
+	}
+
+	free_args(config.parsed);
+	free(config.secret);
+	free_secrets();
+	free((char *)large.json);
+	free_response(response);
+	curl_slist_free_all(auth.headers);
+	free_signer(auth.signer);
+	cleanup_https_client();
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Create the Authorization header for the signed headers of a request.
+ */
+static void bench_add_auth_header(void *data)
+{
+	struct auth_data *auth = data;
+	struct curl_slist *headers = add_auth_header(auth->headers,
+						     &(auth->request),
+						     auth->signer);
+
+	// Drop the appended header again.
+	curl_slist_free_all(headers->next);
+	headers->next = NULL;
+}
+
+/**
+ * Sign the headers and body of a request like the client did before the
+ * signer was introduced. This serves as reference for the signer.
+ */
+static void bench_auth_reference(void *data)
+{
+	struct auth_data *auth = data;
+	struct curl_slist *header = auth->headers;
+	const char *secret = auth->request.secret;
+	const char *body = auth->request.body;
+	char *data_to_sign = NULL;
+	size_t data_to_sign_size = strlen(body) + 1;
+	unsigned char *digest = NULL;
+	char hex_digest[129];
+	char *names = joinHeaderNames(auth->headers);
+
+	for (header = auth->headers; header; header = header->next) {
+		data_to_sign_size += strlen(header->data) + 1;
+	}
+	data_to_sign = malloc(data_to_sign_size);
+	data_to_sign[0] = '\0';
+	for (header = auth->headers; header; header = header->next) {
+		strcat(data_to_sign, header->data);
+		strcat(data_to_sign, "\n");
+	}
+	strcat(data_to_sign, body);
+	digest = HMAC(EVP_sha512(), secret, strlen(secret),
+		      (unsigned char *)data_to_sign, strlen(data_to_sign),
+		      NULL, NULL);
+	for (int i = 0; i < 64; i++) {
+		sprintf(hex_digest + i * 2, "%02X", digest[i]);
+	}
+	free(data_to_sign);
+	free(names);
+}
+
+/**
+ * Parse a json response into a tree to extract the state of the request.
+ */
+static void bench_cjson(void *data)
+{
+	struct json_data *json = data;
+	cJSON *root = cJSON_Parse(json->json);
+	cJSON *state = cJSON_GetObjectItemCaseSensitive(root, "state");
+	char *copy = NULL;
+
+	if (cJSON_IsString(state)) {
+		copy = strdup(state->valuestring);
+	}
+	free(copy);
+	cJSON_Delete(root);
+}
+
+/**
+ * Format the Date header for the current time.
+ */
+static void bench_date_header(void *data)
+{
+	free(date_header(NULL));
+}
+
+/**
+ * Look up the content type of a response.
+ */
+static void bench_get_content_type(void *data)
+{
+	struct Response **response = data;
+
+	if (NULL == get_content_type(*response)) {
+		abort();
+	}
+}
+
+/**
+ * Join the names of the signed headers of a request.
+ */
+static void bench_join_header_names(void *data)
+{
+	struct auth_data *auth = data;
+
+	free(joinHeaderNames(auth->headers));
+}
+
+/**
+ * Merge the arguments from the configuration file into empty arguments,
+ * including the copy of the secret to fresh locked memory.
+ */
+static void bench_merge_config(void *data)
+{
+	struct config_data *config = data;
+	struct arguments *base = create_args();
+
+	merge_config(base, config->parsed);
+	free_args(base);
+	free_secrets();
+}
+
+/**
+ * Parse the example configuration file.
+ */
+static void bench_parse_config_file(void *data)
+{
+	struct config_data *config = data;
+	struct arguments *args = create_args();
+
+	parse_config_file(config->path, args);
+	free_args(args);
+	free_secrets();
+}
+
+/**
+ * Extract the state of the request from a json response.
+ */
+static void bench_scan_json(void *data)
+{
+	struct json_data *json = data;
+	char state[STATE_SIZE];
+	struct json_field field = {
+		.name = "state",
+		.type = JSON_FIELD_STRING,
+		.string = state,
+		.string_size = sizeof(state),
+	};
+
+	if (UL_OK != scan_json_object(json->json, json->length, &field, 1)) {
+		abort();
+	}
+}
+
+/**
+ * Sign the headers and body of a request with the signer.
+ */
+static void bench_sign(void *data)
+{
+	struct auth_data *auth = data;
+	char signature[SIGNATURE_SIZE];
+
+	start_signature(auth->signer);
+	update_signature(auth->signer, auth->headers->data,
+			 strlen(auth->headers->data));
+	update_signature(auth->signer, "\n", 1);
+	update_signature(auth->signer, auth->request.body,
+			 strlen(auth->request.body));
+	finish_signature(auth->signer, signature);
+}
+
+/**
+ * Receive the headers of a response.
+ */
+static void bench_store_header(void *data)
+{
+	struct Response **response = data;
+
+	for (size_t i = 0; i < sizeof(response_headers) / sizeof(char *); i++) {
+		store_header(*response, response_headers[i],
+			     strlen(response_headers[i]));
+	}
+}
+
+/**
+ * Create a large json response, where the state follows many other members.
+ *
+ * @return the json, that must be freed after use, or NULL on failure.
+ */
+static char *create_large_json(void)
+{
+	static const char *const item_fmt =
+	    "{\"id\": %d, \"name\": \"item %d\", \"tags\": [\"a\", \"b\"], "
+	    "\"ratio\": %d.5e-1}, ";
+	size_t size = 96 * LARGE_ITEMS + 64;
+	char *json = malloc(size);
+	size_t length = 0;
+
+	if (NULL == json) {
+		return NULL;
+	}
+	length += snprintf(json + length, size - length, "{\"items\": [");
+	for (int i = 0; i < LARGE_ITEMS; i++) {
+		length += snprintf(json + length, size - length, item_fmt, i, i,
+				   i);
+	}
+	// Replace the separator after the last item.
+	length -= 2;
+	snprintf(json + length, size - length, "], \"id\": 42, "
+		 "\"state\": \"PENDING\"}");
+
+	return json;
+}
+
+/**
+ * Check whether a benchmark is skipped.
+ *
+ * @param name is the name of the benchmark.
+ * @param excludes are the substrings of the names of skipped benchmarks.
+ * @param exclude_count is the number of substrings.
+ *
+ * @return whether the name contains any of the substrings.
+ */
+static int is_excluded(const char *name, const char *const *excludes,
+		       size_t exclude_count)
+{
+	for (size_t i = 0; i < exclude_count; i++) {
+		if (strstr(name, excludes[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Print the usage of the benchmarks.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [--filter <substring>] [--exclude <substring>]... "
+	       "[--json <file>]\n"
+	       "       [--min-time <ms>] [--rounds <count>]\n\n"
+	       "Run the microbenchmarks of the client. The results are "
+	       "printed as table and\n"
+	       "optionally written as json to a file or to stdout for "
+	       "\"-\".\n", program);
+}
@@ -0,0 +1,155 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "check_backoff.h"
+#include "../src/backoff.h"
+
+START_TEST(test_delay_grows_exponentially)
+{
+	struct backoff backoff = { 0 };
+
+	init_backoff(&backoff, 100, 2, 10000, 0);
+	ck_assert_int_eq(100, get_next_delay(&backoff));
+	ck_assert_int_eq(200, get_next_delay(&backoff));
+	ck_assert_int_eq(400, get_next_delay(&backoff));
+	ck_assert_int_eq(800, get_next_delay(&backoff));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_delay_is_capped)
+{
+	struct backoff backoff = { 0 };
+
+	init_backoff(&backoff, 1000, 3, 5000, 0);
+	ck_assert_int_eq(1000, get_next_delay(&backoff));
+	ck_assert_int_eq(3000, get_next_delay(&backoff));
+	ck_assert_int_eq(5000, get_next_delay(&backoff));
+	ck_assert_int_eq(5000, get_next_delay(&backoff));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_delay_is_constant_without_multiplier)
+{
+	struct backoff backoff = { 0 };
+
+	init_backoff(&backoff, 1000, 1, 5000, 0);
+	ck_assert_int_eq(1000, get_next_delay(&backoff));
+	ck_assert_int_eq(1000, get_next_delay(&backoff));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_jitter_stays_below_delay)
+{
+	struct backoff backoff = { 0 };
+	long delay = 0;
+
+	init_backoff(&backoff, 100, 2, 1600, 1);
+	for (long max = 100; max <= 1600; max *= 2) {
+		delay = get_next_delay(&backoff);
+		ck_assert_int_ge(delay, 0);
+		ck_assert_int_le(delay, max);
+	}
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_polls_are_counted)
+{
+	struct backoff backoff = { 0 };
+
+	init_backoff(&backoff, 0, 1, 0, 0);
+	start_poll(&backoff);
+	wait_for_next_poll(&backoff);
+	start_poll(&backoff);
+	ck_assert_uint_eq(2, backoff.polls);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_next_poll_is_relative_to_last_poll)
+{
+	struct backoff backoff = { 0 };
+	struct timespec deadline = { 0 };
+
+	init_backoff(&backoff, 1500, 2, 5000, 0);
+	backoff.last_poll.tv_sec = 10;
+	backoff.last_poll.tv_nsec = 800000000;
+	get_next_poll(&backoff, &deadline);
+	ck_assert_int_eq(12, deadline.tv_sec);
+	ck_assert_int_eq(300000000, deadline.tv_nsec);
+	get_next_poll(&backoff, &deadline);
+	ck_assert_int_eq(13, deadline.tv_sec);
+	ck_assert_int_eq(800000000, deadline.tv_nsec);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_backoff_get_next_delay_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("backoff::get_next_delay");
+	tcase_add_test(tc, test_delay_grows_exponentially);
+	tcase_add_test(tc, test_delay_is_capped);
+	tcase_add_test(tc, test_delay_is_constant_without_multiplier);
+	tcase_add_test(tc, test_jitter_stays_below_delay);
+
+	return tc;
+}
+
+static TCase *make_backoff_get_next_poll_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("backoff::get_next_poll");
+	tcase_add_test(tc, test_next_poll_is_relative_to_last_poll);
+
+	return tc;
+}
+
+static TCase *make_backoff_start_poll_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("backoff::start_poll");
+	tcase_add_test(tc, test_polls_are_counted);
+
+	return tc;
+}
+
+Suite *make_backoff_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client backoff");
+	suite_add_tcase(s, make_backoff_get_next_delay_case());
+	suite_add_tcase(s, make_backoff_get_next_poll_case());
+	suite_add_tcase(s, make_backoff_start_poll_case());
+
+	return s;
+}
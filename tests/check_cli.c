@@ -17,9 +17,83 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdlib.h>
+
 #include "check_cli.h"
 #include "../src/cli.h"
 
+START_TEST(test_agent_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_agent = no;
+
+	base->agent = base_agent;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_agent, base->agent);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_agent_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_agent = no;
+	static enum tristate cli_agent = yes;
+
+	base->agent = base_agent;
+	cli->agent = cli_agent;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_agent, base->agent);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_agent_socket_is_not_merged_when_empty)
+{
+	static char *base_agent_socket = "/run/agent.sock";
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->agent_socket = strdup(base_agent_socket);
+	merge_config(base, cli);
+	ck_assert_str_eq(base_agent_socket, base->agent_socket);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_agent_socket_is_merged)
+{
+	static char *base_agent_socket = "/run/agent.sock";
+	static char *cli_agent_socket = "/tmp/agent.sock";
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->agent_socket = strdup(base_agent_socket);
+	cli->agent_socket = strdup(cli_agent_socket);
+	merge_config(base, cli);
+	ck_assert_str_eq(cli_agent_socket, base->agent_socket);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 START_TEST(test_config_file_is_not_merged_when_empty)
 {
 	static char *base_config = "test";
@@ -94,6 +168,92 @@ START_TEST(test_key_handle_is_merged)
 END_TEST
 // *INDENT-ON*
 
+START_TEST(test_keys_are_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->keys = calloc(1, sizeof(struct key_config));
+	base->keys[0].name = strdup("root");
+	base->keys[0].key_handle = strdup("root-disk");
+	base->key_count = 1;
+	merge_config(base, cli);
+	ck_assert_uint_eq(1, base->key_count);
+	ck_assert_str_eq("root", base->keys[0].name);
+	ck_assert_str_eq("root-disk", base->keys[0].key_handle);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_keys_are_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->keys = calloc(1, sizeof(struct key_config));
+	base->keys[0].name = strdup("root");
+	base->keys[0].key_handle = strdup("root-disk");
+	base->key_count = 1;
+	cli->keys = calloc(2, sizeof(struct key_config));
+	cli->keys[0].name = strdup("data0");
+	cli->keys[0].key_handle = strdup("data0");
+	cli->keys[1].name = strdup("data1");
+	cli->keys[1].key_handle = strdup("backup");
+	cli->key_count = 2;
+	merge_config(base, cli);
+	ck_assert_uint_eq(2, base->key_count);
+	ck_assert_str_eq("data0", base->keys[0].name);
+	ck_assert_str_eq("data0", base->keys[0].key_handle);
+	ck_assert_str_eq("data1", base->keys[1].name);
+	ck_assert_str_eq("backup", base->keys[1].key_handle);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_hedge_delay_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_hedge_delay = 1000;
+
+	base->hedge_delay = base_hedge_delay;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_hedge_delay, base->hedge_delay);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_hedge_delay_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_hedge_delay = 1000;
+	static long cli_hedge_delay = 250;
+
+	base->hedge_delay = base_hedge_delay;
+	cli->hedge_delay = cli_hedge_delay;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_hedge_delay, base->hedge_delay);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 START_TEST(test_host_is_not_merged_when_empty)
 {
 	static char *base_host = "test";
@@ -130,6 +290,330 @@ START_TEST(test_host_is_merged)
 END_TEST
 // *INDENT-ON*
 
+START_TEST(test_key_ttl_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_key_ttl = 300;
+
+	base->key_ttl = base_key_ttl;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_key_ttl, base->key_ttl);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_key_ttl_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_key_ttl = 300;
+	static long cli_key_ttl = 60;
+
+	base->key_ttl = base_key_ttl;
+	cli->key_ttl = cli_key_ttl;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_key_ttl, base->key_ttl);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_long_poll_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_long_poll = no;
+
+	base->long_poll = base_long_poll;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_long_poll, base->long_poll);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_long_poll_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_long_poll = no;
+	static enum tristate cli_long_poll = yes;
+
+	base->long_poll = base_long_poll;
+	cli->long_poll = cli_long_poll;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_long_poll, base->long_poll);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_long_poll_timeout_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_long_poll_timeout = 60;
+
+	base->long_poll_timeout = base_long_poll_timeout;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_long_poll_timeout, base->long_poll_timeout);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_long_poll_timeout_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_long_poll_timeout = 60;
+	static long cli_long_poll_timeout = 300;
+
+	base->long_poll_timeout = base_long_poll_timeout;
+	cli->long_poll_timeout = cli_long_poll_timeout;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_long_poll_timeout, base->long_poll_timeout);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_max_response_size_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_max_response_size = 1048576;
+
+	base->max_response_size = base_max_response_size;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_max_response_size, base->max_response_size);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_max_response_size_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_max_response_size = 1048576;
+	static long cli_max_response_size = 4096;
+
+	base->max_response_size = base_max_response_size;
+	cli->max_response_size = cli_max_response_size;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_max_response_size, base->max_response_size);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_metrics_file_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static char *base_metrics_file = "/var/lib/node_exporter/unlocked.prom";
+
+	base->metrics_file = strdup(base_metrics_file);
+	merge_config(base, cli);
+	ck_assert_str_eq(base_metrics_file, base->metrics_file);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_metrics_file_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static char *base_metrics_file = "/var/lib/node_exporter/unlocked.prom";
+	static char *cli_metrics_file = "/tmp/unlocked.prom";
+
+	base->metrics_file = strdup(base_metrics_file);
+	cli->metrics_file = strdup(cli_metrics_file);
+	merge_config(base, cli);
+	ck_assert_str_eq(cli_metrics_file, base->metrics_file);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_interval_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_poll_interval = 1000;
+
+	base->poll_interval = base_poll_interval;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_poll_interval, base->poll_interval);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_interval_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_poll_interval = 1000;
+	static long cli_poll_interval = 500;
+
+	base->poll_interval = base_poll_interval;
+	cli->poll_interval = cli_poll_interval;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_poll_interval, base->poll_interval);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_jitter_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_poll_jitter = yes;
+
+	base->poll_jitter = base_poll_jitter;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_poll_jitter, base->poll_jitter);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_jitter_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum tristate base_poll_jitter = yes;
+	static enum tristate cli_poll_jitter = no;
+
+	base->poll_jitter = base_poll_jitter;
+	cli->poll_jitter = cli_poll_jitter;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_poll_jitter, base->poll_jitter);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_max_interval_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_poll_max_interval = 10000;
+
+	base->poll_max_interval = base_poll_max_interval;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_poll_max_interval, base->poll_max_interval);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_max_interval_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static long base_poll_max_interval = 10000;
+	static long cli_poll_max_interval = 30000;
+
+	base->poll_max_interval = base_poll_max_interval;
+	cli->poll_max_interval = cli_poll_max_interval;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_poll_max_interval, base->poll_max_interval);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_multiplier_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static double base_poll_multiplier = 1.5;
+
+	base->poll_multiplier = base_poll_multiplier;
+	merge_config(base, cli);
+	ck_assert_double_eq(base_poll_multiplier, base->poll_multiplier);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_poll_multiplier_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static double base_poll_multiplier = 1.5;
+	static double cli_poll_multiplier = 2;
+
+	base->poll_multiplier = base_poll_multiplier;
+	cli->poll_multiplier = cli_poll_multiplier;
+	merge_config(base, cli);
+	ck_assert_double_eq(cli_poll_multiplier, base->poll_multiplier);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 START_TEST(test_port_is_not_merged_when_empty)
 {
 	static long base_port = 443;
@@ -166,6 +650,42 @@ START_TEST(test_port_is_merged)
 END_TEST
 // *INDENT-ON*
 
+START_TEST(test_resolve_is_not_merged_when_empty)
+{
+	static char *base_resolve = "a.example:443:192.0.2.1";
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->resolve = strdup(base_resolve);
+	merge_config(base, cli);
+	ck_assert_str_eq(base_resolve, base->resolve);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_resolve_is_merged)
+{
+	static char *base_resolve = "a.example:443:192.0.2.1";
+	static char *cli_resolve = "a.example:443:192.0.2.2";
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+
+	base->resolve = strdup(base_resolve);
+	cli->resolve = strdup(cli_resolve);
+	merge_config(base, cli);
+	ck_assert_str_eq(cli_resolve, base->resolve);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 START_TEST(test_secret_is_not_merged_when_empty)
 {
 	struct arguments *base = create_args();
@@ -202,6 +722,99 @@ START_TEST(test_secret_is_merged)
 END_TEST
 // *INDENT-ON*
 
+START_TEST(test_secret_is_merged_repeatedly)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static char *secrets[] = { "new", "a much longer secret" };
+
+	// The secret takes the place of the previous one in locked memory.
+	for (size_t i = 0; i < 10000; i++) {
+		cli->secret = secrets[i % 2];
+		ck_assert_int_eq(UL_OK, merge_config(base, cli));
+		ck_assert_str_eq(secrets[i % 2], base->secret);
+	}
+
+	free_args(base);
+	free_args(cli);
+	free_secrets();
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_timings_are_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum timings_format base_timings = TIMINGS_TEXT;
+
+	base->timings = base_timings;
+	merge_config(base, cli);
+	ck_assert_int_eq(base_timings, base->timings);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_timings_are_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static enum timings_format base_timings = TIMINGS_TEXT;
+	static enum timings_format cli_timings = TIMINGS_JSON;
+
+	base->timings = base_timings;
+	cli->timings = cli_timings;
+	merge_config(base, cli);
+	ck_assert_int_eq(cli_timings, base->timings);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_trace_file_is_not_merged_when_empty)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static char *base_trace_file = "/run/unlocked/trace.json";
+
+	base->trace_file = strdup(base_trace_file);
+	merge_config(base, cli);
+	ck_assert_str_eq(base_trace_file, base->trace_file);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_trace_file_is_merged)
+{
+	struct arguments *base = create_args();
+	struct arguments *cli = create_args();
+	static char *base_trace_file = "/run/unlocked/trace.json";
+	static char *cli_trace_file = "/tmp/trace.json";
+
+	base->trace_file = strdup(base_trace_file);
+	cli->trace_file = strdup(cli_trace_file);
+	merge_config(base, cli);
+	ck_assert_str_eq(cli_trace_file, base->trace_file);
+
+	free_args(base);
+	free_args(cli);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 START_TEST(test_username_is_not_merged_when_empty)
 {
 	struct arguments *base = create_args();
@@ -315,16 +928,49 @@ static TCase *make_cli_merge_config_case(void)
 	TCase *tc;
 
 	tc = tcase_create("cli::merge_config");
+	tcase_add_test(tc, test_agent_is_not_merged_when_empty);
+	tcase_add_test(tc, test_agent_is_merged);
+	tcase_add_test(tc, test_agent_socket_is_not_merged_when_empty);
+	tcase_add_test(tc, test_agent_socket_is_merged);
 	tcase_add_test(tc, test_config_file_is_not_merged_when_empty);
 	tcase_add_test(tc, test_config_file_is_merged);
 	tcase_add_test(tc, test_key_handle_is_not_merged_when_empty);
 	tcase_add_test(tc, test_key_handle_is_merged);
+	tcase_add_test(tc, test_keys_are_not_merged_when_empty);
+	tcase_add_test(tc, test_keys_are_merged);
+	tcase_add_test(tc, test_hedge_delay_is_not_merged_when_empty);
+	tcase_add_test(tc, test_hedge_delay_is_merged);
 	tcase_add_test(tc, test_host_is_not_merged_when_empty);
 	tcase_add_test(tc, test_host_is_merged);
+	tcase_add_test(tc, test_key_ttl_is_not_merged_when_empty);
+	tcase_add_test(tc, test_key_ttl_is_merged);
+	tcase_add_test(tc, test_long_poll_is_not_merged_when_empty);
+	tcase_add_test(tc, test_long_poll_is_merged);
+	tcase_add_test(tc, test_long_poll_timeout_is_not_merged_when_empty);
+	tcase_add_test(tc, test_long_poll_timeout_is_merged);
+	tcase_add_test(tc, test_max_response_size_is_not_merged_when_empty);
+	tcase_add_test(tc, test_max_response_size_is_merged);
+	tcase_add_test(tc, test_metrics_file_is_not_merged_when_empty);
+	tcase_add_test(tc, test_metrics_file_is_merged);
+	tcase_add_test(tc, test_poll_interval_is_not_merged_when_empty);
+	tcase_add_test(tc, test_poll_interval_is_merged);
+	tcase_add_test(tc, test_poll_jitter_is_not_merged_when_empty);
+	tcase_add_test(tc, test_poll_jitter_is_merged);
+	tcase_add_test(tc, test_poll_max_interval_is_not_merged_when_empty);
+	tcase_add_test(tc, test_poll_max_interval_is_merged);
+	tcase_add_test(tc, test_poll_multiplier_is_not_merged_when_empty);
+	tcase_add_test(tc, test_poll_multiplier_is_merged);
 	tcase_add_test(tc, test_port_is_not_merged_when_empty);
 	tcase_add_test(tc, test_port_is_merged);
+	tcase_add_test(tc, test_resolve_is_not_merged_when_empty);
+	tcase_add_test(tc, test_resolve_is_merged);
 	tcase_add_test(tc, test_secret_is_not_merged_when_empty);
 	tcase_add_test(tc, test_secret_is_merged);
+	tcase_add_test(tc, test_secret_is_merged_repeatedly);
+	tcase_add_test(tc, test_timings_are_not_merged_when_empty);
+	tcase_add_test(tc, test_timings_are_merged);
+	tcase_add_test(tc, test_trace_file_is_not_merged_when_empty);
+	tcase_add_test(tc, test_trace_file_is_merged);
 	tcase_add_test(tc, test_username_is_not_merged_when_empty);
 	tcase_add_test(tc, test_username_is_merged);
 	tcase_add_test(tc, test_validation_is_not_merged_when_empty);
@@ -0,0 +1,174 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <unistd.h>
+#include <sys/epoll.h>
+
+#include "check_event-loop.h"
+#include "../src/event-loop.h"
+
+static struct event_loop *loop = NULL;
+static unsigned int fired = 0;
+static unsigned int handled = 0;
+static struct timer timers[2];
+
+static void count_fire(void *data)
+{
+	fired++;
+}
+
+static void count_handle(struct event_source *source, uint32_t events)
+{
+	char buffer[8];
+
+	if (EPOLLIN & events) {
+		handled++;
+	}
+	read(source->fd, buffer, sizeof(buffer));
+}
+
+static void free_other_timer(void *data)
+{
+	fired++;
+	free_timer(loop, data);
+}
+
+static void setup(void)
+{
+	fired = 0;
+	handled = 0;
+	timers[0].source.fd = -1;
+	timers[1].source.fd = -1;
+	loop = create_event_loop();
+	ck_assert_ptr_nonnull(loop);
+}
+
+static void teardown(void)
+{
+	free_timer(loop, &(timers[0]));
+	free_timer(loop, &(timers[1]));
+	free_event_loop(loop);
+	loop = NULL;
+}
+
+START_TEST(test_timer_fires)
+{
+	ck_assert_int_eq(UL_OK, init_timer(loop, &(timers[0]), count_fire,
+					   NULL));
+	ck_assert_int_eq(UL_OK, arm_timer(&(timers[0]), 0));
+	ck_assert_int_eq(UL_OK, dispatch_events(loop, 1000));
+	ck_assert_uint_eq(1, fired);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_disarmed_timer_does_not_fire)
+{
+	ck_assert_int_eq(UL_OK, init_timer(loop, &(timers[0]), count_fire,
+					   NULL));
+	ck_assert_int_eq(UL_OK, arm_timer(&(timers[0]), 0));
+	ck_assert_int_eq(UL_OK, arm_timer(&(timers[0]), -1));
+	ck_assert_int_eq(UL_OK, dispatch_events(loop, 10));
+	ck_assert_uint_eq(0, fired);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_removed_source_is_not_dispatched)
+{
+	struct timespec now = { 0 };
+
+	ck_assert_int_eq(UL_OK, init_timer(loop, &(timers[0]),
+					   free_other_timer, &(timers[1])));
+	ck_assert_int_eq(UL_OK, init_timer(loop, &(timers[1]),
+					   free_other_timer, &(timers[0])));
+	// Both timers expire before the events are dispatched.
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ck_assert_int_eq(UL_OK, arm_timer_at(&(timers[0]), &now));
+	ck_assert_int_eq(UL_OK, arm_timer_at(&(timers[1]), &now));
+	usleep(1000);
+	ck_assert_int_eq(UL_OK, dispatch_events(loop, 1000));
+	ck_assert_uint_eq(1, fired);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_watched_fd_is_dispatched)
+{
+	int fds[2];
+	struct event_source source = {
+		.handle = count_handle,
+		.release = NULL,
+		.data = NULL,
+	};
+
+	ck_assert_int_eq(0, pipe(fds));
+	source.fd = fds[0];
+	ck_assert_int_eq(UL_OK, watch_fd(loop, &source, EPOLLIN));
+	ck_assert_int_eq(1, write(fds[1], "x", 1));
+	ck_assert_int_eq(UL_OK, dispatch_events(loop, 1000));
+	ck_assert_uint_eq(1, handled);
+	unwatch_fd(loop, &source);
+	ck_assert_int_eq(1, write(fds[1], "x", 1));
+	ck_assert_int_eq(UL_OK, dispatch_events(loop, 10));
+	ck_assert_uint_eq(1, handled);
+	close(fds[0]);
+	close(fds[1]);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_event_loop_dispatch_events_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("event-loop::dispatch_events");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_removed_source_is_not_dispatched);
+	tcase_add_test(tc, test_watched_fd_is_dispatched);
+
+	return tc;
+}
+
+static TCase *make_event_loop_timer_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("event-loop::timer");
+	tcase_add_checked_fixture(tc, setup, teardown);
+	tcase_add_test(tc, test_timer_fires);
+	tcase_add_test(tc, test_disarmed_timer_does_not_fire);
+
+	return tc;
+}
+
+Suite *make_event_loop_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client event-loop");
+	suite_add_tcase(s, make_event_loop_dispatch_events_case());
+	suite_add_tcase(s, make_event_loop_timer_case());
+
+	return s;
+}
@@ -0,0 +1,109 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+#include "check_hmac-signer.h"
+#include "../src/hmac-signer.h"
+
+/**
+ * Compute a signature with a one-shot HMAC as reference.
+ */
+static void reference_signature(const char *secret, const char *message,
+				char signature[SIGNATURE_SIZE])
+{
+	unsigned char *digest = NULL;
+
+	digest = HMAC(EVP_sha512(), secret, strlen(secret),
+		      (const unsigned char *) message, strlen(message), NULL,
+		      NULL);
+	for (int i = 0; i < 64; i++) {
+		sprintf(signature + i * 2, "%02X", digest[i]);
+	}
+}
+
+START_TEST(test_signature_matches_hmac)
+{
+	struct hmac_signer *signer = create_signer("1234");
+	char expected[SIGNATURE_SIZE];
+	char signature[SIGNATURE_SIZE];
+
+	ck_assert_ptr_nonnull(signer);
+	reference_signature("1234", "Date: Sun, 10 Jul 2022 09:41:29 GMT\ntest",
+			    expected);
+	ck_assert_int_eq(UL_OK, start_signature(signer));
+	ck_assert_int_eq(UL_OK, update_signature(signer, "Date: Sun, 10 Jul ",
+						 18));
+	ck_assert_int_eq(UL_OK, update_signature(signer,
+						 "2022 09:41:29 GMT\n", 18));
+	ck_assert_int_eq(UL_OK, update_signature(signer, "test", 4));
+	ck_assert_int_eq(UL_OK, finish_signature(signer, signature));
+	ck_assert_str_eq(expected, signature);
+	free_signer(signer);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_signature_restarts_with_key)
+{
+	struct hmac_signer *signer = create_signer("a longer secret");
+	char expected[SIGNATURE_SIZE];
+	char signature[SIGNATURE_SIZE];
+
+	ck_assert_ptr_nonnull(signer);
+	reference_signature("a longer secret", "second", expected);
+	ck_assert_int_eq(UL_OK, start_signature(signer));
+	ck_assert_int_eq(UL_OK, update_signature(signer, "first", 5));
+	ck_assert_int_eq(UL_OK, finish_signature(signer, signature));
+	ck_assert_int_eq(UL_OK, start_signature(signer));
+	ck_assert_int_eq(UL_OK, update_signature(signer, "sec", 3));
+	// Restarting drops the data passed so far.
+	ck_assert_int_eq(UL_OK, start_signature(signer));
+	ck_assert_int_eq(UL_OK, update_signature(signer, "second", 6));
+	ck_assert_int_eq(UL_OK, finish_signature(signer, signature));
+	ck_assert_str_eq(expected, signature);
+	free_signer(signer);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_hmac_signer_signature_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("hmac-signer::signature");
+	tcase_add_test(tc, test_signature_matches_hmac);
+	tcase_add_test(tc, test_signature_restarts_with_key);
+
+	return tc;
+}
+
+Suite *make_hmac_signer_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client hmac-signer");
+	suite_add_tcase(s, make_hmac_signer_signature_case());
+
+	return s;
+}
@@ -0,0 +1,160 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+
+#include "check_hosts.h"
+#include "../src/hosts.h"
+
+START_TEST(test_hosts_are_split)
+{
+	struct server_host *hosts = NULL;
+	size_t count = 0;
+
+	ck_assert_int_eq(UL_OK, parse_hosts("a.example, b.example:8443,",
+					    443, &hosts, &count));
+	ck_assert_uint_eq(2, count);
+	ck_assert_str_eq("a.example", hosts[0].name);
+	ck_assert_int_eq(443, hosts[0].port);
+	ck_assert_int_eq(-1, hosts[0].latency);
+	ck_assert_str_eq("b.example", hosts[1].name);
+	ck_assert_int_eq(8443, hosts[1].port);
+
+	free_hosts(hosts, count);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_ipv6_hosts_are_bracketed)
+{
+	struct server_host *hosts = NULL;
+	size_t count = 0;
+
+	ck_assert_int_eq(UL_OK, parse_hosts("[2001:db8::1]:8443,2001:db8::2",
+					    443, &hosts, &count));
+	ck_assert_uint_eq(2, count);
+	ck_assert_str_eq("[2001:db8::1]", hosts[0].name);
+	ck_assert_int_eq(8443, hosts[0].port);
+	ck_assert_str_eq("[2001:db8::2]", hosts[1].name);
+	ck_assert_int_eq(443, hosts[1].port);
+
+	free_hosts(hosts, count);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_invalid_hosts_are_rejected)
+{
+	struct server_host *hosts = NULL;
+	size_t count = 0;
+
+	ck_assert_int_eq(UL_ERR, parse_hosts("a.example:", 443, &hosts,
+					     &count));
+	ck_assert_int_eq(UL_ERR, parse_hosts("a.example:70000", 443, &hosts,
+					     &count));
+	ck_assert_int_eq(UL_ERR, parse_hosts("[::1", 443, &hosts, &count));
+	ck_assert_int_eq(UL_ERR, parse_hosts(" , ", 443, &hosts, &count));
+	ck_assert_ptr_null(hosts);
+	ck_assert_uint_eq(0, count);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_latency_is_smoothed)
+{
+	struct server_host host = {.latency = -1, .failures = 2 };
+
+	record_host_latency(&host, 100);
+	ck_assert_int_eq(100, host.latency);
+	ck_assert_uint_eq(0, host.failures);
+	record_host_latency(&host, 500);
+	ck_assert_int_eq(200, host.latency);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_hosts_are_sorted_by_latency)
+{
+	struct server_host hosts[] = {
+		{.name = "unknown", .latency = -1 },
+		{.name = "slow", .latency = 300 },
+		{.name = "failed", .latency = 10, .failures = 1 },
+		{.name = "fast", .latency = 20 },
+		{.name = "other", .latency = -1 },
+	};
+
+	sort_hosts(hosts, sizeof(hosts) / sizeof(hosts[0]));
+	ck_assert_str_eq("fast", hosts[0].name);
+	ck_assert_str_eq("slow", hosts[1].name);
+	ck_assert_str_eq("unknown", hosts[2].name);
+	ck_assert_str_eq("other", hosts[3].name);
+	ck_assert_str_eq("failed", hosts[4].name);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_hosts_parse_hosts_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("hosts::parse_hosts");
+	tcase_add_test(tc, test_hosts_are_split);
+	tcase_add_test(tc, test_ipv6_hosts_are_bracketed);
+	tcase_add_test(tc, test_invalid_hosts_are_rejected);
+
+	return tc;
+}
+
+static TCase *make_hosts_record_host_latency_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("hosts::record_host_latency");
+	tcase_add_test(tc, test_latency_is_smoothed);
+
+	return tc;
+}
+
+static TCase *make_hosts_sort_hosts_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("hosts::sort_hosts");
+	tcase_add_test(tc, test_hosts_are_sorted_by_latency);
+
+	return tc;
+}
+
+Suite *make_hosts_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client hosts");
+	suite_add_tcase(s, make_hosts_parse_hosts_case());
+	suite_add_tcase(s, make_hosts_record_host_latency_case());
+	suite_add_tcase(s, make_hosts_sort_hosts_case());
+
+	return s;
+}
@@ -18,11 +18,17 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <curl/curl.h>
 
 #include "check_https-client.h"
 #include "../src/https-client.h"
 
+static void store_line(struct Response *response, const char *line)
+{
+	store_header(response, line, strlen(line));
+}
+
 START_TEST(test_add_auth_header)
 {
 	struct Request request = {
@@ -37,8 +43,10 @@ START_TEST(test_add_auth_header)
 		curl_slist_append(NULL, "Date: Sun, 10 Jul 2022 09:41:29 GMT");
 	struct curl_slist *header_iterator = NULL;
 	unsigned int header_count = 0;
+	struct hmac_signer *signer = create_signer(request.secret);
 
-	headers = add_auth_header(headers, &request);
+	ck_assert_ptr_nonnull(signer);
+	headers = add_auth_header(headers, &request, signer);
 	header_iterator = headers;
 	while (header_iterator) {
 		header_count++;
@@ -58,6 +66,7 @@ START_TEST(test_add_auth_header)
 			 "D4C69E2213DB13D93FADF70DE560B6676B\"",
 			 headers->next->data);
 	curl_slist_free_all(headers);
+	free_signer(signer);
 }
 // *INDENT-OFF*
 END_TEST
@@ -117,15 +126,11 @@ END_TEST
 START_TEST(test_get_content_type_no_header)
 {
 	struct Response *response = create_response();
-	char *content_type = NULL;
+	const char *content_type = NULL;
 
 	response->status = 200;
-	response->headers =
-		curl_slist_append(response->headers,
-				  "access-control-allow-origin: *\r\n");
-	response->headers =
-		curl_slist_append(response->headers,
-				  "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
+	store_line(response, "access-control-allow-origin: *\r\n");
+	store_line(response, "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
 	content_type = get_content_type(response);
 	ck_assert_ptr_null(content_type);
 	free_response(response);
@@ -137,22 +142,15 @@ END_TEST
 START_TEST(test_get_content_type_lowercase)
 {
 	struct Response *response = create_response();
-	char *content_type = NULL;
+	const char *content_type = NULL;
 
 	response->status = 200;
-	response->headers =
-		curl_slist_append(response->headers,
-				  "access-control-allow-origin: *\r\n");
-	response->headers =
-		curl_slist_append(response->headers,
-				  "content-type: text/html; charset=utf-8\r\n");
-	response->headers =
-		curl_slist_append(response->headers,
-				  "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
+	store_line(response, "access-control-allow-origin: *\r\n");
+	store_line(response, "content-type: text/html; charset=utf-8\r\n");
+	store_line(response, "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
 	content_type = get_content_type(response);
 	ck_assert_str_eq("text/html; charset=utf-8", content_type);
 	free_response(response);
-	free(content_type);
 }
 // *INDENT-OFF*
 END_TEST
@@ -161,22 +159,95 @@ END_TEST
 START_TEST(test_get_content_type_uppercase)
 {
 	struct Response *response = create_response();
-	char *content_type = NULL;
+	const char *content_type = NULL;
 
 	response->status = 200;
-	response->headers =
-		curl_slist_append(response->headers,
-				  "access-control-allow-origin: *\r\n");
-	response->headers =
-		curl_slist_append(response->headers,
-				  "CONTENT-TYPE: application/json\r\n");
-	response->headers =
-		curl_slist_append(response->headers,
-				  "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
+	store_line(response, "access-control-allow-origin: *\r\n");
+	store_line(response, "CONTENT-TYPE: application/json\r\n");
+	store_line(response, "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
 	content_type = get_content_type(response);
 	ck_assert_str_eq("application/json", content_type);
 	free_response(response);
-	free(content_type);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_reset_response_keeps_body)
+{
+	struct Response *response = create_response();
+	char *body = malloc(16);
+
+	strcpy(body, "secret\n");
+	response->body = body;
+	response->body_len = 7;
+	response->body_size = 16;
+	response->allocations = 1;
+	response->status = 200;
+	store_line(response, "content-type: application/json\r\n");
+	reset_response(response);
+	ck_assert_ptr_eq(body, response->body);
+	ck_assert_uint_eq(16, response->body_size);
+	ck_assert_uint_eq(0, response->body_len);
+	ck_assert_uint_eq(0, response->allocations);
+	ck_assert_str_eq("", response->body);
+	ck_assert_ptr_null(get_content_type(response));
+	ck_assert_int_eq(0, response->status);
+	free_response(response);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_store_header_keeps_known_headers)
+{
+	struct Response *response = create_response();
+
+	store_line(response, "HTTP/1.1 200 OK\r\n");
+	store_line(response, "ETag: \"Ab-12\" \r\n");
+	store_line(response, "x-request-id: 42\r\n");
+	store_line(response, "Retry-After:120");
+	ck_assert_str_eq("\"Ab-12\"", get_header(response, HEADER_ETAG));
+	ck_assert_str_eq("120", get_header(response, HEADER_RETRY_AFTER));
+	ck_assert_ptr_null(get_header(response, HEADER_DATE));
+	ck_assert_uint_eq(strlen("\"Ab-12\"") + strlen("120") + 2,
+			  response->headers.used);
+	free_response(response);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_store_header_drops_headers_of_redirect)
+{
+	struct Response *response = create_response();
+
+	store_line(response, "HTTP/1.1 302 Found\r\n");
+	store_line(response, "content-type: text/html\r\n");
+	store_line(response, "location: /api/\r\n");
+	store_line(response, "HTTP/2 200\r\n");
+	store_line(response, "date: Sat, 09 Jul 2022 23:03:45 GMT\r\n");
+	ck_assert_ptr_null(get_content_type(response));
+	ck_assert_str_eq("Sat, 09 Jul 2022 23:03:45 GMT",
+			 get_header(response, HEADER_DATE));
+	free_response(response);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_store_header_drops_oversized_header)
+{
+	struct Response *response = create_response();
+	char line[HEADER_STORE_SIZE + 16] = "etag: ";
+
+	memset(line + 6, 'a', HEADER_STORE_SIZE);
+	line[HEADER_STORE_SIZE + 6] = '\0';
+	store_line(response, line);
+	store_line(response, "content-type: application/json\r\n");
+	ck_assert_ptr_null(get_header(response, HEADER_ETAG));
+	ck_assert_str_eq("application/json", get_content_type(response));
+	free_response(response);
 }
 // *INDENT-OFF*
 END_TEST
@@ -225,6 +296,28 @@ static TCase *make_https_client_get_content_type_case(void)
 	return tc;
 }
 
+static TCase *make_https_client_reset_response_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("https-client::reset_response");
+	tcase_add_test(tc, test_reset_response_keeps_body);
+
+	return tc;
+}
+
+static TCase *make_https_client_store_header_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("https-client::store_header");
+	tcase_add_test(tc, test_store_header_keeps_known_headers);
+	tcase_add_test(tc, test_store_header_drops_headers_of_redirect);
+	tcase_add_test(tc, test_store_header_drops_oversized_header);
+
+	return tc;
+}
+
 Suite *make_https_client_suite(void)
 {
 	Suite *s;
@@ -234,6 +327,8 @@ Suite *make_https_client_suite(void)
 	suite_add_tcase(s, make_https_client_add_date_header_case());
 	suite_add_tcase(s, make_https_client_date_header_case());
 	suite_add_tcase(s, make_https_client_get_content_type_case());
+	suite_add_tcase(s, make_https_client_reset_response_case());
+	suite_add_tcase(s, make_https_client_store_header_case());
 
 	return s;
 }
@@ -0,0 +1,181 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "check_json-scan.h"
+#include "../src/json-scan.h"
+
+static enum unlocked_err scan(const char *json, struct json_field *fields,
+			      size_t field_count)
+{
+	return scan_json_object(json, strlen(json), fields, field_count);
+}
+
+START_TEST(test_scan_json_object_extracts_fields)
+{
+	char state[16];
+	struct json_field fields[] = {
+		{.name = "id",.type = JSON_FIELD_NUMBER },
+		{.name = "state",.type = JSON_FIELD_STRING,.string = state,
+		 .string_size = sizeof(state) },
+		{.name = "missing",.type = JSON_FIELD_NUMBER },
+	};
+	const char *json = "{\"meta\": {\"id\": 7, \"tags\": [1, \"a\", null]},"
+	    " \"id\": 42, \"state\": \"PENDING\", \"ok\": true}";
+
+	ck_assert_int_eq(UL_OK, scan(json, fields, 3));
+	ck_assert_int_eq(JSON_FIELD_FOUND, fields[0].status);
+	ck_assert_int_eq(42, fields[0].number);
+	ck_assert_int_eq(JSON_FIELD_FOUND, fields[1].status);
+	ck_assert_str_eq("PENDING", state);
+	ck_assert_int_eq(JSON_FIELD_MISSING, fields[2].status);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_scan_json_object_decodes_escapes)
+{
+	char state[16];
+	struct json_field field = {
+		.name = "state",
+		.type = JSON_FIELD_STRING,
+		.string = state,
+		.string_size = sizeof(state),
+	};
+
+	ck_assert_int_eq(UL_OK, scan("{\"st\\u0061te\": \"a\\\"\\n\\u00e4"
+				     "\\ud83d\\ude00\"}", &field, 1));
+	ck_assert_int_eq(JSON_FIELD_FOUND, field.status);
+	ck_assert_str_eq("a\"\n\xc3\xa4\xf0\x9f\x98\x80", state);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_scan_json_object_marks_invalid_fields)
+{
+	char state[8];
+	struct json_field fields[] = {
+		{.name = "id",.type = JSON_FIELD_NUMBER },
+		{.name = "state",.type = JSON_FIELD_STRING,.string = state,
+		 .string_size = sizeof(state) },
+	};
+
+	ck_assert_int_eq(UL_OK, scan("{\"id\": \"42\", "
+				     "\"state\": \"ACCEPTED\"}", fields, 2));
+	ck_assert_int_eq(JSON_FIELD_INVALID, fields[0].status);
+	// The state does not fit into the storage.
+	ck_assert_int_eq(JSON_FIELD_INVALID, fields[1].status);
+	ck_assert_int_eq(UL_OK, scan("{\"state\": [\"PENDING\"]}",
+				     fields + 1, 1));
+	ck_assert_int_eq(JSON_FIELD_INVALID, fields[1].status);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_scan_json_object_keeps_first_duplicate)
+{
+	struct json_field field = {
+		.name = "id",
+		.type = JSON_FIELD_NUMBER,
+	};
+
+	ck_assert_int_eq(UL_OK, scan("{\"id\": -1.5e1, \"id\": 3}", &field, 1));
+	ck_assert_int_eq(JSON_FIELD_FOUND, field.status);
+	ck_assert_double_eq(-15, field.number);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_scan_json_object_rejects_invalid_json)
+{
+	static const char *const documents[] = {
+		"",
+		"[]",
+		"{\"id\": 1",
+		"{\"id\": 1,}",
+		"{\"id\": 01}",
+		"{\"id\": 1} x",
+		"{\"id\": tru}",
+		"{\"id\": \"\\x\"}",
+		"{\"id\": \"\\udc00\"}",
+		"{\"id\": [1 2]}",
+		"{id: 1}",
+	};
+	struct json_field field = {
+		.name = "id",
+		.type = JSON_FIELD_NUMBER,
+	};
+
+	for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+		ck_assert_int_eq(UL_ERR, scan(documents[i], &field, 1));
+	}
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_scan_json_object_limits_depth)
+{
+	char json[256] = "{\"a\": ";
+	size_t length = strlen(json);
+
+	for (int i = 0; i < 100; i++) {
+		json[length++] = '[';
+	}
+	for (int i = 0; i < 100; i++) {
+		json[length++] = ']';
+	}
+	json[length++] = '}';
+	json[length] = '\0';
+	ck_assert_int_eq(UL_ERR, scan(json, NULL, 0));
+	ck_assert_int_eq(UL_OK, scan("{\"a\": [[[{\"b\": {}}]]]}", NULL, 0));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_json_scan_object_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("json-scan::scan_json_object");
+	tcase_add_test(tc, test_scan_json_object_extracts_fields);
+	tcase_add_test(tc, test_scan_json_object_decodes_escapes);
+	tcase_add_test(tc, test_scan_json_object_marks_invalid_fields);
+	tcase_add_test(tc, test_scan_json_object_keeps_first_duplicate);
+	tcase_add_test(tc, test_scan_json_object_rejects_invalid_json);
+	tcase_add_test(tc, test_scan_json_object_limits_depth);
+
+	return tc;
+}
+
+Suite *make_json_scan_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client json-scan");
+	suite_add_tcase(s, make_json_scan_object_case());
+
+	return s;
+}
@@ -0,0 +1,128 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+
+#include "check_key-cache.h"
+#include "../src/key-cache.h"
+
+START_TEST(test_cached_keys_are_found)
+{
+	struct key_cache cache = { 0 };
+	const struct cached_key *cached = NULL;
+
+	init_key_cache(&cache, 60000);
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "root", "secret", 6));
+	cached = find_cached_key(&cache, "root");
+	ck_assert_ptr_nonnull(cached);
+	ck_assert_str_eq("secret", cached->key);
+	ck_assert_uint_eq(6, cached->key_len);
+	ck_assert_ptr_null(find_cached_key(&cache, "data"));
+
+	free_key_cache(&cache);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_cached_keys_are_replaced)
+{
+	struct key_cache cache = { 0 };
+
+	init_key_cache(&cache, 60000);
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "root", "old", 3));
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "root", "new", 3));
+	ck_assert_uint_eq(1, cache.count);
+	ck_assert_str_eq("new", find_cached_key(&cache, "root")->key);
+
+	free_key_cache(&cache);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_expired_keys_are_wiped)
+{
+	struct key_cache cache = { 0 };
+	struct timespec next = { 0 };
+
+	init_key_cache(&cache, 0);
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "root", "secret", 6));
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "data", "secret", 6));
+	ck_assert_ptr_null(find_cached_key(&cache, "root"));
+	ck_assert_uint_eq(0, expire_cached_keys(&cache, &next));
+
+	free_key_cache(&cache);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_next_expiry_is_reported)
+{
+	struct key_cache cache = { 0 };
+	struct timespec next = { 0 };
+
+	init_key_cache(&cache, 60000);
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "root", "secret", 6));
+	cache.ttl = 30000;
+	ck_assert_int_eq(UL_OK, cache_key(&cache, "data", "secret", 6));
+	ck_assert_uint_eq(2, expire_cached_keys(&cache, &next));
+	ck_assert_int_eq(cache.entries[1].expires.tv_sec, next.tv_sec);
+	ck_assert_int_eq(cache.entries[1].expires.tv_nsec, next.tv_nsec);
+
+	free_key_cache(&cache);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_key_cache_cache_key_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("key-cache::cache_key");
+	tcase_add_test(tc, test_cached_keys_are_found);
+	tcase_add_test(tc, test_cached_keys_are_replaced);
+
+	return tc;
+}
+
+static TCase *make_key_cache_expire_cached_keys_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("key-cache::expire_cached_keys");
+	tcase_add_test(tc, test_expired_keys_are_wiped);
+	tcase_add_test(tc, test_next_expiry_is_reported);
+
+	return tc;
+}
+
+Suite *make_key_cache_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client key-cache");
+	suite_add_tcase(s, make_key_cache_cache_key_case());
+	suite_add_tcase(s, make_key_cache_expire_cached_keys_case());
+
+	return s;
+}
@@ -0,0 +1,148 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "check_locked-memory.h"
+#include "../src/locked-memory.h"
+
+START_TEST(test_arena_allocations_are_aligned)
+{
+	struct secure_arena arena = { 0 };
+	char *first = NULL;
+	char *second = NULL;
+
+	ck_assert_int_eq(UL_OK, init_arena(&arena, 64));
+	first = arena_alloc(&arena, 3);
+	second = arena_alloc(&arena, 8);
+	ck_assert_ptr_nonnull(first);
+	ck_assert_ptr_nonnull(second);
+	ck_assert_ptr_ne(first, second);
+	ck_assert_uint_eq(0, (uintptr_t) second % alignof(max_align_t));
+
+	free_arena(&arena);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_exhausted_arena_fails)
+{
+	struct secure_arena arena = { 0 };
+
+	ck_assert_int_eq(UL_OK, init_arena(&arena, 16));
+	ck_assert_ptr_nonnull(arena_alloc(&arena, 16));
+	ck_assert_ptr_null(arena_alloc(&arena, 1));
+	reset_arena(&arena);
+	ck_assert_ptr_nonnull(arena_alloc(&arena, 16));
+
+	free_arena(&arena);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_last_buffer_is_resized_in_place)
+{
+	struct secure_arena arena = { 0 };
+	char *first = NULL;
+	char *second = NULL;
+	char *resized = NULL;
+
+	ck_assert_int_eq(UL_OK, init_arena(&arena, 256));
+	first = arena_strdup(&arena, "first");
+	second = arena_strdup(&arena, "second");
+	resized = arena_realloc(&arena, second, 7, 64);
+	ck_assert_ptr_eq(second, resized);
+	ck_assert_str_eq("second", resized);
+	// Other buffers are moved and the old copy is wiped.
+	resized = arena_realloc(&arena, first, 6, 16);
+	ck_assert_ptr_ne(first, resized);
+	ck_assert_str_eq("first", resized);
+	ck_assert_int_eq(0, first[0]);
+
+	free_arena(&arena);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_reset_wipes_buffers)
+{
+	struct secure_arena arena = { 0 };
+	char *secret = NULL;
+
+	ck_assert_int_eq(UL_OK, init_arena(&arena, 64));
+	secret = arena_strdup(&arena, "secret");
+	reset_arena(&arena);
+	ck_assert_int_eq(0, memcmp(secret, "\0\0\0\0\0\0", 6));
+	ck_assert_ptr_eq(secret, arena_alloc(&arena, 1));
+
+	free_arena(&arena);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_locked_memory_arena_alloc_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("locked-memory::arena_alloc");
+	tcase_add_test(tc, test_arena_allocations_are_aligned);
+	tcase_add_test(tc, test_exhausted_arena_fails);
+
+	return tc;
+}
+
+static TCase *make_locked_memory_arena_realloc_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("locked-memory::arena_realloc");
+	tcase_add_test(tc, test_last_buffer_is_resized_in_place);
+
+	return tc;
+}
+
+static TCase *make_locked_memory_reset_arena_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("locked-memory::reset_arena");
+	tcase_add_test(tc, test_reset_wipes_buffers);
+
+	return tc;
+}
+
+Suite *make_locked_memory_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client locked-memory");
+	suite_add_tcase(s, make_locked_memory_arena_alloc_case());
+	suite_add_tcase(s, make_locked_memory_arena_realloc_case());
+	suite_add_tcase(s, make_locked_memory_reset_arena_case());
+
+	return s;
+}
@@ -0,0 +1,172 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "check_metrics.h"
+#include "../src/metrics.h"
+
+/**
+ * Get a point in time in the past on the monotonic clock.
+ *
+ * @param milliseconds is the time before now.
+ *
+ * @return the point in time.
+ */
+static struct timespec ago(long milliseconds)
+{
+	struct timespec since = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &since);
+	since.tv_sec -= milliseconds / 1000;
+	since.tv_nsec -= (milliseconds % 1000) * 1000000;
+	if (since.tv_nsec < 0) {
+		since.tv_sec--;
+		since.tv_nsec += 1000000000;
+	}
+
+	return since;
+}
+
+START_TEST(test_record_unlock_fills_cumulative_buckets)
+{
+	struct unlock_metrics metrics = { 0 };
+	struct timespec since = ago(700);
+	char output[4096] = { 0 };
+	FILE *file = fmemopen(output, sizeof(output) - 1, "w");
+
+	record_unlock(&metrics, UL_OK, &since);
+	since = ago(3000);
+	record_unlock(&metrics, UL_OK, &since);
+	since = ago(700000);
+	record_unlock(&metrics, UL_ERR, &since);
+	print_metrics(file, &metrics);
+	fclose(file);
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_bucket{le=\"0.5\"} 0\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_bucket{le=\"1\"} 1\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_bucket{le=\"5\"} 2\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_bucket{le=\"600\"} 2\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_bucket{le=\"+Inf\"} 3\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlock_duration_seconds"
+				     "_count 3\n"));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_print_metrics_labels_outcomes)
+{
+	struct unlock_metrics metrics = { 0 };
+	struct timespec since = ago(0);
+	char output[4096] = { 0 };
+	FILE *file = fmemopen(output, sizeof(output) - 1, "w");
+
+	record_unlock(&metrics, UL_OK, &since);
+	record_unlock(&metrics, UL_DENIED, &since);
+	record_unlock(&metrics, UL_CURL, &since);
+	record_unlock(&metrics, UL_CURL, &since);
+	metrics.retries = 4;
+	metrics.bytes_in = 1234;
+	print_metrics(file, &metrics);
+	fclose(file);
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlocks_total"
+				     "{result=\"accepted\"} 1\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlocks_total"
+				     "{result=\"denied\"} 1\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlocks_total"
+				     "{result=\"error\",error=\"curl\"} 2\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_unlocks_total{result="
+				     "\"error\",error=\"malloc\"} 0\n"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_retries_total 4\n"));
+	ck_assert_ptr_nonnull(strstr(output,
+				     "unlocked_received_bytes_total 1234\n"));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_write_metrics_replaces_file)
+{
+	struct unlock_metrics metrics = { .polls = 7 };
+	char dir[] = "/tmp/unlocked-metrics-XXXXXX";
+	char path[64] = { 0 };
+	char output[4096] = { 0 };
+	struct stat status = { 0 };
+	FILE *file = NULL;
+
+	ck_assert_ptr_nonnull(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/unlocked.prom", dir);
+	file = fopen(path, "w");
+	fputs("stale\n", file);
+	fclose(file);
+	ck_assert_int_eq(UL_OK, write_metrics(path, &metrics));
+	file = fopen(path, "r");
+	fread(output, 1, sizeof(output) - 1, file);
+	fclose(file);
+	ck_assert_ptr_null(strstr(output, "stale"));
+	ck_assert_ptr_nonnull(strstr(output, "unlocked_polls_total 7\n"));
+	ck_assert_int_eq(0, stat(path, &status));
+	ck_assert_int_eq(0644, status.st_mode & 0777);
+	unlink(path);
+	ck_assert_int_eq(0, rmdir(dir));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_print_metrics_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("metrics::print_metrics");
+	tcase_add_test(tc, test_record_unlock_fills_cumulative_buckets);
+	tcase_add_test(tc, test_print_metrics_labels_outcomes);
+
+	return tc;
+}
+
+static TCase *make_write_metrics_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("metrics::write_metrics");
+	tcase_add_test(tc, test_write_metrics_replaces_file);
+
+	return tc;
+}
+
+Suite *make_metrics_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client metrics");
+	suite_add_tcase(s, make_print_metrics_case());
+	suite_add_tcase(s, make_write_metrics_case());
+
+	return s;
+}
@@ -0,0 +1,202 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <string.h>
+
+#include "check_request-state.h"
+#include "../src/request-state.h"
+
+/**
+ * Feed a stream of server-sent events to parse_event_stream in one piece.
+ *
+ * @param body is the received part of the stream.
+ * @param stream is the state of the stream.
+ *
+ * @return the result of parse_event_stream.
+ */
+static int feed_stream(char *body, struct event_stream *stream)
+{
+	struct Response response = {
+		.body = body,
+		.body_len = strlen(body),
+		.stream_data = stream,
+	};
+
+	return parse_event_stream(&response);
+}
+
+START_TEST(test_event_end_is_found)
+{
+	char lf[] = "data: {}\n\ndata: {}\n";
+	char crlf[] = "data: {}\r\n\r\ndata: {}\r\n";
+
+	ck_assert_ptr_eq(lf + 9, find_event_end(lf, lf + strlen(lf)));
+	ck_assert_ptr_eq(crlf + 11, find_event_end(crlf, crlf + strlen(crlf)));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_partial_events_have_no_end)
+{
+	char line[] = "data: {\"state\": ";
+	char event[] = "data: {}\n";
+	char crlf[] = "data: {}\r\n\r";
+
+	ck_assert_ptr_null(find_event_end(line, line + strlen(line)));
+	ck_assert_ptr_null(find_event_end(event, event + strlen(event)));
+	ck_assert_ptr_null(find_event_end(crlf, crlf + strlen(crlf)));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_event_state_is_parsed)
+{
+	const char event[] = "event: state\r\n"
+		"data: {\"id\": 1, \"state\": \"ACCEPTED\"}\r\n";
+	char state[REQUEST_STATE_SIZE] = { 0 };
+
+	ck_assert_int_eq(0, parse_event_state(event, event + strlen(event),
+					      state));
+	ck_assert_str_eq("ACCEPTED", state);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_event_data_lines_are_joined)
+{
+	const char event[] = ": keep-alive\n"
+		"data: {\"id\": 1,\n"
+		"data:\"state\":\n"
+		"data: \"DENIED\"}\n";
+	char state[REQUEST_STATE_SIZE] = { 0 };
+
+	ck_assert_int_eq(0, parse_event_state(event, event + strlen(event),
+					      state));
+	ck_assert_str_eq("DENIED", state);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_events_without_state_are_rejected)
+{
+	const char comment[] = ": keep-alive\n";
+	const char no_state[] = "data: {\"id\": 1}\n";
+	char large[EVENT_DATA_SIZE + 32] = "data: {\"state\": \"";
+	char state[REQUEST_STATE_SIZE] = { 0 };
+
+	ck_assert_int_ne(0, parse_event_state(comment,
+					      comment + strlen(comment),
+					      state));
+	ck_assert_int_ne(0, parse_event_state(no_state,
+					      no_state + strlen(no_state),
+					      state));
+	memset(large + strlen(large), 'x', EVENT_DATA_SIZE);
+	ck_assert_int_ne(0, parse_event_state(large, large + strlen(large),
+					      state));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_event_stream_waits_for_complete_events)
+{
+	char body[256] = ": connected\n\n"
+		"data: {\"state\": \"PENDING\"}\n\n"
+		"data: {\"state\": ";
+	struct event_stream stream = { 0 };
+
+	ck_assert_int_eq(0, feed_stream(body, &stream));
+	ck_assert_uint_eq(1, stream.events);
+	ck_assert_str_eq("PENDING", stream.state);
+	ck_assert_uint_eq(strlen(body) - strlen("data: {\"state\": "),
+			  stream.offset);
+	strcat(body, "\"ACCEPTED\"}\r\n\r\n");
+	ck_assert_int_eq(1, feed_stream(body, &stream));
+	ck_assert_uint_eq(2, stream.events);
+	ck_assert_str_eq("ACCEPTED", stream.state);
+	ck_assert_uint_eq(strlen(body), stream.offset);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_event_stream_skips_invalid_events)
+{
+	char body[] = "data: {\"state\": 1}\n\n"
+		"data: {\"state\": \"PENDING\"}\n\n";
+	struct event_stream stream = { 0 };
+
+	ck_assert_int_eq(0, feed_stream(body, &stream));
+	ck_assert_uint_eq(1, stream.events);
+	ck_assert_str_eq("PENDING", stream.state);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_request_state_find_event_end_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("request-state::find_event_end");
+	tcase_add_test(tc, test_event_end_is_found);
+	tcase_add_test(tc, test_partial_events_have_no_end);
+
+	return tc;
+}
+
+static TCase *make_request_state_parse_event_state_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("request-state::parse_event_state");
+	tcase_add_test(tc, test_event_state_is_parsed);
+	tcase_add_test(tc, test_event_data_lines_are_joined);
+	tcase_add_test(tc, test_events_without_state_are_rejected);
+
+	return tc;
+}
+
+static TCase *make_request_state_parse_event_stream_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("request-state::parse_event_stream");
+	tcase_add_test(tc, test_event_stream_waits_for_complete_events);
+	tcase_add_test(tc, test_event_stream_skips_invalid_events);
+
+	return tc;
+}
+
+Suite *make_request_state_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client request-state");
+	suite_add_tcase(s, make_request_state_find_event_end_case());
+	suite_add_tcase(s, make_request_state_parse_event_state_case());
+	suite_add_tcase(s, make_request_state_parse_event_stream_case());
+
+	return s;
+}
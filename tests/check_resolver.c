@@ -0,0 +1,158 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "check_resolver.h"
+#include "../src/resolver.h"
+
+START_TEST(test_pinned_addresses_are_returned)
+{
+	struct curl_slist *entries = NULL;
+	struct resolver resolver = { 0 };
+
+	ck_assert_int_eq(UL_OK, start_resolver(&resolver, "a.example",
+					       443,
+					       " a.example:443:192.0.2.1\t"
+					       "b.example:8443:192.0.2.2 "));
+	ck_assert_uint_eq(0, resolver.lookup_count);
+	entries = take_pinned_addresses(&resolver);
+	ck_assert_ptr_nonnull(entries);
+	ck_assert_str_eq("a.example:443:192.0.2.1", entries->data);
+	ck_assert_ptr_nonnull(entries->next);
+	ck_assert_str_eq("b.example:8443:192.0.2.2", entries->next->data);
+	ck_assert_ptr_null(entries->next->next);
+
+	curl_slist_free_all(entries);
+	free_resolver(&resolver);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_addresses_are_not_resolved)
+{
+	struct resolver resolver = { 0 };
+
+	ck_assert_int_eq(UL_OK, start_resolver(&resolver,
+					       "192.0.2.1, [2001:db8::1]:8443",
+					       443, NULL));
+	ck_assert_uint_eq(0, resolver.lookup_count);
+	ck_assert_ptr_null(take_pinned_addresses(&resolver));
+	ck_assert_ptr_null(collect_lookups(&resolver));
+
+	free_resolver(&resolver);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_invalid_pinned_addresses_are_rejected)
+{
+	struct resolver resolver = { 0 };
+
+	ck_assert_int_eq(UL_ERR, start_resolver(&resolver, "a.example", 443,
+						"a.example:443"));
+	ck_assert_int_eq(UL_ERR, start_resolver(&resolver, "a.example", 443,
+						"a.example:https:192.0.2.1"));
+	ck_assert_int_eq(UL_ERR, start_resolver(&resolver, "a.example", 443,
+						"b.example:443:192.0.2.1 "
+						":443:192.0.2.1"));
+	// The resolver is freed on errors.
+	ck_assert_ptr_null(resolver.pinned);
+	ck_assert_ptr_null(resolver.lookups);
+	ck_assert_uint_eq(0, resolver.lookup_count);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_finished_lookups_are_collected)
+{
+	struct curl_slist *entries = NULL;
+	struct resolver resolver = { 0 };
+	struct timespec delay = {.tv_nsec = 10000000 };
+	int tries = 500;
+
+	ck_assert_int_eq(UL_OK, start_resolver(&resolver, "localhost:8443",
+					       443, NULL));
+	ck_assert_uint_eq(1, resolver.lookup_count);
+	while (!__atomic_load_n(&(resolver.lookups[0]->done), __ATOMIC_ACQUIRE)
+	       && tries--) {
+		nanosleep(&delay, NULL);
+	}
+	entries = collect_lookups(&resolver);
+	ck_assert_ptr_nonnull(entries);
+	ck_assert_int_eq(0, strncmp("+localhost:8443:", entries->data, 16));
+	ck_assert_ptr_null(entries->next);
+	// Every lookup is only collected once.
+	ck_assert_ptr_null(collect_lookups(&resolver));
+
+	curl_slist_free_all(entries);
+	free_resolver(&resolver);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_null_resolver_is_accepted)
+{
+	ck_assert_ptr_null(collect_lookups(NULL));
+	ck_assert_ptr_null(take_pinned_addresses(NULL));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_resolver_collect_lookups_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("resolver::collect_lookups");
+	tcase_add_test(tc, test_finished_lookups_are_collected);
+	tcase_add_test(tc, test_null_resolver_is_accepted);
+
+	return tc;
+}
+
+static TCase *make_resolver_start_resolver_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("resolver::start_resolver");
+	tcase_add_test(tc, test_pinned_addresses_are_returned);
+	tcase_add_test(tc, test_addresses_are_not_resolved);
+	tcase_add_test(tc, test_invalid_pinned_addresses_are_rejected);
+
+	return tc;
+}
+
+Suite *make_resolver_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client resolver");
+	suite_add_tcase(s, make_resolver_collect_lookups_case());
+	suite_add_tcase(s, make_resolver_start_resolver_case());
+
+	return s;
+}
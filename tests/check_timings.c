@@ -0,0 +1,135 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "check_timings.h"
+#include "../src/timings.h"
+
+START_TEST(test_add_request_timings_splits_new_connections)
+{
+	struct timing_report report = { 0 };
+	struct request_timings timings = {
+		.namelookup = 1000,
+		.connect = 3000,
+		.appconnect = 10000,
+		.starttransfer = 15000,
+		.total = 16000,
+	};
+	const struct phase_timings *create = report.phases + PHASE_CREATE;
+
+	add_request_timings(&report, PHASE_CREATE, &timings);
+	add_request_timings(&report, PHASE_CREATE, &timings);
+	ck_assert_uint_eq(2, create->requests);
+	ck_assert_int_eq(2000, create->dns);
+	ck_assert_int_eq(4000, create->connect);
+	ck_assert_int_eq(14000, create->tls);
+	ck_assert_int_eq(10000, create->ttfb);
+	ck_assert_int_eq(32000, create->total);
+	ck_assert_int_eq(16000, create->max_total);
+	ck_assert_uint_eq(0, report.phases[PHASE_POLL].requests);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_add_request_timings_handles_reused_connections)
+{
+	struct timing_report report = { 0 };
+	// libcurl reports no handshake for a reused connection.
+	struct request_timings timings = {
+		.namelookup = 20,
+		.connect = 30,
+		.starttransfer = 2030,
+		.total = 2100,
+	};
+	const struct phase_timings *poll = report.phases + PHASE_POLL;
+
+	add_request_timings(&report, PHASE_POLL, &timings);
+	ck_assert_int_eq(20, poll->dns);
+	ck_assert_int_eq(10, poll->connect);
+	ck_assert_int_eq(0, poll->tls);
+	ck_assert_int_eq(2000, poll->ttfb);
+	ck_assert_int_eq(2100, poll->total);
+	// Only the name lookup is reported for some reused connections.
+	timings.connect = 0;
+	add_request_timings(&report, PHASE_POLL, &timings);
+	ck_assert_int_eq(2000 + 2010, poll->ttfb);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_print_timings_json_lists_all_phases)
+{
+	struct timing_report report = { 0 };
+	struct request_timings timings = {
+		.starttransfer = 1500,
+		.total = 2000,
+	};
+	char output[1024] = { 0 };
+	FILE *file = fmemopen(output, sizeof(output) - 1, "w");
+
+	add_request_timings(&report, PHASE_FULFIL, &timings);
+	print_timings_json(file, &report);
+	fclose(file);
+	ck_assert_ptr_nonnull(strstr(output, "\"create\": {\"requests\": 0,"));
+	ck_assert_ptr_nonnull(strstr(output, "\"poll\": {\"requests\": 0,"));
+	ck_assert_ptr_nonnull(strstr(output, "\"fulfil\": {\"requests\": 1, "
+				     "\"dns_ms\": 0.000, "
+				     "\"connect_ms\": 0.000, "
+				     "\"tls_ms\": 0.000, \"ttfb_ms\": 1.500, "
+				     "\"total_ms\": 2.000"));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_add_request_timings_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("timings::add_request_timings");
+	tcase_add_test(tc, test_add_request_timings_splits_new_connections);
+	tcase_add_test(tc, test_add_request_timings_handles_reused_connections);
+
+	return tc;
+}
+
+static TCase *make_print_timings_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("timings::print_timings_json");
+	tcase_add_test(tc, test_print_timings_json_lists_all_phases);
+
+	return tc;
+}
+
+Suite *make_timings_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client timings");
+	suite_add_tcase(s, make_add_request_timings_case());
+	suite_add_tcase(s, make_print_timings_case());
+
+	return s;
+}
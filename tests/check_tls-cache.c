@@ -0,0 +1,235 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <check.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check_tls-cache.h"
+#include "../src/tls-cache.h"
+
+/**
+ * The sessions seen by collect_record.
+ */
+struct collected_records {
+	unsigned int count;
+	char session_key[32];
+	unsigned char sdata[32];
+	size_t sdata_len;
+};
+
+/**
+ * Remember the last session read from a cache file.
+ *
+ * @param record is the session.
+ * @param userdata is a struct collected_records.
+ *
+ * @return always 1.
+ */
+static int collect_record(const struct tls_record *record, void *userdata)
+{
+	struct collected_records *collected = userdata;
+
+	collected->count++;
+	strncpy(collected->session_key, record->session_key,
+		sizeof(collected->session_key) - 1);
+	ck_assert_uint_le(record->sdata_len, sizeof(collected->sdata));
+	memcpy(collected->sdata, record->sdata, record->sdata_len);
+	collected->sdata_len = record->sdata_len;
+
+	return 1;
+}
+
+/**
+ * Write a cache file with a valid session and an expired session.
+ *
+ * @param file is the file to write to.
+ * @param now is the current time.
+ */
+static void write_test_cache(FILE *file, time_t now)
+{
+	struct tls_record valid = {
+		.session_key = "example.com:443",
+		.shmac = (unsigned char *) "shmac",
+		.shmac_len = 5,
+		.sdata = (unsigned char *) "se\0cret",
+		.sdata_len = 7,
+		.valid_until = now + 60,
+	};
+	struct tls_record expired = {
+		.session_key = "example.org:443",
+		.shmac = (unsigned char *) "",
+		.shmac_len = 0,
+		.sdata = (unsigned char *) "old",
+		.sdata_len = 3,
+		.valid_until = now,
+	};
+
+	ck_assert_int_eq(0, write_tls_cache_header(file));
+	ck_assert_int_eq(0, write_tls_record(file, &valid));
+	ck_assert_int_eq(0, write_tls_record(file, &expired));
+	ck_assert_int_eq(0, fflush(file));
+	rewind(file);
+}
+
+START_TEST(test_cache_files_round_trip)
+{
+	struct collected_records collected = { 0 };
+	FILE *file = tmpfile();
+	unsigned int imported = 0;
+	time_t now = time(NULL);
+
+	ck_assert_ptr_nonnull(file);
+	write_test_cache(file, now);
+	ck_assert_int_eq(UL_OK, read_tls_cache(file, now, collect_record,
+					       &collected, &imported));
+	ck_assert_uint_eq(1, imported);
+	ck_assert_uint_eq(1, collected.count);
+	ck_assert_str_eq("example.com:443", collected.session_key);
+	ck_assert_uint_eq(7, collected.sdata_len);
+	ck_assert_mem_eq("se\0cret", collected.sdata, 7);
+
+	fclose(file);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_invalid_magic_is_rejected)
+{
+	struct collected_records collected = { 0 };
+	FILE *file = tmpfile();
+	unsigned int imported = 1;
+
+	ck_assert_ptr_nonnull(file);
+	ck_assert_int_eq(UL_ERR, read_tls_cache(file, 0, collect_record,
+						&collected, &imported));
+	fputs("ULTLS99\n", file);
+	write_test_cache(file, 0);
+	ck_assert_int_eq(UL_ERR, read_tls_cache(file, 0, collect_record,
+						&collected, &imported));
+	ck_assert_uint_eq(0, imported);
+	ck_assert_uint_eq(0, collected.count);
+
+	fclose(file);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_truncated_files_keep_complete_records)
+{
+	FILE *file = tmpfile();
+	unsigned int imported = 0;
+	// The header and the length prefixed fields of the first session.
+	long first_end = 8 + 4 + 15 + 4 + 5 + 4 + 7 + 8;
+	long size = 0;
+
+	ck_assert_ptr_nonnull(file);
+	write_test_cache(file, 0);
+	fseek(file, 0, SEEK_END);
+	size = ftell(file);
+	for (long cut = size - 1; cut >= 0; cut--) {
+		struct collected_records collected = { 0 };
+		enum unlocked_err err = UL_OK;
+
+		ck_assert_int_eq(0, ftruncate(fileno(file), cut));
+		rewind(file);
+		err = read_tls_cache(file, 0, collect_record, &collected,
+				     &imported);
+		if (cut < 8) {
+			ck_assert_int_eq(UL_ERR, err);
+		} else {
+			ck_assert_int_eq(UL_OK, err);
+			ck_assert_uint_eq(cut >= first_end, imported);
+		}
+	}
+
+	fclose(file);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_oversized_fields_are_rejected)
+{
+	struct collected_records collected = { 0 };
+	unsigned char sdata[65537] = { 0 };
+	struct tls_record record = {
+		.session_key = "example.com:443",
+		.sdata = sdata,
+		.sdata_len = sizeof(sdata),
+		.valid_until = INT64_MAX,
+	};
+	FILE *file = tmpfile();
+	unsigned int imported = 1;
+	uint32_t field_len = sizeof(sdata);
+
+	ck_assert_ptr_nonnull(file);
+	ck_assert_int_eq(0, write_tls_cache_header(file));
+	ck_assert_int_ne(0, write_tls_record(file, &record));
+	rewind(file);
+	ck_assert_int_eq(0, write_tls_cache_header(file));
+	fwrite(&field_len, sizeof(field_len), 1, file);
+	fwrite(sdata, sizeof(sdata), 1, file);
+	rewind(file);
+	ck_assert_int_eq(UL_OK, read_tls_cache(file, 0, collect_record,
+					       &collected, &imported));
+	ck_assert_uint_eq(0, imported);
+
+	fclose(file);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_tls_cache_read_tls_cache_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("tls-cache::read_tls_cache");
+	tcase_add_test(tc, test_cache_files_round_trip);
+	tcase_add_test(tc, test_invalid_magic_is_rejected);
+	tcase_add_test(tc, test_truncated_files_keep_complete_records);
+
+	return tc;
+}
+
+static TCase *make_tls_cache_write_tls_record_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("tls-cache::write_tls_record");
+	tcase_add_test(tc, test_oversized_fields_are_rejected);
+
+	return tc;
+}
+
+Suite *make_tls_cache_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client tls-cache");
+	suite_add_tcase(s, make_tls_cache_read_tls_cache_case());
+	suite_add_tcase(s, make_tls_cache_write_tls_record_case());
+
+	return s;
+}
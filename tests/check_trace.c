@@ -0,0 +1,131 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "check_trace.h"
+#include "../src/trace.h"
+
+/**
+ * Read a whole trace file and remove it.
+ *
+ * @param path is the path of the file.
+ * @param output is the storage for the content.
+ * @param size is the size of the storage.
+ */
+static void read_trace(const char *path, char *output, size_t size)
+{
+	FILE *file = fopen(path, "r");
+
+	ck_assert_ptr_nonnull(file);
+	output[fread(output, 1, size - 1, file)] = '\0';
+	fclose(file);
+	unlink(path);
+}
+
+START_TEST(test_open_trace_writes_earlier_spans)
+{
+	char path[] = "/tmp/unlocked-trace-XXXXXX";
+	char output[4096] = { 0 };
+	long long begin = trace_now();
+
+	close(mkstemp(path));
+	trace_span(TRACE_MAIN, "parse_config_file", begin);
+	ck_assert_int_eq(UL_OK, open_trace(path));
+	trace_span(TRACE_MAIN, "initialize_modules", begin);
+	close_trace();
+	read_trace(path, output, sizeof(output));
+	ck_assert_int_eq('[', output[0]);
+	ck_assert_str_eq("\n]\n", output + strlen(output) - 3);
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": "
+				     "\"parse_config_file\", \"ph\": \"X\", "
+				     "\"ts\": "));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": "
+				     "\"initialize_modules\""));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_trace_request_splits_steps)
+{
+	char path[] = "/tmp/unlocked-trace-XXXXXX";
+	char output[4096] = { 0 };
+	struct request_timings timings = {
+		.namelookup = 1000,
+		.connect = 3000,
+		.appconnect = 10000,
+		.starttransfer = 15000,
+		.total = 16000,
+	};
+
+	close(mkstemp(path));
+	ck_assert_int_eq(UL_OK, open_trace(path));
+	trace_name_track(1, "key ", "root-\"disk\"");
+	trace_request(1, "create", &timings);
+	close_trace();
+	read_trace(path, output, sizeof(output));
+	ck_assert_ptr_nonnull(strstr(output, "\"args\": {\"name\": "
+				     "\"key root-\\\"disk\\\"\"}}"));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": \"create\""));
+	ck_assert_ptr_nonnull(strstr(output, "\"dur\": 16000"));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": \"dns\""));
+	ck_assert_ptr_nonnull(strstr(output, "\"dur\": 2000"));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": \"tls\""));
+	ck_assert_ptr_nonnull(strstr(output, "\"dur\": 7000"));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": \"ttfb\""));
+	ck_assert_ptr_nonnull(strstr(output, "{\"name\": \"receive\""));
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_open_trace_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("trace::open_trace");
+	tcase_add_test(tc, test_open_trace_writes_earlier_spans);
+
+	return tc;
+}
+
+static TCase *make_trace_request_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("trace::trace_request");
+	tcase_add_test(tc, test_trace_request_splits_steps);
+
+	return tc;
+}
+
+Suite *make_trace_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client trace");
+	suite_add_tcase(s, make_open_trace_case());
+	suite_add_tcase(s, make_trace_request_case());
+
+	return s;
+}
@@ -20,8 +20,22 @@
 #include <check.h>
 #include <stdlib.h>
 
+#include "check_backoff.h"
 #include "check_cli.h"
+#include "check_event-loop.h"
+#include "check_hmac-signer.h"
+#include "check_hosts.h"
 #include "check_https-client.h"
+#include "check_json-scan.h"
+#include "check_key-cache.h"
+#include "check_locked-memory.h"
+#include "check_metrics.h"
+#include "check_request-state.h"
+#include "check_resolver.h"
+#include "check_timings.h"
+#include "check_tls-cache.h"
+#include "check_trace.h"
+#include "mod/check_mod_sd_socket.h"
 #include "mod/check_module.h"
 
 int main(void)
@@ -30,9 +44,23 @@ int main(void)
 	SRunner *sr;
 
 	sr = srunner_create(NULL);
+	srunner_add_suite(sr, make_backoff_suite());
 	srunner_add_suite(sr, make_cli_suite());
+	srunner_add_suite(sr, make_event_loop_suite());
+	srunner_add_suite(sr, make_hmac_signer_suite());
+	srunner_add_suite(sr, make_hosts_suite());
 	srunner_add_suite(sr, make_https_client_suite());
+	srunner_add_suite(sr, make_json_scan_suite());
+	srunner_add_suite(sr, make_key_cache_suite());
+	srunner_add_suite(sr, make_locked_memory_suite());
+	srunner_add_suite(sr, make_metrics_suite());
+	srunner_add_suite(sr, make_request_state_suite());
+	srunner_add_suite(sr, make_resolver_suite());
+	srunner_add_suite(sr, make_timings_suite());
+	srunner_add_suite(sr, make_tls_cache_suite());
+	srunner_add_suite(sr, make_trace_suite());
 	srunner_add_suite(sr, make_mod_module_suite());
+	srunner_add_suite(sr, make_mod_sd_socket_suite());
 
 	srunner_run_all(sr, CK_VERBOSE);
 	number_failed = srunner_ntests_failed(sr);
@@ -0,0 +1,457 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock-process.h"
+
+/**
+ * The maximum number of runs of the client per scenario.
+ */
+#define MAX_RUNS 64
+
+/**
+ * The key the mock server delivers.
+ */
+#define BENCH_KEY "bench-key"
+
+extern char **environ;
+
+/**
+ * A configuration of the client and the mock server to measure.
+ */
+struct scenario {
+	const char *name;
+	/**
+	 * The delay between polls of the client in milliseconds.
+	 */
+	long poll_interval;
+	/**
+	 * Additional arguments of the mock server, terminated by NULL.
+	 */
+	const char *server_args[4];
+};
+
+/**
+ * The measured time to unlock of a scenario.
+ */
+struct scenario_result {
+	const char *name;
+	unsigned int runs;
+	double median_ms;
+	double min_ms;
+	double max_ms;
+	/**
+	 * The counters of the mock server over all runs.
+	 */
+	unsigned long handshakes;
+	unsigned long resumed;
+	unsigned long requests;
+};
+
+static const struct scenario scenarios[] = {
+	{"poll-100ms/keep-alive", 100, {NULL}},
+	{"poll-1000ms/keep-alive", 1000, {NULL}},
+	{"poll-100ms/close", 100, {"--close", NULL}},
+	{"poll-100ms/close/no-resumption", 100,
+	 {"--close", "--no-resumption", NULL}},
+	{"poll-100ms/latency-50ms", 100, {"--latency", "50", NULL}},
+};
+
+static int compare_doubles(const void *a, const void *b);
+static double elapsed_ms(const struct timespec *since);
+static void print_json(FILE *file, const struct scenario_result *results,
+		       size_t count);
+static void print_table(const struct scenario_result *results, size_t count);
+static int run_client(const char *client, const char *config, double *ms);
+static int run_scenario(const struct scenario *scenario, const char *client,
+			const char *server, const char *approve_after,
+			unsigned int runs, struct scenario_result *result);
+static int start_server(const char *server, const char *approve_after,
+			const struct scenario *scenario,
+			struct mock_process *mock);
+static void usage(const char *program);
+static int write_config(char *path, unsigned int port, long poll_interval);
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"approve-after", required_argument, NULL, 'a'},
+		{"client", required_argument, NULL, 'c'},
+		{"filter", required_argument, NULL, 'f'},
+		{"help", no_argument, NULL, 'h'},
+		{"json", required_argument, NULL, 'j'},
+		{"runs", required_argument, NULL, 'r'},
+		{"server", required_argument, NULL, 's'},
+		{0, 0, 0, 0},
+	};
+	const size_t scenario_count = sizeof(scenarios) / sizeof(scenarios[0]);
+	struct scenario_result results[sizeof(scenarios) /
+				       sizeof(scenarios[0])];
+	const char *approve_after = "500";
+	const char *client = UNLOCKED_CLIENT_PATH;
+	const char *filter = NULL;
+	const char *json_path = NULL;
+	const char *server = MOCK_SERVER_PATH;
+	unsigned int runs = 5;
+	size_t result_count = 0;
+	FILE *json_file = NULL;
+	int opt = 0;
+
+	while (-1 != (opt = getopt_long(argc, argv, "a:c:f:hj:r:s:", options,
+					NULL))) {
+		switch (opt) {
+		case 'a':
+			approve_after = optarg;
+			break;
+		case 'c':
+			client = optarg;
+			break;
+		case 'f':
+			filter = optarg;
+			break;
+		case 'j':
+			json_path = optarg;
+			break;
+		case 'r':
+			runs = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+	if (0 == runs || runs > MAX_RUNS) {
+		fprintf(stderr, "The number of runs must be between 1 and %d\n",
+			MAX_RUNS);
+
+		return EXIT_FAILURE;
+	}
+
+	for (size_t i = 0; i < scenario_count; i++) {
+		if (filter && NULL == strstr(scenarios[i].name, filter)) {
+			continue;
+		}
+		if (run_scenario(scenarios + i, client, server, approve_after,
+				 runs, results + result_count)) {
+			fprintf(stderr, "The scenario %s failed\n",
+				scenarios[i].name);
+
+			return EXIT_FAILURE;
+		}
+		result_count++;
+	}
+	print_table(results, result_count);
+	if (json_path) {
+		json_file = strcmp(json_path, "-") ? fopen(json_path, "w") :
+		    stdout;
+		if (NULL == json_file) {
+			perror(json_path);
+
+			return EXIT_FAILURE;
+		}
+		print_json(json_file, results, result_count);
+		if (stdout != json_file) {
+			fclose(json_file);
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Compare two doubles for qsort.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+	const double *x = a;
+	const double *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/**
+ * Get the milliseconds passed since a point in time.
+ *
+ * @param since is the point in time on the monotonic clock.
+ *
+ * @return the passed milliseconds.
+ */
+static double elapsed_ms(const struct timespec *since)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1e3
+	    + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/**
+ * Print the results as json.
+ *
+ * @param file is the file to print to.
+ * @param results are the results of the scenarios.
+ * @param count is the number of results.
+ */
+static void print_json(FILE *file, const struct scenario_result *results,
+		       size_t count)
+{
+	fprintf(file, "{\n  \"scenarios\": [");
+	for (size_t i = 0; i < count; i++) {
+		fprintf(file, "%s\n    {\"name\": \"%s\", \"runs\": %u, "
+			"\"median_ms\": %.3f, \"min_ms\": %.3f, "
+			"\"max_ms\": %.3f, \"handshakes\": %lu, "
+			"\"resumed\": %lu, \"requests\": %lu}", i ? "," : "",
+			results[i].name, results[i].runs, results[i].median_ms,
+			results[i].min_ms, results[i].max_ms,
+			results[i].handshakes, results[i].resumed,
+			results[i].requests);
+	}
+	fprintf(file, "\n  ]\n}\n");
+}
+
+/**
+ * Print the results as table on the standard output.
+ *
+ * @param results are the results of the scenarios.
+ * @param count is the number of results.
+ */
+static void print_table(const struct scenario_result *results, size_t count)
+{
+	printf("%-32s %10s %10s %10s %10s %8s %9s\n", "scenario", "median ms",
+	       "min ms", "max ms", "handshakes", "resumed", "requests");
+	for (size_t i = 0; i < count; i++) {
+		printf("%-32s %10.1f %10.1f %10.1f %10lu %8lu %9lu\n",
+		       results[i].name, results[i].median_ms,
+		       results[i].min_ms, results[i].max_ms,
+		       results[i].handshakes, results[i].resumed,
+		       results[i].requests);
+	}
+}
+
+/**
+ * Run the client once and measure the time until it delivered the key.
+ *
+ * @param client is the path of the client.
+ * @param config is the path of the configuration file.
+ * @param ms is set to the time from the start of the client until the key
+ *           was written to its standard output.
+ *
+ * @return 0 on success or -1 if the client did not deliver the key.
+ */
+static int run_client(const char *client, const char *config, double *ms)
+{
+	char *const argv[] = {
+		(char *)client, "--config", (char *)config, NULL
+	};
+	posix_spawn_file_actions_t actions;
+	struct timespec start = { 0 };
+	char output[sizeof(BENCH_KEY) + 16];
+	size_t length = 0;
+	ssize_t count = 0;
+	int pipe_fds[2];
+	int status = 0;
+	pid_t pid = 0;
+
+	if (pipe(pipe_fds)) {
+		return -1;
+	}
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+	posix_spawn_file_actions_addclose(&actions, pipe_fds[1]);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	status = posix_spawn(&pid, client, &actions, NULL, argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipe_fds[1]);
+	if (status) {
+		close(pipe_fds[0]);
+		errno = status;
+		perror(client);
+
+		return -1;
+	}
+	*ms = -1;
+	while (length < sizeof(output) - 1
+	       && (count = read(pipe_fds[0], output + length,
+				sizeof(output) - 1 - length)) > 0) {
+		length += count;
+		if (*ms < 0 && length >= sizeof(BENCH_KEY) - 1) {
+			*ms = elapsed_ms(&start);
+		}
+	}
+	close(pipe_fds[0]);
+	waitpid(pid, &status, 0);
+	output[length] = '\0';
+	if (!WIFEXITED(status) || EXIT_SUCCESS != WEXITSTATUS(status)
+	    || strncmp(output, BENCH_KEY, sizeof(BENCH_KEY) - 1)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Measure the time to unlock of a scenario against a fresh mock server.
+ *
+ * @param scenario is the scenario.
+ * @param client is the path of the client.
+ * @param server is the path of the mock server.
+ * @param approve_after is the time until the server accepts requests.
+ * @param runs is the number of runs of the client.
+ * @param result is set to the result of the scenario.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int run_scenario(const struct scenario *scenario, const char *client,
+			const char *server, const char *approve_after,
+			unsigned int runs, struct scenario_result *result)
+{
+	struct mock_process mock = { 0 };
+	struct mock_stats stats = { 0 };
+	char config[] = "/tmp/unlocked-bench-XXXXXX";
+	double times[MAX_RUNS];
+	int failed = 0;
+
+	memset(result, 0, sizeof(struct scenario_result));
+	result->name = scenario->name;
+	if (start_server(server, approve_after, scenario, &mock)) {
+		return -1;
+	}
+	failed = write_config(config, mock.port, scenario->poll_interval);
+	for (unsigned int i = 0; !failed && i < runs; i++) {
+		failed = run_client(client, config, times + i);
+	}
+	if (!failed) {
+		unlink(config);
+	}
+	if (stop_mock_server(&mock, &stats) || failed) {
+		return -1;
+	}
+	qsort(times, runs, sizeof(double), compare_doubles);
+	result->runs = runs;
+	result->handshakes = stats.handshakes;
+	result->resumed = stats.resumed;
+	result->requests = stats.requests;
+	result->min_ms = times[0];
+	result->max_ms = times[runs - 1];
+	result->median_ms = runs % 2 ? times[runs / 2] :
+	    (times[runs / 2 - 1] + times[runs / 2]) / 2;
+
+	return 0;
+}
+
+/**
+ * Start the mock server for a scenario and wait until it listens.
+ *
+ * @param server is the path of the mock server.
+ * @param approve_after is the time until the server accepts requests.
+ * @param scenario is the scenario.
+ * @param mock is set to the running server.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int start_server(const char *server, const char *approve_after,
+			const struct scenario *scenario,
+			struct mock_process *mock)
+{
+	const char *args[16] = {
+		"--approve-after", approve_after, "--key", BENCH_KEY,
+		"--secret", "bench-secret", "--username", "bench",
+	};
+	size_t count = 8;
+
+	for (size_t i = 0; scenario->server_args[i]; i++) {
+		args[count++] = scenario->server_args[i];
+	}
+
+	return start_mock_server(server, args, mock);
+}
+
+/**
+ * Print the usage of the benchmark.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [--approve-after <ms>] [--client <path>] "
+	       "[--filter <substring>]\n"
+	       "       [--json <file>] [--runs <count>] [--server <path>]\n\n"
+	       "Measure the time from the start of the client until it "
+	       "delivered the key\n"
+	       "against the mock server with different polling intervals, "
+	       "with and without\n"
+	       "connection reuse and TLS session resumption.\n", program);
+}
+
+/**
+ * Write the configuration of the client for the mock server.
+ *
+ * @param path is the template of the path, that is replaced with the path of
+ *             the created file.
+ * @param port is the port of the mock server.
+ * @param poll_interval is the delay between polls in milliseconds.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int write_config(char *path, unsigned int port, long poll_interval)
+{
+	int fd = mkstemp(path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+
+	if (NULL == file) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		perror("Could not create the configuration");
+
+		return -1;
+	}
+	fprintf(file, "[unlocked]\n"
+		"key_handle = bench-key ;\n"
+		"secret = bench-secret ;\n"
+		"username = bench ;\n"
+		"host = 127.0.0.1 ;\n"
+		"port = %u ;\n"
+		"validate = FALSE ;\n"
+		"poll_interval = %ld ;\n"
+		"poll_jitter = FALSE ;\n"
+		"[stdout]\n"
+		"use_stdout = TRUE ;\n", port, poll_interval);
+
+	return fclose(file) ? -1 : 0;
+}
@@ -0,0 +1,451 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "mock-process.h"
+#include "../../src/agent.h"
+#include "../../src/cli.h"
+#include "../../src/error.h"
+
+/**
+ * The handle of the key requested from the agent.
+ */
+#define HANDLE "root-disk"
+
+/**
+ * The key delivered by the mock server.
+ */
+#define KEY "mock-key"
+
+/**
+ * The time in seconds to wait for the agent.
+ */
+#define TIMEOUT 30
+
+static int check_cache_hit(int fd, struct mock_process *mock);
+static int check_invalid_frame(const char *path);
+static int check_shared_fetch(const char *path, struct mock_process *mock,
+			      int *fd);
+static int connect_agent(const char *path);
+static struct arguments *get_arguments(unsigned int port, const char *path);
+static int read_reply(int fd, char *payload, size_t size);
+static int send_request(int fd, const char *handle, int split);
+static void usage(const char *program);
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"help", no_argument, NULL, 'h'},
+		{"server", required_argument, NULL, 's'},
+		{0, 0, 0, 0},
+	};
+	const char *server_args[] = { "--approve-after", "500", NULL };
+	pid_t agent = -1;
+	struct arguments *arguments = NULL;
+	char dir[] = "/tmp/check_agent-XXXXXX";
+	int fd = -1;
+	struct mock_process mock = { 0 };
+	int opt = 0;
+	char path[sizeof(dir) + sizeof("/agent.sock")];
+	const char *server = MOCK_SERVER_PATH;
+	int status = EXIT_FAILURE;
+
+	while (-1 != (opt = getopt_long(argc, argv, "hs:", options, NULL))) {
+		switch (opt) {
+		case 's':
+			server = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+	if (NULL == mkdtemp(dir)) {
+		perror("Could not create the directory for the socket");
+
+		return EXIT_FAILURE;
+	}
+	snprintf(path, sizeof(path), "%s/agent.sock", dir);
+	if (start_mock_server(server, server_args, &mock)) {
+		rmdir(dir);
+
+		return EXIT_FAILURE;
+	}
+	arguments = get_arguments(mock.port, path);
+	if (NULL == arguments) {
+		fprintf(stderr, "Could not create the arguments\n");
+		goto cleanup;
+	}
+	agent = fork();
+	if (0 == agent) {
+		fclose(mock.output);
+		_exit(UL_OK == run_agent(arguments, NULL) ?
+		      EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	if (agent < 0) {
+		perror("Could not start the agent");
+		goto cleanup;
+	}
+	if (check_shared_fetch(path, &mock, &fd)
+	    || check_cache_hit(fd, &mock) || check_invalid_frame(path)) {
+		goto cleanup;
+	}
+	status = EXIT_SUCCESS;
+
+ cleanup:
+	if (fd >= 0) {
+		close(fd);
+	}
+	if (agent > 0) {
+		kill(agent, SIGTERM);
+		waitpid(agent, &opt, 0);
+		if (!WIFEXITED(opt) || EXIT_SUCCESS != WEXITSTATUS(opt)) {
+			fprintf(stderr, "The agent did not stop cleanly\n");
+			status = EXIT_FAILURE;
+		}
+	}
+	stop_mock_server(&mock, NULL);
+	free_args(arguments);
+	unlink(path);
+	rmdir(dir);
+	if (EXIT_SUCCESS == status) {
+		printf("The agent passed all checks\n");
+	}
+
+	return status;
+}
+
+/**
+ * Check that a key, that was received before, is served from the cache
+ * without asking the server again.
+ *
+ * @param fd is a connection, that already received the key.
+ * @param mock is the mock server.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int check_cache_hit(int fd, struct mock_process *mock)
+{
+	struct mock_stats stats = { 0 };
+	char payload[64];
+
+	// A second request on the same connection.
+	if (send_request(fd, HANDLE, 0) || read_reply(fd, payload,
+						      sizeof(payload))) {
+		return -1;
+	}
+	if (strcmp(KEY, payload)) {
+		fprintf(stderr, "The cache served \"%s\"\n", payload);
+
+		return -1;
+	}
+	if (sample_mock_server(mock, &stats)) {
+		fprintf(stderr, "Could not sample the mock server\n");
+
+		return -1;
+	}
+	if (1 != stats.created) {
+		fprintf(stderr, "The cached key was requested again, %lu "
+			"requests were created\n", stats.created);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check that the agent closes the connection after a frame without handle.
+ *
+ * @param path is the path of the agent socket.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int check_invalid_frame(const char *path)
+{
+	uint32_t frame_len = 0;
+	char buffer[8];
+	int fd = connect_agent(path);
+	ssize_t received = 0;
+
+	if (fd < 0) {
+		return -1;
+	}
+	if (sizeof(frame_len) != send(fd, &frame_len, sizeof(frame_len),
+				      MSG_NOSIGNAL)) {
+		close(fd);
+
+		return -1;
+	}
+	received = recv(fd, buffer, sizeof(buffer), 0);
+	close(fd);
+	if (0 != received) {
+		fprintf(stderr, "The agent answered an empty handle\n");
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Check that consumers waiting for the same key share a single negotiation.
+ *
+ * The first consumer sends its request in pieces and the second one shuts
+ * down its side of the connection right after the request, like `nc -N`.
+ *
+ * @param path is the path of the agent socket.
+ * @param mock is the mock server.
+ * @param fd is set to the still open connection of the first consumer.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int check_shared_fetch(const char *path, struct mock_process *mock,
+			      int *fd)
+{
+	int half_closed = -1;
+	char payload[64];
+	int result = -1;
+	struct mock_stats stats = { 0 };
+
+	*fd = connect_agent(path);
+	half_closed = connect_agent(path);
+	if (*fd < 0 || half_closed < 0 || send_request(*fd, HANDLE, 1)
+	    || send_request(half_closed, HANDLE, 0)
+	    || shutdown(half_closed, SHUT_WR)) {
+		goto cleanup;
+	}
+	if (read_reply(half_closed, payload, sizeof(payload))) {
+		fprintf(stderr, "The half closed consumer got no key\n");
+		goto cleanup;
+	}
+	if (strcmp(KEY, payload)) {
+		fprintf(stderr, "The half closed consumer got \"%s\"\n",
+			payload);
+		goto cleanup;
+	}
+	if (read_reply(*fd, payload, sizeof(payload))) {
+		fprintf(stderr, "The first consumer got no key\n");
+		goto cleanup;
+	}
+	if (strcmp(KEY, payload)) {
+		fprintf(stderr, "The first consumer got \"%s\"\n", payload);
+		goto cleanup;
+	}
+	if (sample_mock_server(mock, &stats)) {
+		fprintf(stderr, "Could not sample the mock server\n");
+		goto cleanup;
+	}
+	if (1 != stats.created) {
+		fprintf(stderr, "The consumers did not share the negotiation, "
+			"%lu requests were created\n", stats.created);
+		goto cleanup;
+	}
+	result = 0;
+
+ cleanup:
+	if (half_closed >= 0) {
+		close(half_closed);
+	}
+
+	return result;
+}
+
+/**
+ * Connect to the agent, waiting for it to listen.
+ *
+ * @param path is the path of the agent socket.
+ *
+ * @return the connection or -1 on failure.
+ */
+static int connect_agent(const char *path)
+{
+	struct sockaddr_un addr = {.sun_family = AF_UNIX };
+	struct timespec delay = {.tv_nsec = 10000000 };
+	time_t deadline = time(NULL) + TIMEOUT;
+	int fd = -1;
+	struct timeval timeout = {.tv_sec = TIMEOUT };
+
+	strncpy(addr.sun_path, path, sizeof(addr.sun_path) - 1);
+	while (time(NULL) < deadline) {
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			return -1;
+		}
+		if (0 == connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+				   sizeof(timeout));
+
+			return fd;
+		}
+		close(fd);
+		nanosleep(&delay, NULL);
+	}
+	fprintf(stderr, "Could not connect to the agent on %s\n", path);
+
+	return -1;
+}
+
+/**
+ * Get the arguments of an agent polling the mock server with a short fixed
+ * interval.
+ *
+ * @param port is the port of the mock server.
+ * @param path is the path of the agent socket.
+ *
+ * @return the arguments or NULL on failure.
+ */
+static struct arguments *get_arguments(unsigned int port, const char *path)
+{
+	struct arguments *arguments = create_args();
+
+	if (NULL == arguments) {
+		return NULL;
+	}
+	arguments->agent_socket = strdup(path);
+	arguments->hedge_delay = 1000;
+	arguments->host = strdup("127.0.0.1");
+	arguments->key_ttl = 60;
+	arguments->long_poll_timeout = 60;
+	arguments->max_response_size = 1024 * 1024;
+	arguments->poll_interval = 20;
+	arguments->poll_jitter = no;
+	arguments->poll_max_interval = 20;
+	arguments->poll_multiplier = 1;
+	arguments->port = port;
+	// The secret is not freed with the arguments.
+	arguments->secret = "test-secret";
+	arguments->username = strdup("test-server");
+	arguments->validate = no;
+	if (NULL == arguments->agent_socket || NULL == arguments->host
+	    || NULL == arguments->username) {
+		free_args(arguments);
+
+		return NULL;
+	}
+
+	return arguments;
+}
+
+/**
+ * Receive a successful reply from the agent.
+ *
+ * @param fd is the connection to the agent.
+ * @param payload is set to the key terminated by a null byte.
+ * @param size is the size of the payload buffer.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int read_reply(int fd, char *payload, size_t size)
+{
+	uint32_t frame_len = 0;
+	char status = 0;
+
+	if (sizeof(frame_len) != recv(fd, &frame_len, sizeof(frame_len),
+				      MSG_WAITALL)) {
+		return -1;
+	}
+	frame_len = ntohl(frame_len);
+	if (0 == frame_len || frame_len > size
+	    || 1 != recv(fd, &status, 1, MSG_WAITALL)) {
+		return -1;
+	}
+	frame_len--;
+	if (frame_len != (uint32_t)recv(fd, payload, frame_len, MSG_WAITALL)) {
+		return -1;
+	}
+	payload[frame_len] = '\0';
+	if (UL_OK != status) {
+		fprintf(stderr, "The agent replied with an error: %s\n",
+			payload);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Send a request for a key to the agent.
+ *
+ * @param fd is the connection to the agent.
+ * @param handle is the handle of the key.
+ * @param split is whether to send the request in pieces.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int send_request(int fd, const char *handle, int split)
+{
+	struct timespec delay = {.tv_nsec = 10000000 };
+	unsigned char frame[sizeof(uint32_t) + AGENT_MAX_HANDLE];
+	uint32_t frame_len = htonl(strlen(handle));
+	size_t len = sizeof(frame_len) + strlen(handle);
+	size_t offset = 0;
+	size_t part = 0;
+
+	memcpy(frame, &frame_len, sizeof(frame_len));
+	memcpy(frame + sizeof(frame_len), handle, strlen(handle));
+	while (offset < len) {
+		part = split ? 3 : len - offset;
+		part = part < len - offset ? part : len - offset;
+		if ((ssize_t)part != send(fd, frame + offset, part,
+					  MSG_NOSIGNAL)) {
+			return -1;
+		}
+		offset += part;
+		if (split) {
+			nanosleep(&delay, NULL);
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Print the usage of the agent test.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [options]\n\n"
+	       "Serve keys from the mock server with the agent and check the "
+	       "framed protocol,\nthe cache and the sharing of "
+	       "negotiations.\n\n"
+	       "  --server <path>  path of the mock server\n", program);
+}
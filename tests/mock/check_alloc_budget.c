@@ -0,0 +1,218 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "mock-process.h"
+#include "../../src/alloc-stats.h"
+#include "../../src/cli.h"
+#include "../../src/client.h"
+#include "../../src/error.h"
+
+/**
+ * The time in seconds after which the negotiation is given up.
+ */
+#define TIMEOUT 30
+
+/**
+ * The outcome of the negotiation of the key.
+ */
+struct outcome {
+	enum unlocked_err err;
+	int finished;
+};
+
+static void finish_fetch(void *data, enum unlocked_err err, char *key);
+static struct arguments *get_arguments(unsigned int port);
+static void usage(const char *program);
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"approve-after", required_argument, NULL, 'a'},
+		{"budget", required_argument, NULL, 'b'},
+		{"help", no_argument, NULL, 'h'},
+		{"server", required_argument, NULL, 's'},
+		{0, 0, 0, 0},
+	};
+	const char *server_args[] = { "--approve-after", "1000", NULL };
+	struct arguments *arguments = NULL;
+	double budget = 2;
+	struct key_client *client = NULL;
+	struct alloc_counters counters = { 0 };
+	struct mock_process mock = { 0 };
+	int opt = 0;
+	struct outcome outcome = { 0 };
+	double per_poll = 0;
+	unsigned long polls = 0;
+	const char *server = MOCK_SERVER_PATH;
+	int status = EXIT_FAILURE;
+	time_t deadline = 0;
+
+	while (-1 != (opt = getopt_long(argc, argv, "a:b:hs:", options,
+					NULL))) {
+		switch (opt) {
+		case 'a':
+			server_args[1] = optarg;
+			break;
+		case 'b':
+			budget = strtod(optarg, NULL);
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+	if (start_mock_server(server, server_args, &mock)) {
+		return EXIT_FAILURE;
+	}
+	arguments = get_arguments(mock.port);
+	if (NULL == arguments
+	    || UL_OK != create_key_client(arguments, NULL, &client)) {
+		fprintf(stderr, "Could not create the client\n");
+		goto cleanup;
+	}
+	// Only the negotiation itself is measured.
+	reset_alloc_stats();
+	if (UL_OK != fetch_key(client, arguments->key_handle, finish_fetch,
+			       &outcome)) {
+		fprintf(stderr, "Could not request the key\n");
+		goto cleanup;
+	}
+	deadline = time(NULL) + TIMEOUT;
+	while (!outcome.finished && time(NULL) < deadline) {
+		if (UL_OK != dispatch_key_client(client, 1000)) {
+			perror("Dispatching events failed");
+			goto cleanup;
+		}
+	}
+	if (!outcome.finished || UL_OK != outcome.err) {
+		fprintf(stderr, "The key was not received: %s\n",
+			outcome.finished ? ul_error(outcome.err) : "timeout");
+		goto cleanup;
+	}
+	print_alloc_stats(stdout);
+	polls = count_key_polls(client);
+	get_alloc_stats(ALLOC_POLL, &counters);
+	if (0 == polls) {
+		fprintf(stderr, "The client did not poll the request state\n");
+		goto cleanup;
+	}
+	per_poll = (double)counters.allocations / polls;
+	printf("%.1f allocation(s) and %.0f byte(s) per poll over %lu "
+	       "poll(s), the budget is %.1f allocation(s)\n", per_poll,
+	       (double)counters.bytes / polls, polls, budget);
+	if (per_poll > budget) {
+		fprintf(stderr, "A poll allocates more than the budget\n");
+		goto cleanup;
+	}
+	status = EXIT_SUCCESS;
+
+ cleanup:
+	if (client) {
+		free_key_client(client);
+	}
+	stop_mock_server(&mock, NULL);
+	free_args(arguments);
+
+	return status;
+}
+
+/**
+ * Completion callback of the negotiation of the key.
+ *
+ * @param data is the outcome to populate.
+ * @param err is any error that occured.
+ * @param key is the received key or NULL.
+ */
+static void finish_fetch(void *data, enum unlocked_err err, char *key)
+{
+	struct outcome *outcome = data;
+
+	outcome->err = err;
+	outcome->finished = 1;
+}
+
+/**
+ * Get the arguments of a client polling the mock server with a short fixed
+ * interval.
+ *
+ * @param port is the port of the mock server.
+ *
+ * @return the arguments or NULL on failure.
+ */
+static struct arguments *get_arguments(unsigned int port)
+{
+	struct arguments *arguments = create_args();
+
+	if (NULL == arguments) {
+		return NULL;
+	}
+	arguments->hedge_delay = 1000;
+	arguments->host = strdup("127.0.0.1");
+	arguments->key_handle = strdup("mock-key");
+	arguments->long_poll_timeout = 60;
+	arguments->max_response_size = 1024 * 1024;
+	arguments->poll_interval = 20;
+	arguments->poll_jitter = no;
+	arguments->poll_max_interval = 20;
+	arguments->poll_multiplier = 1;
+	arguments->port = port;
+	// The secret is not freed with the arguments.
+	arguments->secret = "test-secret";
+	arguments->username = strdup("test-server");
+	arguments->validate = no;
+	if (NULL == arguments->host || NULL == arguments->key_handle
+	    || NULL == arguments->username) {
+		free_args(arguments);
+
+		return NULL;
+	}
+
+	return arguments;
+}
+
+/**
+ * Print the usage of the allocation budget test.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [options]\n\n"
+	       "Fail if a poll of the mock server allocates more than the "
+	       "budget.\n\n"
+	       "  --approve-after <ms>  approve the request after this time "
+	       "(default 1000)\n"
+	       "  --budget <count>      maximum allocations per poll "
+	       "(default 2)\n"
+	       "  --server <path>       path of the mock server\n", program);
+}
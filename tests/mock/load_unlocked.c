@@ -0,0 +1,667 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mock-process.h"
+#include "../../src/cli.h"
+#include "../../src/client.h"
+#include "../../src/error.h"
+#include "../../src/event-loop.h"
+
+/**
+ * The interval in milliseconds the counters of the mock server are sampled
+ * with.
+ */
+#define SAMPLE_INTERVAL 1000
+
+/**
+ * The interval in milliseconds clients are started with during a ramp.
+ */
+#define RAMP_STEP 10
+
+/**
+ * A simulated node negotiating its key.
+ */
+struct node {
+	struct load_test *test;
+	struct key_client *client;
+	/**
+	 * The epoll file descriptor of the event loop of the client, that is
+	 * watched by the event loop of the load test.
+	 */
+	struct event_source source;
+	struct timespec started;
+	/**
+	 * The time from the start of the node until it received its key or
+	 * -1 while it is running.
+	 */
+	double unlock_ms;
+	enum unlocked_err err;
+	int finished;
+};
+
+/**
+ * Many nodes requesting their keys at the same time.
+ */
+struct load_test {
+	struct event_loop *loop;
+	const struct arguments *arguments;
+	struct node *nodes;
+	size_t node_count;
+	size_t started;
+	size_t finished;
+	size_t failed;
+	/**
+	 * The time in milliseconds over which the starts of the nodes are
+	 * spread.
+	 */
+	long ramp;
+	struct timespec start;
+	struct timer ramp_timer;
+	struct timer sample_timer;
+	/**
+	 * The mock server or a server with a pid of 0 for an external server.
+	 */
+	struct mock_process mock;
+	struct mock_stats last_sample;
+	double last_sample_ms;
+	double peak_requests;
+	double peak_handshakes;
+	double duration_ms;
+};
+
+static int compare_doubles(const void *a, const void *b);
+static double elapsed_ms(const struct timespec *since);
+static void finish_node(void *data, enum unlocked_err err, char *key);
+static void fire_ramp(void *data);
+static void fire_sample(void *data);
+static void handle_node(struct event_source *source, uint32_t events);
+static double percentile(const double *sorted, size_t count, double rank);
+static void print_report(FILE *file, struct load_test *test,
+			 const struct mock_stats *stats, int json);
+static void raise_file_limit(size_t node_count);
+static void start_node(struct load_test *test, struct node *node);
+static void usage(const char *program);
+static int write_config(char *path, unsigned int port);
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"clients", required_argument, NULL, 'n'},
+		{"config", required_argument, NULL, 'c'},
+		{"help", no_argument, NULL, 'h'},
+		{"json", required_argument, NULL, 'j'},
+		{"long-poll", no_argument, NULL, 'L'},
+		{"no-jitter", no_argument, NULL, 'J'},
+		{"poll-interval", required_argument, NULL, 'i'},
+		{"poll-max-interval", required_argument, NULL, 'x'},
+		{"poll-multiplier", required_argument, NULL, 'm'},
+		{"ramp", required_argument, NULL, 'r'},
+		{"server", required_argument, NULL, 's'},
+		{"timeout", required_argument, NULL, 't'},
+		{0, 0, 0, 0},
+	};
+	struct load_test test = {
+		.node_count = 100,
+		.ramp_timer = {.source = {.fd = -1}},
+		.sample_timer = {.source = {.fd = -1}},
+	};
+	struct arguments *arguments = create_args();
+	struct arguments *config_args = NULL;
+	struct arguments overrides = { 0 };
+	struct mock_stats stats = { 0 };
+	const char *config_path = NULL;
+	const char *json_path = NULL;
+	const char *server = MOCK_SERVER_PATH;
+	const char *default_server_args[] = { "--approve-after", "5000", NULL };
+	const char *const *server_args = default_server_args;
+	char config[] = "/tmp/unlocked-load-XXXXXX";
+	long timeout = 300;
+	FILE *json_file = NULL;
+	int status = EXIT_FAILURE;
+	int opt = 0;
+
+	if (NULL == arguments) {
+		return EXIT_FAILURE;
+	}
+	arguments->hedge_delay = 1000;
+	arguments->long_poll_timeout = 60;
+	arguments->max_response_size = 1024 * 1024;
+	arguments->poll_interval = 1000;
+	arguments->poll_jitter = yes;
+	arguments->poll_max_interval = 10000;
+	arguments->poll_multiplier = 1.5;
+	arguments->port = 443;
+	arguments->validate = yes;
+	while (-1 != (opt = getopt_long(argc, argv, "c:hi:j:JLm:n:r:s:t:x:",
+					options, NULL))) {
+		switch (opt) {
+		case 'c':
+			config_path = optarg;
+			break;
+		case 'i':
+			overrides.poll_interval = strtol(optarg, NULL, 10);
+			break;
+		case 'j':
+			json_path = optarg;
+			break;
+		case 'J':
+			overrides.poll_jitter = no;
+			break;
+		case 'L':
+			overrides.long_poll = yes;
+			break;
+		case 'm':
+			overrides.poll_multiplier = strtod(optarg, NULL);
+			break;
+		case 'n':
+			test.node_count = strtoul(optarg, NULL, 10);
+			break;
+		case 'r':
+			test.ramp = strtol(optarg, NULL, 10);
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 't':
+			timeout = strtol(optarg, NULL, 10);
+			break;
+		case 'x':
+			overrides.poll_max_interval = strtol(optarg, NULL, 10);
+			break;
+		case 'h':
+			usage(argv[0]);
+			free_args(arguments);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+			free_args(arguments);
+
+			return EXIT_FAILURE;
+		}
+	}
+	// Arguments after "--" are passed to the mock server.
+	if (optind < argc) {
+		server_args = (const char *const *)argv + optind;
+	}
+	if (0 == test.node_count) {
+		fprintf(stderr, "At least one client is required\n");
+		free_args(arguments);
+
+		return EXIT_FAILURE;
+	}
+	raise_file_limit(test.node_count);
+	if (NULL == config_path) {
+		if (start_mock_server(server, server_args, &(test.mock))) {
+			free_args(arguments);
+
+			return EXIT_FAILURE;
+		}
+		if (write_config(config, test.mock.port)) {
+			goto cleanup;
+		}
+		config_path = config;
+	}
+	config_args = create_args();
+	if (NULL == config_args
+	    || UL_OK != parse_config_file(config_path, config_args)) {
+		fprintf(stderr, "Could not read the configuration %s\n",
+			config_path);
+		goto cleanup;
+	}
+	merge_config(arguments, config_args);
+	merge_config(arguments, &overrides);
+	test.arguments = arguments;
+	test.nodes = calloc(test.node_count, sizeof(struct node));
+	test.loop = create_event_loop();
+	if (NULL == test.nodes || NULL == test.loop
+	    || UL_OK != init_timer(test.loop, &(test.ramp_timer), fire_ramp,
+				   &test)
+	    || (test.mock.pid
+		&& UL_OK != init_timer(test.loop, &(test.sample_timer),
+				       fire_sample, &test))) {
+		fprintf(stderr, "Could not prepare the load test\n");
+		goto cleanup;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &(test.start));
+	arm_timer(&(test.ramp_timer), 0);
+	if (test.mock.pid) {
+		arm_timer(&(test.sample_timer), SAMPLE_INTERVAL);
+	}
+	while (test.finished < test.node_count
+	       && elapsed_ms(&(test.start)) < timeout * 1000.0) {
+		if (UL_OK != dispatch_events(test.loop, SAMPLE_INTERVAL)) {
+			perror("Dispatching events failed");
+			goto cleanup;
+		}
+	}
+	test.duration_ms = elapsed_ms(&(test.start));
+	if (test.mock.pid) {
+		fire_sample(&test);
+		stats = test.last_sample;
+	}
+	print_report(stdout, &test, test.mock.pid ? &stats : NULL, 0);
+	if (json_path) {
+		json_file = strcmp(json_path, "-") ? fopen(json_path, "w") :
+		    stdout;
+		if (NULL == json_file) {
+			perror(json_path);
+			goto cleanup;
+		}
+		print_report(json_file, &test, test.mock.pid ? &stats : NULL,
+			     1);
+		if (stdout != json_file) {
+			fclose(json_file);
+		}
+	}
+	status = test.finished == test.node_count ? EXIT_SUCCESS :
+	    EXIT_FAILURE;
+
+ cleanup:
+	for (size_t i = 0; test.nodes && i < test.started; i++) {
+		if (test.nodes[i].client) {
+			unwatch_fd(test.loop, &(test.nodes[i].source));
+			free_key_client(test.nodes[i].client);
+		}
+	}
+	if (test.loop) {
+		free_timer(test.loop, &(test.ramp_timer));
+		free_timer(test.loop, &(test.sample_timer));
+	}
+	free_event_loop(test.loop);
+	free(test.nodes);
+	if (test.mock.pid) {
+		unlink(config);
+		stop_mock_server(&(test.mock), NULL);
+	}
+	free_args(config_args);
+	free_args(arguments);
+	free_secrets();
+
+	return status;
+}
+
+/**
+ * Compare two doubles for qsort.
+ */
+static int compare_doubles(const void *a, const void *b)
+{
+	const double *x = a;
+	const double *y = b;
+
+	return (*x > *y) - (*x < *y);
+}
+
+/**
+ * Get the milliseconds passed since a point in time.
+ *
+ * @param since is the point in time on the monotonic clock.
+ *
+ * @return the passed milliseconds.
+ */
+static double elapsed_ms(const struct timespec *since)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1e3
+	    + (now.tv_nsec - since->tv_nsec) / 1e6;
+}
+
+/**
+ * Record the outcome of the negotiation of a node.
+ *
+ * The client is freed once its events were dispatched.
+ *
+ * @param data is the node.
+ * @param err is any error that occured.
+ * @param key is the received key or NULL on failure.
+ */
+static void finish_node(void *data, enum unlocked_err err, char *key)
+{
+	struct node *node = data;
+
+	node->err = err;
+	node->finished = 1;
+	node->test->finished++;
+	if (UL_OK == err && key) {
+		node->unlock_ms = elapsed_ms(&(node->started));
+	} else {
+		node->test->failed++;
+	}
+}
+
+/**
+ * Start the nodes due according to the ramp.
+ *
+ * @param data is the load test.
+ */
+static void fire_ramp(void *data)
+{
+	struct load_test *test = data;
+	size_t due = test->node_count;
+
+	if (test->ramp > 0) {
+		due = test->node_count * elapsed_ms(&(test->start))
+		    / test->ramp;
+		if (due > test->node_count) {
+			due = test->node_count;
+		}
+	}
+	while (test->started < due) {
+		start_node(test, test->nodes + test->started);
+	}
+	if (test->started < test->node_count) {
+		arm_timer(&(test->ramp_timer), RAMP_STEP);
+	}
+}
+
+/**
+ * Sample the counters of the mock server and update the peak rates.
+ *
+ * @param data is the load test.
+ */
+static void fire_sample(void *data)
+{
+	struct load_test *test = data;
+	struct mock_stats sample = { 0 };
+	double now = 0;
+	double seconds = 0;
+
+	if (sample_mock_server(&(test->mock), &sample)) {
+		return;
+	}
+	now = elapsed_ms(&(test->start));
+	seconds = (now - test->last_sample_ms) / 1000;
+	if (seconds > 0) {
+		if ((sample.requests - test->last_sample.requests) / seconds >
+		    test->peak_requests) {
+			test->peak_requests = (sample.requests -
+					       test->last_sample.requests) /
+			    seconds;
+		}
+		if ((sample.handshakes - test->last_sample.handshakes) /
+		    seconds > test->peak_handshakes) {
+			test->peak_handshakes = (sample.handshakes -
+						 test->last_sample.handshakes) /
+			    seconds;
+		}
+	}
+	test->last_sample = sample;
+	test->last_sample_ms = now;
+	if (test->finished < test->node_count) {
+		arm_timer(&(test->sample_timer), SAMPLE_INTERVAL);
+	}
+}
+
+/**
+ * Dispatch the events of a node and free its client once it finished.
+ *
+ * @param source is the epoll file descriptor of the client.
+ * @param events are the epoll events that occured.
+ */
+static void handle_node(struct event_source *source, uint32_t events)
+{
+	struct node *node = source->data;
+
+	dispatch_key_client(node->client, 0);
+	if (node->finished) {
+		unwatch_fd(node->test->loop, source);
+		free_key_client(node->client);
+		node->client = NULL;
+	}
+}
+
+/**
+ * Get a percentile of sorted values with the nearest rank method.
+ *
+ * @param sorted are the sorted values.
+ * @param count is the number of values.
+ * @param rank is the percentile between 0 and 100.
+ *
+ * @return the percentile or 0 without values.
+ */
+static double percentile(const double *sorted, size_t count, double rank)
+{
+	size_t index = rank / 100 * count + 0.5;
+
+	if (0 == count) {
+		return 0;
+	}
+	if (index > 0) {
+		index--;
+	}
+
+	return sorted[index < count ? index : count - 1];
+}
+
+/**
+ * Print the results of a load test.
+ *
+ * @param file is the file to print to.
+ * @param test is the finished load test.
+ * @param stats are the final counters of the mock server or NULL for an
+ *              external server.
+ * @param json is whether to print json instead of text.
+ */
+static void print_report(FILE *file, struct load_test *test,
+			 const struct mock_stats *stats, int json)
+{
+	double *times = malloc(sizeof(double) * test->node_count);
+	double seconds = test->duration_ms / 1000;
+	size_t count = 0;
+
+	for (size_t i = 0; times && i < test->node_count; i++) {
+		if (test->nodes[i].finished && UL_OK == test->nodes[i].err) {
+			times[count++] = test->nodes[i].unlock_ms;
+		}
+	}
+	qsort(times, count, sizeof(double), compare_doubles);
+	if (json) {
+		fprintf(file, "{\n  \"clients\": %zu,\n  \"unlocked\": %zu,\n"
+			"  \"failed\": %zu,\n  \"duration_ms\": %.3f,\n"
+			"  \"unlock_ms\": {\"p50\": %.3f, \"p90\": %.3f, "
+			"\"p99\": %.3f, \"max\": %.3f}", test->node_count,
+			count, test->node_count - count, test->duration_ms,
+			percentile(times, count, 50),
+			percentile(times, count, 90),
+			percentile(times, count, 99),
+			percentile(times, count, 100));
+		if (stats) {
+			fprintf(file, ",\n  \"server\": {\"requests\": %lu, "
+				"\"requests_per_s\": %.1f, "
+				"\"peak_requests_per_s\": %.1f, "
+				"\"handshakes\": %lu, "
+				"\"handshakes_per_s\": %.1f, "
+				"\"peak_handshakes_per_s\": %.1f, "
+				"\"resumed\": %lu, \"connections\": %lu, "
+				"\"bytes_in\": %lu, \"bytes_out\": %lu}",
+				stats->requests, stats->requests / seconds,
+				test->peak_requests, stats->handshakes,
+				stats->handshakes / seconds,
+				test->peak_handshakes, stats->resumed,
+				stats->connections, stats->bytes_in,
+				stats->bytes_out);
+		}
+		fprintf(file, "\n}\n");
+		free(times);
+
+		return;
+	}
+	fprintf(file, "clients:            %zu (%zu unlocked, %zu failed) "
+		"in %.1f s\n", test->node_count, count,
+		test->node_count - count, seconds);
+	fprintf(file, "time to unlock ms:  p50 %.1f  p90 %.1f  p99 %.1f  "
+		"max %.1f\n", percentile(times, count, 50),
+		percentile(times, count, 90), percentile(times, count, 99),
+		percentile(times, count, 100));
+	if (stats) {
+		fprintf(file, "requests:           %lu (%.1f/s, peak %.1f/s)\n",
+			stats->requests, stats->requests / seconds,
+			test->peak_requests);
+		fprintf(file, "handshakes:         %lu (%.1f/s, peak %.1f/s), "
+			"%lu resumed\n", stats->handshakes,
+			stats->handshakes / seconds, test->peak_handshakes,
+			stats->resumed);
+		fprintf(file, "connections:        %lu\n", stats->connections);
+		fprintf(file, "bytes:              %lu in, %lu out\n",
+			stats->bytes_in, stats->bytes_out);
+	}
+	free(times);
+}
+
+/**
+ * Raise the limit of open files for the connections and event loops of
+ * many clients.
+ *
+ * @param node_count is the number of simulated nodes.
+ */
+static void raise_file_limit(size_t node_count)
+{
+	struct rlimit limit = { 0 };
+
+	if (getrlimit(RLIMIT_NOFILE, &limit)) {
+		return;
+	}
+	limit.rlim_cur = limit.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &limit);
+	// Every client needs its epoll and timer descriptors besides its
+	// connections.
+	if (limit.rlim_cur < node_count * 6 + 64) {
+		fprintf(stderr, "The limit of %lu open files may be too low "
+			"for %zu clients\n", (unsigned long)limit.rlim_cur,
+			node_count);
+	}
+}
+
+/**
+ * Create the client of a node and request its key.
+ *
+ * @param test is the load test.
+ * @param node is the node to start.
+ */
+static void start_node(struct load_test *test, struct node *node)
+{
+	enum unlocked_err err = UL_OK;
+
+	test->started++;
+	node->test = test;
+	node->unlock_ms = -1;
+	clock_gettime(CLOCK_MONOTONIC, &(node->started));
+	err = create_key_client(test->arguments, NULL, &(node->client));
+	if (UL_OK != err) {
+		finish_node(node, err, NULL);
+
+		return;
+	}
+	node->source.fd = get_key_client_loop(node->client)->epoll_fd;
+	node->source.data = node;
+	node->source.handle = handle_node;
+	node->source.release = NULL;
+	err = watch_fd(test->loop, &(node->source), EPOLLIN);
+	if (UL_OK == err) {
+		err = fetch_key(node->client, test->arguments->key_handle,
+				finish_node, node);
+	}
+	if (UL_OK != err) {
+		unwatch_fd(test->loop, &(node->source));
+		free_key_client(node->client);
+		node->client = NULL;
+		finish_node(node, err, NULL);
+
+		return;
+	}
+	// Requests failing right away finish without events.
+	handle_node(&(node->source), 0);
+}
+
+/**
+ * Print the usage of the load test.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [options] [-- <mock server options>]\n\n"
+	       "Simulate many nodes requesting their keys at the same time "
+	       "from one process.\n\n"
+	       "  --clients <count>          number of nodes (default 100)\n"
+	       "  --ramp <ms>                spread the starts of the nodes "
+	       "(default 0)\n"
+	       "  --poll-interval <ms>       override the poll interval\n"
+	       "  --poll-multiplier <factor> override the poll multiplier\n"
+	       "  --poll-max-interval <ms>   override the maximum poll "
+	       "interval\n"
+	       "  --no-jitter                poll without jitter\n"
+	       "  --long-poll                stream the request state\n"
+	       "  --timeout <s>              give up after this time "
+	       "(default 300)\n"
+	       "  --json <file>              write the results as json\n"
+	       "  --config <file>            use a configuration for an "
+	       "external server\n"
+	       "  --server <path>            path of the mock server\n\n"
+	       "Without --config a mock server is started, by default with "
+	       "\"--approve-after\n"
+	       "5000\". The requests and handshakes per second and the bytes "
+	       "are reported from\n"
+	       "its counters.\n", program);
+}
+
+/**
+ * Write the configuration of the nodes for the mock server.
+ *
+ * @param path is the template of the path, that is replaced with the path of
+ *             the created file.
+ * @param port is the port of the mock server.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int write_config(char *path, unsigned int port)
+{
+	int fd = mkstemp(path);
+	FILE *file = fd < 0 ? NULL : fdopen(fd, "w");
+
+	if (NULL == file) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		perror("Could not create the configuration");
+
+		return -1;
+	}
+	fprintf(file, "[unlocked]\n"
+		"key_handle = mock-key ;\n"
+		"secret = test-secret ;\n"
+		"username = test-server ;\n"
+		"host = 127.0.0.1 ;\n"
+		"port = %u ;\n"
+		"validate = FALSE ;\n", port);
+
+	return fclose(file) ? -1 : 0;
+}
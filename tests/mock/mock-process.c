@@ -0,0 +1,164 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <spawn.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "mock-process.h"
+#include "../../src/error.h"
+#include "../../src/json-scan.h"
+
+/**
+ * The maximum number of arguments of the mock server.
+ */
+#define MAX_ARGS 32
+
+extern char **environ;
+
+static int read_stats(struct mock_process *mock, struct mock_stats *stats);
+
+void print_mock_stats(FILE *file, const struct mock_stats *stats)
+{
+	fprintf(file, "{\"connections\": %lu, \"handshakes\": %lu, "
+		"\"resumed\": %lu, \"requests\": %lu, \"created\": %lu, "
+		"\"errors\": %lu, \"unauthorized\": %lu, \"bytes_in\": %lu, "
+		"\"bytes_out\": %lu}\n", stats->connections, stats->handshakes,
+		stats->resumed, stats->requests, stats->created, stats->errors,
+		stats->unauthorized, stats->bytes_in, stats->bytes_out);
+	fflush(file);
+}
+
+int sample_mock_server(struct mock_process *mock, struct mock_stats *stats)
+{
+	if (kill(mock->pid, SIGUSR1)) {
+		return -1;
+	}
+
+	return read_stats(mock, stats);
+}
+
+int start_mock_server(const char *path, const char *const *args,
+		      struct mock_process *mock)
+{
+	const char *argv[MAX_ARGS + 2] = { path };
+	posix_spawn_file_actions_t actions;
+	char line[128];
+	int pipe_fds[2];
+	int err = 0;
+
+	for (size_t i = 0; args[i]; i++) {
+		if (MAX_ARGS == i) {
+			return -1;
+		}
+		argv[i + 1] = args[i];
+	}
+	if (pipe(pipe_fds)) {
+		return -1;
+	}
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+	posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+	posix_spawn_file_actions_addclose(&actions, pipe_fds[1]);
+	err = posix_spawn(&(mock->pid), path, &actions, NULL,
+			  (char *const *)argv, environ);
+	posix_spawn_file_actions_destroy(&actions);
+	close(pipe_fds[1]);
+	if (err) {
+		close(pipe_fds[0]);
+		errno = err;
+		perror(path);
+
+		return -1;
+	}
+	mock->output = fdopen(pipe_fds[0], "r");
+	if (NULL == mock->output || NULL == fgets(line, sizeof(line),
+						  mock->output)
+	    || 1 != sscanf(line, "Listening on 127.0.0.1:%u", &(mock->port))) {
+		fprintf(stderr, "The mock server did not start\n");
+		if (mock->output) {
+			fclose(mock->output);
+		} else {
+			close(pipe_fds[0]);
+		}
+		kill(mock->pid, SIGTERM);
+		waitpid(mock->pid, NULL, 0);
+
+		return -1;
+	}
+
+	return 0;
+}
+
+int stop_mock_server(struct mock_process *mock, struct mock_stats *stats)
+{
+	struct mock_stats ignored = { 0 };
+	int result = 0;
+
+	kill(mock->pid, SIGTERM);
+	result = read_stats(mock, stats ? stats : &ignored);
+	fclose(mock->output);
+	waitpid(mock->pid, NULL, 0);
+
+	return result;
+}
+
+/**
+ * Read the next line with counters from the mock server.
+ *
+ * @param mock is the server.
+ * @param stats is set to the counters.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int read_stats(struct mock_process *mock, struct mock_stats *stats)
+{
+	struct json_field fields[] = {
+		{.name = "connections",.type = JSON_FIELD_NUMBER},
+		{.name = "handshakes",.type = JSON_FIELD_NUMBER},
+		{.name = "resumed",.type = JSON_FIELD_NUMBER},
+		{.name = "requests",.type = JSON_FIELD_NUMBER},
+		{.name = "created",.type = JSON_FIELD_NUMBER},
+		{.name = "errors",.type = JSON_FIELD_NUMBER},
+		{.name = "unauthorized",.type = JSON_FIELD_NUMBER},
+		{.name = "bytes_in",.type = JSON_FIELD_NUMBER},
+		{.name = "bytes_out",.type = JSON_FIELD_NUMBER},
+	};
+	unsigned long *counters[] = {
+		&(stats->connections), &(stats->handshakes), &(stats->resumed),
+		&(stats->requests), &(stats->created), &(stats->errors),
+		&(stats->unauthorized), &(stats->bytes_in), &(stats->bytes_out),
+	};
+	const size_t field_count = sizeof(fields) / sizeof(fields[0]);
+	char line[512];
+
+	if (NULL == fgets(line, sizeof(line), mock->output)
+	    || UL_OK != scan_json_object(line, strlen(line), fields,
+					 field_count)) {
+		return -1;
+	}
+	for (size_t i = 0; i < field_count; i++) {
+		*(counters[i]) = fields[i].number;
+	}
+
+	return 0;
+}
@@ -0,0 +1,98 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UNLOCKED_MOCK_PROCESS_H
+#define UNLOCKED_MOCK_PROCESS_H
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * The counters of the mock server, printed as json on SIGUSR1 and when the
+ * server stops.
+ */
+struct mock_stats {
+	unsigned long connections;
+	unsigned long handshakes;
+	unsigned long resumed;
+	unsigned long requests;
+	/**
+	 * The number of key requests created by clients.
+	 */
+	unsigned long created;
+	unsigned long errors;
+	unsigned long unauthorized;
+	unsigned long bytes_in;
+	unsigned long bytes_out;
+};
+
+/**
+ * A mock server running as child process.
+ */
+struct mock_process {
+	pid_t pid;
+	/**
+	 * The standard output of the server.
+	 */
+	FILE *output;
+	unsigned int port;
+};
+
+/**
+ * Print the counters of the mock server as a single line of json.
+ *
+ * @param file is the file to print to.
+ * @param stats are the counters.
+ */
+void print_mock_stats(FILE *file, const struct mock_stats *stats);
+
+/**
+ * Ask a running mock server for its counters.
+ *
+ * @param mock is the server.
+ * @param stats is set to the counters.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+int sample_mock_server(struct mock_process *mock, struct mock_stats *stats);
+
+/**
+ * Start the mock server and wait until it accepts connections.
+ *
+ * @param path is the path of the mock server.
+ * @param args are the arguments of the server terminated by NULL.
+ * @param mock is set to the running server.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+int start_mock_server(const char *path, const char *const *args,
+		      struct mock_process *mock);
+
+/**
+ * Stop the mock server and collect its final counters.
+ *
+ * @param mock is the server.
+ * @param stats is set to the counters or NULL to ignore them.
+ *
+ * @return 0 on success or -1 if the counters could not be read.
+ */
+int stop_mock_server(struct mock_process *mock, struct mock_stats *stats);
+
+#endif
@@ -0,0 +1,1191 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <getopt.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+#include "mock-process.h"
+#include "../../src/error.h"
+#include "../../src/event-loop.h"
+#include "../../src/hmac-signer.h"
+#include "../../src/json-scan.h"
+
+/**
+ * The size of the buffer for the requests received on a connection.
+ */
+#define INPUT_SIZE 16384
+
+/**
+ * The size of the buffer for a response.
+ */
+#define OUTPUT_SIZE 4096
+
+/**
+ * The size of the storage for the state in the body of a request.
+ */
+#define STATE_SIZE 32
+
+/**
+ * The path of the collection of key requests.
+ */
+#define REQUESTS_PATH "/api/requests"
+
+/**
+ * The behaviour of the server, configured on the command line.
+ */
+struct mock_options {
+	/**
+	 * The time in milliseconds after which a request is accepted or
+	 * denied.
+	 */
+	long approve_after;
+	/**
+	 * Whether to close the connection after every response.
+	 */
+	int close;
+	/**
+	 * Whether requests are denied instead of accepted.
+	 */
+	int deny;
+	/**
+	 * The percentage of requests answered with `error_status`.
+	 */
+	unsigned int error_rate;
+	long error_status;
+	const char *key;
+	/**
+	 * The delay in milliseconds before every response is sent.
+	 */
+	long latency;
+	unsigned short port;
+	/**
+	 * Whether clients may resume TLS sessions.
+	 */
+	int resumption;
+	const char *secret;
+	unsigned int seed;
+	const char *username;
+	int verbose;
+};
+
+/**
+ * A request for access to a key created by a client.
+ */
+struct key_request {
+	struct timespec created;
+	int fulfilled;
+};
+
+struct mock_conn;
+
+struct mock_server {
+	struct mock_options options;
+	struct event_loop *loop;
+	struct event_source listener;
+	struct event_source signals;
+	sigset_t signal_mask;
+	SSL_CTX *tls;
+	struct hmac_signer *signer;
+	struct key_request *requests;
+	size_t request_count;
+	size_t request_size;
+	struct mock_conn *connections;
+	struct mock_stats stats;
+	int running;
+};
+
+/**
+ * A TLS connection of a client.
+ */
+struct mock_conn {
+	struct event_source source;
+	struct mock_server *server;
+	SSL *ssl;
+	int established;
+	/**
+	 * Whether the response is held back to inject latency.
+	 */
+	int delayed;
+	/**
+	 * Whether the connection is closed after the response.
+	 */
+	int closing;
+	struct timer delay;
+	char input[INPUT_SIZE];
+	size_t input_length;
+	char output[OUTPUT_SIZE];
+	size_t output_length;
+	size_t output_sent;
+	struct mock_conn *prev;
+	struct mock_conn *next;
+};
+
+static void accept_connections(struct event_source *source, uint32_t events);
+static void close_connection(struct mock_conn *conn);
+static enum unlocked_err create_certificate(SSL_CTX *tls);
+static enum unlocked_err create_listener(struct mock_server *server);
+static enum unlocked_err create_signal_source(struct mock_server *server);
+static SSL_CTX *create_tls_context(const struct mock_options *options);
+static void drive_connection(struct mock_conn *conn);
+static long elapsed_ms(const struct timespec *since);
+static const char *find_header(const char *head, size_t head_length,
+			       const char *name, size_t *line_length);
+static const char *find_param(const char *value, size_t length,
+			      const char *name, size_t *param_length);
+static void fire_delay(void *data);
+static void handle_connection(struct event_source *source, uint32_t events);
+static void handle_key_request(struct mock_conn *conn, const char *method,
+			       const char *path, const char *body,
+			       size_t body_length);
+static void handle_signal(struct event_source *source, uint32_t events);
+static const char *header_value(const char *line, size_t line_length,
+				size_t *value_length);
+static int parse_options(int argc, char **argv, struct mock_options *options);
+static int process_input(struct mock_conn *conn);
+static const char *reason_phrase(long status);
+static void release_connection(struct event_source *source);
+static void respond(struct mock_conn *conn, long status,
+		    const char *content_type, const char *body);
+static void usage(const char *program);
+static int verify_auth(struct mock_server *server, const char *head,
+		       size_t head_length, const char *body,
+		       size_t body_length);
+static void wait_for_tls(struct mock_conn *conn, int result);
+
+int main(int argc, char **argv)
+{
+	struct mock_server server = {
+		.options = {
+			    .approve_after = 1000,
+			    .error_status = 503,
+			    .key = "mock-key",
+			    .port = 0,
+			    .resumption = 1,
+			    .secret = "test-secret",
+			    .seed = 1,
+			    .username = "test-server",
+			    },
+		.listener = {.fd = -1},
+		.signals = {.fd = -1},
+	};
+	int status = EXIT_FAILURE;
+
+	if (parse_options(argc, argv, &(server.options))) {
+		return EXIT_FAILURE;
+	}
+	server.loop = create_event_loop();
+	server.tls = create_tls_context(&(server.options));
+	server.signer = create_signer(server.options.secret);
+	if (NULL == server.loop || NULL == server.tls || NULL == server.signer
+	    || UL_OK != create_signal_source(&server)
+	    || UL_OK != create_listener(&server)) {
+		fprintf(stderr, "Could not start the mock server\n");
+		ERR_print_errors_fp(stderr);
+		goto cleanup;
+	}
+	server.running = 1;
+	while (server.running) {
+		if (UL_OK != dispatch_events(server.loop, -1)) {
+			perror("Dispatching events failed");
+			goto cleanup;
+		}
+	}
+	print_mock_stats(stdout, &(server.stats));
+	status = EXIT_SUCCESS;
+
+ cleanup:
+	while (server.connections) {
+		close_connection(server.connections);
+	}
+	if (server.listener.fd >= 0) {
+		unwatch_fd(server.loop, &(server.listener));
+		close(server.listener.fd);
+	}
+	if (server.signals.fd >= 0) {
+		unwatch_fd(server.loop, &(server.signals));
+		close(server.signals.fd);
+	}
+	free(server.requests);
+	free_signer(server.signer);
+	SSL_CTX_free(server.tls);
+	free_event_loop(server.loop);
+
+	return status;
+}
+
+/**
+ * Accept all pending connections of clients.
+ *
+ * @param source is the listening socket.
+ * @param events are the epoll events that occured.
+ */
+static void accept_connections(struct event_source *source, uint32_t events)
+{
+	struct mock_server *server = source->data;
+	struct mock_conn *conn = NULL;
+	int enable = 1;
+	int fd = -1;
+
+	while ((fd = accept4(source->fd, NULL, NULL,
+			     SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+		conn = calloc(1, sizeof(struct mock_conn));
+		if (NULL == conn) {
+			close(fd);
+			continue;
+		}
+		// Like common web servers, responses are not held back waiting
+		// for acknowledgements.
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable,
+			   sizeof(enable));
+		conn->server = server;
+		conn->delay.source.fd = -1;
+		conn->source.fd = fd;
+		conn->source.data = conn;
+		conn->source.handle = handle_connection;
+		conn->source.release = release_connection;
+		conn->ssl = SSL_new(server->tls);
+		if (NULL == conn->ssl || 1 != SSL_set_fd(conn->ssl, fd)
+		    || UL_OK != watch_fd(server->loop, &(conn->source),
+					 EPOLLIN)) {
+			SSL_free(conn->ssl);
+			free(conn);
+			close(fd);
+			continue;
+		}
+		conn->next = server->connections;
+		if (server->connections) {
+			server->connections->prev = conn;
+		}
+		server->connections = conn;
+		server->stats.connections++;
+	}
+}
+
+/**
+ * Close the connection of a client.
+ *
+ * @param conn is the connection, that is freed once the event loop released
+ *             it.
+ */
+static void close_connection(struct mock_conn *conn)
+{
+	struct mock_server *server = conn->server;
+
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		server->connections = conn->next;
+	}
+	if (conn->next) {
+		conn->next->prev = conn->prev;
+	}
+	free_timer(server->loop, &(conn->delay));
+	unwatch_fd(server->loop, &(conn->source));
+}
+
+/**
+ * Generate a self-signed certificate for localhost with a fresh key.
+ *
+ * @param tls is the context to use the certificate with.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err create_certificate(SSL_CTX *tls)
+{
+	enum unlocked_err err = UL_ERR;
+	EVP_PKEY *key = EVP_EC_gen("P-256");
+	X509 *cert = X509_new();
+	X509_NAME *name = NULL;
+
+	if (NULL == key || NULL == cert || 1 != X509_set_version(cert, 2)
+	    || 1 != ASN1_INTEGER_set(X509_get_serialNumber(cert), 1)
+	    || NULL == X509_gmtime_adj(X509_getm_notBefore(cert), 0)
+	    || NULL == X509_gmtime_adj(X509_getm_notAfter(cert), 86400)
+	    || 1 != X509_set_pubkey(cert, key)) {
+		goto cleanup;
+	}
+	name = X509_get_subject_name(cert);
+	if (1 != X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+					    (const unsigned char *)"localhost",
+					    -1, -1, 0)
+	    || 1 != X509_set_issuer_name(cert, name)
+	    || 0 == X509_sign(cert, key, EVP_sha256())
+	    || 1 != SSL_CTX_use_certificate(tls, cert)
+	    || 1 != SSL_CTX_use_PrivateKey(tls, key)) {
+		goto cleanup;
+	}
+	err = UL_OK;
+
+ cleanup:
+	X509_free(cert);
+	EVP_PKEY_free(key);
+
+	return err;
+}
+
+/**
+ * Listen on the loopback interface and print the address once clients may
+ * connect.
+ *
+ * @param server is the server.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err create_listener(struct mock_server *server)
+{
+	struct sockaddr_in address = {
+		.sin_family = AF_INET,
+		.sin_port = htons(server->options.port),
+		.sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+	};
+	socklen_t address_length = sizeof(address);
+	int enable = 1;
+
+	server->listener.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK
+				     | SOCK_CLOEXEC, 0);
+	if (server->listener.fd < 0) {
+		return UL_ERRNO;
+	}
+	server->listener.data = server;
+	server->listener.handle = accept_connections;
+	server->listener.release = NULL;
+	if (setsockopt(server->listener.fd, SOL_SOCKET, SO_REUSEADDR, &enable,
+		       sizeof(enable))
+	    || bind(server->listener.fd, (struct sockaddr *)&address,
+		    sizeof(address))
+	    || listen(server->listener.fd, SOMAXCONN)
+	    || getsockname(server->listener.fd, (struct sockaddr *)&address,
+			   &address_length)) {
+		close(server->listener.fd);
+		server->listener.fd = -1;
+
+		return UL_ERRNO;
+	}
+	if (UL_OK != watch_fd(server->loop, &(server->listener), EPOLLIN)) {
+		close(server->listener.fd);
+		server->listener.fd = -1;
+
+		return UL_ERRNO;
+	}
+	// Scripts wait for this line before they start clients.
+	printf("Listening on 127.0.0.1:%u\n", ntohs(address.sin_port));
+	fflush(stdout);
+
+	return UL_OK;
+}
+
+/**
+ * Receive the signals controlling the server from the event loop.
+ *
+ * @param server is the server.
+ *
+ * @return any error that occured.
+ */
+static enum unlocked_err create_signal_source(struct mock_server *server)
+{
+	sigemptyset(&(server->signal_mask));
+	sigaddset(&(server->signal_mask), SIGINT);
+	sigaddset(&(server->signal_mask), SIGTERM);
+	sigaddset(&(server->signal_mask), SIGUSR1);
+	if (sigprocmask(SIG_BLOCK, &(server->signal_mask), NULL)) {
+		return UL_ERRNO;
+	}
+	server->signals.fd = signalfd(-1, &(server->signal_mask),
+				      SFD_NONBLOCK | SFD_CLOEXEC);
+	if (server->signals.fd < 0) {
+		return UL_ERRNO;
+	}
+	server->signals.data = server;
+	server->signals.handle = handle_signal;
+	server->signals.release = NULL;
+
+	return watch_fd(server->loop, &(server->signals), EPOLLIN);
+}
+
+/**
+ * Create the TLS context of the server with a generated certificate.
+ *
+ * @param options are the options of the server.
+ *
+ * @return the context or NULL on failure.
+ */
+static SSL_CTX *create_tls_context(const struct mock_options *options)
+{
+	static const unsigned char session_context[] = "unlocked-mock";
+	SSL_CTX *tls = SSL_CTX_new(TLS_server_method());
+
+	if (NULL == tls) {
+		return NULL;
+	}
+	SSL_CTX_set_min_proto_version(tls, TLS1_2_VERSION);
+	SSL_CTX_set_session_id_context(tls, session_context,
+				       sizeof(session_context) - 1);
+	if (!options->resumption) {
+		SSL_CTX_set_session_cache_mode(tls, SSL_SESS_CACHE_OFF);
+		SSL_CTX_set_options(tls, SSL_OP_NO_TICKET);
+		SSL_CTX_set_num_tickets(tls, 0);
+	}
+	if (UL_OK != create_certificate(tls)) {
+		SSL_CTX_free(tls);
+
+		return NULL;
+	}
+
+	return tls;
+}
+
+/**
+ * Advance a connection as far as possible without blocking.
+ *
+ * The handshake is completed, pending output is written and requests are
+ * read and answered one after another until the TLS layer has to wait for
+ * the socket.
+ *
+ * @param conn is the connection.
+ */
+static void drive_connection(struct mock_conn *conn)
+{
+	struct mock_server *server = conn->server;
+	int result = 0;
+
+	if (!conn->established) {
+		result = SSL_accept(conn->ssl);
+		if (1 != result) {
+			wait_for_tls(conn, result);
+
+			return;
+		}
+		conn->established = 1;
+		server->stats.handshakes++;
+		if (SSL_session_reused(conn->ssl)) {
+			server->stats.resumed++;
+		}
+	}
+	while (!conn->delayed) {
+		if (conn->output_sent < conn->output_length) {
+			result = SSL_write(conn->ssl,
+					   conn->output + conn->output_sent,
+					   conn->output_length -
+					   conn->output_sent);
+			if (result <= 0) {
+				wait_for_tls(conn, result);
+
+				return;
+			}
+			conn->output_sent += result;
+			server->stats.bytes_out += result;
+			continue;
+		}
+		if (conn->output_length) {
+			conn->output_length = 0;
+			conn->output_sent = 0;
+			if (conn->closing) {
+				SSL_shutdown(conn->ssl);
+				close_connection(conn);
+
+				return;
+			}
+		}
+		result = process_input(conn);
+		if (result < 0) {
+			close_connection(conn);
+
+			return;
+		}
+		if (result > 0) {
+			continue;
+		}
+		if (INPUT_SIZE == conn->input_length) {
+			close_connection(conn);
+
+			return;
+		}
+		result = SSL_read(conn->ssl, conn->input + conn->input_length,
+				  INPUT_SIZE - conn->input_length);
+		if (result <= 0) {
+			wait_for_tls(conn, result);
+
+			return;
+		}
+		conn->input_length += result;
+		server->stats.bytes_in += result;
+	}
+	// Only a hang up of the client is of interest while delaying.
+	watch_fd(server->loop, &(conn->source), EPOLLRDHUP);
+}
+
+/**
+ * Get the milliseconds passed since a point in time.
+ *
+ * @param since is the point in time on the monotonic clock.
+ *
+ * @return the passed milliseconds.
+ */
+static long elapsed_ms(const struct timespec *since)
+{
+	struct timespec now = { 0 };
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (now.tv_sec - since->tv_sec) * 1000
+	    + (now.tv_nsec - since->tv_nsec) / 1000000;
+}
+
+/**
+ * Find a header in the head of a request.
+ *
+ * @param head is the head of the request starting with the request line.
+ * @param head_length is the length of the head without the empty line.
+ * @param name is the case insensitive name of the header.
+ * @param line_length is set to the length of the header line without the
+ *                    line break.
+ *
+ * @return the start of the header line or NULL if the header is missing.
+ */
+static const char *find_header(const char *head, size_t head_length,
+			       const char *name, size_t *line_length)
+{
+	const char *end = head + head_length;
+	const char *line = memchr(head, '\n', head_length);
+	const char *line_end = NULL;
+	size_t name_length = strlen(name);
+
+	while (line && ++line < end) {
+		line_end = memchr(line, '\r', end - line);
+		if (NULL == line_end) {
+			line_end = end;
+		}
+		if ((size_t)(line_end - line) > name_length
+		    && ':' == line[name_length]
+		    && 0 == strncasecmp(line, name, name_length)) {
+			*line_length = line_end - line;
+
+			return line;
+		}
+		line = memchr(line, '\n', end - line);
+	}
+
+	return NULL;
+}
+
+/**
+ * Find a quoted parameter in the value of the Authorization header.
+ *
+ * @param value is the value of the header.
+ * @param length is the length of the value.
+ * @param name is the name of the parameter.
+ * @param param_length is set to the length of the parameter without quotes.
+ *
+ * @return the start of the parameter or NULL if it is missing.
+ */
+static const char *find_param(const char *value, size_t length,
+			      const char *name, size_t *param_length)
+{
+	const char *end = value + length;
+	const char *param = value;
+	const char *quote = NULL;
+	size_t name_length = strlen(name);
+
+	while ((param = memmem(param, end - param, name, name_length))) {
+		quote = param + name_length;
+		if ((param == value || ' ' == param[-1] || ',' == param[-1])
+		    && end - quote > 1 && '=' == quote[0] && '"' == quote[1]) {
+			param = quote + 2;
+			quote = memchr(param, '"', end - param);
+			if (NULL == quote) {
+				return NULL;
+			}
+			*param_length = quote - param;
+
+			return param;
+		}
+		param += name_length;
+	}
+
+	return NULL;
+}
+
+/**
+ * Send the response held back to inject latency.
+ *
+ * @param data is the connection.
+ */
+static void fire_delay(void *data)
+{
+	struct mock_conn *conn = data;
+
+	conn->delayed = 0;
+	drive_connection(conn);
+}
+
+/**
+ * Handle the events of the connection of a client.
+ *
+ * @param source is the connection.
+ * @param events are the epoll events that occured.
+ */
+static void handle_connection(struct event_source *source, uint32_t events)
+{
+	struct mock_conn *conn = source->data;
+
+	if (conn->delayed && events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) {
+		close_connection(conn);
+
+		return;
+	}
+	drive_connection(conn);
+}
+
+/**
+ * Answer a request against the key requests.
+ *
+ * @param conn is the connection with the request.
+ * @param method is the method of the request.
+ * @param path is the path of the request without query.
+ * @param body is the body of the request.
+ * @param body_length is the length of the body.
+ */
+static void handle_key_request(struct mock_conn *conn, const char *method,
+			       const char *path, const char *body,
+			       size_t body_length)
+{
+	struct mock_server *server = conn->server;
+	const struct mock_options *options = &(server->options);
+	struct key_request *requests = NULL;
+	struct key_request *request = NULL;
+	const char *state = "PENDING";
+	char state_value[STATE_SIZE];
+	struct json_field field = {
+		.name = "state",
+		.type = JSON_FIELD_STRING,
+		.string = state_value,
+		.string_size = sizeof(state_value),
+	};
+	char response[128];
+	char *end = NULL;
+	unsigned long id = 0;
+
+	if (0 == strcmp(path, REQUESTS_PATH) && 0 == strcmp(method, "POST")) {
+		if (server->request_count == server->request_size) {
+			requests = realloc(server->requests,
+					   sizeof(struct key_request)
+					   * (server->request_size + 64));
+			if (NULL == requests) {
+				respond(conn, 500, "text/plain",
+					"Out of memory");
+
+				return;
+			}
+			server->requests = requests;
+			server->request_size += 64;
+		}
+		request = server->requests + server->request_count++;
+		server->stats.created++;
+		clock_gettime(CLOCK_MONOTONIC, &(request->created));
+		request->fulfilled = 0;
+		snprintf(response, sizeof(response),
+			 "{\"id\": %zu, \"state\": \"PENDING\"}",
+			 server->request_count);
+		respond(conn, 201, "application/json", response);
+
+		return;
+	}
+	if (0 == strncmp(path, REQUESTS_PATH "/", sizeof(REQUESTS_PATH))) {
+		id = strtoul(path + sizeof(REQUESTS_PATH), &end, 10);
+	}
+	if (0 == id || id > server->request_count || '\0' != *end) {
+		respond(conn, 404, "text/plain", "Not found");
+
+		return;
+	}
+	request = server->requests + id - 1;
+	if (request->fulfilled) {
+		state = "FULFILLED";
+	} else if (elapsed_ms(&(request->created)) >= options->approve_after) {
+		state = options->deny ? "DENIED" : "ACCEPTED";
+	}
+	if (0 == strcmp(method, "GET")) {
+		snprintf(response, sizeof(response),
+			 "{\"id\": %lu, \"state\": \"%s\"}", id, state);
+		respond(conn, 200, "application/json", response);
+
+		return;
+	}
+	if (strcmp(method, "PATCH")) {
+		respond(conn, 405, "text/plain", "Method not allowed");
+
+		return;
+	}
+	if (UL_OK != scan_json_object(body, body_length, &field, 1)
+	    || JSON_FIELD_FOUND != field.status
+	    || strcmp(state_value, "FULFILLED")) {
+		respond(conn, 400, "text/plain", "Bad request");
+
+		return;
+	}
+	if (strcmp(state, "ACCEPTED") && strcmp(state, "FULFILLED")) {
+		respond(conn, 409, "text/plain", "The request is not accepted");
+
+		return;
+	}
+	request->fulfilled = 1;
+	respond(conn, 200, "text/plain", options->key);
+}
+
+/**
+ * Stop the server after a terminating signal was received or print the
+ * counters for SIGUSR1.
+ *
+ * @param source is the signal file descriptor.
+ * @param events are the epoll events that occured.
+ */
+static void handle_signal(struct event_source *source, uint32_t events)
+{
+	struct mock_server *server = source->data;
+	struct signalfd_siginfo info = { 0 };
+
+	while (sizeof(info) == read(source->fd, &info, sizeof(info))) {
+		if (SIGUSR1 == info.ssi_signo) {
+			print_mock_stats(stdout, &(server->stats));
+		} else {
+			server->running = 0;
+		}
+	}
+}
+
+/**
+ * Get the value of a header line.
+ *
+ * @param line is the header line.
+ * @param line_length is the length of the line.
+ * @param value_length is set to the length of the value.
+ *
+ * @return the start of the value without leading whitespace.
+ */
+static const char *header_value(const char *line, size_t line_length,
+				size_t *value_length)
+{
+	const char *end = line + line_length;
+	const char *value = memchr(line, ':', line_length) + 1;
+
+	while (value < end && (' ' == *value || '\t' == *value)) {
+		value++;
+	}
+	while (end > value && (' ' == end[-1] || '\t' == end[-1])) {
+		end--;
+	}
+	*value_length = end - value;
+
+	return value;
+}
+
+/**
+ * Parse the command line options of the server.
+ *
+ * @param argc is the number of arguments.
+ * @param argv are the arguments.
+ * @param options are set from the arguments.
+ *
+ * @return 0 on success or -1 if the server should not start.
+ */
+static int parse_options(int argc, char **argv, struct mock_options *options)
+{
+	static const struct option long_options[] = {
+		{"approve-after", required_argument, NULL, 'a'},
+		{"close", no_argument, NULL, 'c'},
+		{"deny", no_argument, NULL, 'd'},
+		{"error-rate", required_argument, NULL, 'e'},
+		{"error-status", required_argument, NULL, 'E'},
+		{"help", no_argument, NULL, 'h'},
+		{"key", required_argument, NULL, 'k'},
+		{"latency", required_argument, NULL, 'l'},
+		{"no-resumption", no_argument, NULL, 'R'},
+		{"port", required_argument, NULL, 'p'},
+		{"secret", required_argument, NULL, 's'},
+		{"seed", required_argument, NULL, 'S'},
+		{"username", required_argument, NULL, 'u'},
+		{"verbose", no_argument, NULL, 'v'},
+		{0, 0, 0, 0},
+	};
+	int opt = 0;
+
+	while (-1 != (opt = getopt_long(argc, argv, "a:cde:E:hk:l:p:Rs:S:u:v",
+					long_options, NULL))) {
+		switch (opt) {
+		case 'a':
+			options->approve_after = strtol(optarg, NULL, 10);
+			break;
+		case 'c':
+			options->close = 1;
+			break;
+		case 'd':
+			options->deny = 1;
+			break;
+		case 'e':
+			options->error_rate = strtoul(optarg, NULL, 10);
+			break;
+		case 'E':
+			options->error_status = strtol(optarg, NULL, 10);
+			break;
+		case 'k':
+			options->key = optarg;
+			break;
+		case 'l':
+			options->latency = strtol(optarg, NULL, 10);
+			break;
+		case 'p':
+			options->port = strtoul(optarg, NULL, 10);
+			break;
+		case 'R':
+			options->resumption = 0;
+			break;
+		case 's':
+			options->secret = optarg;
+			break;
+		case 'S':
+			options->seed = strtoul(optarg, NULL, 10);
+			break;
+		case 'u':
+			options->username = optarg;
+			break;
+		case 'v':
+			options->verbose = 1;
+			break;
+		case 'h':
+			usage(argv[0]);
+			exit(EXIT_SUCCESS);
+		default:
+			usage(argv[0]);
+
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Answer the next complete request in the input of a connection.
+ *
+ * @param conn is the connection.
+ *
+ * @return 1 if a response was prepared, 0 if more input is needed or -1 if
+ *         the input is no valid request.
+ */
+static int process_input(struct mock_conn *conn)
+{
+	struct mock_server *server = conn->server;
+	const char *head = conn->input;
+	const char *head_end = memmem(head, conn->input_length, "\r\n\r\n", 4);
+	const char *line = NULL;
+	const char *value = NULL;
+	char method[8];
+	char path[256];
+	size_t head_length = 0;
+	size_t line_length = 0;
+	size_t value_length = 0;
+	size_t body_length = 0;
+	size_t request_length = 0;
+
+	if (NULL == head_end) {
+		return 0;
+	}
+	head_length = head_end - head;
+	if (2 != sscanf(head, "%7s %255s HTTP/1.", method, path)) {
+		return -1;
+	}
+	line = find_header(head, head_length, "content-length", &line_length);
+	if (line) {
+		value = header_value(line, line_length, &value_length);
+		body_length = strtoul(value, NULL, 10);
+	}
+	request_length = head_length + 4 + body_length;
+	if (request_length > INPUT_SIZE) {
+		return -1;
+	}
+	if (request_length > conn->input_length) {
+		return 0;
+	}
+	line = find_header(head, head_length, "connection", &line_length);
+	if (line) {
+		value = header_value(line, line_length, &value_length);
+		conn->closing = 5 == value_length
+		    && 0 == strncasecmp(value, "close", 5);
+	}
+	conn->closing |= server->options.close;
+	// The query of streaming requests is ignored, they are answered like
+	// polls.
+	path[strcspn(path, "?")] = '\0';
+	server->stats.requests++;
+	if (server->options.verbose) {
+		fprintf(stderr, "%s %s\n", method, path);
+	}
+	if (server->options.error_rate
+	    && (unsigned int)rand_r(&(server->options.seed)) % 100
+	    < server->options.error_rate) {
+		server->stats.errors++;
+		respond(conn, server->options.error_status, "text/plain",
+			"Injected error");
+	} else if (!verify_auth(server, head, head_length, head_end + 4,
+				body_length)) {
+		server->stats.unauthorized++;
+		respond(conn, 401, "text/plain", "Unauthorized");
+	} else {
+		handle_key_request(conn, method, path, head_end + 4,
+				   body_length);
+	}
+	conn->input_length -= request_length;
+	memmove(conn->input, conn->input + request_length, conn->input_length);
+	if (server->options.latency > 0) {
+		if (conn->delay.source.fd < 0
+		    && UL_OK != init_timer(server->loop, &(conn->delay),
+					   fire_delay, conn)) {
+			return 1;
+		}
+		conn->delayed = 1;
+		arm_timer(&(conn->delay), server->options.latency);
+	}
+
+	return 1;
+}
+
+/**
+ * Get the reason phrase for a status code.
+ *
+ * @param status is the status code.
+ *
+ * @return the reason phrase.
+ */
+static const char *reason_phrase(long status)
+{
+	switch (status) {
+	case 200:
+		return "OK";
+	case 201:
+		return "Created";
+	case 400:
+		return "Bad Request";
+	case 401:
+		return "Unauthorized";
+	case 404:
+		return "Not Found";
+	case 405:
+		return "Method Not Allowed";
+	case 409:
+		return "Conflict";
+	case 429:
+		return "Too Many Requests";
+	case 500:
+		return "Internal Server Error";
+	case 503:
+		return "Service Unavailable";
+	default:
+		return "Unknown";
+	}
+}
+
+/**
+ * Free a connection after the event loop stopped watching it.
+ *
+ * @param source is the connection.
+ */
+static void release_connection(struct event_source *source)
+{
+	struct mock_conn *conn = source->data;
+
+	SSL_free(conn->ssl);
+	close(source->fd);
+	free(conn);
+}
+
+/**
+ * Prepare a response on a connection.
+ *
+ * @param conn is the connection.
+ * @param status is the status code.
+ * @param content_type is the type of the body.
+ * @param body is the body.
+ */
+static void respond(struct mock_conn *conn, long status,
+		    const char *content_type, const char *body)
+{
+	int length = snprintf(conn->output, OUTPUT_SIZE,
+			      "HTTP/1.1 %ld %s\r\n"
+			      "Content-Type: %s\r\n"
+			      "Content-Length: %zu\r\n"
+			      "%s\r\n%s", status, reason_phrase(status),
+			      content_type, strlen(body),
+			      conn->closing ? "Connection: close\r\n" : "",
+			      body);
+
+	conn->output_length = length < OUTPUT_SIZE ? length : OUTPUT_SIZE - 1;
+	conn->output_sent = 0;
+}
+
+/**
+ * Print the usage of the server.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [options]\n\n"
+	       "Serve the unlocked api over TLS on the loopback interface.\n\n"
+	       "  --port <port>           port to listen on, 0 picks a free "
+	       "one (default)\n"
+	       "  --username <name>       username of the client\n"
+	       "  --secret <secret>       secret requests are signed with\n"
+	       "  --key <key>             key delivered for accepted "
+	       "requests\n"
+	       "  --approve-after <ms>    time until requests are accepted\n"
+	       "  --deny                  deny requests instead\n"
+	       "  --latency <ms>          delay before every response\n"
+	       "  --error-rate <percent>  share of requests answered with an "
+	       "error\n"
+	       "  --error-status <code>   status of injected errors\n"
+	       "  --seed <seed>           seed for the injected errors\n"
+	       "  --close                 close connections after every "
+	       "response\n"
+	       "  --no-resumption         disable TLS session resumption\n"
+	       "  --verbose               print every request\n\n"
+	       "The listening address is printed once clients may connect. "
+	       "The counters of\n"
+	       "the server are printed as json on SIGUSR1 and after SIGINT or "
+	       "SIGTERM.\n",
+	       program);
+}
+
+/**
+ * Verify the signature of a request.
+ *
+ * @param server is the server.
+ * @param head is the head of the request.
+ * @param head_length is the length of the head.
+ * @param body is the body of the request.
+ * @param body_length is the length of the body.
+ *
+ * @return whether the request is signed by the configured user.
+ */
+static int verify_auth(struct mock_server *server, const char *head,
+		       size_t head_length, const char *body,
+		       size_t body_length)
+{
+	struct hmac_signer *signer = server->signer;
+	const char *username = server->options.username;
+	char signature[SIGNATURE_SIZE];
+	char name[64];
+	const char *auth = NULL;
+	const char *param = NULL;
+	const char *names = NULL;
+	const char *line = NULL;
+	size_t auth_length = 0;
+	size_t param_length = 0;
+	size_t names_length = 0;
+	size_t name_length = 0;
+	size_t line_length = 0;
+
+	line = find_header(head, head_length, "authorization", &line_length);
+	if (NULL == line) {
+		return 0;
+	}
+	auth = header_value(line, line_length, &auth_length);
+	if (auth_length < 5 || strncasecmp(auth, "hmac ", 5)) {
+		return 0;
+	}
+	param = find_param(auth, auth_length, "username", &param_length);
+	if (NULL == param || param_length != strlen(username)
+	    || memcmp(param, username, param_length)) {
+		return 0;
+	}
+	names = find_param(auth, auth_length, "headers", &names_length);
+	if (NULL == names || UL_OK != start_signature(signer)) {
+		return 0;
+	}
+	// The signed header lines are hashed as received, each followed by a
+	// newline.
+	while (names_length) {
+		name_length = strcspn(names, " \"");
+		if (name_length >= sizeof(name)) {
+			return 0;
+		}
+		memcpy(name, names, name_length);
+		name[name_length] = '\0';
+		line = find_header(head, head_length, name, &line_length);
+		if (NULL == line) {
+			return 0;
+		}
+		update_signature(signer, line, line_length);
+		update_signature(signer, "\n", 1);
+		names += name_length;
+		names_length -= name_length;
+		if (names_length && ' ' == *names) {
+			names++;
+			names_length--;
+		}
+	}
+	update_signature(signer, body, body_length);
+	param = find_param(auth, auth_length, "signature", &param_length);
+	if (NULL == param || SIGNATURE_SIZE - 1 != param_length
+	    || UL_OK != finish_signature(signer, signature)) {
+		return 0;
+	}
+
+	return 0 == strncasecmp(param, signature, param_length);
+}
+
+/**
+ * Wait for the socket after the TLS layer could not proceed or close the
+ * connection if it failed.
+ *
+ * @param conn is the connection.
+ * @param result is the result of the failed TLS operation.
+ */
+static void wait_for_tls(struct mock_conn *conn, int result)
+{
+	struct event_loop *loop = conn->server->loop;
+
+	switch (SSL_get_error(conn->ssl, result)) {
+	case SSL_ERROR_WANT_READ:
+		watch_fd(loop, &(conn->source), EPOLLIN);
+		break;
+	case SSL_ERROR_WANT_WRITE:
+		watch_fd(loop, &(conn->source), EPOLLOUT);
+		break;
+	default:
+		close_connection(conn);
+	}
+}
@@ -0,0 +1,211 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "check_mod_sd_socket.h"
+#include "../../src/mod/mod_sd_socket.h"
+
+/**
+ * Create a listening unix socket with an automatically bound abstract address.
+ */
+static int create_listener(struct sockaddr_un *addr, socklen_t *addr_len)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	ck_assert_int_ge(fd, 0);
+	addr->sun_family = AF_UNIX;
+	ck_assert_int_eq(0, bind(fd, (struct sockaddr *)addr,
+				 sizeof(sa_family_t)));
+	*addr_len = sizeof(struct sockaddr_un);
+	ck_assert_int_eq(0, getsockname(fd, (struct sockaddr *)addr,
+					addr_len));
+	ck_assert_int_eq(0, listen(fd, 8));
+
+	return fd;
+}
+
+static int connect_consumer(const struct sockaddr_un *addr,
+			    socklen_t addr_len)
+{
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	ck_assert_int_ge(fd, 0);
+	ck_assert_int_eq(0, connect(fd, (const struct sockaddr *)addr,
+				    addr_len));
+
+	return fd;
+}
+
+static void assert_key_received(int fd, const char *key)
+{
+	char buffer[64] = { 0 };
+	ssize_t received = 0;
+	size_t total = 0;
+
+	while ((received = read(fd, buffer + total,
+				sizeof(buffer) - 1 - total)) > 0) {
+		total += received;
+	}
+	ck_assert_int_eq(0, received);
+	ck_assert_str_eq(key, buffer);
+}
+
+/**
+ * Receive a file descriptor passed with `SCM_RIGHTS`.
+ */
+static int receive_fd(int fd)
+{
+	char control[CMSG_SPACE(sizeof(int))] = { 0 };
+	struct cmsghdr *cmsg = NULL;
+	char payload = 1;
+	struct iovec iov = {.iov_base = &payload,.iov_len = 1 };
+	struct msghdr msg = { 0 };
+	int received = -1;
+
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+	ck_assert_int_eq(1, recvmsg(fd, &msg, 0));
+	ck_assert_int_eq(0, payload);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	ck_assert_ptr_nonnull(cmsg);
+	ck_assert_int_eq(SCM_RIGHTS, cmsg->cmsg_type);
+	memcpy(&received, CMSG_DATA(cmsg), sizeof(int));
+
+	return received;
+}
+
+START_TEST(test_serve_sd_sockets_passes_key_fd)
+{
+	struct sockaddr_un addr = { 0 };
+	socklen_t addr_len = 0;
+	int consumers[2] = { -1 };
+	unsigned int deliveries = 0;
+	int key_fd = memfd_create("key", MFD_CLOEXEC);
+	int listener = create_listener(&addr, &addr_len);
+
+	ck_assert_int_eq(6, write(key_fd, "secret", 6));
+	for (int i = 0; i < 2; i++) {
+		consumers[i] = connect_consumer(&addr, addr_len);
+	}
+	ck_assert_int_eq(UL_OK, serve_sd_sockets(&listener, 1, NULL, key_fd,
+						 2, 0, &deliveries));
+	ck_assert_uint_eq(2, deliveries);
+	// Both consumers read the key from their own offset.
+	for (int i = 0; i < 2; i++) {
+		int fd = receive_fd(consumers[i]);
+
+		assert_key_received(fd, "secret");
+		ck_assert_int_eq(O_RDONLY, fcntl(fd, F_GETFL) & O_ACCMODE);
+		close(fd);
+		close(consumers[i]);
+	}
+	close(key_fd);
+	close(listener);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_serve_sd_sockets_stops_after_consumers)
+{
+	struct sockaddr_un addr = { 0 };
+	socklen_t addr_len = 0;
+	char buffer[8];
+	int consumers[3] = { -1 };
+	unsigned int deliveries = 0;
+	int listener = create_listener(&addr, &addr_len);
+
+	for (int i = 0; i < 3; i++) {
+		consumers[i] = connect_consumer(&addr, addr_len);
+	}
+	ck_assert_int_eq(UL_OK, serve_sd_sockets(&listener, 1, "secret", -1, 2,
+						 0, &deliveries));
+	ck_assert_uint_eq(2, deliveries);
+	assert_key_received(consumers[0], "secret");
+	assert_key_received(consumers[1], "secret");
+	ck_assert_int_eq(-1, recv(consumers[2], buffer, sizeof(buffer),
+				  MSG_DONTWAIT));
+	ck_assert_int_eq(EAGAIN, errno);
+
+	for (int i = 0; i < 3; i++) {
+		close(consumers[i]);
+	}
+	close(listener);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_serve_sd_sockets_stops_after_timeout)
+{
+	struct sockaddr_un addr[2] = { 0 };
+	socklen_t addr_len[2] = { 0 };
+	int consumers[2] = { -1 };
+	unsigned int deliveries = 0;
+	int listeners[2] = { -1 };
+
+	for (int i = 0; i < 2; i++) {
+		listeners[i] = create_listener(&(addr[i]), &(addr_len[i]));
+		consumers[i] = connect_consumer(&(addr[i]), addr_len[i]);
+	}
+	ck_assert_int_eq(UL_OK, serve_sd_sockets(listeners, 2, "secret", -1, 0,
+						 1, &deliveries));
+	ck_assert_uint_eq(2, deliveries);
+	for (int i = 0; i < 2; i++) {
+		assert_key_received(consumers[i], "secret");
+		close(consumers[i]);
+		close(listeners[i]);
+	}
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+static TCase *make_mod_sd_socket_serve_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("mod::sd_socket::serve_sd_sockets");
+	tcase_add_test(tc, test_serve_sd_sockets_passes_key_fd);
+	tcase_add_test(tc, test_serve_sd_sockets_stops_after_consumers);
+	tcase_add_test(tc, test_serve_sd_sockets_stops_after_timeout);
+
+	return tc;
+}
+
+Suite *make_mod_sd_socket_suite(void)
+{
+	Suite *s;
+
+	s = suite_create("unlocked-client mod sd_socket");
+	suite_add_tcase(s, make_mod_sd_socket_serve_case());
+
+	return s;
+}
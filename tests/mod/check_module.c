@@ -17,11 +17,19 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <unistd.h>
+
 #include "check_module.h"
 #include "../../src/mod/module.h"
 
 static int failure_called = 0;
+static char fd_success_key[16] = { 0 };
+static int fd_success_seals = 0;
 static const char *success_key = NULL;
+static const char *named_success_key = NULL;
 
 static enum unlocked_err test_mod_success(struct unlocked_module *module,
 					  const char *const key)
@@ -39,6 +47,46 @@ static enum unlocked_err test_mod_failure(struct unlocked_module *module,
 	return UL_OK;
 }
 
+static enum unlocked_err test_mod_named_success(struct unlocked_module *module,
+						const char *const key)
+{
+	named_success_key = key;
+
+	return UL_OK;
+}
+
+static enum unlocked_err test_mod_fd_success(struct unlocked_module *module,
+					     int key_fd)
+{
+	fd_success_seals = fcntl(key_fd, F_GET_SEALS);
+	if (pread(key_fd, fd_success_key, sizeof(fd_success_key) - 1, 0) < 0) {
+		return UL_ERRNO;
+	}
+
+	return UL_OK;
+}
+
+static struct unlocked_module fd_test_module = {
+	.name = "mod_test",
+	.key_name = "swap",
+	.enabled = 1,
+	.init = NULL,
+	.success = NULL,
+	.success_fd = &test_mod_fd_success,
+	.failure = NULL,
+	.cleanup = NULL,
+};
+
+static struct unlocked_module named_test_module = {
+	.name = "mod_test",
+	.key_name = "root",
+	.enabled = 1,
+	.init = NULL,
+	.success = &test_mod_named_success,
+	.failure = NULL,
+	.cleanup = NULL,
+};
+
 static struct unlocked_module test_module = {
 	.name = "mod_test",
 	.enabled = 1,
@@ -53,8 +101,18 @@ static void setup(void)
 	register_module(&test_module);
 }
 
+static void setup_named(void)
+{
+	register_module(&test_module);
+	register_module(&named_test_module);
+	register_module(&fd_test_module);
+}
+
 static void teardown(void)
 {
+	memset(fd_success_key, 0, sizeof(fd_success_key));
+	fd_success_seals = 0;
+	named_success_key = NULL;
 	success_key = NULL;
 	failure_called = 0;
 	cleanup_modules();
@@ -79,6 +137,48 @@ START_TEST(test_mod_module_handle_success)
 END_TEST
 // *INDENT-ON*
 
+START_TEST(test_mod_module_handle_key_success)
+{
+	handle_key_success("root", "test");
+	ck_assert_str_eq("test", named_success_key);
+	ck_assert_ptr_null(success_key);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_mod_module_handle_key_success_passes_sealed_fd)
+{
+	ck_assert_int_eq(UL_OK, handle_key_success("swap", "test"));
+	ck_assert_str_eq("test", fd_success_key);
+	ck_assert_int_eq(F_SEAL_WRITE, fd_success_seals & F_SEAL_WRITE);
+	ck_assert_ptr_null(named_success_key);
+	ck_assert_ptr_null(success_key);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_mod_module_handle_key_success_unknown_key)
+{
+	handle_key_success("data0", "test");
+	ck_assert_ptr_null(named_success_key);
+	ck_assert_ptr_null(success_key);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
+START_TEST(test_mod_module_handle_success_skips_named_modules)
+{
+	handle_success("test");
+	ck_assert_str_eq("test", success_key);
+	ck_assert_ptr_null(named_success_key);
+}
+// *INDENT-OFF*
+END_TEST
+// *INDENT-ON*
+
 static TCase *make_mod_module_handle_failure_case(void)
 {
 	TCase *tc;
@@ -101,6 +201,20 @@ static TCase *make_mod_module_handle_success_case(void)
 	return tc;
 }
 
+static TCase *make_mod_module_handle_key_success_case(void)
+{
+	TCase *tc;
+
+	tc = tcase_create("mod::module::handle_key_success");
+	tcase_add_checked_fixture(tc, setup_named, teardown);
+	tcase_add_test(tc, test_mod_module_handle_key_success);
+	tcase_add_test(tc, test_mod_module_handle_key_success_passes_sealed_fd);
+	tcase_add_test(tc, test_mod_module_handle_key_success_unknown_key);
+	tcase_add_test(tc, test_mod_module_handle_success_skips_named_modules);
+
+	return tc;
+}
+
 Suite *make_mod_module_suite(void)
 {
 	Suite *s;
@@ -108,6 +222,7 @@ Suite *make_mod_module_suite(void)
 	s = suite_create("unlocked-client mod module");
 	suite_add_tcase(s, make_mod_module_handle_failure_case());
 	suite_add_tcase(s, make_mod_module_handle_success_case());
+	suite_add_tcase(s, make_mod_module_handle_key_success_case());
 
 	return s;
 
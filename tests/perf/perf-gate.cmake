@@ -0,0 +1,25 @@
+# Run a benchmark and compare its json results with a checked-in baseline.
+#
+# Called by ctest with -P and the variables BENCH, BENCH_ARGS, RESULTS,
+# COMPARE, BASELINE, TOLERANCE, ALLOC_TOLERANCE and LATENCY_SLACK.
+
+separate_arguments(BENCH_ARGS)
+execute_process(
+  COMMAND ${BENCH} ${BENCH_ARGS} --json ${RESULTS}
+  RESULT_VARIABLE status
+)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "${BENCH} failed: ${status}")
+endif()
+
+execute_process(
+  COMMAND ${COMPARE}
+    --tolerance ${TOLERANCE}
+    --alloc-tolerance ${ALLOC_TOLERANCE}
+    --latency-slack ${LATENCY_SLACK}
+    ${BASELINE} ${RESULTS}
+  RESULT_VARIABLE status
+)
+if(NOT status EQUAL 0)
+  message(FATAL_ERROR "${RESULTS} regressed against ${BASELINE}")
+endif()
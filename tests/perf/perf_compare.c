@@ -0,0 +1,332 @@
+// Copyright 2022 by Karsten Lehmann <mail@kalehmann.de>
+
+/*
+ * This file is part of unlocked-client.
+ *
+ * unlocked-client is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../src/json-scan.h"
+
+/**
+ * The maximum number of results in a file.
+ */
+#define MAX_RESULTS 64
+
+/**
+ * The size of the storage for the name of a result.
+ */
+#define NAME_SIZE 64
+
+/**
+ * The metrics of the results, that are compared.
+ */
+enum metric {
+	METRIC_NS_PER_OP,
+	METRIC_ALLOCS_PER_OP,
+	METRIC_MEDIAN_MS,
+	METRIC_COUNT,
+};
+
+/**
+ * A single benchmark or scenario.
+ */
+struct result {
+	char name[NAME_SIZE];
+	double values[METRIC_COUNT];
+	/**
+	 * Whether the result contains the metric.
+	 */
+	int present[METRIC_COUNT];
+};
+
+/**
+ * The allowed regression of the metrics.
+ */
+struct tolerance {
+	/**
+	 * The allowed increase of the durations in percent.
+	 */
+	double time;
+	/**
+	 * The allowed increase of the allocations per operation.
+	 */
+	double allocs;
+	/**
+	 * The increase of the time to unlock in milliseconds, that is always
+	 * allowed, because short runs of the client are noisy.
+	 */
+	double latency_slack;
+};
+
+static int compare_metric(const char *name, enum metric metric,
+			  double baseline, double current,
+			  const struct tolerance *tolerance);
+static const struct result *find_result(const struct result *results,
+					size_t count, const char *name);
+static int read_results(const char *path, struct result *results,
+			size_t *count);
+static void usage(const char *program);
+
+static const char *const metric_names[] = {
+	[METRIC_NS_PER_OP] = "ns_per_op",
+	[METRIC_ALLOCS_PER_OP] = "allocs_per_op",
+	[METRIC_MEDIAN_MS] = "median_ms",
+};
+
+int main(int argc, char **argv)
+{
+	static const struct option options[] = {
+		{"alloc-tolerance", required_argument, NULL, 'a'},
+		{"help", no_argument, NULL, 'h'},
+		{"latency-slack", required_argument, NULL, 'l'},
+		{"tolerance", required_argument, NULL, 't'},
+		{0, 0, 0, 0},
+	};
+	static struct result baseline[MAX_RESULTS];
+	static struct result current[MAX_RESULTS];
+	size_t baseline_count = 0;
+	size_t current_count = 0;
+	const struct result *match = NULL;
+	int opt = 0;
+	int regressions = 0;
+	struct tolerance tolerance = {
+		.time = 25,
+		.allocs = 0,
+		.latency_slack = 5,
+	};
+
+	while (-1 != (opt = getopt_long(argc, argv, "a:hl:t:", options,
+					NULL))) {
+		switch (opt) {
+		case 'a':
+			tolerance.allocs = strtod(optarg, NULL);
+			break;
+		case 'l':
+			tolerance.latency_slack = strtod(optarg, NULL);
+			break;
+		case 't':
+			tolerance.time = strtod(optarg, NULL);
+			break;
+		case 'h':
+			usage(argv[0]);
+
+			return EXIT_SUCCESS;
+		default:
+			usage(argv[0]);
+
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+
+		return EXIT_FAILURE;
+	}
+	if (read_results(argv[optind], baseline, &baseline_count)
+	    || read_results(argv[optind + 1], current, &current_count)) {
+		return EXIT_FAILURE;
+	}
+	printf("%-32s %-14s %12s %12s %9s\n", "name", "metric", "baseline",
+	       "current", "change");
+	for (size_t i = 0; i < baseline_count; i++) {
+		match = find_result(current, current_count, baseline[i].name);
+		if (NULL == match) {
+			fprintf(stderr, "No result for %s\n", baseline[i].name);
+			regressions++;
+			continue;
+		}
+		for (int m = 0; m < METRIC_COUNT; m++) {
+			if (baseline[i].present[m] && match->present[m]) {
+				regressions +=
+				    compare_metric(baseline[i].name, m,
+						   baseline[i].values[m],
+						   match->values[m],
+						   &tolerance);
+			}
+		}
+	}
+	for (size_t i = 0; i < current_count; i++) {
+		if (NULL == find_result(baseline, baseline_count,
+					current[i].name)) {
+			printf("%-32s has no baseline yet\n", current[i].name);
+		}
+	}
+	if (regressions) {
+		fprintf(stderr, "%d metric(s) regressed beyond the tolerance "
+			"of %.1f%% for durations and %.2f allocation(s)\n",
+			regressions, tolerance.time, tolerance.allocs);
+
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**
+ * Compare a metric with its baseline and print the outcome.
+ *
+ * Durations may grow by a percentage, allocations by an absolute number,
+ * because they do not depend on the machine. The time to unlock may always
+ * grow by the latency slack.
+ *
+ * @param name is the name of the result.
+ * @param metric is the metric.
+ * @param baseline is the value of the baseline.
+ * @param current is the measured value.
+ * @param tolerance is the allowed regression.
+ *
+ * @return 1 if the metric regressed beyond the tolerance or 0 otherwise.
+ */
+static int compare_metric(const char *name, enum metric metric,
+			  double baseline, double current,
+			  const struct tolerance *tolerance)
+{
+	double change = baseline > 0 ? (current - baseline) * 100 / baseline :
+	    0;
+	double limit = 0;
+
+	if (METRIC_ALLOCS_PER_OP == metric) {
+		// The allocations are printed with two decimals.
+		limit = baseline + tolerance->allocs + 0.005;
+	} else {
+		limit = baseline * (1 + tolerance->time / 100);
+	}
+	if (METRIC_MEDIAN_MS == metric
+	    && limit < baseline + tolerance->latency_slack) {
+		limit = baseline + tolerance->latency_slack;
+	}
+	printf("%-32s %-14s %12.2f %12.2f %8.1f%%%s\n", name,
+	       metric_names[metric], baseline, current, change,
+	       current > limit ? "  REGRESSED" : "");
+
+	return current > limit;
+}
+
+/**
+ * Find a result by its name.
+ *
+ * @param results are the results.
+ * @param count is the number of results.
+ * @param name is the name.
+ *
+ * @return the result or NULL if there is none with the name.
+ */
+static const struct result *find_result(const struct result *results,
+					size_t count, const char *name)
+{
+	for (size_t i = 0; i < count; i++) {
+		if (0 == strcmp(results[i].name, name)) {
+			return results + i;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Read the results written with `--json` by `bench_unlocked_client` or
+ * `bench_unlock_latency`.
+ *
+ * Both print every result as a json object on its own line, so the results
+ * are scanned line by line.
+ *
+ * @param path is the path of the file.
+ * @param results is the storage for the results.
+ * @param count is set to the number of results.
+ *
+ * @return 0 on success or -1 on failure.
+ */
+static int read_results(const char *path, struct result *results,
+			size_t *count)
+{
+	char line[1024];
+	char *start = NULL;
+	char *end = NULL;
+	FILE *file = fopen(path, "r");
+	struct json_field fields[METRIC_COUNT + 1] = { 0 };
+
+	if (NULL == file) {
+		perror(path);
+
+		return -1;
+	}
+	*count = 0;
+	while (fgets(line, sizeof(line), file)) {
+		start = strchr(line, '{');
+		end = strrchr(line, '}');
+		if (NULL == start || NULL == end || end < start
+		    || NULL == strstr(start, "\"name\"")) {
+			continue;
+		}
+		if (*count >= MAX_RESULTS) {
+			fprintf(stderr, "%s has more than %d results\n", path,
+				MAX_RESULTS);
+			fclose(file);
+
+			return -1;
+		}
+		for (int m = 0; m < METRIC_COUNT; m++) {
+			fields[m].name = metric_names[m];
+			fields[m].type = JSON_FIELD_NUMBER;
+		}
+		fields[METRIC_COUNT].name = "name";
+		fields[METRIC_COUNT].type = JSON_FIELD_STRING;
+		fields[METRIC_COUNT].string = results[*count].name;
+		fields[METRIC_COUNT].string_size = NAME_SIZE;
+		if (UL_OK != scan_json_object(start, end - start + 1, fields,
+					      METRIC_COUNT + 1)
+		    || JSON_FIELD_FOUND != fields[METRIC_COUNT].status) {
+			fprintf(stderr, "Invalid result in %s: %s", path, line);
+			fclose(file);
+
+			return -1;
+		}
+		for (int m = 0; m < METRIC_COUNT; m++) {
+			results[*count].present[m] =
+			    JSON_FIELD_FOUND == fields[m].status;
+			results[*count].values[m] = fields[m].number;
+		}
+		(*count)++;
+	}
+	fclose(file);
+
+	return 0;
+}
+
+/**
+ * Print the usage of the comparison.
+ *
+ * @param program is the name of the program.
+ */
+static void usage(const char *program)
+{
+	printf("Usage: %s [options] <baseline> <results>\n\n"
+	       "Compare the json results of bench_unlocked_client or "
+	       "bench_unlock_latency with\n"
+	       "a baseline and fail if any metric regressed.\n\n"
+	       "  --tolerance <percent>        allowed increase of the "
+	       "durations (default 25)\n"
+	       "  --alloc-tolerance <count>    allowed increase of the "
+	       "allocations per operation\n"
+	       "                               (default 0)\n"
+	       "  --latency-slack <ms>         increase of the time to unlock, "
+	       "that is always\n"
+	       "                               allowed (default 5)\n", program);
+}